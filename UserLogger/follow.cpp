@@ -0,0 +1,449 @@
+#include <windows.h>
+#include <cwchar>
+#include "follow.h"
+
+constexpr ULONG64 LOGGER_SEGMENT_DATA_OFFSET = sizeof(LOGGER_SEGMENT_HEADER);
+
+static ULONG64 RecordSize(ULONG length) {
+    return (FIELD_OFFSET(LOGGER_SEGMENT_RECORD, Data) + static_cast<ULONG64>(length) + 7) & ~7ull;
+}
+
+LoggerFollowWriter::~LoggerFollowWriter() {
+    Close();
+}
+
+HRESULT LoggerFollowWriter::Open(ULONG64 segmentSize) {
+    wchar_t name[64];
+    ULONG64 first = 0;
+    ULONG64 previous = 0;
+    bool resume = false;
+    HRESULT hr;
+
+    ControlMapping = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+        0, sizeof(LOGGER_FOLLOW_CONTROL), LOGGER_FOLLOW_CONTROL_NAME);
+    if (!ControlMapping) {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+    const bool existed = GetLastError() == ERROR_ALREADY_EXISTS;
+
+    Control = static_cast<LOGGER_FOLLOW_CONTROL*>(MapViewOfFile(ControlMapping, FILE_MAP_WRITE,
+        0, 0, sizeof(LOGGER_FOLLOW_CONTROL)));
+    if (!Control) {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        Close();
+        return hr;
+    }
+
+    // Readers of a previous UserLogger still hold the control block. Keep
+    // their slots and continue after the segment they are reading.
+    if (existed && Control->Magic == LOGGER_FOLLOW_MAGIC && Control->Version == LOGGER_FOLLOW_VERSION) {
+        previous = static_cast<ULONG64>(Control->CurrentSegment);
+        first = previous + 1;
+        resume = true;
+    }
+    else {
+        ZeroMemory(Control, sizeof(LOGGER_FOLLOW_CONTROL));
+        Control->Magic = LOGGER_FOLLOW_MAGIC;
+        Control->Version = LOGGER_FOLLOW_VERSION;
+    }
+    Control->SegmentSize = segmentSize;
+
+    // The time of the start tells this run from the earlier ones whose
+    // segments readers may still hold. It only has to differ from theirs.
+    FILETIME now;
+    GetSystemTimePreciseAsFileTime(&now);
+    RunId = (static_cast<ULONG64>(now.dwHighDateTime) << 32) | now.dwLowDateTime;
+    if (resume && RunId <= static_cast<ULONG64>(Control->RunId)) {
+        RunId = static_cast<ULONG64>(Control->RunId) + 1;
+    }
+    InterlockedExchange64(&Control->RunId, static_cast<LONG64>(RunId));
+
+    for (ULONG i = 0; i < LOGGER_FOLLOW_MAX_READERS; ++i) {
+        swprintf(name, _countof(name), LOGGER_FOLLOW_EVENT_FORMAT, i);
+        Events[i] = CreateEventW(nullptr, FALSE, FALSE, name);
+        if (!Events[i]) {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+            Close();
+            return hr;
+        }
+    }
+
+    hr = CreateSegment(first);
+    if (FAILED(hr)) {
+        Close();
+        return hr;
+    }
+
+    if (resume) {
+        swprintf(name, _countof(name), LOGGER_FOLLOW_SEGMENT_FORMAT, previous);
+        HANDLE mapping = OpenFileMappingW(FILE_MAP_WRITE, FALSE, name);
+
+        if (mapping) {
+            auto header = static_cast<LOGGER_SEGMENT_HEADER*>(MapViewOfFile(mapping, FILE_MAP_WRITE,
+                0, 0, sizeof(LOGGER_SEGMENT_HEADER)));
+            if (header) {
+                InterlockedExchange(&header->Sealed, 1);
+                UnmapViewOfFile(header);
+            }
+            CloseHandle(mapping);
+        }
+        Notify();
+    }
+    return S_OK;
+}
+
+void LoggerFollowWriter::Close() {
+    // The current segment is left open: readers wait on it until another
+    // UserLogger seals it.
+    if (Segment) {
+        UnmapViewOfFile(Segment);
+        Segment = nullptr;
+    }
+    if (SegmentMapping) {
+        CloseHandle(SegmentMapping);
+        SegmentMapping = nullptr;
+    }
+    if (PreviousMapping) {
+        CloseHandle(PreviousMapping);
+        PreviousMapping = nullptr;
+    }
+    for (auto& event : Events) {
+        if (event) {
+            CloseHandle(event);
+            event = nullptr;
+        }
+    }
+    if (Control) {
+        UnmapViewOfFile(Control);
+        Control = nullptr;
+    }
+    if (ControlMapping) {
+        CloseHandle(ControlMapping);
+        ControlMapping = nullptr;
+    }
+}
+
+HRESULT LoggerFollowWriter::CreateSegment(ULONG64 index) {
+    /*
+    Creates segment index, makes it current and seals the one it replaces.
+    An index still held by a reader of an earlier run is skipped.
+    */
+    const ULONG64 size = Control->SegmentSize;
+    wchar_t name[64];
+    HANDLE mapping;
+
+    while (true) {
+        swprintf(name, _countof(name), LOGGER_FOLLOW_SEGMENT_FORMAT, index);
+        mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+            static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), name);
+        if (!mapping) {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+        if (GetLastError() != ERROR_ALREADY_EXISTS) {
+            break;
+        }
+        CloseHandle(mapping);
+        ++index;
+    }
+
+    auto header = static_cast<LOGGER_SEGMENT_HEADER*>(MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0));
+    if (!header) {
+        HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+        CloseHandle(mapping);
+        return hr;
+    }
+
+    header->Magic = LOGGER_FOLLOW_MAGIC;
+    header->Version = LOGGER_FOLLOW_VERSION;
+    header->Index = index;
+    header->RunId = RunId;
+    header->Size = size;
+    header->Committed = LOGGER_SEGMENT_DATA_OFFSET;
+    header->Sealed = 0;
+
+    // The new segment exists before the old one says to move on to it.
+    InterlockedExchange64(&Control->CurrentSegment, static_cast<LONG64>(index));
+
+    if (Segment) {
+        InterlockedExchange(&Segment->Sealed, 1);
+        UnmapViewOfFile(Segment);
+        Notify();
+
+        // Hold on to the sealed segment until the next rollover, for readers
+        // that have not reached it yet.
+        if (PreviousMapping) {
+            CloseHandle(PreviousMapping);
+        }
+        PreviousMapping = SegmentMapping;
+    }
+
+    Segment = header;
+    SegmentMapping = mapping;
+    Offset = LOGGER_SEGMENT_DATA_OFFSET;
+    return S_OK;
+}
+
+HRESULT LoggerFollowWriter::Append(ULONG priority, ULONG64 sequence, const char* data, ULONG length) {
+    // The writer threads of both lanes append; they take turns.
+    AcquireSRWLockExclusive(&Lock);
+    HRESULT hr = AppendLocked(priority, sequence, data, length);
+    ReleaseSRWLockExclusive(&Lock);
+    return hr;
+}
+
+HRESULT LoggerFollowWriter::AppendLocked(ULONG priority, ULONG64 sequence, const char* data, ULONG length) {
+    const ULONG64 size = RecordSize(length);
+
+    if (!Segment) {
+        return E_HANDLE;
+    }
+    if (LOGGER_SEGMENT_DATA_OFFSET + size > Segment->Size) {
+        return E_INVALIDARG;
+    }
+
+    if (Offset + size > Segment->Size) {
+        HRESULT hr = CreateSegment(Segment->Index + 1);
+        if (FAILED(hr)) {
+            return hr;
+        }
+    }
+
+    auto record = reinterpret_cast<LOGGER_SEGMENT_RECORD*>(reinterpret_cast<CHAR*>(Segment) + Offset);
+    record->Length = length;
+    record->Priority = priority;
+    record->Sequence = sequence;
+    memcpy(record->Data, data, length);
+    Offset += size;
+
+    // The exchange orders the record before the offset that publishes it,
+    // and the offset before the read of WaiterCount (see Wait).
+    InterlockedExchange64(&Segment->Committed, static_cast<LONG64>(Offset));
+
+    if (Control->WaiterCount != 0) {
+        Notify();
+    }
+    return S_OK;
+}
+
+void LoggerFollowWriter::Notify() {
+    for (ULONG i = 0; i < LOGGER_FOLLOW_MAX_READERS; ++i) {
+        LOGGER_FOLLOW_SLOT& slot = Control->Readers[i];
+
+        if (slot.Waiting && InterlockedExchange(&slot.Waiting, 0) == 1) {
+            InterlockedDecrement(&Control->WaiterCount);
+            SetEvent(Events[i]);
+        }
+    }
+}
+
+LoggerFollowReader::~LoggerFollowReader() {
+    Close();
+}
+
+HRESULT LoggerFollowReader::Open() {
+    wchar_t name[64];
+    const LONG processId = static_cast<LONG>(GetCurrentProcessId());
+    HRESULT hr;
+
+    ControlMapping = OpenFileMappingW(FILE_MAP_WRITE, FALSE, LOGGER_FOLLOW_CONTROL_NAME);
+    if (!ControlMapping) {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    Control = static_cast<LOGGER_FOLLOW_CONTROL*>(MapViewOfFile(ControlMapping, FILE_MAP_WRITE,
+        0, 0, sizeof(LOGGER_FOLLOW_CONTROL)));
+    if (!Control) {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        Close();
+        return hr;
+    }
+
+    if (Control->Magic != LOGGER_FOLLOW_MAGIC || Control->Version != LOGGER_FOLLOW_VERSION) {
+        Close();
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    // Take a free slot, or one left behind by a reader that exited.
+    for (ULONG i = 0; i < LOGGER_FOLLOW_MAX_READERS && Slot < 0; ++i) {
+        LOGGER_FOLLOW_SLOT& slot = Control->Readers[i];
+        LONG owner = slot.ProcessId;
+
+        if (owner != 0) {
+            // Only a process known to be gone gives up its slot. Failing to
+            // open it for any other reason, such as access denied or a
+            // protected process, says nothing about whether it still reads.
+            HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, static_cast<DWORD>(owner));
+            bool exited;
+            if (process) {
+                exited = WaitForSingleObject(process, 0) == WAIT_OBJECT_0;
+                CloseHandle(process);
+            }
+            else {
+                exited = GetLastError() == ERROR_INVALID_PARAMETER;
+            }
+            if (!exited) {
+                continue;
+            }
+        }
+
+        if (InterlockedCompareExchange(&slot.ProcessId, processId, owner) == owner) {
+            swprintf(name, _countof(name), LOGGER_FOLLOW_EVENT_FORMAT, i);
+            Event = OpenEventW(SYNCHRONIZE | EVENT_MODIFY_STATE, FALSE, name);
+            if (Event) {
+                if (InterlockedExchange(&slot.Waiting, 0) == 1) {
+                    InterlockedDecrement(&Control->WaiterCount);
+                }
+                Slot = static_cast<LONG>(i);
+            }
+            else {
+                InterlockedExchange(&slot.ProcessId, 0);
+            }
+        }
+    }
+
+    // Without a slot the reader still works, it polls.
+    hr = OpenSegment(static_cast<ULONG64>(Control->CurrentSegment), false);
+    if (FAILED(hr)) {
+        Close();
+        return hr;
+    }
+    return S_OK;
+}
+
+void LoggerFollowReader::Close() {
+    CloseSegment();
+
+    if (Slot >= 0) {
+        LOGGER_FOLLOW_SLOT& slot = Control->Readers[Slot];
+        if (InterlockedExchange(&slot.Waiting, 0) == 1) {
+            InterlockedDecrement(&Control->WaiterCount);
+        }
+        InterlockedExchange(&slot.ProcessId, 0);
+        Slot = -1;
+    }
+    if (Event) {
+        CloseHandle(Event);
+        Event = nullptr;
+    }
+    if (Control) {
+        UnmapViewOfFile(Control);
+        Control = nullptr;
+    }
+    if (ControlMapping) {
+        CloseHandle(ControlMapping);
+        ControlMapping = nullptr;
+    }
+}
+
+HRESULT LoggerFollowReader::OpenSegment(ULONG64 index, bool successor) {
+    wchar_t name[64];
+
+    swprintf(name, _countof(name), LOGGER_FOLLOW_SEGMENT_FORMAT, index);
+    SegmentMapping = OpenFileMappingW(FILE_MAP_READ, FALSE, name);
+    if (!SegmentMapping) {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    Segment = static_cast<const LOGGER_SEGMENT_HEADER*>(MapViewOfFile(SegmentMapping, FILE_MAP_READ, 0, 0, 0));
+    if (!Segment || Segment->Magic != LOGGER_FOLLOW_MAGIC || Segment->Version != LOGGER_FOLLOW_VERSION) {
+        HRESULT hr = Segment ? HRESULT_FROM_WIN32(ERROR_INVALID_DATA) : HRESULT_FROM_WIN32(GetLastError());
+        CloseSegment();
+        return hr;
+    }
+
+    // Another run's segment under the index that follows: its records were
+    // read long ago, or never belonged to this stream.
+    if (successor && Segment->RunId != RunId && Segment->RunId != static_cast<ULONG64>(ReadAcquire64(&Control->RunId))) {
+        CloseSegment();
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    RunId = Segment->RunId;
+    Offset = LOGGER_SEGMENT_DATA_OFFSET;
+    Limit = Offset;
+    return S_OK;
+}
+
+void LoggerFollowReader::CloseSegment() {
+    if (Segment) {
+        UnmapViewOfFile(Segment);
+        Segment = nullptr;
+    }
+    if (SegmentMapping) {
+        CloseHandle(SegmentMapping);
+        SegmentMapping = nullptr;
+    }
+}
+
+const LOGGER_SEGMENT_RECORD* LoggerFollowReader::Next() {
+    if (!Control) {
+        return nullptr;
+    }
+
+    // A new UserLogger may have started since the last segment went away.
+    if (!Segment && FAILED(OpenSegment(static_cast<ULONG64>(ReadAcquire64(&Control->CurrentSegment)), false))) {
+        return nullptr;
+    }
+
+    while (true) {
+        if (Offset >= Limit) {
+            Limit = static_cast<ULONG64>(ReadAcquire64(&Segment->Committed));
+        }
+
+        if (Offset < Limit) {
+            auto record = reinterpret_cast<const LOGGER_SEGMENT_RECORD*>(
+                reinterpret_cast<const CHAR*>(Segment) + Offset);
+            Offset += RecordSize(record->Length);
+            return record;
+        }
+
+        if (!ReadAcquire(&Segment->Sealed)) {
+            return nullptr;
+        }
+
+        // Records published just before sealing.
+        Limit = static_cast<ULONG64>(ReadAcquire64(&Segment->Committed));
+        if (Offset < Limit) {
+            continue;
+        }
+
+        // Move on to the first segment of this run after this one. An index
+        // may be missing because the writer skipped it, or because we fell
+        // more than a segment behind; the current segment is always there.
+        const ULONG64 current = static_cast<ULONG64>(ReadAcquire64(&Control->CurrentSegment));
+        ULONG64 next = Segment->Index + 1;
+        CloseSegment();
+
+        while (next < current && FAILED(OpenSegment(next, true))) {
+            ++next;
+        }
+        if (!Segment && FAILED(OpenSegment(current, false))) {
+            return nullptr;
+        }
+    }
+}
+
+void LoggerFollowReader::Wait(DWORD timeoutMs) {
+    if (Slot < 0) {
+        Sleep(timeoutMs);
+        return;
+    }
+
+    LOGGER_FOLLOW_SLOT& slot = Control->Readers[Slot];
+
+    InterlockedExchange(&slot.Waiting, 1);
+    InterlockedIncrement(&Control->WaiterCount);
+
+    // Look again after announcing the wait: either this sees what the writer
+    // published meanwhile, or the writer sees WaiterCount and wakes us.
+    const bool pending = Segment &&
+        (Offset < static_cast<ULONG64>(ReadAcquire64(&Segment->Committed)) || ReadAcquire(&Segment->Sealed));
+
+    if (!pending) {
+        WaitForSingleObject(Event, timeoutMs);
+    }
+
+    if (InterlockedExchange(&slot.Waiting, 0) == 1) {
+        InterlockedDecrement(&Control->WaiterCount);
+    }
+}
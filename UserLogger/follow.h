@@ -0,0 +1,170 @@
+#ifndef __FOLLOW_H__
+#define __FOLLOW_H__
+
+/*
+    Live follow of the log.
+
+    Every line written to the logs of both lanes is also appended, as a
+    record, to a shared memory segment that other processes map read-only.
+    The writer copies the record in and then publishes it by moving the
+    segment's Committed offset; readers consume everything below Committed
+    in place, without copying and without locks, each at its own pace.
+
+    A reader that has nothing to read sets the Waiting flag of its slot in
+    the control block and sleeps on the slot's event. The writer only looks
+    at the slots while WaiterCount is not zero, so readers that keep up by
+    polling cost it nothing.
+
+    When a segment is full the writer creates the next one, makes it current
+    and seals the full one. Readers move on when they reach the end of a
+    sealed segment. The writer keeps the previous segment mapped, so a reader
+    may fall up to a whole segment behind without losing records; past that
+    it skips to the current segment and sees a jump in Sequence.
+
+    Segment names are only unique while a segment is mapped. Every writer
+    stamps its segments with the ID of its run, and a reader moving on from
+    a sealed segment only takes the next index if it was written by the same
+    run or by the run now current. A segment left over from an earlier run,
+    which a writer skips when it finds the index still taken, is never
+    replayed.
+*/
+
+constexpr ULONG LOGGER_FOLLOW_MAGIC = 'wflL';
+constexpr ULONG LOGGER_FOLLOW_VERSION = 2;
+constexpr ULONG64 LOGGER_FOLLOW_SEGMENT_SIZE = 16 * 1024 * 1024;
+constexpr ULONG LOGGER_FOLLOW_MAX_READERS = 16;
+
+constexpr const wchar_t* LOGGER_FOLLOW_CONTROL_NAME = L"Local\\UserLoggerFollow";
+constexpr const wchar_t* LOGGER_FOLLOW_SEGMENT_FORMAT = L"Local\\UserLoggerSegment%llu";
+constexpr const wchar_t* LOGGER_FOLLOW_EVENT_FORMAT = L"Local\\UserLoggerFollowReader%u";
+
+#pragma pack(push, 8)
+
+// One per reader, each in a cache line of its own.
+struct LOGGER_FOLLOW_SLOT {
+    // Process ID of the reader holding the slot, 0 when free.
+    volatile LONG ProcessId;
+    // Set by the reader before it sleeps, cleared by whoever wakes it.
+    volatile LONG Waiting;
+    CHAR Reserved[56];
+};
+
+struct LOGGER_FOLLOW_CONTROL {
+    ULONG Magic;
+    ULONG Version;
+    ULONG64 SegmentSize;
+    // Index of the segment the writer appends to.
+    volatile LONG64 CurrentSegment;
+    // Number of slots with Waiting set.
+    volatile LONG WaiterCount;
+    ULONG Reserved;
+    // Run of the writer that appends to CurrentSegment.
+    volatile LONG64 RunId;
+    CHAR Padding[24];
+    LOGGER_FOLLOW_SLOT Readers[LOGGER_FOLLOW_MAX_READERS];
+};
+
+struct LOGGER_SEGMENT_HEADER {
+    ULONG Magic;
+    ULONG Version;
+    ULONG64 Index;
+    // Run of the writer that created the segment.
+    ULONG64 RunId;
+    ULONG64 Size;
+    // Offset just past the last published record.
+    volatile LONG64 Committed;
+    // Set once no record will be added; continue with segment Index + 1.
+    volatile LONG Sealed;
+    ULONG Reserved;
+};
+
+// Records start right after the header and are 8-byte aligned.
+struct LOGGER_SEGMENT_RECORD {
+    // Bytes of Data.
+    ULONG Length;
+    // LOGGER_PRIORITY of the lane; Sequence counts within the lane.
+    ULONG Priority;
+    ULONG64 Sequence;
+    CHAR Data[1];
+};
+
+#pragma pack(pop)
+
+class LoggerFollowWriter {
+    /*
+    Appends records for the readers. The reorder stages' writer threads, one
+    per lane, call Append.
+    */
+public:
+    LoggerFollowWriter() = default;
+    ~LoggerFollowWriter();
+
+    LoggerFollowWriter(const LoggerFollowWriter&) = delete;
+    LoggerFollowWriter& operator=(const LoggerFollowWriter&) = delete;
+
+    HRESULT Open(ULONG64 segmentSize);
+    void Close();
+
+    // Publishes one record and wakes the readers waiting for it.
+    HRESULT Append(ULONG priority, ULONG64 sequence, const char* data, ULONG length);
+
+private:
+    HRESULT AppendLocked(ULONG priority, ULONG64 sequence, const char* data, ULONG length);
+    HRESULT CreateSegment(ULONG64 index);
+    void Notify();
+
+    HANDLE ControlMapping = nullptr;
+    LOGGER_FOLLOW_CONTROL* Control = nullptr;
+    HANDLE SegmentMapping = nullptr;
+    LOGGER_SEGMENT_HEADER* Segment = nullptr;
+    HANDLE PreviousMapping = nullptr;
+    ULONG64 RunId = 0;
+    ULONG64 Offset = 0;
+    HANDLE Events[LOGGER_FOLLOW_MAX_READERS] = {};
+    SRWLOCK Lock = SRWLOCK_INIT;
+};
+
+class LoggerFollowReader {
+    /*
+    Follows the records from the segment that is current when it opens.
+    */
+public:
+    LoggerFollowReader() = default;
+    ~LoggerFollowReader();
+
+    LoggerFollowReader(const LoggerFollowReader&) = delete;
+    LoggerFollowReader& operator=(const LoggerFollowReader&) = delete;
+
+    HRESULT Open();
+    void Close();
+
+    // Returns the next record, in place in the shared segment, or nullptr
+    // when the writer has not published one yet. The record stays valid
+    // until the following call.
+    const LOGGER_SEGMENT_RECORD* Next();
+
+    // Sleeps until the writer publishes a record or timeoutMs passes. Without
+    // a free slot it just sleeps for timeoutMs.
+    void Wait(DWORD timeoutMs);
+
+private:
+    // A successor must belong to the run of the segment just left or to the
+    // current run.
+    HRESULT OpenSegment(ULONG64 index, bool successor);
+    void CloseSegment();
+
+    HANDLE ControlMapping = nullptr;
+    LOGGER_FOLLOW_CONTROL* Control = nullptr;
+    HANDLE SegmentMapping = nullptr;
+    const LOGGER_SEGMENT_HEADER* Segment = nullptr;
+    // Run of the segment read last.
+    ULONG64 RunId = 0;
+    ULONG64 Offset = 0;
+    // Committed as last read; the shared value is only read again once the
+    // reader gets there, which keeps its cache line with the writer.
+    ULONG64 Limit = 0;
+    LONG Slot = -1;
+    HANDLE Event = nullptr;
+};
+
+#endif
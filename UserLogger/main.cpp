@@ -6,27 +6,226 @@
 #include <fltUser.h>
 #include <fstream>
 #include "userlogger.h"
+#include "reorder.h"
+#include "metrics.h"
+#include "follow.h"
+#include "traceDecode.h"
 
 constexpr DWORD LOGGER_DEFAULT_REQUEST_COUNT = 5;
 constexpr DWORD LOGGER_DEFAULT_THREAD_COUNT = 2;
 constexpr DWORD LOGGER_MAX_THREAD_COUNT = 64;
 
+// Size of each trace read and how often the driver's trace rings are drained.
+constexpr DWORD LOGGER_TRACE_READ_SIZE = 64 * 1024;
+constexpr DWORD LOGGER_TRACE_POLL_MS = 1000;
+
+// Acknowledge logged events to the driver every this many sequence numbers,
+// and at the latest this long after the first event that was not.
+constexpr ULONG64 LOGGER_ACK_INTERVAL = 32;
+constexpr DWORD LOGGER_ACK_MAX_DELAY_MS = 250;
+
+// Log of each lane, and its last acknowledged session and sequence, read
+// back on startup to resume. The bulk lane keeps the names used before
+// there were lanes.
+const char* const LoggerLogFiles[LoggerPriorityCount] = { "process_log.txt", "process_log.high.txt" };
+const char* const LoggerSequenceFiles[LoggerPriorityCount] = { "process_log.seq", "process_log.high.seq" };
+
+// Longest line written to the log for one event.
+constexpr size_t LOGGER_LINE_SIZE = 128;
+
+// How long --follow sleeps when no record arrives.
+constexpr DWORD LOGGER_FOLLOW_WAIT_MS = 1000;
+
+struct LOGGER_ACK_STATE {
+    /*
+    The last event written to the log. Events are written in sequence order
+    by the reorder stage's writer thread, which owns this state while it
+    runs. Watermark is what the driver may release from its backlog and what
+    a restarted UserLogger resumes from.
+    */
+    LOGGER_PRIORITY Priority = LoggerPriorityBulk;
+    HANDLE Port = nullptr;
+    ULONG64 SessionId = 0;
+    ULONG64 Watermark = 0;
+    ULONG64 LastAck = 0;
+    std::ofstream LogFile;
+
+    // Driver timestamps of the events written since the last flush.
+    std::vector<LONG64> Unflushed;
+    LoggerMetrics* Metrics = nullptr;
+
+    // Live copy of the log for --follow readers, if it could be created.
+    LoggerFollowWriter* Follow = nullptr;
+};
+
+struct LOGGER_LANE {
+    /*
+    Everything that carries the events of one priority, from the driver's
+    port to the log file: its own completion port, workers, reorder stage and
+    acknowledgements. Lanes share no queue or thread, so high priority events
+    never wait behind bulk ones.
+    */
+    HANDLE Port = nullptr;
+    HANDLE Completion = nullptr;
+    LOGGER_REPLAY_REPLY Reply = {};
+    LOGGER_ACK_STATE Ack;
+    LOGGER_THREAD_CONTEXT Context = {};
+    std::unique_ptr<LoggerReorder> Reorder;
+    std::vector<LOGGER_MESSAGE> Messages;
+};
+
 void Usage() {
-    std::wcerr << L"Usage: <executable> [RequestCount] [ThreadCount]" << std::endl;
+    std::wcerr << L"Usage: <executable> [RequestCount] [ThreadCount] [TraceFile|-] [MaxHoldMs] [MetricsFile|-]" << std::endl;
+    std::wcerr << L"       <executable> --decode-trace <TraceFile>" << std::endl;
+    std::wcerr << L"       <executable> --follow" << std::endl;
+}
+
+void LoadAckState(LOGGER_ACK_STATE& ack) {
+    std::ifstream seqFile(LoggerSequenceFiles[ack.Priority]);
+    if (!(seqFile >> ack.SessionId >> ack.Watermark)) {
+        ack.SessionId = 0;
+        ack.Watermark = 0;
+    }
+    ack.LastAck = ack.Watermark;
+}
+
+void SaveAckState(const LOGGER_ACK_STATE& ack) {
+    std::ofstream seqFile(LoggerSequenceFiles[ack.Priority], std::ios_base::trunc);
+    if (seqFile.is_open()) {
+        seqFile << ack.SessionId << " " << ack.Watermark << std::endl;
+    }
+}
+
+void FlushLog(LOGGER_ACK_STATE& ack) {
+    ack.LogFile.flush();
+
+    // The flush stage closes the end-to-end latency of every event it covers.
+    const LONG64 now = LoggerMetrics::Now();
+    for (LONG64 timestamp : ack.Unflushed) {
+        ack.Metrics->RecordStage(ack.Priority, LoggerStageFlush, timestamp, now);
+    }
+    ack.Unflushed.clear();
+    ack.Metrics->SetUnflushed(ack.Priority, 0);
+}
+
+void AcknowledgeWatermark(LOGGER_ACK_STATE& ack) {
+    LOGGER_COMMAND_MESSAGE command = {};
+    LOGGER_REPLAY_REPLY reply = {};
+    DWORD returned;
+
+    // Everything acknowledged must be on disk first.
+    FlushLog(ack);
+
+    if (ack.Watermark == ack.LastAck) {
+        return;
+    }
+
+    command.Command = LoggerCommandAck;
+    command.SessionId = ack.SessionId;
+    command.Sequence = ack.Watermark;
+
+    if (SUCCEEDED(FilterSendMessage(ack.Port, &command, sizeof(command), &reply, sizeof(reply), &returned))) {
+        ack.LastAck = ack.Watermark;
+        SaveAckState(ack);
+
+        if (returned >= sizeof(reply)) {
+            ack.Metrics->SetDriverDropped(ack.Priority, reply.DroppedCount);
+        }
+    }
+}
+
+void AdvanceWatermark(LOGGER_ACK_STATE& ack, ULONG64 sequence) {
+    ack.Watermark = sequence;
+
+    if (ack.Watermark - ack.LastAck >= LOGGER_ACK_INTERVAL) {
+        AcknowledgeWatermark(ack);
+    }
+}
+
+bool ResendEvents(LOGGER_LANE& lane, ULONG64 first, ULONG64 mask) {
+    /*
+    Asks the driver to send the selected events of the lane again and
+    discards those it no longer holds. Called on the writer thread of the
+    lane's reorder stage; the lane's workers receive the events while the
+    driver sends them.
+    */
+    LOGGER_COMMAND_MESSAGE command = {};
+    LOGGER_RESEND_REPLY reply = {};
+    DWORD replyLength;
+    unsigned long bit;
+
+    command.Command = LoggerCommandResend;
+    command.SessionId = lane.Ack.SessionId;
+    command.Sequence = first;
+    command.Mask = mask;
+
+    if (FAILED(FilterSendMessage(lane.Port, &command, sizeof(command), &reply, sizeof(reply), &replyLength))) {
+        return false;
+    }
+
+    for (ULONG64 lost = reply.LostMask; _BitScanForward64(&bit, lost); lost &= lost - 1) {
+        lane.Reorder->Discard(first + bit);
+    }
+    return true;
+}
+
+int FormatProcessInfo(char* line, size_t size, const LOGGER_NOTIFICATION& notification) {
+    int length = snprintf(line, size, " Process ID: %llu, rule: %lu, open at : %.*s\n",
+        notification.ProcessId, notification.Rule,
+        static_cast<int>(sizeof(notification.Time)), notification.Time);
+
+    return length < 0 ? 0 : (static_cast<size_t>(length) < size ? length : static_cast<int>(size) - 1);
 }
 
-void LogProcessInfo(ULONG64 processId, const char* time) {
-    std::ofstream logFile("process_log.txt", std::ios_base::app);
+void LogProcessInfo(std::ofstream& logFile, const char* line, int length) {
     if (logFile.is_open()) {
-        logFile << " Process ID: " << processId
-			<< ", open at : " << time << std::endl;
-        logFile.close();
+        logFile.write(line, length);
     }
     else {
         std::cerr << "Unable to open log file." << std::endl;
     }
 }
 
+void WriteEvent(LOGGER_ACK_STATE& ack, const LOGGER_NOTIFICATION& notification) {
+    /*
+    Called by the reorder stage for each event, in sequence order.
+    */
+    printf("Received message, Lane %s, Sequence %llu, ProcessId %llu, Rule %lu\n",
+        LoggerPriorityNames[ack.Priority], notification.Sequence, notification.ProcessId, notification.Rule);
+    printf("time: %s\n", notification.Time);
+
+    char line[LOGGER_LINE_SIZE];
+    int length = FormatProcessInfo(line, sizeof(line), notification);
+    ack.Metrics->RecordStage(ack.Priority, LoggerStageFormat, notification.Timestamp, LoggerMetrics::Now());
+
+    // Log process ID and time to a file
+    LogProcessInfo(ack.LogFile, line, length);
+    ack.Metrics->RecordStage(ack.Priority, LoggerStageWrite, notification.Timestamp, LoggerMetrics::Now());
+
+    if (ack.Follow) {
+        ack.Follow->Append(ack.Priority, notification.Sequence, line, length);
+    }
+
+    ack.Unflushed.push_back(notification.Timestamp);
+    ack.Metrics->SetUnflushed(ack.Priority, ack.Unflushed.size());
+
+    AdvanceWatermark(ack, notification.Sequence);
+}
+
+void WriteGap(LOGGER_ACK_STATE& ack, ULONG64 first, ULONG64 last) {
+    /*
+    Called by the reorder stage for sequences that were dropped or expired in
+    the driver, or did not arrive within the maximum hold time.
+    */
+    ack.LogFile << " Gap: " << last - first + 1 << " event(s) lost between sequence " << first
+        << " and " << last << "\n";
+    printf("Logger: %llu %s event(s) lost between sequence %llu and %llu\n",
+        last - first + 1, LoggerPriorityNames[ack.Priority], first, last);
+    ack.Metrics->RecordGap(ack.Priority, last - first + 1);
+
+    AdvanceWatermark(ack, last);
+}
+
 DWORD WINAPI LoggerWorker(LPVOID context) {
 /*++
 Routine Description
@@ -63,11 +262,24 @@ Return Value
             break;
         }
 		notification = &message->Notification;
-        printf("Received message, size %Id, ProcessId %I64u\n", overlapped->InternalHigh, message->Notification.ProcessId);
-		printf("time: %s\n", message->Notification.Time);
+        ctx->Metrics->RecordStage(ctx->Priority, LoggerStageReceive, notification->Timestamp, LoggerMetrics::Now());
+
+        // Hand the event to the reorder stage, which writes it in sequence
+        // order. Replay duplicates and events of an older session are dropped.
+        if (notification->SessionId == ctx->SessionId) {
+            // The events the driver shed before this one never arrive live;
+            // the reorder stage asks for them again without waiting.
+            if (notification->ShedSequence != 0) {
+                ctx->Reorder->ReportShed(notification->ShedSequence);
+            }
 
-		// Log process ID and time to a file
-		LogProcessInfo(message->Notification.ProcessId, message->Notification.Time);
+            if (ctx->Reorder->Insert(*notification)) {
+                ctx->Metrics->RecordStage(ctx->Priority, LoggerStageDecode, notification->Timestamp, LoggerMetrics::Now());
+            }
+            else {
+                ctx->Metrics->RecordDuplicate(ctx->Priority);
+            }
+        }
 
         memset(&message->Ovlp, 0, sizeof(OVERLAPPED));
         hr = FilterGetMessage(ctx->Port,
@@ -93,6 +305,223 @@ Return Value
 }
 
 
+DWORD WINAPI LoggerTraceWorker(LPVOID context) {
+/*++
+Routine Description
+    Drains the driver's binary trace rings into the trace file, unformatted.
+    Use --decode-trace to turn the file into text.
+
+Arguments
+    Context  - The thread context, TraceFile names the output file.
+
+Return Value
+    HRESULT indicating the status of thread exit.
+--*/
+    auto ctx = reinterpret_cast<LOGGER_THREAD_CONTEXT*>(context);
+    std::vector<char> buffer(LOGGER_TRACE_READ_SIZE);
+    LOGGER_COMMAND_MESSAGE command = {};
+    DWORD returned;
+    HRESULT hr;
+
+    std::ofstream traceFile(ctx->TraceFile, std::ios_base::binary | std::ios_base::app);
+    if (!traceFile.is_open()) {
+        std::cerr << "Unable to open trace file." << std::endl;
+        return E_FAIL;
+    }
+
+    command.Command = LoggerCommandReadTrace;
+
+    while (true) {
+        hr = FilterSendMessage(ctx->Port, &command, sizeof(command),
+            buffer.data(), static_cast<DWORD>(buffer.size()), &returned);
+
+        if (FAILED(hr)) {
+            break;
+        }
+
+        auto header = reinterpret_cast<PLOGGER_TRACE_READ_REPLY>(buffer.data());
+        if (header->RecordCount != 0 || header->LostCount != 0) {
+            traceFile.write(buffer.data(), returned);
+            traceFile.flush();
+        }
+
+        // A full buffer means more records are waiting.
+        if (returned + sizeof(LOGGER_TRACE_RECORD) <= buffer.size()) {
+            Sleep(LOGGER_TRACE_POLL_MS);
+        }
+    }
+
+    return hr;
+}
+
+int DecodeTrace(const char* fileName) {
+    /*
+    Prints the records of a trace file written by LoggerTraceWorker.
+    */
+    std::ifstream traceFile(fileName, std::ios_base::binary);
+
+    if (!traceFile.is_open()) {
+        std::cerr << "Unable to open trace file." << std::endl;
+        return 1;
+    }
+
+    return LoggerDecodeTrace(traceFile, stdout);
+}
+
+int FollowLog() {
+    /*
+    Prints the log of a running UserLogger as it is written, reading the
+    records in place from the shared segments.
+    */
+    LoggerFollowReader reader;
+    const LOGGER_SEGMENT_RECORD* record;
+
+    HRESULT hr = reader.Open();
+    if (FAILED(hr)) {
+        std::wcerr << L"ERROR: Opening the live log: 0x" << std::hex << hr << std::endl;
+        return 2;
+    }
+
+    while (true) {
+        while ((record = reader.Next()) != nullptr) {
+            if (record->Priority == LoggerPriorityHigh) {
+                fputs("[high]", stdout);
+            }
+            fwrite(record->Data, 1, record->Length, stdout);
+        }
+        fflush(stdout);
+        reader.Wait(LOGGER_FOLLOW_WAIT_MS);
+    }
+}
+
+HRESULT OpenLane(LOGGER_LANE& lane, LOGGER_PRIORITY priority, DWORD threadCount) {
+    /*
+    Connects to the port of the lane and learns the driver's session, so we
+    know whether our saved sequence still means anything, before any event
+    is accepted. Opens the lane's log file.
+    */
+    const PWSTR portName = priority == LoggerPriorityHigh ? LOGGERHighPortName : LOGGERPortName;
+    LOGGER_COMMAND_MESSAGE query = {};
+    DWORD replyLength;
+    HRESULT hr;
+
+    lane.Ack.Priority = priority;
+    lane.Context.Priority = priority;
+
+    // Open a commuication channel to the filter
+    hr = FilterConnectCommunicationPort(portName, 0, nullptr, 0, nullptr, &lane.Port);
+
+    if (FAILED(hr)) {
+        std::wcerr << L"ERROR: Connecting to filter port " << portName << L": 0x" << std::hex << hr << std::endl;
+        lane.Port = nullptr;
+        return hr;
+    }
+
+    // Create a completion port to use GetQueuedCompletionStatus to get messages from the driver.
+    lane.Completion = CreateIoCompletionPort(lane.Port, nullptr, 0, threadCount);
+
+    if (!lane.Completion) {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        std::wcerr << L"ERROR: Creating completion port: 0x" << std::hex << hr << std::endl;
+        return hr;
+    }
+
+    std::wcout << L"NULL: Port = " << lane.Port << L" Completion = " << lane.Completion << std::endl;
+
+    LoadAckState(lane.Ack);
+    lane.Ack.Port = lane.Port;
+
+    query.Command = LoggerCommandQuery;
+
+    hr = FilterSendMessage(lane.Port, &query, sizeof(query), &lane.Reply, sizeof(lane.Reply), &replyLength);
+
+    if (FAILED(hr)) {
+        std::wcerr << L"ERROR: Querying backlog: 0x" << std::hex << hr << std::endl;
+        return hr;
+    }
+
+    if (lane.Reply.SessionId != lane.Ack.SessionId) {
+        lane.Ack.SessionId = lane.Reply.SessionId;
+        lane.Ack.Watermark = 0;
+        lane.Ack.LastAck = 0;
+    }
+
+    lane.Ack.LogFile.open(LoggerLogFiles[priority], std::ios_base::app);
+
+    lane.Context.Port = lane.Port;
+    lane.Context.Completion = lane.Completion;
+    lane.Context.SessionId = lane.Ack.SessionId;
+    return S_OK;
+}
+
+HRESULT StartLane(LOGGER_LANE& lane, DWORD threadCount, DWORD requestCount, std::vector<HANDLE>& threads) {
+    /*
+    Starts the workers of the lane, each with requestCount messages pending,
+    then asks the driver for everything the lane recorded since our last
+    acknowledged event. The workers of the high priority lane run above
+    normal priority, so they are scheduled ahead of the bulk workers.
+    */
+    LOGGER_COMMAND_MESSAGE replay = {};
+    DWORD replyLength;
+    HRESULT hr;
+
+    // Allocate messages.
+    lane.Messages.resize(static_cast<size_t>(threadCount) * requestCount);
+
+    // Create specified number of threads.
+    for (DWORD i = 0; i < threadCount; ++i) {
+        HANDLE thread = CreateThread(nullptr, 0, LoggerWorker, &lane.Context, 0, nullptr);
+
+        if (!thread) {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+            std::wcerr << L"ERROR: Couldn't create thread: 0x" << std::hex << hr << std::endl;
+            return hr;
+        }
+
+        threads.push_back(thread);
+
+        if (lane.Context.Priority == LoggerPriorityHigh) {
+            SetThreadPriority(thread, THREAD_PRIORITY_ABOVE_NORMAL);
+        }
+
+        // Get messages for each thread.
+        for (DWORD j = 0; j < requestCount; ++j) {
+            LOGGER_MESSAGE& msg = lane.Messages[i * requestCount + j];
+            std::memset(&msg.Ovlp, 0, sizeof(OVERLAPPED));
+
+            hr = FilterGetMessage(
+                lane.Port,
+                &msg.MessageHeader,
+                FIELD_OFFSET(LOGGER_MESSAGE, Ovlp),
+                &msg.Ovlp
+            );
+            if (hr != HRESULT_FROM_WIN32(ERROR_IO_PENDING)) {
+                return hr;
+            }
+        }
+    }
+
+    // The replayed events arrive through the pending messages while this call waits.
+    replay.Command = LoggerCommandReplay;
+    replay.SessionId = lane.Ack.SessionId;
+    replay.Sequence = lane.Ack.Watermark;
+
+    hr = FilterSendMessage(lane.Port, &replay, sizeof(replay), &lane.Reply, sizeof(lane.Reply), &replyLength);
+
+    if (SUCCEEDED(hr)) {
+        std::wcout << L"LOGGER: " << LoggerPriorityNames[lane.Context.Priority] << L" lane resumed at sequence "
+            << std::dec << lane.Reply.FirstSequence << L", next " << lane.Reply.NextSequence << std::endl;
+
+        // Anything before FirstSequence that has not arrived is lost.
+        lane.Reorder->SkipBelow(lane.Reply.FirstSequence);
+        lane.Ack.Metrics->SetDriverDropped(lane.Context.Priority, lane.Reply.DroppedCount);
+    }
+    else {
+        std::wcerr << L"ERROR: Replaying backlog: 0x" << std::hex << hr << std::endl;
+    }
+    return S_OK;
+}
+
 int main(int argc, char* argv[]) { 
     /*
 	Main entry point for the userlogger application.
@@ -101,13 +530,28 @@ int main(int argc, char* argv[]) {
     */
     DWORD requestCount = LOGGER_DEFAULT_REQUEST_COUNT;
     DWORD threadCount = LOGGER_DEFAULT_THREAD_COUNT;
+    DWORD maxHoldMs = LOGGER_DEFAULT_MAX_HOLD_MS;
     std::vector<HANDLE> threads;  
-    LOGGER_THREAD_CONTEXT context;
-    HANDLE port = nullptr;
-    HANDLE completion = nullptr;
-    std::vector<LOGGER_MESSAGE> messages;
+    LOGGER_LANE lanes[LoggerPriorityCount];
+    LOGGER_LANE& bulk = lanes[LoggerPriorityBulk];
+    std::unique_ptr<LoggerMetrics> metrics;
+    LoggerFollowWriter follow;
+    LoggerFollowWriter* followWriter = nullptr;
+    std::string metricsFile = LOGGER_METRICS_FILE;
     HRESULT hr;
 
+    if (argc > 1 && std::string(argv[1]) == "--decode-trace") {
+        if (argc != 3) {
+            Usage();
+            return 1;
+        }
+        return DecodeTrace(argv[2]);
+    }
+
+    if (argc > 1 && std::string(argv[1]) == "--follow") {
+        return FollowLog();
+    }
+
     // Check how many threads and per thread requests are desired.
     if (argc > 1) {
         requestCount = std::atoi(argv[1]);
@@ -125,79 +569,111 @@ int main(int argc, char* argv[]) {
             Usage();
             return 1;
         }
-    }
 
-    // Open a commuication channel to the filter
-    std::wcout << L"LOGGER: Connecting to the filter..." << std::endl;
-
-    hr = FilterConnectCommunicationPort(LOGGERPortName, 0, nullptr, 0, nullptr, &port);
-
-    if (FAILED(hr)) {
-        std::wcerr << L"ERROR: Connecting to filter port: 0x" << std::hex << hr << std::endl;
-        return 2;
-    }
+        if (argc > 3 && std::string(argv[3]) != "-") {
+            bulk.Context.TraceFile = argv[3];
+        }
 
-    // Create a completion port to use GetQueuedCompletionStatus to get messages from the driver.
-    completion = CreateIoCompletionPort(port, nullptr, 0, threadCount);
+        if (argc > 4) {
+            maxHoldMs = std::atoi(argv[4]);
+        }
 
-    if (!completion) {
-        std::wcerr << L"ERROR: Creating completion port: " << GetLastError() << std::endl;
-        CloseHandle(port);
-		return 3; 
+        if (argc > 5) {
+            metricsFile = std::string(argv[5]) == "-" ? std::string() : std::string(argv[5]);
+        }
     }
 
-    std::wcout << L"NULL: Port = " << port << L" Completion = " << completion << std::endl;
-
-    context.Port = port;
-    context.Completion = completion;
-
-    // Allocate messages.
+    // The workers of a lane record into the metrics as soon as it starts.
     try {
-        messages.resize(static_cast<size_t>(threadCount) * requestCount);
+        metrics = std::make_unique<LoggerMetrics>(metricsFile, LOGGER_METRICS_INTERVAL_MS,
+            [&lanes](LOGGER_PRIORITY priority) { return lanes[priority].Reorder->Depth(); });
     }
     catch (const std::bad_alloc&) {
         hr = E_OUTOFMEMORY;
         goto main_cleanup;
     }
 
-    // Create specified number of threads.
-    try {
-        for (DWORD i = 0; i < threadCount; ++i) {
-            threads.emplace_back(CreateThread(
-                nullptr,
-                0,
-                LoggerWorker,
-                &context,
-                0,
-                nullptr
-            ));
-
-            if (!threads.back()) {
-                hr = GetLastError();
-                std::wcerr << L"ERROR: Couldn't create thread: " << hr << std::endl;
-                goto main_cleanup;
-            }
+    // Logging goes on without followers if the shared segment is unavailable.
+    hr = follow.Open(LOGGER_FOLLOW_SEGMENT_SIZE);
+
+    if (FAILED(hr)) {
+        std::wcerr << L"WARNING: Live follow unavailable: 0x" << std::hex << hr << std::endl;
+    }
+    else {
+        followWriter = &follow;
+    }
+
+    std::wcout << L"LOGGER: Connecting to the filter..." << std::endl;
+
+    // Each lane is started right after connecting to its port: until its
+    // reads are posted, its high priority creates wait for us and its bulk
+    // events are shed, and the replay resends whatever was shed meanwhile.
+    // The high priority lane goes first, so its backlog is replayed first.
+    for (LOGGER_PRIORITY priority : { LoggerPriorityHigh, LoggerPriorityBulk }) {
+        LOGGER_LANE& lane = lanes[priority];
+        LOGGER_ACK_STATE& ack = lane.Ack;
+
+        hr = OpenLane(lane, priority, threadCount);
 
-			// Get messages for each thread.
-            for (DWORD j = 0; j < requestCount; ++j) {
-                LOGGER_MESSAGE msg = messages[i * requestCount + j];
-                std::memset(&msg.Ovlp, 0, sizeof(OVERLAPPED));
+        if (FAILED(hr)) {
+            goto main_cleanup;
+        }
+
+        // Events are written by the reorder stage of their lane, in sequence
+        // order, starting right after the last one we acknowledged. A replay
+        // can deliver the whole backlog ahead of a missing sequence, so the
+        // ring holds at least that many.
+        try {
+            const ULONG64 window = lane.Reply.Capacity > LOGGER_DEFAULT_REORDER_WINDOW ?
+                lane.Reply.Capacity : LOGGER_DEFAULT_REORDER_WINDOW;
+
+            lane.Reorder = std::make_unique<LoggerReorder>(window, maxHoldMs,
+                [&ack](const LOGGER_NOTIFICATION& notification) { WriteEvent(ack, notification); },
+                [&ack](ULONG64 first, ULONG64 last) { WriteGap(ack, first, last); },
+                LOGGER_ACK_MAX_DELAY_MS,
+                [&ack]() { AcknowledgeWatermark(ack); },
+                [&lane](ULONG64 first, ULONG64 mask) { return ResendEvents(lane, first, mask); });
+        }
+        catch (const std::bad_alloc&) {
+            hr = E_OUTOFMEMORY;
+            goto main_cleanup;
+        }
+
+        ack.Metrics = metrics.get();
+        ack.Follow = followWriter;
+        lane.Context.Metrics = metrics.get();
+        lane.Context.Reorder = lane.Reorder.get();
+
+        hr = lane.Reorder->Start(ack.Watermark + 1,
+            priority == LoggerPriorityHigh ? THREAD_PRIORITY_ABOVE_NORMAL : THREAD_PRIORITY_NORMAL);
+
+        if (FAILED(hr)) {
+            goto main_cleanup;
+        }
+
+        lane.Reorder->SkipBelow(lane.Reply.FirstSequence);
 
-                hr = FilterGetMessage(
-                    port,
-					&msg.MessageHeader,
-                    FIELD_OFFSET(LOGGER_MESSAGE, Ovlp),
-                    &msg.Ovlp
-                );
-                if (hr != HRESULT_FROM_WIN32(ERROR_IO_PENDING)) {
-                    goto main_cleanup;
-                }
-            } 
+        try {
+            hr = StartLane(lane, threadCount, requestCount, threads);
+        }
+        catch (const std::bad_alloc&) {
+            hr = E_OUTOFMEMORY;
+        }
+
+        if (FAILED(hr)) {
+            goto main_cleanup;
         }
-        hr = S_OK;
     }
-    catch (...) {
-        hr = E_FAIL;
+
+    hr = metrics->Start();
+
+    if (SUCCEEDED(hr) && bulk.Context.TraceFile != nullptr) {
+        try {
+            threads.emplace_back(CreateThread(nullptr, 0, LoggerTraceWorker, &bulk.Context, 0, nullptr));
+        }
+        catch (const std::bad_alloc&) {
+            hr = E_OUTOFMEMORY;
+        }
     }
 
 main_cleanup:
@@ -209,10 +685,37 @@ main_cleanup:
         }
     }
 
+    // Write whatever the workers left in the reorder stages.
+    for (LOGGER_LANE& lane : lanes) {
+        if (lane.Reorder) {
+            lane.Reorder->Stop();
+        }
+    }
+
+    if (metrics) {
+        for (LOGGER_LANE& lane : lanes) {
+            if (lane.Ack.Metrics) {
+                FlushLog(lane.Ack);
+            }
+        }
+        metrics->Stop();
+    }
+
+    // Only a lane that got as far as loading its state saves it back.
+    for (LOGGER_LANE& lane : lanes) {
+        lane.Ack.LogFile.close();
+
+        if (lane.Ack.Port) {
+            SaveAckState(lane.Ack);
+        }
+    }
+
     std::wcout << L"NULL:  All done. Result = 0x" << std::hex << hr << std::endl;
 
-    if (port) CloseHandle(port);
-    if (completion) CloseHandle(completion);
+    for (LOGGER_LANE& lane : lanes) {
+        if (lane.Port) CloseHandle(lane.Port);
+        if (lane.Completion) CloseHandle(lane.Completion);
+    }
 
     return hr;
 }
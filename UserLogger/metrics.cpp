@@ -0,0 +1,204 @@
+#include <fstream>
+#include <windows.h>
+#include <fltUser.h>
+#include "userlogger.h"
+#include "metrics.h"
+
+// LOGGER_NOTIFICATION.Timestamp counts 100 ns units.
+constexpr LONG64 LOGGER_TICKS_PER_MICROSECOND = 10;
+constexpr double LOGGER_TICKS_PER_SECOND = 10000000.0;
+
+static const char* const LoggerStageNames[LoggerStageCount] = {
+    "receive", "decode", "format", "write", "flush"
+};
+
+void LoggerHistogram::Record(ULONG64 micros) {
+    ULONG bucket = 0;
+    unsigned long msb;
+
+    if (micros > 1 && _BitScanReverse64(&msb, micros - 1)) {
+        bucket = msb + 1;
+    }
+    if (bucket >= BucketCount) {
+        bucket = BucketCount - 1;
+    }
+
+    Buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    SumMicros.fetch_add(micros, std::memory_order_relaxed);
+    Count.fetch_add(1, std::memory_order_relaxed);
+}
+
+LoggerMetrics::LoggerMetrics(std::string fileName, DWORD intervalMs, DepthRoutine reorderDepth)
+    : FileName(std::move(fileName)), IntervalMs(intervalMs), ReorderDepth(std::move(reorderDepth)) {
+}
+
+LoggerMetrics::~LoggerMetrics() {
+    Stop();
+}
+
+HRESULT LoggerMetrics::Start() {
+    LastExport = Now();
+
+    if (FileName.empty()) {
+        return S_OK;
+    }
+
+    Event = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    if (!Event) {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    Thread = CreateThread(nullptr, 0, ExportThread, this, 0, nullptr);
+    if (!Thread) {
+        HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+        CloseHandle(Event);
+        Event = nullptr;
+        return hr;
+    }
+    return S_OK;
+}
+
+void LoggerMetrics::Stop() {
+    if (Thread) {
+        Stopping.store(true);
+        SetEvent(Event);
+        WaitForSingleObject(Thread, INFINITE);
+        CloseHandle(Thread);
+        Thread = nullptr;
+        Export();
+    }
+    if (Event) {
+        CloseHandle(Event);
+        Event = nullptr;
+    }
+}
+
+LONG64 LoggerMetrics::Now() {
+    FILETIME now;
+    ULARGE_INTEGER time;
+
+    GetSystemTimePreciseAsFileTime(&now);
+    time.LowPart = now.dwLowDateTime;
+    time.HighPart = now.dwHighDateTime;
+    return static_cast<LONG64>(time.QuadPart);
+}
+
+void LoggerMetrics::RecordStage(LOGGER_PRIORITY priority, LOGGER_STAGE stage, LONG64 timestamp, LONG64 now) {
+    // Both clocks are the system time; a clock change can make the age negative.
+    LONG64 age = now > timestamp ? (now - timestamp) / LOGGER_TICKS_PER_MICROSECOND : 0;
+    Stages[priority][stage].Record(static_cast<ULONG64>(age));
+}
+
+DWORD WINAPI LoggerMetrics::ExportThread(LPVOID context) {
+    reinterpret_cast<LoggerMetrics*>(context)->Run();
+    return 0;
+}
+
+void LoggerMetrics::Run() {
+    while (!Stopping.load()) {
+        WaitForSingleObject(Event, IntervalMs);
+        if (!Stopping.load()) {
+            Export();
+        }
+    }
+}
+
+HRESULT LoggerMetrics::Export() {
+    /*
+    Writes every metric to FileName in the Prometheus text exposition format.
+    */
+    const LONG64 now = Now();
+    const double elapsed = static_cast<double>(now - LastExport) / LOGGER_TICKS_PER_SECOND;
+    const std::string temporary = FileName + ".tmp";
+    std::string text;
+    char line[512];
+
+    text += "# HELP userlogger_event_age_seconds Time from the driver's timestamp to each UserLogger stage.\n";
+    text += "# TYPE userlogger_event_age_seconds histogram\n";
+
+    for (ULONG priority = 0; priority < LoggerPriorityCount; ++priority) {
+        const char* lane = LoggerPriorityNames[priority];
+
+        for (ULONG stage = 0; stage < LoggerStageCount; ++stage) {
+            const LoggerHistogram& histogram = Stages[priority][stage];
+            ULONG64 cumulative = 0;
+
+            for (ULONG bucket = 0; bucket < LoggerHistogram::BucketCount; ++bucket) {
+                cumulative += histogram.Buckets[bucket].load(std::memory_order_relaxed);
+
+                if (bucket + 1 < LoggerHistogram::BucketCount) {
+                    snprintf(line, sizeof(line),
+                        "userlogger_event_age_seconds_bucket{lane=\"%s\",stage=\"%s\",le=\"%.9g\"} %llu\n",
+                        lane, LoggerStageNames[stage], static_cast<double>(1ull << bucket) / 1000000.0, cumulative);
+                }
+                else {
+                    snprintf(line, sizeof(line),
+                        "userlogger_event_age_seconds_bucket{lane=\"%s\",stage=\"%s\",le=\"+Inf\"} %llu\n",
+                        lane, LoggerStageNames[stage], cumulative);
+                }
+                text += line;
+            }
+
+            // Count is taken from the buckets, so it always agrees with +Inf.
+            snprintf(line, sizeof(line), "userlogger_event_age_seconds_sum{lane=\"%s\",stage=\"%s\"} %.6f\n",
+                lane, LoggerStageNames[stage],
+                static_cast<double>(histogram.SumMicros.load(std::memory_order_relaxed)) / 1000000.0);
+            text += line;
+            snprintf(line, sizeof(line), "userlogger_event_age_seconds_count{lane=\"%s\",stage=\"%s\"} %llu\n",
+                lane, LoggerStageNames[stage], cumulative);
+            text += line;
+        }
+    }
+
+    text += "# HELP userlogger_events_per_second Events passing each stage per second since the previous export.\n";
+    text += "# TYPE userlogger_events_per_second gauge\n";
+
+    for (ULONG priority = 0; priority < LoggerPriorityCount; ++priority) {
+        for (ULONG stage = 0; stage < LoggerStageCount; ++stage) {
+            const ULONG64 count = Stages[priority][stage].Count.load(std::memory_order_relaxed);
+
+            snprintf(line, sizeof(line), "userlogger_events_per_second{lane=\"%s\",stage=\"%s\"} %.3f\n",
+                LoggerPriorityNames[priority], LoggerStageNames[stage],
+                elapsed > 0.0 ? static_cast<double>(count - LastCount[priority][stage]) / elapsed : 0.0);
+            text += line;
+            LastCount[priority][stage] = count;
+        }
+    }
+
+    // The remaining metrics are one gauge or counter per lane.
+    auto perLane = [&](const char* name, const char* type, const char* help, auto value) {
+        snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+        text += line;
+
+        for (ULONG priority = 0; priority < LoggerPriorityCount; ++priority) {
+            snprintf(line, sizeof(line), "%s{lane=\"%s\"} %llu\n", name, LoggerPriorityNames[priority],
+                static_cast<ULONG64>(value(static_cast<LOGGER_PRIORITY>(priority))));
+            text += line;
+        }
+    };
+
+    perLane("userlogger_reorder_depth", "gauge", "Events received but not yet written in sequence order.",
+        [this](LOGGER_PRIORITY priority) { return ReorderDepth ? ReorderDepth(priority) : 0ull; });
+    perLane("userlogger_unflushed_events", "gauge", "Events written to the log but not yet flushed.",
+        [this](LOGGER_PRIORITY priority) { return Unflushed[priority].load(std::memory_order_relaxed); });
+    perLane("userlogger_events_lost_total", "counter", "Events logged as a gap.",
+        [this](LOGGER_PRIORITY priority) { return Lost[priority].load(std::memory_order_relaxed); });
+    perLane("userlogger_duplicates_total", "counter", "Replayed events that had already been received.",
+        [this](LOGGER_PRIORITY priority) { return Duplicates[priority].load(std::memory_order_relaxed); });
+    perLane("userlogger_driver_dropped_total", "counter", "Unacknowledged events the driver's backlog overwrote.",
+        [this](LOGGER_PRIORITY priority) { return DriverDropped[priority].load(std::memory_order_relaxed); });
+
+    LastExport = now;
+
+    {
+        std::ofstream file(temporary, std::ios_base::binary | std::ios_base::trunc);
+        if (!file.is_open() || !file.write(text.data(), text.size())) {
+            return E_FAIL;
+        }
+    }
+
+    if (!MoveFileExA(temporary.c_str(), FileName.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+    return S_OK;
+}
@@ -0,0 +1,104 @@
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <atomic>
+#include <functional>
+#include <string>
+
+// How often the metrics file is rewritten, and its default name.
+constexpr DWORD LOGGER_METRICS_INTERVAL_MS = 1000;
+constexpr const char* LOGGER_METRICS_FILE = "process_log.prom";
+
+// Points an event passes in UserLogger, in order. The age of the event,
+// measured from the driver's timestamp, is recorded at each of them.
+enum LOGGER_STAGE {
+    LoggerStageReceive,     // FilterGetMessage completed
+    LoggerStageDecode,      // checked and handed to the reorder stage
+    LoggerStageFormat,      // taken in sequence order and formatted
+    LoggerStageWrite,       // written to the log file stream
+    LoggerStageFlush,       // flushed, about to be acknowledged to the driver
+    LoggerStageCount
+};
+
+class LoggerHistogram {
+    /*
+    Counts values in power-of-two buckets of microseconds. Recording is a
+    few relaxed atomic increments, so any thread may record at any time; a
+    reader may see a bucket and Count from slightly different moments.
+    */
+public:
+    // Bucket i counts values up to 2^i microseconds, the last one the rest.
+    static constexpr ULONG BucketCount = 34;
+
+    void Record(ULONG64 micros);
+
+    std::atomic<ULONG64> Buckets[BucketCount] = {};
+    std::atomic<ULONG64> Count{ 0 };
+    std::atomic<ULONG64> SumMicros{ 0 };
+};
+
+class LoggerMetrics {
+    /*
+    End-to-end latency, throughput and queue depth of UserLogger, per
+    priority lane. Stages record into lock-free histograms; a thread of its own rewrites the
+    metrics file in the Prometheus text format every IntervalMs. The file is
+    written under a temporary name and moved over the old one, so a scraper
+    never reads half of it.
+    */
+public:
+    using DepthRoutine = std::function<ULONG64(LOGGER_PRIORITY priority)>;
+
+    // An empty fileName collects the metrics without exporting them.
+    LoggerMetrics(std::string fileName, DWORD intervalMs, DepthRoutine reorderDepth);
+    ~LoggerMetrics();
+
+    LoggerMetrics(const LoggerMetrics&) = delete;
+    LoggerMetrics& operator=(const LoggerMetrics&) = delete;
+
+    HRESULT Start();
+
+    // Stops the thread and writes the file one last time.
+    void Stop();
+
+    // Current system time, in the unit of LOGGER_NOTIFICATION.Timestamp.
+    static LONG64 Now();
+
+    void RecordStage(LOGGER_PRIORITY priority, LOGGER_STAGE stage, LONG64 timestamp, LONG64 now);
+    void RecordGap(LOGGER_PRIORITY priority, ULONG64 count) {
+        Lost[priority].fetch_add(count, std::memory_order_relaxed);
+    }
+    void RecordDuplicate(LOGGER_PRIORITY priority) {
+        Duplicates[priority].fetch_add(1, std::memory_order_relaxed);
+    }
+    void SetUnflushed(LOGGER_PRIORITY priority, ULONG64 count) {
+        Unflushed[priority].store(count, std::memory_order_relaxed);
+    }
+    void SetDriverDropped(LOGGER_PRIORITY priority, ULONG64 count) {
+        DriverDropped[priority].store(count, std::memory_order_relaxed);
+    }
+
+private:
+    static DWORD WINAPI ExportThread(LPVOID context);
+    void Run();
+    HRESULT Export();
+
+    const std::string FileName;
+    const DWORD IntervalMs;
+    DepthRoutine ReorderDepth;
+
+    LoggerHistogram Stages[LoggerPriorityCount][LoggerStageCount];
+    std::atomic<ULONG64> Lost[LoggerPriorityCount] = {};
+    std::atomic<ULONG64> Duplicates[LoggerPriorityCount] = {};
+    std::atomic<ULONG64> Unflushed[LoggerPriorityCount] = {};
+    std::atomic<ULONG64> DriverDropped[LoggerPriorityCount] = {};
+
+    // Only the export thread uses these, to turn counts into rates.
+    ULONG64 LastCount[LoggerPriorityCount][LoggerStageCount] = {};
+    LONG64 LastExport = 0;
+
+    std::atomic<bool> Stopping{ false };
+    HANDLE Event = nullptr;
+    HANDLE Thread = nullptr;
+};
+
+#endif
@@ -0,0 +1,437 @@
+#include <windows.h>
+#include <fltUser.h>
+#include "userlogger.h"
+#include "reorder.h"
+
+constexpr ULONG64 LOGGER_REORDER_BUSY = 1ull << 63;
+constexpr ULONG64 LOGGER_REORDER_DISCARDED = 1ull << 62;
+constexpr ULONG64 LOGGER_REORDER_SKIPPED = ~0ull;
+
+// Sequences covered by one resend request, and how many requests are made
+// for a sequence before it is given up as a gap.
+constexpr ULONG64 LOGGER_REORDER_RESEND_SPAN = 64;
+constexpr DWORD LOGGER_REORDER_MAX_RESENDS = 3;
+
+LoggerReorder::LoggerReorder(ULONG64 window, DWORD maxHoldMs, EmitRoutine emit, GapRoutine gap,
+    DWORD flushIntervalMs, FlushRoutine flush, ResendRoutine resend)
+    : Window(window), MaxHoldMs(maxHoldMs), FlushIntervalMs(flushIntervalMs), Emit(std::move(emit)), Gap(std::move(gap)),
+      Flush(std::move(flush)), Resend(std::move(resend)), Slots(new Slot[window]) {
+}
+
+LoggerReorder::~LoggerReorder() {
+    Stop();
+}
+
+HRESULT LoggerReorder::Start(ULONG64 nextSequence, int threadPriority) {
+    Next.store(nextSequence);
+
+    Event = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    if (!Event) {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    Thread = CreateThread(nullptr, 0, WriterThread, this, 0, nullptr);
+    if (!Thread) {
+        HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+        CloseHandle(Event);
+        Event = nullptr;
+        return hr;
+    }
+
+    SetThreadPriority(Thread, threadPriority);
+    return S_OK;
+}
+
+void LoggerReorder::Stop() {
+    if (Thread) {
+        Stopping.store(true);
+        SetEvent(Event);
+        WaitForSingleObject(Thread, INFINITE);
+        CloseHandle(Thread);
+        Thread = nullptr;
+    }
+    if (Event) {
+        CloseHandle(Event);
+        Event = nullptr;
+    }
+}
+
+bool LoggerReorder::Insert(const LOGGER_NOTIFICATION& notification) {
+    return Claim(notification.Sequence, &notification);
+}
+
+bool LoggerReorder::Discard(ULONG64 sequence) {
+    return Claim(sequence, nullptr);
+}
+
+bool LoggerReorder::Claim(ULONG64 sequence, const LOGGER_NOTIFICATION* notification) {
+    /*
+    Fills the slot of sequence with the notification, or marks it discarded
+    when notification is nullptr.
+    */
+    Slot& slot = Slots[sequence % Window];
+
+    Pending.fetch_add(1);
+
+    while (true) {
+        // Too far ahead for the ring: park it until the writer gets close.
+        if (sequence >= Next.load() + Window) {
+            bool parked = false;
+            bool duplicate = false;
+
+            AcquireSRWLockExclusive(&ParkLock);
+
+            // The writer only skips with ParkLock held, so Next cannot move
+            // past the sequence before the writer sees it parked.
+            if (sequence >= Next.load() + Window) {
+                auto inserted = Parked.try_emplace(sequence);
+
+                if (inserted.second) {
+                    ParkedEvent& event = inserted.first->second;
+
+                    event.Discarded = notification == nullptr;
+                    if (notification) {
+                        event.Notification = *notification;
+                    }
+                    ParkedCount.fetch_add(1);
+                    parked = true;
+                }
+                else {
+                    // A replay duplicate of an event that is already parked.
+                    duplicate = true;
+                }
+            }
+
+            ReleaseSRWLockExclusive(&ParkLock);
+
+            if (duplicate) {
+                break;
+            }
+            if (parked) {
+                Wake();
+                return true;
+            }
+            continue;
+        }
+
+        if (sequence < Next.load()) {
+            break;
+        }
+
+        ULONG64 state = 0;
+        if (slot.State.compare_exchange_strong(state, sequence | LOGGER_REORDER_BUSY)) {
+
+            // The writer may have skipped this sequence between the check
+            // above and the claim; it always advances Next before it frees
+            // the slot, so Next shows it.
+            if (sequence < Next.load()) {
+                slot.State.store(0);
+                break;
+            }
+
+            if (notification) {
+                slot.Notification = *notification;
+                slot.State.store(sequence);
+            }
+            else {
+                slot.State.store(sequence | LOGGER_REORDER_DISCARDED);
+            }
+            Wake();
+            return true;
+        }
+
+        if (state == sequence || state == (sequence | LOGGER_REORDER_BUSY) ||
+            state == (sequence | LOGGER_REORDER_DISCARDED)) {
+            break;
+        }
+
+        // The slot still holds the previous lap or is being skipped.
+        YieldProcessor();
+    }
+
+    Pending.fetch_sub(1);
+    return false;
+}
+
+void LoggerReorder::SkipBelow(ULONG64 sequence) {
+    ULONG64 current = SkipTarget.load();
+    while (current < sequence && !SkipTarget.compare_exchange_weak(current, sequence)) {
+    }
+    Wake();
+}
+
+void LoggerReorder::Wake() {
+    if (Waiting.load() && Waiting.exchange(false)) {
+        SetEvent(Event);
+    }
+}
+
+DWORD WINAPI LoggerReorder::WriterThread(LPVOID context) {
+    reinterpret_cast<LoggerReorder*>(context)->Run();
+    return 0;
+}
+
+bool LoggerReorder::UnparkLocked() {
+    /*
+    Moves the parked events that are now within Window of Next into the ring.
+    Only the writer calls this, with ParkLock held. Returns true if the ring
+    changed.
+    */
+    const ULONG64 next = Next.load();
+    bool moved = false;
+
+    while (!Parked.empty() && Parked.begin()->first < next + Window) {
+        auto parked = Parked.begin();
+        const ULONG64 sequence = parked->first;
+        Slot& slot = Slots[sequence % Window];
+        ULONG64 state = 0;
+
+        if (sequence < next) {
+            // A worker inserted the same sequence into the ring once it came
+            // within the window, and it has been written.
+            Pending.fetch_sub(1);
+        }
+        else if (slot.State.compare_exchange_strong(state, sequence | LOGGER_REORDER_BUSY)) {
+            if (parked->second.Discarded) {
+                slot.State.store(sequence | LOGGER_REORDER_DISCARDED);
+            }
+            else {
+                slot.Notification = parked->second.Notification;
+                slot.State.store(sequence);
+            }
+        }
+        else if (state == sequence || state == (sequence | LOGGER_REORDER_BUSY) ||
+            state == (sequence | LOGGER_REORDER_DISCARDED)) {
+            // A worker inserted the same sequence once it came within the window.
+            Pending.fetch_sub(1);
+        }
+        else {
+            // A late worker briefly holds the slot of the previous lap.
+            break;
+        }
+
+        Parked.erase(parked);
+        ParkedCount.fetch_sub(1);
+        moved = true;
+    }
+    return moved;
+}
+
+bool LoggerReorder::RequestResend(ULONG64 sequence) {
+    /*
+    Asks the driver for the sequences missing from the ring among the
+    LOGGER_REORDER_RESEND_SPAN starting at sequence, which is Next. Returns
+    false if the request failed. Only the writer calls this.
+    */
+    ULONG64 mask = 0;
+
+    for (ULONG64 i = 0; i < LOGGER_REORDER_RESEND_SPAN && i < Window; ++i) {
+        if (Slots[(sequence + i) % Window].State.load() == 0) {
+            mask |= 1ull << i;
+        }
+    }
+    return Resend(sequence, mask);
+}
+
+void LoggerReorder::ReportShed(ULONG64 sequence) {
+    ULONG64 current = ShedSequence.load();
+    while (current < sequence && !ShedSequence.compare_exchange_weak(current, sequence)) {
+    }
+    Wake();
+}
+
+bool LoggerReorder::TrySkip(ULONG64 sequence) {
+    // Only the writer calls this, with sequence == Next.
+    Slot& slot = Slots[sequence % Window];
+    ULONG64 state = 0;
+
+    if (!slot.State.compare_exchange_strong(state, LOGGER_REORDER_SKIPPED)) {
+        return false;   // A worker is inserting it after all.
+    }
+    Next.store(sequence + 1);
+    slot.State.store(0);
+    return true;
+}
+
+void LoggerReorder::Run() {
+    ULONG64 holdStart = 0;
+    ULONG64 gapFirst = 0;
+    bool holdExpired = false;
+    // Resend requests made for Next, and the last sequence they covered.
+    DWORD resends = 0;
+    ULONG64 resentThrough = 0;
+    // Tick of the first event or gap written since the last flush, 0 if none.
+    ULONG64 dirtySince = 0;
+
+    while (true) {
+        const ULONG64 sequence = Next.load();
+        Slot& slot = Slots[sequence % Window];
+        const ULONG64 state = slot.State.load();
+
+        if (state == sequence) {
+            if (gapFirst != 0) {
+                Gap(gapFirst, sequence - 1);
+                gapFirst = 0;
+            }
+
+            Emit(slot.Notification);
+
+            if (dirtySince == 0) {
+                dirtySince = GetTickCount64();
+            }
+
+            Next.store(sequence + 1);
+            slot.State.store(0);
+            Pending.fetch_sub(1);
+
+            holdStart = 0;
+            holdExpired = false;
+            resends = 0;
+            continue;
+        }
+
+        if (state == (sequence | LOGGER_REORDER_DISCARDED)) {
+            if (gapFirst == 0) {
+                gapFirst = sequence;
+            }
+
+            Next.store(sequence + 1);
+            slot.State.store(0);
+            Pending.fetch_sub(1);
+
+            holdStart = 0;
+            holdExpired = false;
+            resends = 0;
+            continue;
+        }
+
+        if (state == 0 && ParkedCount.load() != 0) {
+            AcquireSRWLockExclusive(&ParkLock);
+            const bool moved = UnparkLocked();
+            ReleaseSRWLockExclusive(&ParkLock);
+
+            if (moved) {
+                continue;
+            }
+        }
+
+        const bool shed = sequence <= ShedSequence.load();
+        const bool pending = Pending.load() != 0 || shed;
+        bool skip = sequence < SkipTarget.load();
+
+        if (!skip && pending && state == 0 && !Stopping.load()) {
+            const ULONG64 now = GetTickCount64();
+            if (holdStart == 0) {
+                holdStart = now;
+            }
+
+            // A shed event never arrives by itself, and one that is late may
+            // have been lost in any other way: ask the driver for the missing
+            // events. Only those it no longer holds are given up.
+            if ((shed && resentThrough < sequence) || now - holdStart >= MaxHoldMs) {
+                if (resends < LOGGER_REORDER_MAX_RESENDS && RequestResend(sequence)) {
+                    resends++;
+                    resentThrough = sequence + LOGGER_REORDER_RESEND_SPAN - 1;
+                    holdStart = now;
+                    continue;
+                }
+
+                // The driver cannot be asked, or what it sent never arrived.
+                holdExpired = true;
+            }
+            skip = holdExpired;
+        }
+
+        if (skip && state == 0) {
+            // Skip with ParkLock held, so no worker parks the sequence
+            // being skipped in the meantime.
+            AcquireSRWLockExclusive(&ParkLock);
+
+            if (UnparkLocked()) {
+                ReleaseSRWLockExclusive(&ParkLock);
+                continue;
+            }
+
+            if (TrySkip(sequence)) {
+                if (gapFirst == 0) {
+                    gapFirst = sequence;
+                }
+
+                // After the hold expires keep skipping up to the first held
+                // event instead of waiting again for every missing sequence.
+                if (holdExpired) {
+                    for (ULONG64 ahead = sequence + 1; ahead < sequence + Window; ++ahead) {
+                        if (Slots[ahead % Window].State.load() != 0 || !TrySkip(ahead)) {
+                            break;
+                        }
+                    }
+                }
+            }
+
+            ReleaseSRWLockExclusive(&ParkLock);
+            continue;
+        }
+
+        if (state != 0) {
+            // A worker is copying this sequence in; it is about to be ready.
+            YieldProcessor();
+            continue;
+        }
+
+        // Stop at the first missing sequence. Nothing after it is written
+        // or acknowledged, so the driver replays it all on the next start.
+        if (Stopping.load()) {
+            break;
+        }
+
+        if (!pending) {
+            // Nothing is waiting behind this sequence, so it is not late yet.
+            holdStart = 0;
+            holdExpired = false;
+        }
+
+        // A gap being skipped is reported once the next event arrives;
+        // report it now so the flush covers it.
+        if (gapFirst != 0 && !pending) {
+            Gap(gapFirst, sequence - 1);
+            gapFirst = 0;
+            if (dirtySince == 0) {
+                dirtySince = GetTickCount64();
+            }
+        }
+
+        if (dirtySince != 0 && GetTickCount64() - dirtySince >= FlushIntervalMs) {
+            Flush();
+            dirtySince = 0;
+            continue;
+        }
+
+        // Nothing to do: wait for an insert, the hold deadline, or Stop.
+        Waiting.store(true);
+
+        if (Slots[sequence % Window].State.load() != 0 || Stopping.load() ||
+            (!pending && (Pending.load() != 0 || sequence <= ShedSequence.load())) ||
+            sequence < SkipTarget.load()) {
+            Waiting.store(false);
+            continue;
+        }
+
+        DWORD timeout = INFINITE;
+        if (pending) {
+            const ULONG64 elapsed = GetTickCount64() - holdStart;
+            timeout = elapsed >= MaxHoldMs ? 0 : static_cast<DWORD>(MaxHoldMs - elapsed);
+        }
+        if (dirtySince != 0) {
+            const ULONG64 elapsed = GetTickCount64() - dirtySince;
+            const DWORD flushTimeout = elapsed >= FlushIntervalMs ? 0 : static_cast<DWORD>(FlushIntervalMs - elapsed);
+            timeout = flushTimeout < timeout ? flushTimeout : timeout;
+        }
+
+        WaitForSingleObject(Event, timeout);
+        Waiting.store(false);
+    }
+
+    if (gapFirst != 0) {
+        Gap(gapFirst, Next.load() - 1);
+    }
+}
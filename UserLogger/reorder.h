@@ -0,0 +1,125 @@
+#ifndef __REORDER_H__
+#define __REORDER_H__
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+
+// Number of sequence numbers the reorder stage holds in its ring ahead of the
+// next one to be written, unless the driver's backlog is deeper, and how long
+// it waits for a missing one before moving on.
+constexpr ULONG64 LOGGER_DEFAULT_REORDER_WINDOW = 4096;
+constexpr DWORD LOGGER_DEFAULT_MAX_HOLD_MS = 500;
+
+class LoggerReorder {
+    /*
+    Puts notifications completed by several LoggerWorker threads back into
+    sequence order. Workers insert into a ring of Window slots indexed by
+    sequence number, without locks. A single writer thread hands the events
+    to Emit strictly in order. Events that arrive more than Window ahead of
+    the writer are parked in an ordered map under a lock and moved into the
+    ring once it catches up, so workers never wait for the writer. When a
+    sequence has not arrived after MaxHoldMs while later ones are waiting,
+    or at once when it is known to be shed, the writer asks for it again
+    through Resend. Only a sequence that is discarded, because the driver no
+    longer holds it, or that still has not arrived after a few requests is
+    reported to Gap and skipped. A sequence a worker has claimed is never
+    skipped.
+    Flush is called on the writer thread at most FlushIntervalMs after the
+    first event or gap that followed the previous call, however few events
+    arrive.
+    */
+public:
+    using EmitRoutine = std::function<void(const LOGGER_NOTIFICATION&)>;
+    using GapRoutine = std::function<void(ULONG64 first, ULONG64 last)>;
+    using FlushRoutine = std::function<void()>;
+    // Requests the sequences first + i for every bit i set in mask, and
+    // discards those that cannot be sent. Returns false if the request failed.
+    using ResendRoutine = std::function<bool(ULONG64 first, ULONG64 mask)>;
+
+    LoggerReorder(ULONG64 window, DWORD maxHoldMs, EmitRoutine emit, GapRoutine gap,
+        DWORD flushIntervalMs, FlushRoutine flush, ResendRoutine resend);
+    ~LoggerReorder();
+
+    LoggerReorder(const LoggerReorder&) = delete;
+    LoggerReorder& operator=(const LoggerReorder&) = delete;
+
+    // Starts the writer thread. nextSequence is the first sequence to write,
+    // threadPriority the priority of the writer thread.
+    HRESULT Start(ULONG64 nextSequence, int threadPriority = THREAD_PRIORITY_NORMAL);
+
+    // Writes everything held up to the first missing sequence and stops the
+    // writer. What follows the missing sequence is left for the next replay.
+    void Stop();
+
+    // Called by workers. Returns false if the sequence was already written,
+    // skipped, or is being inserted by another worker (a replay duplicate).
+    // Never waits for the writer.
+    bool Insert(const LOGGER_NOTIFICATION& notification);
+
+    // Called for a sequence the driver no longer holds. The writer reports it
+    // to Gap as soon as it gets there. Returns false like Insert.
+    bool Discard(ULONG64 sequence);
+
+    // Sequences below this are known to be lost; skip them without waiting.
+    void SkipBelow(ULONG64 sequence);
+
+    // Sequences up to this one may have been shed by the driver; the writer
+    // requests those that are missing instead of waiting for them.
+    void ReportShed(ULONG64 sequence);
+
+    // Number of inserted events not yet written.
+    ULONG64 Depth() const { return Pending.load(); }
+
+private:
+    struct Slot {
+        // 0 when free, the sequence | LOGGER_REORDER_BUSY while a worker
+        // copies the notification in, the sequence once it is ready, the
+        // sequence | LOGGER_REORDER_DISCARDED once it is known to be lost, or
+        // LOGGER_REORDER_SKIPPED while the writer skips it.
+        std::atomic<ULONG64> State{ 0 };
+        LOGGER_NOTIFICATION Notification;
+    };
+
+    struct ParkedEvent {
+        bool Discarded;
+        LOGGER_NOTIFICATION Notification;
+    };
+
+    static DWORD WINAPI WriterThread(LPVOID context);
+    void Run();
+    bool Claim(ULONG64 sequence, const LOGGER_NOTIFICATION* notification);
+    bool UnparkLocked();
+    bool RequestResend(ULONG64 sequence);
+    bool TrySkip(ULONG64 sequence);
+    void Wake();
+
+    const ULONG64 Window;
+    const DWORD MaxHoldMs;
+    const DWORD FlushIntervalMs;
+    EmitRoutine Emit;
+    GapRoutine Gap;
+    FlushRoutine Flush;
+    ResendRoutine Resend;
+    std::unique_ptr<Slot[]> Slots;
+
+    // Next sequence to write. Only the writer thread stores it.
+    alignas(64) std::atomic<ULONG64> Next{ 1 };
+    alignas(64) std::atomic<ULONG64> Pending{ 0 };
+    std::atomic<ULONG64> SkipTarget{ 0 };
+    std::atomic<ULONG64> ShedSequence{ 0 };
+    std::atomic<bool> Waiting{ false };
+    std::atomic<bool> Stopping{ false };
+
+    // Events at or beyond Next + Window, by sequence. The writer takes
+    // ParkLock only while ParkedCount is not 0 or when it skips.
+    SRWLOCK ParkLock = SRWLOCK_INIT;
+    std::map<ULONG64, ParkedEvent> Parked;
+    std::atomic<ULONG64> ParkedCount{ 0 };
+
+    HANDLE Event = nullptr;
+    HANDLE Thread = nullptr;
+};
+
+#endif
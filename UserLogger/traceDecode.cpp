@@ -0,0 +1,46 @@
+#include <windows.h>
+#include <fltUser.h>
+#include "userlogger.h"
+#include "traceDecode.h"
+
+int LoggerDecodeTrace(std::istream& trace, FILE* output) {
+    LOGGER_TRACE_READ_REPLY header;
+    LOGGER_TRACE_RECORD record;
+    LONG64 base = 0;
+    bool first = true;
+
+    while (trace.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+
+        if (header.LostCount != 0) {
+            fprintf(output, "-- %u record(s) lost --\n", header.LostCount);
+        }
+
+        for (ULONG i = 0; i < header.RecordCount; ++i) {
+            if (!trace.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+                return 1;
+            }
+
+            if (first) {
+                base = record.Timestamp;
+                first = false;
+            }
+
+            double micros = header.Frequency == 0 ? 0.0 :
+                static_cast<double>(record.Timestamp - base) * 1000000.0 / static_cast<double>(header.Frequency);
+            const char* level = record.Level < _countof(LoggerTraceLevels) ? LoggerTraceLevels[record.Level] : "?";
+
+            fprintf(output, "%14.1f cpu%-3u %-7s cat 0x%02X  ", micros, record.Processor, level, record.Category);
+
+            if (record.FormatId != 0 && record.FormatId < _countof(LoggerTraceFormats)) {
+                fprintf(output, LoggerTraceFormats[record.FormatId],
+                    record.Args[0], record.Args[1], record.Args[2], record.Args[3]);
+            }
+            else {
+                fprintf(output, "unknown format %u: 0x%llX 0x%llX 0x%llX 0x%llX", record.FormatId,
+                    record.Args[0], record.Args[1], record.Args[2], record.Args[3]);
+            }
+            fprintf(output, "\n");
+        }
+    }
+    return 0;
+}
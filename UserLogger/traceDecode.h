@@ -0,0 +1,12 @@
+#ifndef __TRACEDECODE_H__
+#define __TRACEDECODE_H__
+
+#include <cstdio>
+#include <istream>
+
+// Prints the records of a trace file written by LoggerTraceWorker, one line
+// per record with the time in microseconds since the first record. Returns
+// 0, or 1 if the trace ends inside a read reply.
+int LoggerDecodeTrace(std::istream& trace, FILE* output);
+
+#endif
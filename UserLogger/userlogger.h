@@ -4,16 +4,65 @@
 
 
 const PWSTR LOGGERPortName = L"\\LOGGERPort";
+const PWSTR LOGGERHighPortName = L"\\LOGGERHighPort";
 
 #pragma pack(push, 8)
+
+// Priority lanes, must match loggerFilter.h
+typedef enum _LOGGER_PRIORITY {
+    LoggerPriorityBulk,
+    LoggerPriorityHigh,
+    LoggerPriorityCount
+
+} LOGGER_PRIORITY;
  
 typedef struct _LOGGER_NOTIFICATION {
+    UINT64 SessionId;
+    UINT64 Sequence;
     UINT64 ProcessId;
+    LONG64 Timestamp;
+    UINT64 ShedSequence;
+    ULONG Rule;
+    ULONG Priority;
     CHAR Time[20];
     CHAR MessageData[256];
 
 } LOGGER_NOTIFICATION, * PLOGGER_NOTIFICATION;
 
+// Commands sent to the driver, must match loggerFilter.h
+typedef enum _LOGGER_COMMAND {
+    LoggerCommandReplay,
+    LoggerCommandAck,
+    LoggerCommandReadTrace,
+    LoggerCommandQuery,
+    LoggerCommandResend
+
+} LOGGER_COMMAND;
+
+typedef struct _LOGGER_COMMAND_MESSAGE {
+    LOGGER_COMMAND Command;
+    ULONG Reserved;
+    UINT64 SessionId;
+    UINT64 Sequence;
+    UINT64 Mask;
+
+} LOGGER_COMMAND_MESSAGE, * PLOGGER_COMMAND_MESSAGE;
+
+typedef struct _LOGGER_REPLAY_REPLY {
+    UINT64 SessionId;
+    UINT64 FirstSequence;
+    UINT64 NextSequence;
+    ULONG Capacity;
+    ULONG Reserved;
+    UINT64 DroppedCount;
+
+} LOGGER_REPLAY_REPLY, * PLOGGER_REPLAY_REPLY;
+
+typedef struct _LOGGER_RESEND_REPLY {
+    UINT64 LostMask;
+
+} LOGGER_RESEND_REPLY, * PLOGGER_RESEND_REPLY;
+
 typedef struct _LOGGER_MESSAGE {
 
     FILTER_MESSAGE_HEADER MessageHeader;
@@ -22,10 +71,62 @@ typedef struct _LOGGER_MESSAGE {
 
 } LOGGER_MESSAGE, * PLOGGER_MESSAGE;
 
+// Binary trace records, must match loggerTrace.h
+#define LOGGER_TRACE_MAX_ARGS 4
+
+typedef struct _LOGGER_TRACE_RECORD {
+    LONG64 Stamp;
+    LONG64 Timestamp;
+    USHORT FormatId;
+    UCHAR Level;
+    UCHAR Category;
+    ULONG Processor;
+    UINT64 Args[LOGGER_TRACE_MAX_ARGS];
+
+} LOGGER_TRACE_RECORD, * PLOGGER_TRACE_RECORD;
+
+typedef struct _LOGGER_TRACE_READ_REPLY {
+    UINT64 Frequency;
+    ULONG RecordCount;
+    ULONG LostCount;
+
+} LOGGER_TRACE_READ_REPLY, * PLOGGER_TRACE_READ_REPLY;
+
+// Decoder table, indexed by the driver's LOGGER_TRACE_FORMAT values.
+// Every argument is passed to the format as an unsigned 64-bit value.
+const char* const LoggerTraceFormats[] = {
+    nullptr,
+    "create of target by pid %llu, name length %llu, rule %llu",
+    "no memory for notification, pid %llu",
+    "recorded sequence %llu for pid %llu, priority %llu",
+    "sent sequence %llu",
+    "failed to send sequence %llu, status 0x%llX",
+    "backlog overwrote unacknowledged sequence %llu",
+    "replay after %llu: first %llu, next %llu",
+    "client connected, pid %llu, priority %llu",
+    "client disconnected, priority %llu",
+    "process %llu started, on lists 0x%llX",
+    "shed sequence %llu, priority %llu",
+    "resend from %llu, mask 0x%llX",
+    "target rules compiled into %llu DFAs after %llu split(s), %llu rule(s) without a DFA",
+};
+
+const char* const LoggerPriorityNames[LoggerPriorityCount] = { "bulk", "high" };
+
+const char* const LoggerTraceLevels[] = { "NONE", "ERROR", "INFO", "VERBOSE" };
+
+class LoggerReorder;
+class LoggerMetrics;
+
 struct LOGGER_THREAD_CONTEXT {
 
+    LOGGER_PRIORITY Priority;
     HANDLE Port;
     HANDLE Completion;
+    ULONG64 SessionId;
+    LoggerReorder* Reorder;
+    LoggerMetrics* Metrics;
+    const char* TraceFile;
 };
 
 #endif
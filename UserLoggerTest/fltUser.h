@@ -0,0 +1,33 @@
+/*++
+Module Name:
+    fltUser.h
+
+Abstract:
+    User-mode stand-in for the filter manager's user-mode header, for the
+    UserLogger tests. Only what the UserLogger sources use is declared. The
+    communication port routines are implemented by the test that simulates
+    LoggerFilter, laneSimulation.cpp.
+
+Environment:
+    User mode
+--*/
+
+#ifndef __USERLOGGERTEST_FLTUSER_H__
+#define __USERLOGGERTEST_FLTUSER_H__
+
+typedef struct _FILTER_MESSAGE_HEADER {
+    ULONG ReplyLength;
+    ULONGLONG MessageId;
+} FILTER_MESSAGE_HEADER, * PFILTER_MESSAGE_HEADER;
+
+HRESULT FilterConnectCommunicationPort(LPCWSTR portName, DWORD options, LPCVOID context,
+    WORD sizeOfContext, LPSECURITY_ATTRIBUTES securityAttributes, HANDLE* port);
+
+// Always completes through the completion port of the port handle.
+HRESULT FilterGetMessage(HANDLE port, PFILTER_MESSAGE_HEADER messageBuffer, DWORD messageBufferSize,
+    LPOVERLAPPED overlapped);
+
+HRESULT FilterSendMessage(HANDLE port, LPVOID inBuffer, DWORD inBufferSize, LPVOID outBuffer,
+    DWORD outBufferSize, LPDWORD bytesReturned);
+
+#endif
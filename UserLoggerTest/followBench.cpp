@@ -0,0 +1,141 @@
+/*++
+Module Name:
+    followBench.cpp
+
+Abstract:
+    One writer and many readers of the live follow segments. The writer
+    appends records at full speed, stamped with the time of the append, and
+    1 to 8 readers follow them, waiting on their slot's event when they have
+    caught up. Reports the writer's cost per append, and for the readers the
+    share of records read, the segment skips of those that fell behind, and
+    the latency from append to read.
+
+Environment:
+    User mode
+--*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <windows.h>
+#include "follow.h"
+
+constexpr ULONG64 BENCH_RECORDS = 2000000;
+constexpr ULONG BENCH_RECORD_LENGTH = 120;
+constexpr ULONG BENCH_READER_COUNTS[] = { 0, 1, 2, 4, 8 };
+constexpr DWORD BENCH_WAIT_MS = 10;
+
+static LONG64 BenchNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct BENCH_READER {
+    std::vector<LONG64> Latencies;
+    ULONG64 Skips = 0;
+    bool Opened = false;
+};
+
+static void BenchRun(ULONG readerCount) {
+    LoggerFollowWriter writer;
+    std::vector<BENCH_READER> readers(readerCount);
+    std::vector<std::thread> threads;
+    std::atomic<ULONG> ready{ 0 };
+    std::atomic<bool> done{ false };
+    char data[BENCH_RECORD_LENGTH] = {};
+
+    if (FAILED(writer.Open(LOGGER_FOLLOW_SEGMENT_SIZE))) {
+        printf("%7lu writer open failed\n", static_cast<unsigned long>(readerCount));
+        return;
+    }
+
+    for (BENCH_READER& reader : readers) {
+        threads.emplace_back([&reader, &ready, &done]() {
+            LoggerFollowReader follow;
+            ULONG64 next = 0;
+
+            reader.Opened = SUCCEEDED(follow.Open());
+            reader.Latencies.reserve(BENCH_RECORDS);
+            ready.fetch_add(1);
+
+            while (reader.Opened) {
+                const LOGGER_SEGMENT_RECORD* record = follow.Next();
+
+                if (!record) {
+                    if (done.load()) {
+                        break;
+                    }
+                    follow.Wait(BENCH_WAIT_MS);
+                    continue;
+                }
+
+                LONG64 appended;
+                memcpy(&appended, record->Data, sizeof(appended));
+                reader.Latencies.push_back(BenchNow() - appended);
+                if (record->Sequence != next) {
+                    reader.Skips++;
+                }
+                next = record->Sequence + 1;
+            }
+        });
+    }
+    while (ready.load() < readerCount) {
+        Sleep(1);
+    }
+
+    const LONG64 start = BenchNow();
+    for (ULONG64 sequence = 0; sequence < BENCH_RECORDS; ++sequence) {
+        const LONG64 now = BenchNow();
+
+        memcpy(data, &now, sizeof(now));
+        writer.Append(static_cast<ULONG>(sequence % 2), sequence, data, sizeof(data));
+    }
+    const double appendNs = static_cast<double>(BenchNow() - start) / BENCH_RECORDS;
+
+    done.store(true);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    std::vector<LONG64> latencies;
+    ULONG64 skips = 0;
+    ULONG opened = 0;
+
+    for (BENCH_READER& reader : readers) {
+        latencies.insert(latencies.end(), reader.Latencies.begin(), reader.Latencies.end());
+        skips += reader.Skips;
+        opened += reader.Opened;
+    }
+
+    printf("%7lu %6lu %9.1f %7.2f", static_cast<unsigned long>(readerCount), static_cast<unsigned long>(opened),
+        appendNs, 1000.0 / appendNs);
+
+    if (latencies.empty()) {
+        printf("\n");
+        return;
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    printf(" %7.1f %7lu %9.1f %9.1f %9.1f\n",
+        100.0 * latencies.size() / (static_cast<double>(BENCH_RECORDS) * opened),
+        static_cast<unsigned long>(skips),
+        latencies[latencies.size() / 2] / 1000.0,
+        latencies[latencies.size() * 99 / 100] / 1000.0,
+        latencies.back() / 1000.0);
+}
+
+int main() {
+    printf("%7s %6s %9s %7s %7s %7s %9s %9s %9s\n",
+        "readers", "opened", "append", "rate", "read", "skips", "p50", "p99", "max");
+    printf("%7s %6s %9s %7s %7s %7s %9s %9s %9s\n",
+        "", "", "ns", "M/s", "%", "", "us", "us", "us");
+
+    for (ULONG readerCount : BENCH_READER_COUNTS) {
+        BenchRun(readerCount);
+    }
+    return 0;
+}
@@ -0,0 +1,256 @@
+/*++
+Module Name:
+    followTest.cpp
+
+Abstract:
+    Checks the live follow segments: a reader sees every record in order
+    across segment rollovers, one that falls behind skips ahead without
+    reading garbage, a reader of one run continues into the next, a reader
+    that waits is woken by the writer, and a segment left over from an
+    earlier run under the next index is never replayed.
+    The process exits with the number of failed checks.
+
+Environment:
+    User mode
+--*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <windows.h>
+#include "follow.h"
+
+#define CHECK(Condition)                                                        \
+    if (!(Condition)) {                                                         \
+        printf("FAIL %s: %s, line %d\n", Title, #Condition, __LINE__);          \
+        failures++;                                                             \
+    }
+
+// Small segments, so that a few hundred records roll over many times.
+constexpr ULONG64 TEST_SEGMENT_SIZE = 4096;
+constexpr ULONG TEST_RECORD_LENGTH = 100;
+constexpr DWORD TEST_WAIT_MS = 10000;
+
+struct TEST_CASE {
+    const char* Title;
+    ULONG (*Run)(const char* Title);
+};
+
+// The data of a record names its sequence; the length varies with it.
+static ULONG RecordData(ULONG64 sequence, char* data) {
+    const ULONG length = TEST_RECORD_LENGTH - static_cast<ULONG>(sequence % 16);
+
+    memset(data, '.', length);
+    snprintf(data, length, "record %llu", sequence);
+    return length;
+}
+
+static bool Append(LoggerFollowWriter& writer, ULONG64 first, ULONG64 count) {
+    char data[TEST_RECORD_LENGTH];
+
+    for (ULONG64 sequence = first; sequence < first + count; ++sequence) {
+        if (FAILED(writer.Append(static_cast<ULONG>(sequence % 2), sequence, data, RecordData(sequence, data)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool Matches(const LOGGER_SEGMENT_RECORD* record, ULONG64 sequence) {
+    char data[TEST_RECORD_LENGTH];
+    const ULONG length = RecordData(sequence, data);
+
+    return record && record->Sequence == sequence && record->Priority == sequence % 2 &&
+        record->Length == length && memcmp(record->Data, data, length) == 0;
+}
+
+// Reads up to the last record published. Returns false if a record is out
+// of order or its data does not match its sequence.
+static bool Drain(LoggerFollowReader& reader, ULONG64& count, ULONG64& last) {
+    const LOGGER_SEGMENT_RECORD* record;
+
+    while ((record = reader.Next()) != nullptr) {
+        if ((count != 0 && record->Sequence <= last) || !Matches(record, record->Sequence)) {
+            return false;
+        }
+        last = record->Sequence;
+        count++;
+    }
+    return true;
+}
+
+
+/*************************************************************************
+    Cases
+*************************************************************************/
+
+static ULONG TestInOrder(const char* Title) {
+    LoggerFollowWriter writer;
+    LoggerFollowReader reader;
+    ULONG failures = 0;
+    ULONG read = 0;
+
+    CHECK(SUCCEEDED(writer.Open(TEST_SEGMENT_SIZE)));
+    CHECK(SUCCEEDED(reader.Open()));
+
+    for (ULONG64 sequence = 0; sequence < 2000; ++sequence) {
+        if (!Append(writer, sequence, 1)) {
+            break;
+        }
+        // Two records per read, so the reader is never a segment behind.
+        if (sequence % 2 == 1) {
+            read += Matches(reader.Next(), sequence - 1);
+            read += Matches(reader.Next(), sequence);
+        }
+    }
+    CHECK(read == 2000);
+    CHECK(reader.Next() == nullptr);
+
+    // A record larger than a segment is refused.
+    static char large[TEST_SEGMENT_SIZE];
+    CHECK(writer.Append(0, 2000, large, sizeof(large)) == E_INVALIDARG);
+    return failures;
+}
+
+static ULONG TestFallBehind(const char* Title) {
+    LoggerFollowWriter writer;
+    LoggerFollowReader reader;
+    ULONG64 count = 0;
+    ULONG64 last = 0;
+    ULONG failures = 0;
+
+    CHECK(SUCCEEDED(writer.Open(TEST_SEGMENT_SIZE)));
+    CHECK(SUCCEEDED(reader.Open()));
+    CHECK(Append(writer, 0, 500));
+
+    // The reader lost what went before the previous segment and resumes
+    // with records it can still read.
+    CHECK(Drain(reader, count, last));
+    CHECK(count > 0 && count < 500);
+    CHECK(last == 499);
+
+    CHECK(Append(writer, 500, 10));
+    CHECK(Drain(reader, count, last));
+    CHECK(last == 509);
+    return failures;
+}
+
+static ULONG TestNextRun(const char* Title) {
+    LoggerFollowWriter first;
+    LoggerFollowWriter second;
+    LoggerFollowReader reader;
+    ULONG64 count = 0;
+    ULONG64 last = 0;
+    ULONG failures = 0;
+
+    CHECK(SUCCEEDED(first.Open(TEST_SEGMENT_SIZE)));
+    CHECK(SUCCEEDED(reader.Open()));
+    CHECK(Append(first, 0, 20));
+    first.Close();
+
+    // The reader waits in the last segment of the first run until the next
+    // UserLogger seals it.
+    CHECK(Drain(reader, count, last));
+    CHECK(count == 20);
+    CHECK(reader.Next() == nullptr);
+
+    CHECK(SUCCEEDED(second.Open(TEST_SEGMENT_SIZE)));
+    CHECK(Append(second, 20, 20));
+    CHECK(Drain(reader, count, last));
+    CHECK(count == 40);
+    CHECK(last == 39);
+    return failures;
+}
+
+static ULONG TestWait(const char* Title) {
+    LoggerFollowWriter writer;
+    LoggerFollowReader reader;
+    ULONG failures = 0;
+
+    CHECK(SUCCEEDED(writer.Open(TEST_SEGMENT_SIZE)));
+    CHECK(SUCCEEDED(reader.Open()));
+
+    std::thread append([&writer]() {
+        Sleep(50);
+        Append(writer, 0, 1);
+    });
+
+    const auto start = std::chrono::steady_clock::now();
+    const LOGGER_SEGMENT_RECORD* record = nullptr;
+    while (!record && std::chrono::steady_clock::now() - start < std::chrono::milliseconds(TEST_WAIT_MS)) {
+        reader.Wait(TEST_WAIT_MS);
+        record = reader.Next();
+    }
+    const auto waited = std::chrono::steady_clock::now() - start;
+    append.join();
+
+    CHECK(Matches(record, 0));
+    CHECK(waited < std::chrono::milliseconds(TEST_WAIT_MS / 2));
+    return failures;
+}
+
+static ULONG TestStaleSegment(const char* Title) {
+    wchar_t name[64];
+    ULONG64 count = 0;
+    ULONG64 last = 0;
+    ULONG failures = 0;
+
+    // An earlier run writes six segments, and some process still holds its
+    // segment 2 once everything else of that run is gone.
+    swprintf(name, _countof(name), LOGGER_FOLLOW_SEGMENT_FORMAT, 2ull);
+    HANDLE stale = nullptr;
+    {
+        LoggerFollowWriter earlier;
+
+        CHECK(SUCCEEDED(earlier.Open(TEST_SEGMENT_SIZE)));
+        CHECK(Append(earlier, 0, 80));
+        stale = OpenFileMappingW(FILE_MAP_READ, FALSE, name);
+        CHECK(Append(earlier, 80, 120));
+    }
+    CHECK(stale != nullptr);
+
+    // The new run starts again at segment 0 and skips index 2. A reader
+    // moving on from segment 1 must not take the old segment 2 for the next.
+    LoggerFollowWriter writer;
+    LoggerFollowReader reader;
+
+    CHECK(SUCCEEDED(writer.Open(TEST_SEGMENT_SIZE)));
+    CHECK(SUCCEEDED(reader.Open()));
+
+    for (ULONG64 sequence = 1000; sequence < 1200; ++sequence) {
+        CHECK(Append(writer, sequence, 1));
+        CHECK(Drain(reader, count, last));
+    }
+    CHECK(count == 200);
+    CHECK(last == 1199);
+
+    if (stale) {
+        CloseHandle(stale);
+    }
+    return failures;
+}
+
+static const TEST_CASE TestCases[] = {
+    { "records are read in order across segments", TestInOrder },
+    { "a reader that falls behind skips ahead", TestFallBehind },
+    { "a reader continues into the next run", TestNextRun },
+    { "a waiting reader is woken by the writer", TestWait },
+    { "a segment of an earlier run is not replayed", TestStaleSegment },
+};
+
+int main() {
+    ULONG failures = 0;
+
+    for (const TEST_CASE& test : TestCases) {
+        const ULONG caseFailures = test.Run(test.Title);
+
+        if (caseFailures == 0) {
+            printf("ok   %s\n", test.Title);
+        }
+        failures += caseFailures;
+    }
+
+    printf("%u failure(s)\n", failures);
+    return static_cast<int>(failures);
+}
@@ -0,0 +1,729 @@
+/*++
+Module Name:
+    laneSimulation.cpp
+
+Abstract:
+    Runs UserLogger against a simulated LoggerFilter and checks that the
+    high priority lane stays fast while the bulk lane is flooded. The
+    simulated driver has the ports, backlogs and commands of the real one
+    and sends the same way: a high priority event waits until the client
+    posts a read, a bulk one is shed after the bulk send timeout and resent
+    when the client asks for it.
+
+    UserLogger's main runs twice, each time in a directory of its own, while
+    the driver sends a high priority event every millisecond. The first run
+    leaves the bulk lane idle, the second floods it from several threads.
+    The latencies are read back from the metrics file UserLogger writes. The
+    high priority p99 of the flood must stay within a bucket of the idle
+    one, or under a floor that leaves room for the scheduling noise of a
+    shared machine.
+    The process exits with the number of failed checks.
+
+Environment:
+    User mode
+--*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <windows.h>
+#include <fltUser.h>
+#include "userlogger.h"
+#include "metrics.h"
+
+#define CHECK(Condition)                                                        \
+    if (!(Condition)) {                                                         \
+        printf("FAIL %s: %s, line %d\n", Title, #Condition, __LINE__);          \
+        failures++;                                                             \
+    }
+
+// UserLogger's main, renamed when main.cpp is compiled for the simulation.
+int UserLoggerMain(int argc, char* argv[]);
+
+// The driver's default backlog size.
+constexpr ULONG SIM_BACKLOG_ENTRIES = 4096;
+
+// The driver sheds a bulk event after 100 ms by default. The flood uses a
+// short timeout, so that events are shed whenever UserLogger falls behind
+// and the run also checks that they are resent.
+constexpr DWORD SIM_BULK_SEND_TIMEOUT_MS = 1;
+
+constexpr auto SIM_HIGH_INTERVAL = std::chrono::milliseconds(1);
+constexpr auto SIM_RUN_TIME = std::chrono::seconds(3);
+constexpr ULONG SIM_FLOOD_THREADS = 4;
+
+// How long UserLogger may take to start, and to acknowledge every event
+// once they stop.
+constexpr auto SIM_START_TIME = std::chrono::seconds(10);
+constexpr auto SIM_DRAIN_TIME = std::chrono::seconds(10);
+
+// A high priority p99 at or under this is flat, whatever the idle one was.
+// On one processor the flood's threads delay the high priority ones by a
+// few milliseconds, since the stand-in cannot raise their priority.
+constexpr double SIM_P99_FLOOR_SECONDS = 0.016384;
+
+// The high priority log, named in main.cpp.
+constexpr const char* SIM_HIGH_LOG_FILE = "process_log.high.txt";
+
+struct TEST_CASE {
+    const char* Title;
+    ULONG (*Run)(const char* Title);
+};
+
+
+/*************************************************************************
+    Simulated driver
+*************************************************************************/
+
+// Sends copy the notification right behind the header, as the filter
+// manager does.
+static_assert(FIELD_OFFSET(LOGGER_MESSAGE, Notification) == sizeof(FILTER_MESSAGE_HEADER),
+    "LOGGER_MESSAGE does not match the layout of a message");
+
+struct SIM_READ {
+    PFILTER_MESSAGE_HEADER Buffer;
+    DWORD Size;
+    LPOVERLAPPED Overlapped;
+};
+
+struct SIM_LANE {
+    /*
+    One port of the driver and its backlog. Sequence s is held in
+    Entries[(s - 1) % SIM_BACKLOG_ENTRIES] until a later one overwrites it,
+    as in the driver. Everything is under Lock.
+    */
+    LOGGER_PRIORITY Priority = LoggerPriorityBulk;
+    PCWSTR PortName = nullptr;
+    DWORD SendTimeoutMs = INFINITE;
+
+    std::mutex Lock;
+    // Signaled when a read is posted or the driver unloads.
+    std::condition_variable ReadPosted;
+    // Signaled when the client replays or acknowledges.
+    std::condition_variable Progress;
+    HANDLE Client = nullptr;
+    bool Replayed = false;
+    bool Unloaded = false;
+    std::deque<SIM_READ> Reads;
+
+    ULONG64 SessionId = 0;
+    ULONG64 LastSequence = 0;
+    ULONG64 AckedSequence = 0;
+    ULONG64 ShedSequence = 0;
+    ULONG64 DroppedCount = 0;
+    std::vector<LOGGER_NOTIFICATION> Entries;
+
+    // Live sends, those shed, resends, and events a resend found overwritten.
+    ULONG64 Sent = 0;
+    ULONG64 Shed = 0;
+    ULONG64 Resent = 0;
+    ULONG64 Unavailable = 0;
+};
+
+static SIM_LANE* SimLanes[LoggerPriorityCount];
+
+static SIM_LANE* SimFindLane(HANDLE port) {
+    for (SIM_LANE* lane : SimLanes) {
+        if (lane) {
+            std::lock_guard<std::mutex> guard(lane->Lock);
+            if (lane->Client == port) {
+                return lane;
+            }
+        }
+    }
+    return nullptr;
+}
+
+static void SimRecord(SIM_LANE& lane, LOGGER_NOTIFICATION& notification) {
+    LOGGER_NOTIFICATION& entry = lane.Entries[lane.LastSequence % SIM_BACKLOG_ENTRIES];
+    const ULONG64 sequence = ++lane.LastSequence;
+
+    // Overwriting an entry the client never acknowledged loses it.
+    if (sequence > SIM_BACKLOG_ENTRIES && sequence - SIM_BACKLOG_ENTRIES > lane.AckedSequence) {
+        lane.DroppedCount++;
+    }
+
+    notification.SessionId = lane.SessionId;
+    notification.Sequence = sequence;
+    notification.ShedSequence = 0;
+    entry = notification;
+    notification.ShedSequence = lane.ShedSequence;
+}
+
+// Copies the held event sequence out of the backlog. Returns false if it
+// was overwritten.
+static bool SimCopy(const SIM_LANE& lane, ULONG64 sequence, LOGGER_NOTIFICATION& notification) {
+    const LOGGER_NOTIFICATION& entry = lane.Entries[(sequence - 1) % SIM_BACKLOG_ENTRIES];
+
+    if (entry.Sequence != sequence) {
+        return false;
+    }
+    notification = entry;
+    return true;
+}
+
+// Completes a posted read with the notification, waiting up to timeoutMs
+// for one. Returns ERROR_SUCCESS, WAIT_TIMEOUT, or ERROR_INVALID_HANDLE once
+// the driver unloads.
+static DWORD SimSend(SIM_LANE& lane, std::unique_lock<std::mutex>& guard, const LOGGER_NOTIFICATION& notification,
+    DWORD timeoutMs) {
+    auto ready = [&lane]() { return lane.Unloaded || !lane.Reads.empty(); };
+
+    if (timeoutMs == INFINITE) {
+        lane.ReadPosted.wait(guard, ready);
+    }
+    else if (!lane.ReadPosted.wait_for(guard, std::chrono::milliseconds(timeoutMs), ready)) {
+        return WAIT_TIMEOUT;
+    }
+    if (lane.Unloaded) {
+        return ERROR_INVALID_HANDLE;
+    }
+
+    const SIM_READ read = lane.Reads.front();
+    const DWORD length = sizeof(FILTER_MESSAGE_HEADER) + sizeof(LOGGER_NOTIFICATION);
+    lane.Reads.pop_front();
+
+    if (read.Size < length) {
+        StandInCompleteIo(lane.Client, read.Overlapped, 0, ERROR_INVALID_PARAMETER);
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    read.Buffer->ReplyLength = 0;
+    read.Buffer->MessageId = notification.Sequence;
+    memcpy(read.Buffer + 1, &notification, sizeof(notification));
+    StandInCompleteIo(lane.Client, read.Overlapped, length, ERROR_SUCCESS);
+    return ERROR_SUCCESS;
+}
+
+// A create of a target: recorded, then sent live like the driver does.
+static void SimCreate(SIM_LANE& lane, ULONG rule) {
+    LOGGER_NOTIFICATION notification = {};
+    FILETIME now;
+    ULARGE_INTEGER timestamp;
+    const time_t wallClock = time(nullptr);
+    struct tm local;
+
+    GetSystemTimePreciseAsFileTime(&now);
+    timestamp.LowPart = now.dwLowDateTime;
+    timestamp.HighPart = now.dwHighDateTime;
+
+    notification.ProcessId = GetCurrentProcessId();
+    notification.Timestamp = static_cast<LONG64>(timestamp.QuadPart);
+    notification.Rule = rule;
+    notification.Priority = lane.Priority;
+    localtime_r(&wallClock, &local);
+    strftime(notification.Time, sizeof(notification.Time), "%Y-%m-%d %H:%M:%S", &local);
+    strcpy(notification.MessageData, "File accessed");
+
+    std::unique_lock<std::mutex> guard(lane.Lock);
+
+    SimRecord(lane, notification);
+
+    const DWORD result = SimSend(lane, guard, notification, lane.SendTimeoutMs);
+    if (result == ERROR_SUCCESS) {
+        lane.Sent++;
+    }
+    else if (result == WAIT_TIMEOUT) {
+        lane.ShedSequence = std::max(lane.ShedSequence, notification.Sequence);
+        lane.Shed++;
+    }
+}
+
+// Fails every posted read and every call from now on, as when the driver
+// unloads.
+static void SimUnload(SIM_LANE& lane) {
+    std::lock_guard<std::mutex> guard(lane.Lock);
+
+    lane.Unloaded = true;
+    for (const SIM_READ& read : lane.Reads) {
+        StandInCompleteIo(lane.Client, read.Overlapped, 0, ERROR_INVALID_HANDLE);
+    }
+    lane.Reads.clear();
+    lane.ReadPosted.notify_all();
+}
+
+HRESULT FilterConnectCommunicationPort(LPCWSTR portName, DWORD, LPCVOID, WORD, LPSECURITY_ATTRIBUTES, HANDLE* port) {
+    for (SIM_LANE* lane : SimLanes) {
+        if (lane && wcscmp(lane->PortName, portName) == 0) {
+            std::lock_guard<std::mutex> guard(lane->Lock);
+
+            // The driver takes one client per port.
+            if (lane->Client) {
+                return HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED);
+            }
+            lane->Client = StandInCreateFile();
+            *port = lane->Client;
+            return S_OK;
+        }
+    }
+    return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+}
+
+HRESULT FilterGetMessage(HANDLE port, PFILTER_MESSAGE_HEADER messageBuffer, DWORD messageBufferSize,
+    LPOVERLAPPED overlapped) {
+    SIM_LANE* lane = SimFindLane(port);
+
+    if (!lane) {
+        return E_HANDLE;
+    }
+
+    std::lock_guard<std::mutex> guard(lane->Lock);
+    if (lane->Unloaded) {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_HANDLE);
+    }
+    lane->Reads.push_back({ messageBuffer, messageBufferSize, overlapped });
+    lane->ReadPosted.notify_one();
+    return HRESULT_FROM_WIN32(ERROR_IO_PENDING);
+}
+
+HRESULT FilterSendMessage(HANDLE port, LPVOID inBuffer, DWORD inBufferSize, LPVOID outBuffer,
+    DWORD outBufferSize, LPDWORD bytesReturned) {
+    SIM_LANE* lane = SimFindLane(port);
+    LOGGER_COMMAND_MESSAGE command;
+    LOGGER_NOTIFICATION notification;
+    LOGGER_REPLAY_REPLY reply = {};
+    LOGGER_RESEND_REPLY resendReply = {};
+    unsigned long bit;
+
+    *bytesReturned = 0;
+
+    if (!lane) {
+        return E_HANDLE;
+    }
+    if (!inBuffer || inBufferSize < sizeof(command)) {
+        return E_INVALIDARG;
+    }
+    memcpy(&command, inBuffer, sizeof(command));
+
+    std::unique_lock<std::mutex> guard(lane->Lock);
+
+    if (lane->Unloaded) {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_HANDLE);
+    }
+
+    const bool current = command.SessionId == lane->SessionId;
+
+    reply.SessionId = lane->SessionId;
+    reply.NextSequence = lane->LastSequence + 1;
+    reply.FirstSequence = reply.NextSequence > SIM_BACKLOG_ENTRIES ? reply.NextSequence - SIM_BACKLOG_ENTRIES : 1;
+    reply.Capacity = SIM_BACKLOG_ENTRIES;
+    reply.DroppedCount = lane->DroppedCount;
+
+    switch (command.Command) {
+
+    case LoggerCommandReplay:
+    case LoggerCommandQuery:
+        if (!outBuffer || outBufferSize < sizeof(reply)) {
+            return E_INVALIDARG;
+        }
+
+        if (command.Command == LoggerCommandReplay) {
+            if (current && reply.FirstSequence <= command.Sequence) {
+                reply.FirstSequence = command.Sequence + 1;
+            }
+
+            for (ULONG64 sequence = reply.FirstSequence; sequence < reply.NextSequence; ++sequence) {
+                if (!SimCopy(*lane, sequence, notification)) {
+                    reply.FirstSequence = sequence + 1;
+                    continue;
+                }
+                if (SimSend(*lane, guard, notification, INFINITE) != ERROR_SUCCESS) {
+                    break;
+                }
+            }
+
+            lane->Replayed = true;
+            lane->Progress.notify_all();
+        }
+
+        memcpy(outBuffer, &reply, sizeof(reply));
+        *bytesReturned = sizeof(reply);
+        return S_OK;
+
+    case LoggerCommandResend:
+        if (!outBuffer || outBufferSize < sizeof(resendReply)) {
+            return E_INVALIDARG;
+        }
+
+        for (ULONG64 mask = current ? command.Mask : 0; _BitScanForward64(&bit, mask); mask &= mask - 1) {
+            const ULONG64 sequence = command.Sequence + bit;
+
+            if (sequence > lane->LastSequence) {
+                break;
+            }
+            if (!SimCopy(*lane, sequence, notification)) {
+                resendReply.LostMask |= 1ull << bit;
+                lane->Unavailable++;
+                continue;
+            }
+            if (SimSend(*lane, guard, notification, INFINITE) != ERROR_SUCCESS) {
+                break;
+            }
+            lane->Resent++;
+        }
+
+        memcpy(outBuffer, &resendReply, sizeof(resendReply));
+        *bytesReturned = sizeof(resendReply);
+        return S_OK;
+
+    case LoggerCommandAck:
+        if (current && command.Sequence <= lane->LastSequence) {
+            lane->AckedSequence = std::max(lane->AckedSequence, command.Sequence);
+            lane->Progress.notify_all();
+        }
+
+        if (outBuffer && outBufferSize >= sizeof(reply)) {
+            memcpy(outBuffer, &reply, sizeof(reply));
+            *bytesReturned = sizeof(reply);
+        }
+        return S_OK;
+
+    default:
+        // The trace rings are not simulated.
+        return E_INVALIDARG;
+    }
+}
+
+
+/*************************************************************************
+    Runs
+*************************************************************************/
+
+struct SIM_RESULT {
+    bool Started = false;
+    bool Drained = false;
+    int ExitCode = -1;
+
+    // Per lane, from the simulated driver.
+    ULONG64 Recorded[LoggerPriorityCount] = {};
+    ULONG64 Sent[LoggerPriorityCount] = {};
+    ULONG64 Shed[LoggerPriorityCount] = {};
+    ULONG64 Resent[LoggerPriorityCount] = {};
+    ULONG64 Unavailable[LoggerPriorityCount] = {};
+    ULONG64 Dropped[LoggerPriorityCount] = {};
+
+    // From the high priority log.
+    ULONG64 HighLogged = 0;
+    ULONG64 HighGaps = 0;
+
+    // The metrics file UserLogger wrote last.
+    std::string Metrics;
+};
+
+static SIM_RESULT IdleRun;
+static SIM_RESULT FloodRun;
+
+// The value of the metric with exactly these labels, or -1.
+static double SimMetric(const std::string& metrics, const std::string& name) {
+    std::istringstream lines(metrics);
+    std::string line;
+
+    while (std::getline(lines, line)) {
+        if (line.compare(0, name.size(), name) == 0 && line.size() > name.size() && line[name.size()] == ' ') {
+            return std::strtod(line.c_str() + name.size() + 1, nullptr);
+        }
+    }
+    return -1.0;
+}
+
+// Upper bound in seconds of the bucket that holds the p99 of a stage's age,
+// or -1 if nothing was recorded.
+static double SimP99(const std::string& metrics, const char* lane, const char* stage) {
+    const std::string prefix = std::string("userlogger_event_age_seconds_bucket{lane=\"") + lane +
+        "\",stage=\"" + stage + "\",le=\"";
+    const double count = SimMetric(metrics,
+        std::string("userlogger_event_age_seconds_count{lane=\"") + lane + "\",stage=\"" + stage + "\"}");
+    std::istringstream lines(metrics);
+    std::string line;
+
+    if (count <= 0.0) {
+        return -1.0;
+    }
+
+    while (std::getline(lines, line)) {
+        if (line.compare(0, prefix.size(), prefix) != 0) {
+            continue;
+        }
+        const size_t close = line.find("\"} ", prefix.size());
+        if (close == std::string::npos) {
+            continue;
+        }
+        if (std::strtod(line.c_str() + close + 3, nullptr) >= std::ceil(count * 0.99)) {
+            return std::strtod(line.substr(prefix.size(), close - prefix.size()).c_str(), nullptr);
+        }
+    }
+    return -1.0;
+}
+
+static void SimProduce(SIM_LANE* lanes, ULONG floodThreads, SIM_RESULT& result) {
+    std::atomic<bool> stop{ false };
+    std::vector<std::thread> threads;
+
+    threads.emplace_back([&lanes, &stop]() {
+        auto next = std::chrono::steady_clock::now();
+
+        while (!stop.load()) {
+            SimCreate(lanes[LoggerPriorityHigh], 0);
+            next = std::max(next + SIM_HIGH_INTERVAL, std::chrono::steady_clock::now());
+            std::this_thread::sleep_until(next);
+        }
+    });
+
+    for (ULONG i = 0; i < floodThreads; ++i) {
+        threads.emplace_back([&lanes, &stop, i]() {
+            while (!stop.load()) {
+                SimCreate(lanes[LoggerPriorityBulk], i + 1);
+            }
+        });
+    }
+
+    std::this_thread::sleep_for(SIM_RUN_TIME);
+    stop.store(true);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // UserLogger acknowledges every event it logged, or gave up as lost.
+    result.Drained = true;
+    for (ULONG priority = 0; priority < LoggerPriorityCount; ++priority) {
+        SIM_LANE& lane = lanes[priority];
+        std::unique_lock<std::mutex> guard(lane.Lock);
+
+        result.Drained &= lane.Progress.wait_for(guard, SIM_DRAIN_TIME,
+            [&lane]() { return lane.AckedSequence == lane.LastSequence; });
+    }
+}
+
+static void SimRun(ULONG floodThreads, SIM_RESULT& result) {
+    /*
+    Runs UserLogger in a directory of its own against a new simulated
+    driver, floodThreads flooding the bulk lane while the high priority one
+    gets an event every SIM_HIGH_INTERVAL.
+    */
+    SIM_LANE lanes[LoggerPriorityCount];
+    const auto directory = std::filesystem::temp_directory_path() /
+        ("laneSimulation." + std::to_string(getpid()) + "." + std::to_string(floodThreads));
+    const auto previous = std::filesystem::current_path();
+    char program[] = "UserLogger";
+    char* argv[] = { program, nullptr };
+
+    for (ULONG priority = 0; priority < LoggerPriorityCount; ++priority) {
+        lanes[priority].Priority = static_cast<LOGGER_PRIORITY>(priority);
+        lanes[priority].PortName = priority == LoggerPriorityHigh ? LOGGERHighPortName : LOGGERPortName;
+        lanes[priority].SendTimeoutMs = priority == LoggerPriorityHigh ? INFINITE : SIM_BULK_SEND_TIMEOUT_MS;
+        lanes[priority].SessionId = LoggerMetrics::Now();
+        lanes[priority].Entries.resize(SIM_BACKLOG_ENTRIES);
+        SimLanes[priority] = &lanes[priority];
+    }
+
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directory(directory);
+    std::filesystem::current_path(directory);
+
+    // UserLogger prints every event; keep it off the report.
+    fflush(stdout);
+    const int output = dup(STDOUT_FILENO);
+    const int discard = open("/dev/null", O_WRONLY);
+    dup2(discard, STDOUT_FILENO);
+    close(discard);
+
+    std::thread logger([&result, &argv]() { result.ExitCode = UserLoggerMain(1, argv); });
+
+    result.Started = true;
+    for (SIM_LANE& lane : lanes) {
+        std::unique_lock<std::mutex> guard(lane.Lock);
+        result.Started &= lane.Progress.wait_for(guard, SIM_START_TIME, [&lane]() { return lane.Replayed; });
+    }
+
+    if (result.Started) {
+        SimProduce(lanes, floodThreads, result);
+    }
+
+    for (SIM_LANE& lane : lanes) {
+        SimUnload(lane);
+    }
+    logger.join();
+
+    fflush(stdout);
+    dup2(output, STDOUT_FILENO);
+    close(output);
+
+    for (ULONG priority = 0; priority < LoggerPriorityCount; ++priority) {
+        const SIM_LANE& lane = lanes[priority];
+
+        result.Recorded[priority] = lane.LastSequence;
+        result.Sent[priority] = lane.Sent;
+        result.Shed[priority] = lane.Shed;
+        result.Resent[priority] = lane.Resent;
+        result.Unavailable[priority] = lane.Unavailable;
+        result.Dropped[priority] = lane.DroppedCount;
+        SimLanes[priority] = nullptr;
+    }
+
+    std::ifstream highLog(SIM_HIGH_LOG_FILE);
+    std::string line;
+    while (std::getline(highLog, line)) {
+        result.HighLogged += line.compare(0, 11, " Process ID") == 0;
+        result.HighGaps += line.compare(0, 5, " Gap:") == 0;
+    }
+
+    std::ifstream metricsFile(LOGGER_METRICS_FILE);
+    std::ostringstream metrics;
+    metrics << metricsFile.rdbuf();
+    result.Metrics = metrics.str();
+
+    std::filesystem::current_path(previous);
+    std::filesystem::remove_all(directory);
+}
+
+// A p99 in milliseconds for the report, "-" if nothing was recorded.
+static std::string SimMs(const SIM_RESULT& result, const char* lane, const char* stage) {
+    const double p99 = SimP99(result.Metrics, lane, stage);
+    char text[32];
+
+    if (p99 < 0.0) {
+        return "-";
+    }
+    snprintf(text, sizeof(text), "%.3f", p99 * 1000.0);
+    return text;
+}
+
+static void SimReport(const char* name, const SIM_RESULT& result) {
+    printf("%-6s %7llu %9s %9s %9s %9llu %9s %7llu %7llu %7llu %7.0f\n", name,
+        result.Recorded[LoggerPriorityHigh],
+        SimMs(result, "high", "receive").c_str(),
+        SimMs(result, "high", "write").c_str(),
+        SimMs(result, "high", "flush").c_str(),
+        result.Recorded[LoggerPriorityBulk],
+        SimMs(result, "bulk", "write").c_str(),
+        result.Shed[LoggerPriorityBulk],
+        result.Resent[LoggerPriorityBulk],
+        result.Dropped[LoggerPriorityBulk],
+        SimMetric(result.Metrics, "userlogger_events_lost_total{lane=\"bulk\"}"));
+}
+
+
+/*************************************************************************
+    Cases
+*************************************************************************/
+
+static ULONG TestRuns(const char* Title) {
+    ULONG failures = 0;
+
+    for (const SIM_RESULT* result : { &IdleRun, &FloodRun }) {
+        CHECK(result->Started);
+        CHECK(result->Drained);
+        CHECK(SUCCEEDED(result->ExitCode));
+    }
+    return failures;
+}
+
+static ULONG TestSaturated(const char* Title) {
+    ULONG failures = 0;
+
+    // UserLogger fell behind the bulk lane: the driver shed events, and its
+    // backlog overwrote some before they were logged.
+    CHECK(IdleRun.Recorded[LoggerPriorityBulk] == 0);
+    CHECK(FloodRun.Recorded[LoggerPriorityBulk] > 100 * FloodRun.Recorded[LoggerPriorityHigh]);
+    CHECK(FloodRun.Shed[LoggerPriorityBulk] > 0);
+    CHECK(FloodRun.Dropped[LoggerPriorityBulk] > 0);
+    return failures;
+}
+
+static ULONG TestHighWritten(const char* Title) {
+    ULONG failures = 0;
+
+    for (const SIM_RESULT* result : { &IdleRun, &FloodRun }) {
+        CHECK(result->Recorded[LoggerPriorityHigh] > 1000);
+        CHECK(result->Shed[LoggerPriorityHigh] == 0);
+        CHECK(result->HighLogged == result->Recorded[LoggerPriorityHigh]);
+        CHECK(result->HighGaps == 0);
+        CHECK(SimMetric(result->Metrics, "userlogger_event_age_seconds_count{lane=\"high\",stage=\"flush\"}") ==
+            static_cast<double>(result->Recorded[LoggerPriorityHigh]));
+    }
+    return failures;
+}
+
+static ULONG TestHighFlat(const char* Title) {
+    ULONG failures = 0;
+
+    for (const char* stage : { "receive", "write", "flush" }) {
+        const double idle = SimP99(IdleRun.Metrics, "high", stage);
+        const double flood = SimP99(FloodRun.Metrics, "high", stage);
+
+        CHECK(idle > 0.0);
+        CHECK(flood > 0.0);
+        CHECK(flood <= std::max(2 * idle, SIM_P99_FLOOR_SECONDS));
+    }
+
+    // Behind one queue the high priority events would wait as long as the
+    // bulk ones do.
+    CHECK(SimP99(FloodRun.Metrics, "high", "write") * 16 <= SimP99(FloodRun.Metrics, "bulk", "write"));
+    return failures;
+}
+
+static ULONG TestBulkResent(const char* Title) {
+    ULONG failures = 0;
+
+    // Every shed event is asked for again, and only those the driver answers
+    // it no longer holds are logged as lost.
+    CHECK(FloodRun.Resent[LoggerPriorityBulk] + FloodRun.Unavailable[LoggerPriorityBulk] >=
+        FloodRun.Shed[LoggerPriorityBulk]);
+    CHECK(SimMetric(FloodRun.Metrics, "userlogger_events_lost_total{lane=\"bulk\"}") <=
+        static_cast<double>(FloodRun.Unavailable[LoggerPriorityBulk]));
+    return failures;
+}
+
+static const TEST_CASE TestCases[] = {
+    { "both runs start, drain and exit", TestRuns },
+    { "the flood saturates the bulk lane", TestSaturated },
+    { "every high priority event is written", TestHighWritten },
+    { "the high priority p99 stays flat under the flood", TestHighFlat },
+    { "shed bulk events are resent rather than lost", TestBulkResent },
+};
+
+int main() {
+    ULONG failures = 0;
+
+    // UserLogger prints with both printf and std::wcout, which glibc cannot
+    // mix on one stream. Keep stdout narrow for the report.
+    fwide(stdout, -1);
+
+    SimRun(0, IdleRun);
+    SimRun(SIM_FLOOD_THREADS, FloodRun);
+
+    printf("%-6s %7s %9s %9s %9s %9s %9s %7s %7s %7s %7s\n",
+        "run", "high", "receive", "write", "flush", "bulk", "write", "shed", "resent", "dropped", "lost");
+    printf("%-6s %7s %9s %9s %9s %9s %9s %7s %7s %7s %7s\n",
+        "", "", "p99 ms", "p99 ms", "p99 ms", "", "p99 ms", "", "", "", "");
+    SimReport("idle", IdleRun);
+    SimReport("flood", FloodRun);
+
+    for (const TEST_CASE& test : TestCases) {
+        const ULONG caseFailures = test.Run(test.Title);
+
+        if (caseFailures == 0) {
+            printf("ok   %s\n", test.Title);
+        }
+        failures += caseFailures;
+    }
+
+    printf("%u failure(s)\n", failures);
+    return static_cast<int>(failures);
+}
@@ -0,0 +1,254 @@
+/*++
+Module Name:
+    metricsTest.cpp
+
+Abstract:
+    Checks LoggerMetrics with known stage latencies: ages fall into the
+    expected power-of-two buckets, and the exported file carries them, the
+    per-lane gauges and counters in the Prometheus text format. A stand-in
+    event source records from several threads while the export thread
+    rewrites the file, and no event is lost from the counts.
+    The process exits with the number of failed checks.
+
+Environment:
+    User mode
+--*/
+
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <windows.h>
+#include <fltUser.h>
+#include "userlogger.h"
+#include "metrics.h"
+
+#define CHECK(Condition)                                                        \
+    if (!(Condition)) {                                                         \
+        printf("FAIL %s: %s, line %d\n", Title, #Condition, __LINE__);          \
+        failures++;                                                             \
+    }
+
+constexpr const char* TEST_METRICS_FILE = "metricsTest.prom";
+
+// Long enough that only Stop exports in a case that does not expect more.
+constexpr DWORD TEST_NO_EXPORT_MS = 60000;
+
+// LOGGER_NOTIFICATION.Timestamp ticks per microsecond.
+constexpr LONG64 TEST_TICKS_PER_MICROSECOND = 10;
+
+constexpr ULONG TEST_SOURCE_THREADS = 4;
+constexpr ULONG TEST_SOURCE_EVENTS = 100000;
+
+struct TEST_CASE {
+    const char* Title;
+    ULONG (*Run)(const char* Title);
+};
+
+// Series of the exported file, by name and labels.
+using TEST_SERIES = std::map<std::string, std::string>;
+
+static bool ReadSeries(TEST_SERIES& series, ULONG& bucketLines) {
+    std::ifstream file(TEST_METRICS_FILE);
+    std::string line;
+
+    if (!file.is_open()) {
+        return false;
+    }
+
+    series.clear();
+    bucketLines = 0;
+
+    while (std::getline(file, line)) {
+        const size_t space = line.rfind(' ');
+
+        if (line.empty() || line[0] == '#' || space == std::string::npos) {
+            continue;
+        }
+        if (line.find("_bucket{") != std::string::npos) {
+            ++bucketLines;
+        }
+        series[line.substr(0, space)] = line.substr(space + 1);
+    }
+    return true;
+}
+
+static std::string Series(TEST_SERIES& series, const char* name) {
+    auto found = series.find(name);
+    return found == series.end() ? std::string("missing") : found->second;
+}
+
+static bool FileExists(const std::string& name) {
+    std::ifstream file(name);
+    return file.is_open();
+}
+
+
+/*************************************************************************
+    Cases
+*************************************************************************/
+
+static ULONG TestBuckets(const char* Title) {
+    LoggerHistogram histogram;
+    ULONG failures = 0;
+
+    // Bucket i counts values up to 2^i microseconds.
+    for (ULONG64 micros : { 0ull, 1ull, 2ull, 3ull, 4ull, 5ull, 1000ull, 1024ull, 1025ull, 1ull << 40 }) {
+        histogram.Record(micros);
+    }
+
+    CHECK(histogram.Buckets[0] == 2);
+    CHECK(histogram.Buckets[1] == 1);
+    CHECK(histogram.Buckets[2] == 2);
+    CHECK(histogram.Buckets[3] == 1);
+    CHECK(histogram.Buckets[10] == 2);
+    CHECK(histogram.Buckets[11] == 1);
+    CHECK(histogram.Buckets[LoggerHistogram::BucketCount - 1] == 1);
+    CHECK(histogram.Count == 10);
+    CHECK(histogram.SumMicros == 0 + 1 + 2 + 3 + 4 + 5 + 1000 + 1024 + 1025 + (1ull << 40));
+    return failures;
+}
+
+static ULONG TestExport(const char* Title) {
+    LoggerMetrics metrics(TEST_METRICS_FILE, TEST_NO_EXPORT_MS,
+        [](LOGGER_PRIORITY priority) { return priority == LoggerPriorityBulk ? 7ull : 3ull; });
+    const LONG64 timestamp = LoggerMetrics::Now();
+    TEST_SERIES series;
+    ULONG bucketLines = 0;
+    ULONG failures = 0;
+
+    remove(TEST_METRICS_FILE);
+    CHECK(SUCCEEDED(metrics.Start()));
+
+    // 2 us, 2.5 ms, and an event stamped after it was received.
+    metrics.RecordStage(LoggerPriorityBulk, LoggerStageReceive, timestamp, timestamp + 2 * TEST_TICKS_PER_MICROSECOND);
+    metrics.RecordStage(LoggerPriorityBulk, LoggerStageFlush, timestamp, timestamp + 2500 * TEST_TICKS_PER_MICROSECOND);
+    metrics.RecordStage(LoggerPriorityHigh, LoggerStageReceive, timestamp, timestamp - 100);
+
+    metrics.RecordGap(LoggerPriorityBulk, 5);
+    metrics.RecordDuplicate(LoggerPriorityHigh);
+    metrics.RecordDuplicate(LoggerPriorityHigh);
+    metrics.SetUnflushed(LoggerPriorityBulk, 4);
+    metrics.SetDriverDropped(LoggerPriorityHigh, 9);
+
+    metrics.Stop();
+
+    CHECK(ReadSeries(series, bucketLines));
+    CHECK(!FileExists(std::string(TEST_METRICS_FILE) + ".tmp"));
+    CHECK(bucketLines == LoggerPriorityCount * LoggerStageCount * LoggerHistogram::BucketCount);
+
+    CHECK(Series(series, "userlogger_event_age_seconds_bucket{lane=\"bulk\",stage=\"receive\",le=\"1e-06\"}") == "0");
+    CHECK(Series(series, "userlogger_event_age_seconds_bucket{lane=\"bulk\",stage=\"receive\",le=\"2e-06\"}") == "1");
+    CHECK(Series(series, "userlogger_event_age_seconds_bucket{lane=\"bulk\",stage=\"receive\",le=\"+Inf\"}") == "1");
+    CHECK(Series(series, "userlogger_event_age_seconds_bucket{lane=\"bulk\",stage=\"flush\",le=\"0.002048\"}") == "0");
+    CHECK(Series(series, "userlogger_event_age_seconds_bucket{lane=\"bulk\",stage=\"flush\",le=\"0.004096\"}") == "1");
+    CHECK(Series(series, "userlogger_event_age_seconds_sum{lane=\"bulk\",stage=\"flush\"}") == "0.002500");
+    CHECK(Series(series, "userlogger_event_age_seconds_count{lane=\"bulk\",stage=\"flush\"}") == "1");
+    CHECK(Series(series, "userlogger_event_age_seconds_count{lane=\"bulk\",stage=\"write\"}") == "0");
+
+    // A negative age counts as zero.
+    CHECK(Series(series, "userlogger_event_age_seconds_bucket{lane=\"high\",stage=\"receive\",le=\"1e-06\"}") == "1");
+    CHECK(Series(series, "userlogger_event_age_seconds_sum{lane=\"high\",stage=\"receive\"}") == "0.000000");
+
+    CHECK(Series(series, "userlogger_reorder_depth{lane=\"bulk\"}") == "7");
+    CHECK(Series(series, "userlogger_reorder_depth{lane=\"high\"}") == "3");
+    CHECK(Series(series, "userlogger_unflushed_events{lane=\"bulk\"}") == "4");
+    CHECK(Series(series, "userlogger_events_lost_total{lane=\"bulk\"}") == "5");
+    CHECK(Series(series, "userlogger_events_lost_total{lane=\"high\"}") == "0");
+    CHECK(Series(series, "userlogger_duplicates_total{lane=\"high\"}") == "2");
+    CHECK(Series(series, "userlogger_driver_dropped_total{lane=\"high\"}") == "9");
+    CHECK(Series(series, "userlogger_events_per_second{lane=\"bulk\",stage=\"flush\"}") != "missing");
+
+    remove(TEST_METRICS_FILE);
+    return failures;
+}
+
+static ULONG TestConcurrentSource(const char* Title) {
+    LoggerMetrics metrics(TEST_METRICS_FILE, 10, nullptr);
+    std::vector<std::thread> sources;
+    TEST_SERIES series;
+    ULONG bucketLines = 0;
+    ULONG64 sumMicros = 0;
+    ULONG failures = 0;
+    char expected[64];
+
+    remove(TEST_METRICS_FILE);
+    CHECK(SUCCEEDED(metrics.Start()));
+
+    // Each thread plays a lane worker: the same known ages, while the export
+    // thread rewrites the file every 10 ms.
+    for (ULONG thread = 0; thread < TEST_SOURCE_THREADS; ++thread) {
+        sources.emplace_back([&metrics]() {
+            const LONG64 timestamp = LoggerMetrics::Now();
+
+            for (ULONG i = 0; i < TEST_SOURCE_EVENTS; ++i) {
+                metrics.RecordStage(LoggerPriorityBulk, LoggerStageDecode, timestamp,
+                    timestamp + (i % 4096) * TEST_TICKS_PER_MICROSECOND);
+            }
+        });
+    }
+    for (auto& source : sources) {
+        source.join();
+    }
+    for (ULONG i = 0; i < TEST_SOURCE_EVENTS; ++i) {
+        sumMicros += i % 4096;
+    }
+
+    metrics.Stop();
+
+    CHECK(ReadSeries(series, bucketLines));
+
+    snprintf(expected, sizeof(expected), "%lu", static_cast<unsigned long>(TEST_SOURCE_THREADS * TEST_SOURCE_EVENTS));
+    CHECK(Series(series, "userlogger_event_age_seconds_count{lane=\"bulk\",stage=\"decode\"}") == expected);
+    CHECK(Series(series, "userlogger_event_age_seconds_bucket{lane=\"bulk\",stage=\"decode\",le=\"+Inf\"}") == expected);
+    CHECK(Series(series, "userlogger_event_age_seconds_bucket{lane=\"bulk\",stage=\"decode\",le=\"0.004096\"}") == expected);
+
+    // Ages 0 and 1 us of every 4096.
+    snprintf(expected, sizeof(expected), "%lu",
+        static_cast<unsigned long>(TEST_SOURCE_THREADS * (2 * (TEST_SOURCE_EVENTS / 4096) + 2)));
+    CHECK(Series(series, "userlogger_event_age_seconds_bucket{lane=\"bulk\",stage=\"decode\",le=\"1e-06\"}") == expected);
+
+    snprintf(expected, sizeof(expected), "%.6f", static_cast<double>(sumMicros * TEST_SOURCE_THREADS) / 1000000.0);
+    CHECK(Series(series, "userlogger_event_age_seconds_sum{lane=\"bulk\",stage=\"decode\"}") == expected);
+    CHECK(Series(series, "userlogger_reorder_depth{lane=\"bulk\"}") == "0");
+
+    remove(TEST_METRICS_FILE);
+    return failures;
+}
+
+static ULONG TestNoFile(const char* Title) {
+    LoggerMetrics metrics(std::string(), TEST_NO_EXPORT_MS, nullptr);
+    ULONG failures = 0;
+
+    remove(TEST_METRICS_FILE);
+    CHECK(SUCCEEDED(metrics.Start()));
+    metrics.RecordStage(LoggerPriorityBulk, LoggerStageReceive, 0, 10);
+    metrics.Stop();
+    CHECK(!FileExists(TEST_METRICS_FILE));
+    return failures;
+}
+
+static const TEST_CASE TestCases[] = {
+    { "ages fall into power-of-two buckets", TestBuckets },
+    { "the export carries every stage, gauge and counter of each lane", TestExport },
+    { "events recorded while exporting are all counted", TestConcurrentSource },
+    { "an empty file name turns the export off", TestNoFile },
+};
+
+int main() {
+    ULONG failures = 0;
+
+    for (const TEST_CASE& test : TestCases) {
+        const ULONG caseFailures = test.Run(test.Title);
+
+        if (caseFailures == 0) {
+            printf("ok   %s\n", test.Title);
+        }
+        failures += caseFailures;
+    }
+
+    printf("%u failure(s)\n", failures);
+    return static_cast<int>(failures);
+}
@@ -0,0 +1,93 @@
+/*++
+Module Name:
+    reorderBench.cpp
+
+Abstract:
+    Measures the throughput of LoggerReorder and the latency from Insert to
+    Emit across worker thread counts. Workers take sequences from a shared
+    counter, as LoggerWorker threads complete FilterGetMessage in whatever
+    order they are scheduled, and each event carries its insert time to the
+    writer thread.
+
+Environment:
+    User mode
+--*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include <windows.h>
+#include <fltUser.h>
+#include "userlogger.h"
+#include "reorder.h"
+
+constexpr ULONG64 BENCH_EVENTS = 1000000;
+constexpr ULONG BENCH_THREAD_COUNTS[] = { 1, 2, 4, 8, 16 };
+
+static LONG64 BenchNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void BenchRun(ULONG threadCount) {
+    std::vector<LONG64> latencies;
+    std::atomic<ULONG64> next{ 1 };
+    std::atomic<ULONG64> written{ 0 };
+    std::vector<std::thread> threads;
+
+    latencies.reserve(BENCH_EVENTS);
+
+    LoggerReorder reorder(LOGGER_DEFAULT_REORDER_WINDOW, LOGGER_DEFAULT_MAX_HOLD_MS,
+        [&](const LOGGER_NOTIFICATION& notification) {
+            latencies.push_back(BenchNow() - notification.Timestamp);
+            written.fetch_add(1, std::memory_order_release);
+        },
+        [](ULONG64, ULONG64) {},
+        1000,
+        []() {},
+        [](ULONG64, ULONG64) { return false; });
+
+    reorder.Start(1);
+    const LONG64 start = BenchNow();
+
+    for (ULONG i = 0; i < threadCount; ++i) {
+        threads.emplace_back([&]() {
+            LOGGER_NOTIFICATION notification = {};
+
+            while ((notification.Sequence = next.fetch_add(1)) <= BENCH_EVENTS) {
+                notification.Timestamp = BenchNow();
+                reorder.Insert(notification);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    while (written.load(std::memory_order_acquire) < BENCH_EVENTS) {
+        std::this_thread::yield();
+    }
+
+    const double seconds = static_cast<double>(BenchNow() - start) / 1e9;
+    reorder.Stop();
+
+    std::sort(latencies.begin(), latencies.end());
+    printf("%7u %14.0f %10.1f %10.1f %10.1f\n", threadCount,
+        static_cast<double>(BENCH_EVENTS) / seconds,
+        static_cast<double>(latencies[latencies.size() / 2]) / 1000.0,
+        static_cast<double>(latencies[latencies.size() * 99 / 100]) / 1000.0,
+        static_cast<double>(latencies.back()) / 1000.0);
+}
+
+int main() {
+    printf("%u events per run, window %llu, %u processor(s)\n", static_cast<ULONG>(BENCH_EVENTS),
+        LOGGER_DEFAULT_REORDER_WINDOW, std::thread::hardware_concurrency());
+    printf("%7s %14s %10s %10s %10s\n", "threads", "events/s", "p50 us", "p99 us", "max us");
+
+    for (ULONG threadCount : BENCH_THREAD_COUNTS) {
+        BenchRun(threadCount);
+    }
+    return 0;
+}
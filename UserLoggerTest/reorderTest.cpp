@@ -0,0 +1,390 @@
+/*++
+Module Name:
+    reorderTest.cpp
+
+Abstract:
+    Checks that LoggerReorder writes events in sequence order when they
+    arrive out of order across the edge of its window: events beyond the
+    window are parked and moved into the ring as the writer catches up,
+    parked duplicates and discards are handled once, and a sequence that
+    never arrives is requested again before it is skipped as a gap.
+    The process exits with the number of failed checks.
+
+Environment:
+    User mode
+--*/
+
+#include <algorithm>
+#include <cstdio>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <windows.h>
+#include <fltUser.h>
+#include "userlogger.h"
+#include "reorder.h"
+
+#define CHECK(Condition)                                                        \
+    if (!(Condition)) {                                                         \
+        printf("FAIL %s: %s, line %d\n", Title, #Condition, __LINE__);          \
+        failures++;                                                             \
+    }
+
+// Long enough that a hold never expires in a case that does not expect it.
+constexpr DWORD TEST_NO_HOLD_MS = 60000;
+constexpr DWORD TEST_WAIT_MS = 10000;
+
+struct TEST_CASE {
+    const char* Title;
+    ULONG (*Run)(const char* Title);
+};
+
+struct TEST_SINK {
+    /*
+    Collects what the writer thread hands to the reorder stage's routines.
+    */
+    std::mutex Lock;
+    std::vector<ULONG64> Emitted;
+    std::vector<std::pair<ULONG64, ULONG64>> Gaps;
+    std::vector<std::pair<ULONG64, ULONG64>> Resends;
+    ULONG Corrupted = 0;
+    ULONG Flushes = 0;
+    // Sequences written or skipped so far.
+    ULONG64 Done = 0;
+
+    std::unique_ptr<LoggerReorder> Create(ULONG64 window, DWORD maxHoldMs) {
+        return std::make_unique<LoggerReorder>(window, maxHoldMs,
+            [this](const LOGGER_NOTIFICATION& notification) {
+                std::lock_guard<std::mutex> guard(Lock);
+                if (notification.ProcessId != notification.Sequence * 7) {
+                    Corrupted++;
+                }
+                Emitted.push_back(notification.Sequence);
+                Done++;
+            },
+            [this](ULONG64 first, ULONG64 last) {
+                std::lock_guard<std::mutex> guard(Lock);
+                Gaps.emplace_back(first, last);
+                Done += last - first + 1;
+            },
+            10,
+            [this]() {
+                std::lock_guard<std::mutex> guard(Lock);
+                Flushes++;
+            },
+            [this](ULONG64 first, ULONG64 mask) {
+                std::lock_guard<std::mutex> guard(Lock);
+                Resends.emplace_back(first, mask);
+                return true;
+            });
+    }
+
+    bool WaitFor(ULONG64 done) {
+        const ULONGLONG start = GetTickCount64();
+
+        while (GetTickCount64() - start < TEST_WAIT_MS) {
+            {
+                std::lock_guard<std::mutex> guard(Lock);
+                if (Done >= done) {
+                    return true;
+                }
+            }
+            Sleep(1);
+        }
+        return false;
+    }
+};
+
+static LOGGER_NOTIFICATION TestNotification(ULONG64 sequence) {
+    LOGGER_NOTIFICATION notification = {};
+
+    notification.Sequence = sequence;
+    notification.ProcessId = sequence * 7;
+    return notification;
+}
+
+static std::vector<ULONG64> TestRange(ULONG64 first, ULONG64 last) {
+    std::vector<ULONG64> range;
+
+    for (ULONG64 sequence = first; sequence <= last; ++sequence) {
+        range.push_back(sequence);
+    }
+    return range;
+}
+
+
+/*************************************************************************
+    Cases
+*************************************************************************/
+
+static ULONG TestWithinWindow(const char* Title) {
+    TEST_SINK sink;
+    auto reorder = sink.Create(8, TEST_NO_HOLD_MS);
+    const ULONG64 order[] = { 8, 3, 5, 1, 7, 2, 6, 4 };
+    ULONG failures = 0;
+
+    CHECK(SUCCEEDED(reorder->Start(1)));
+    for (ULONG64 sequence : order) {
+        CHECK(reorder->Insert(TestNotification(sequence)));
+    }
+
+    CHECK(sink.WaitFor(8));
+
+    // A flush follows within the flush interval, with no further events.
+    Sleep(100);
+    reorder->Stop();
+
+    CHECK(sink.Emitted == TestRange(1, 8));
+    CHECK(sink.Gaps.empty());
+    CHECK(sink.Corrupted == 0);
+    CHECK(reorder->Depth() == 0);
+    CHECK(sink.Flushes != 0);
+    return failures;
+}
+
+static ULONG TestParked(const char* Title) {
+    TEST_SINK sink;
+    auto reorder = sink.Create(8, TEST_NO_HOLD_MS);
+    ULONG failures = 0;
+
+    CHECK(SUCCEEDED(reorder->Start(1)));
+
+    // 9 and later are beyond the window of the writer waiting at 1.
+    for (ULONG64 sequence = 40; sequence >= 2; --sequence) {
+        CHECK(reorder->Insert(TestNotification(sequence)));
+    }
+
+    Sleep(50);
+    {
+        std::lock_guard<std::mutex> guard(sink.Lock);
+        CHECK(sink.Emitted.empty());
+    }
+    CHECK(reorder->Depth() == 39);
+
+    CHECK(reorder->Insert(TestNotification(1)));
+    CHECK(sink.WaitFor(40));
+    reorder->Stop();
+
+    CHECK(sink.Emitted == TestRange(1, 40));
+    CHECK(sink.Gaps.empty());
+    CHECK(sink.Resends.empty());
+    CHECK(sink.Corrupted == 0);
+    CHECK(reorder->Depth() == 0);
+    return failures;
+}
+
+static ULONG TestAcrossEdge(const char* Title) {
+    const ULONG64 count = 5000;
+    const size_t window = 16;
+    std::vector<ULONG64> order = TestRange(1, count);
+    std::mt19937_64 random(28);
+    ULONG failures = 0;
+
+    // Shuffle within blocks of several windows, so events land in the ring,
+    // beyond it, and on both sides of its edge as the writer moves.
+    for (size_t block = 0; block < order.size(); block += 3 * window) {
+        std::shuffle(order.begin() + block, order.begin() + std::min(order.size(), block + 3 * window), random);
+    }
+
+    for (ULONG64 round = 0; round < 2; ++round) {
+        TEST_SINK sink;
+        auto reorder = sink.Create(window, TEST_NO_HOLD_MS);
+
+        CHECK(SUCCEEDED(reorder->Start(1)));
+        for (ULONG64 sequence : order) {
+            CHECK(reorder->Insert(TestNotification(sequence)));
+
+            // The second round lets the writer run between inserts.
+            if (round == 1 && sequence % 5 == 0) {
+                std::this_thread::yield();
+            }
+        }
+
+        CHECK(sink.WaitFor(count));
+        reorder->Stop();
+
+        CHECK(sink.Emitted == TestRange(1, count));
+        CHECK(sink.Gaps.empty());
+        CHECK(sink.Corrupted == 0);
+        CHECK(reorder->Depth() == 0);
+    }
+    return failures;
+}
+
+static ULONG TestParkedDiscard(const char* Title) {
+    TEST_SINK sink;
+    auto reorder = sink.Create(8, TEST_NO_HOLD_MS);
+    std::vector<ULONG64> expected = TestRange(1, 11);
+    ULONG failures = 0;
+
+    CHECK(SUCCEEDED(reorder->Start(1)));
+
+    for (ULONG64 sequence = 2; sequence <= 20; ++sequence) {
+        if (sequence == 12 || sequence == 13) {
+            CHECK(reorder->Discard(sequence));
+        }
+        else {
+            CHECK(reorder->Insert(TestNotification(sequence)));
+        }
+    }
+    CHECK(reorder->Insert(TestNotification(1)));
+
+    CHECK(sink.WaitFor(20));
+    reorder->Stop();
+
+    for (ULONG64 sequence = 14; sequence <= 20; ++sequence) {
+        expected.push_back(sequence);
+    }
+    CHECK(sink.Emitted == expected);
+    CHECK(sink.Gaps.size() == 1 && sink.Gaps[0] == std::make_pair(12ull, 13ull));
+    CHECK(sink.Resends.empty());
+    CHECK(reorder->Depth() == 0);
+    return failures;
+}
+
+static ULONG TestDuplicates(const char* Title) {
+    TEST_SINK sink;
+    auto reorder = sink.Create(8, TEST_NO_HOLD_MS);
+    ULONG failures = 0;
+
+    CHECK(SUCCEEDED(reorder->Start(1)));
+
+    // Replay duplicates of an event in the ring and of a parked one.
+    CHECK(reorder->Insert(TestNotification(3)));
+    CHECK(!reorder->Insert(TestNotification(3)));
+    CHECK(reorder->Insert(TestNotification(12)));
+    CHECK(!reorder->Insert(TestNotification(12)));
+    CHECK(!reorder->Discard(12));
+    CHECK(reorder->Depth() == 2);
+
+    for (ULONG64 sequence = 1; sequence <= 12; ++sequence) {
+        if (sequence != 3 && sequence != 12) {
+            CHECK(reorder->Insert(TestNotification(sequence)));
+        }
+    }
+    CHECK(sink.WaitFor(12));
+
+    // And of events already written.
+    CHECK(!reorder->Insert(TestNotification(1)));
+    CHECK(!reorder->Insert(TestNotification(12)));
+    reorder->Stop();
+
+    CHECK(sink.Emitted == TestRange(1, 12));
+    CHECK(reorder->Depth() == 0);
+    return failures;
+}
+
+static ULONG TestResendThenGap(const char* Title) {
+    TEST_SINK sink;
+    auto reorder = sink.Create(8, 50);
+    std::vector<ULONG64> expected = TestRange(2, 20);
+    ULONG failures = 0;
+
+    CHECK(SUCCEEDED(reorder->Start(1)));
+
+    // 1 never arrives; 9 and later are parked behind it.
+    for (ULONG64 sequence = 2; sequence <= 20; ++sequence) {
+        CHECK(reorder->Insert(TestNotification(sequence)));
+    }
+
+    CHECK(sink.WaitFor(20));
+    reorder->Stop();
+
+    CHECK(sink.Emitted == expected);
+    CHECK(sink.Gaps.size() == 1 && sink.Gaps[0] == std::make_pair(1ull, 1ull));
+
+    // Requested a few times, for the missing sequence only.
+    CHECK(sink.Resends.size() == 3);
+    for (const auto& resend : sink.Resends) {
+        CHECK(resend.first == 1 && resend.second == 1);
+    }
+    return failures;
+}
+
+static ULONG TestStopAtMissing(const char* Title) {
+    TEST_SINK sink;
+    auto reorder = sink.Create(8, TEST_NO_HOLD_MS);
+    ULONG failures = 0;
+
+    CHECK(SUCCEEDED(reorder->Start(1)));
+    CHECK(reorder->Insert(TestNotification(1)));
+    CHECK(reorder->Insert(TestNotification(2)));
+    CHECK(reorder->Insert(TestNotification(4)));
+    CHECK(reorder->Insert(TestNotification(30)));
+
+    CHECK(sink.WaitFor(2));
+    reorder->Stop();
+
+    // What follows the missing sequence is left for the driver's replay.
+    CHECK(sink.Emitted == TestRange(1, 2));
+    CHECK(sink.Gaps.empty());
+    CHECK(reorder->Depth() == 2);
+    return failures;
+}
+
+static ULONG TestConcurrentWorkers(const char* Title) {
+    const ULONG64 count = 200000;
+    const ULONG workers = 4;
+    TEST_SINK sink;
+    auto reorder = sink.Create(16, TEST_NO_HOLD_MS);
+    std::vector<std::thread> threads;
+    std::vector<ULONG> rejected(workers);
+    ULONG failures = 0;
+
+    CHECK(SUCCEEDED(reorder->Start(1)));
+
+    // Worker i inserts the sequences i + 1 modulo the worker count, the last
+    // one in reverse, so most of its events are parked.
+    for (ULONG i = 0; i < workers; ++i) {
+        threads.emplace_back([&, i]() {
+            for (ULONG64 k = 0; k < count / workers; ++k) {
+                const ULONG64 index = i == workers - 1 ? count / workers - 1 - k : k;
+                if (!reorder->Insert(TestNotification(index * workers + i + 1))) {
+                    rejected[i]++;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    CHECK(sink.WaitFor(count));
+    reorder->Stop();
+
+    CHECK(sink.Emitted == TestRange(1, count));
+    CHECK(sink.Gaps.empty());
+    CHECK(sink.Corrupted == 0);
+    CHECK(std::count(rejected.begin(), rejected.end(), 0u) == static_cast<long>(workers));
+    CHECK(reorder->Depth() == 0);
+    return failures;
+}
+
+static const TEST_CASE TestCases[] = {
+    { "events within the window are written in order", TestWithinWindow },
+    { "events beyond the window are parked until the writer catches up", TestParked },
+    { "events shuffled across the window edge are written in order", TestAcrossEdge },
+    { "a parked discard is reported as a gap", TestParkedDiscard },
+    { "replay duplicates in the ring and parked are dropped", TestDuplicates },
+    { "a missing sequence is requested again, then skipped as a gap", TestResendThenGap },
+    { "the writer stops at the first missing sequence", TestStopAtMissing },
+    { "concurrent workers across the window edge", TestConcurrentWorkers },
+};
+
+int main() {
+    ULONG failures = 0;
+
+    for (const TEST_CASE& test : TestCases) {
+        ULONG caseFailures = test.Run(test.Title);
+
+        if (caseFailures == 0) {
+            printf("ok   %s\n", test.Title);
+        }
+        failures += caseFailures;
+    }
+
+    printf("%u failure(s)\n", failures);
+    return static_cast<int>(failures);
+}
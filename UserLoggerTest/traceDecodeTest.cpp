@@ -0,0 +1,170 @@
+/*++
+Module Name:
+    traceDecodeTest.cpp
+
+Abstract:
+    Checks that LoggerDecodeTrace turns a trace file, as LoggerTraceWorker
+    writes it from the driver's read replies, into the expected text.
+    The process exits with the number of failed checks.
+
+Environment:
+    User mode
+--*/
+
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <windows.h>
+#include <fltUser.h>
+#include "userlogger.h"
+#include "traceDecode.h"
+
+#define CHECK(Condition)                                                        \
+    if (!(Condition)) {                                                         \
+        printf("FAIL %s: %s, line %d\n", Title, #Condition, __LINE__);          \
+        failures++;                                                             \
+    }
+
+struct TEST_CASE {
+    const char* Title;
+    ULONG (*Run)(const char* Title);
+};
+
+static void TestAppendReply(std::string& trace, ULONG recordCount, ULONG lostCount) {
+    LOGGER_TRACE_READ_REPLY header = {};
+
+    header.Frequency = 10000000;
+    header.RecordCount = recordCount;
+    header.LostCount = lostCount;
+    trace.append(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+static void TestAppendRecord(std::string& trace, LONG64 timestamp, ULONG processor, UCHAR level,
+    UCHAR category, USHORT formatId, UINT64 a0, UINT64 a1, UINT64 a2, UINT64 a3) {
+    LOGGER_TRACE_RECORD record = {};
+
+    record.Stamp = 1;
+    record.Timestamp = timestamp;
+    record.FormatId = formatId;
+    record.Level = level;
+    record.Category = category;
+    record.Processor = processor;
+    record.Args[0] = a0;
+    record.Args[1] = a1;
+    record.Args[2] = a2;
+    record.Args[3] = a3;
+    trace.append(reinterpret_cast<const char*>(&record), sizeof(record));
+}
+
+static int TestDecode(const std::string& trace, std::string& text) {
+    std::istringstream input(trace);
+    char buffer[4096];
+    size_t length;
+    FILE* output = tmpfile();
+    int result;
+
+    result = LoggerDecodeTrace(input, output);
+
+    rewind(output);
+    text.clear();
+    while ((length = fread(buffer, 1, sizeof(buffer), output)) != 0) {
+        text.append(buffer, length);
+    }
+    fclose(output);
+    return result;
+}
+
+
+/*************************************************************************
+    Cases
+*************************************************************************/
+
+static ULONG TestRecords(const char* Title) {
+    std::string trace;
+    std::string text;
+    ULONG failures = 0;
+
+    TestAppendReply(trace, 2, 0);
+    TestAppendRecord(trace, 1000, 2, 2, 0x04, 7, 5, 6, 9, 0);
+    TestAppendRecord(trace, 1025, 11, 1, 0x02, 5, 12, 0xC0000037, 0, 0);
+
+    CHECK(TestDecode(trace, text) == 0);
+    CHECK(text ==
+        "           0.0 cpu2   INFO    cat 0x04  replay after 5: first 6, next 9\n"
+        "           2.5 cpu11  ERROR   cat 0x02  failed to send sequence 12, status 0xC0000037\n");
+    return failures;
+}
+
+static ULONG TestLostAndUnknown(const char* Title) {
+    std::string trace;
+    std::string text;
+    ULONG failures = 0;
+
+    TestAppendReply(trace, 1, 0);
+    TestAppendRecord(trace, 500, 0, 2, 0x01, 4, 1, 0, 0, 0);
+    TestAppendReply(trace, 0, 0);
+    TestAppendReply(trace, 1, 3);
+    TestAppendRecord(trace, 500 + 10000000, 0, 7, 0x01, 99, 1, 2, 3, 0xFF);
+
+    CHECK(TestDecode(trace, text) == 0);
+    CHECK(text ==
+        "           0.0 cpu0   INFO    cat 0x01  sent sequence 1\n"
+        "-- 3 record(s) lost --\n"
+        "     1000000.0 cpu0   ?       cat 0x01  unknown format 99: 0x1 0x2 0x3 0xFF\n");
+    return failures;
+}
+
+static ULONG TestTruncated(const char* Title) {
+    std::string trace;
+    std::string text;
+    ULONG failures = 0;
+
+    TestAppendReply(trace, 2, 0);
+    TestAppendRecord(trace, 0, 1, 3, 0x08, 10, 4, 1, 0, 0);
+
+    CHECK(TestDecode(trace, text) == 1);
+    CHECK(text == "           0.0 cpu1   VERBOSE cat 0x08  process 4 started, on lists 0x1\n");
+    return failures;
+}
+
+static ULONG TestFormats(const char* Title) {
+    ULONG failures = 0;
+
+    // Every conversion takes an unsigned 64-bit value, and no more than
+    // the record carries.
+    for (size_t i = 1; i < _countof(LoggerTraceFormats); ++i) {
+        const char* format = LoggerTraceFormats[i];
+        ULONG conversions = 0;
+
+        while ((format = strchr(format, '%')) != nullptr) {
+            CHECK(strncmp(format, "%llu", 4) == 0 || strncmp(format, "%llX", 4) == 0);
+            conversions++;
+            format++;
+        }
+        CHECK(conversions <= LOGGER_TRACE_MAX_ARGS);
+    }
+    return failures;
+}
+
+static const TEST_CASE TestCases[] = {
+    { "records are printed with their level, time and format", TestRecords },
+    { "lost records and unknown formats are reported", TestLostAndUnknown },
+    { "a trace cut inside a reply is an error", TestTruncated },
+    { "decoder formats take 64-bit arguments", TestFormats },
+};
+
+int main() {
+    ULONG failures = 0;
+
+    for (const TEST_CASE& test : TestCases) {
+        ULONG caseFailures = test.Run(test.Title);
+
+        if (caseFailures == 0) {
+            printf("ok   %s\n", test.Title);
+        }
+        failures += caseFailures;
+    }
+
+    printf("%u failure(s)\n", failures);
+    return static_cast<int>(failures);
+}
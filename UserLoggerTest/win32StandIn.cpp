@@ -0,0 +1,425 @@
+/*++
+Module Name:
+    win32StandIn.cpp
+
+Abstract:
+    Implements the Win32 routines declared by the stand-in windows.h for the
+    UserLogger tests. Events and threads are waitable objects behind the
+    HANDLE; a thread keeps its own reference until it returns, so it may be
+    closed while running like a Win32 thread. A file mapping is a block of
+    memory, and each view of it holds a reference like a handle does. Named
+    events and mappings are found by name while a reference remains. A
+    completion port is a queue of packets, and a file associated with it
+    holds a reference to it.
+
+Environment:
+    User mode
+--*/
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <windows.h>
+
+enum STANDIN_KIND {
+    StandInWaitable,
+    StandInMapping,
+    StandInFile,
+    StandInCompletion,
+};
+
+struct STANDIN_PACKET {
+    DWORD BytesTransferred;
+    ULONG_PTR CompletionKey;
+    LPOVERLAPPED Overlapped;
+    DWORD Error;
+};
+
+struct STANDIN_OBJECT {
+    std::atomic<LONG> References{ 1 };
+    std::mutex Lock;
+    std::condition_variable Changed;
+    bool Signaled = false;
+    bool ManualReset = true;
+    STANDIN_KIND Kind = StandInWaitable;
+    // Empty for an object without a name.
+    std::wstring Name;
+    std::vector<UCHAR> Data;
+    // The completion port of a file, and the packets of a completion port.
+    STANDIN_OBJECT* Completion = nullptr;
+    ULONG_PTR CompletionKey = 0;
+    std::deque<STANDIN_PACKET> Packets;
+};
+
+static thread_local DWORD StandInLastError = ERROR_SUCCESS;
+
+// Named objects, and the mapping behind each view. Taking a reference by
+// name and dropping the last one both happen under the lock.
+static std::mutex StandInNamesLock;
+static std::map<std::wstring, STANDIN_OBJECT*> StandInNames;
+static std::multimap<const void*, STANDIN_OBJECT*> StandInViews;
+
+static void StandInRelease(STANDIN_OBJECT* object);
+
+static void StandInDelete(STANDIN_OBJECT* object) {
+    STANDIN_OBJECT* completion = object->Completion;
+
+    delete object;
+    if (completion) {
+        StandInRelease(completion);
+    }
+}
+
+static void StandInRelease(STANDIN_OBJECT* object) {
+    if (object->Name.empty()) {
+        if (object->References.fetch_sub(1) == 1) {
+            StandInDelete(object);
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(StandInNamesLock);
+    if (object->References.fetch_sub(1) == 1) {
+        StandInNames.erase(object->Name);
+        StandInDelete(object);
+    }
+}
+
+// Returns a new reference to the named object of that kind, or nullptr with
+// the last error set.
+static STANDIN_OBJECT* StandInOpen(LPCWSTR name, STANDIN_KIND kind) {
+    std::lock_guard<std::mutex> guard(StandInNamesLock);
+    auto found = StandInNames.find(name);
+
+    if (found == StandInNames.end()) {
+        StandInLastError = ERROR_FILE_NOT_FOUND;
+        return nullptr;
+    }
+    if (found->second->Kind != kind) {
+        StandInLastError = ERROR_INVALID_HANDLE;
+        return nullptr;
+    }
+    found->second->References.fetch_add(1);
+    StandInLastError = ERROR_SUCCESS;
+    return found->second;
+}
+
+// Opens the named object, or creates it with create. The last error is
+// ERROR_ALREADY_EXISTS when it was opened.
+template <typename CREATE>
+static STANDIN_OBJECT* StandInOpenOrCreate(LPCWSTR name, STANDIN_KIND kind, CREATE create) {
+    std::lock_guard<std::mutex> guard(StandInNamesLock);
+    auto found = StandInNames.find(name);
+
+    if (found != StandInNames.end()) {
+        if (found->second->Kind != kind) {
+            StandInLastError = ERROR_INVALID_HANDLE;
+            return nullptr;
+        }
+        found->second->References.fetch_add(1);
+        StandInLastError = ERROR_ALREADY_EXISTS;
+        return found->second;
+    }
+
+    STANDIN_OBJECT* object = create();
+    object->Kind = kind;
+    object->Name = name;
+    StandInNames[object->Name] = object;
+    StandInLastError = ERROR_SUCCESS;
+    return object;
+}
+
+static void StandInSignal(STANDIN_OBJECT* object) {
+    std::lock_guard<std::mutex> guard(object->Lock);
+
+    object->Signaled = true;
+    if (object->ManualReset) {
+        object->Changed.notify_all();
+    }
+    else {
+        object->Changed.notify_one();
+    }
+}
+
+DWORD GetLastError() {
+    return StandInLastError;
+}
+
+HANDLE CreateThread(PVOID, SIZE_T, LPTHREAD_START_ROUTINE start, LPVOID parameter, DWORD, LPDWORD threadId) {
+    STANDIN_OBJECT* object = new STANDIN_OBJECT;
+
+    // One reference for the handle, one for the running thread.
+    object->References.store(2);
+
+    std::thread([object, start, parameter]() {
+        start(parameter);
+        StandInSignal(object);
+        StandInRelease(object);
+    }).detach();
+
+    if (threadId) {
+        *threadId = 0;
+    }
+    return object;
+}
+
+BOOL SetThreadPriority(HANDLE, int) {
+    return TRUE;
+}
+
+HANDLE CreateEventW(PVOID, BOOL manualReset, BOOL initialState, LPCWSTR name) {
+    auto create = [manualReset, initialState]() {
+        STANDIN_OBJECT* object = new STANDIN_OBJECT;
+        object->ManualReset = manualReset != FALSE;
+        object->Signaled = initialState != FALSE;
+        return object;
+    };
+
+    if (name) {
+        return StandInOpenOrCreate(name, StandInWaitable, create);
+    }
+    StandInLastError = ERROR_SUCCESS;
+    return create();
+}
+
+HANDLE OpenEventW(DWORD, BOOL, LPCWSTR name) {
+    return StandInOpen(name, StandInWaitable);
+}
+
+BOOL SetEvent(HANDLE event) {
+    StandInSignal(static_cast<STANDIN_OBJECT*>(event));
+    return TRUE;
+}
+
+DWORD WaitForSingleObject(HANDLE handle, DWORD milliseconds) {
+    STANDIN_OBJECT* object = static_cast<STANDIN_OBJECT*>(handle);
+    std::unique_lock<std::mutex> guard(object->Lock);
+    auto signaled = [object]() { return object->Signaled; };
+
+    if (milliseconds == INFINITE) {
+        object->Changed.wait(guard, signaled);
+    }
+    else if (!object->Changed.wait_for(guard, std::chrono::milliseconds(milliseconds), signaled)) {
+        return WAIT_TIMEOUT;
+    }
+
+    if (!object->ManualReset) {
+        object->Signaled = false;
+    }
+    return WAIT_OBJECT_0;
+}
+
+BOOL CloseHandle(HANDLE handle) {
+    if (!handle) {
+        StandInLastError = ERROR_INVALID_HANDLE;
+        return FALSE;
+    }
+    StandInRelease(static_cast<STANDIN_OBJECT*>(handle));
+    return TRUE;
+}
+
+void Sleep(DWORD milliseconds) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+}
+
+ULONGLONG GetTickCount64() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<ULONGLONG>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+void GetSystemTimePreciseAsFileTime(LPFILETIME systemTime) {
+    // Seconds from 1601 to 1970.
+    constexpr ULONGLONG unixEpoch = 11644473600ull;
+    struct timespec now;
+    ULARGE_INTEGER time;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    time.QuadPart = (static_cast<ULONGLONG>(now.tv_sec) + unixEpoch) * 10000000 + now.tv_nsec / 100;
+    systemTime->dwLowDateTime = time.LowPart;
+    systemTime->dwHighDateTime = time.HighPart;
+}
+
+BOOL MoveFileExA(LPCSTR existingFileName, LPCSTR newFileName, DWORD flags) {
+    // rename replaces the target on POSIX; without the flag it must not.
+    if (!(flags & MOVEFILE_REPLACE_EXISTING)) {
+        FILE* existing = fopen(newFileName, "rb");
+        if (existing) {
+            fclose(existing);
+            StandInLastError = ERROR_ALREADY_EXISTS;
+            return FALSE;
+        }
+    }
+    if (rename(existingFileName, newFileName) != 0) {
+        StandInLastError = errno == ENOENT ? ERROR_FILE_NOT_FOUND : ERROR_ACCESS_DENIED;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+DWORD GetCurrentProcessId() {
+    return static_cast<DWORD>(getpid());
+}
+
+HANDLE OpenProcess(DWORD, BOOL, DWORD processId) {
+    if (processId != GetCurrentProcessId()) {
+        StandInLastError = ERROR_INVALID_PARAMETER;
+        return nullptr;
+    }
+    StandInLastError = ERROR_SUCCESS;
+    return new STANDIN_OBJECT;
+}
+
+HANDLE CreateFileMappingW(HANDLE file, PVOID, DWORD, DWORD maximumSizeHigh, DWORD maximumSizeLow, LPCWSTR name) {
+    const ULONG64 size = (static_cast<ULONG64>(maximumSizeHigh) << 32) | maximumSizeLow;
+    auto create = [size]() {
+        STANDIN_OBJECT* object = new STANDIN_OBJECT;
+        object->Data.resize(size);
+        return object;
+    };
+
+    if (file != INVALID_HANDLE_VALUE || size == 0) {
+        StandInLastError = ERROR_INVALID_PARAMETER;
+        return nullptr;
+    }
+    if (name) {
+        return StandInOpenOrCreate(name, StandInMapping, create);
+    }
+
+    STANDIN_OBJECT* object = create();
+    object->Kind = StandInMapping;
+    StandInLastError = ERROR_SUCCESS;
+    return object;
+}
+
+HANDLE OpenFileMappingW(DWORD, BOOL, LPCWSTR name) {
+    return StandInOpen(name, StandInMapping);
+}
+
+LPVOID MapViewOfFile(HANDLE mapping, DWORD, DWORD offsetHigh, DWORD offsetLow, SIZE_T bytes) {
+    STANDIN_OBJECT* object = static_cast<STANDIN_OBJECT*>(mapping);
+    const ULONG64 offset = (static_cast<ULONG64>(offsetHigh) << 32) | offsetLow;
+
+    if (object->Kind != StandInMapping || offset + bytes > object->Data.size()) {
+        StandInLastError = ERROR_INVALID_PARAMETER;
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> guard(StandInNamesLock);
+    object->References.fetch_add(1);
+    StandInViews.emplace(object->Data.data() + offset, object);
+    return object->Data.data() + offset;
+}
+
+BOOL UnmapViewOfFile(const void* baseAddress) {
+    STANDIN_OBJECT* object;
+
+    {
+        std::lock_guard<std::mutex> guard(StandInNamesLock);
+        auto found = StandInViews.find(baseAddress);
+
+        if (found == StandInViews.end()) {
+            StandInLastError = ERROR_INVALID_PARAMETER;
+            return FALSE;
+        }
+        object = found->second;
+        StandInViews.erase(found);
+    }
+    StandInRelease(object);
+    return TRUE;
+}
+
+HANDLE CreateIoCompletionPort(HANDLE file, HANDLE existingCompletionPort, ULONG_PTR completionKey, DWORD) {
+    STANDIN_OBJECT* completion = static_cast<STANDIN_OBJECT*>(existingCompletionPort);
+
+    if (file != INVALID_HANDLE_VALUE) {
+        STANDIN_OBJECT* object = static_cast<STANDIN_OBJECT*>(file);
+
+        if (!object || object->Kind != StandInFile || object->Completion) {
+            StandInLastError = ERROR_INVALID_PARAMETER;
+            return nullptr;
+        }
+    }
+
+    if (!completion) {
+        completion = new STANDIN_OBJECT;
+        completion->Kind = StandInCompletion;
+    }
+    else if (completion->Kind != StandInCompletion) {
+        StandInLastError = ERROR_INVALID_PARAMETER;
+        return nullptr;
+    }
+
+    if (file != INVALID_HANDLE_VALUE) {
+        STANDIN_OBJECT* object = static_cast<STANDIN_OBJECT*>(file);
+
+        // The file's reference; a new completion port starts with the handle's.
+        if (existingCompletionPort) {
+            completion->References.fetch_add(1);
+        }
+        else {
+            completion->References.store(2);
+        }
+        object->Completion = completion;
+        object->CompletionKey = completionKey;
+    }
+    StandInLastError = ERROR_SUCCESS;
+    return completion;
+}
+
+BOOL GetQueuedCompletionStatus(HANDLE completionPort, LPDWORD bytesTransferred, ULONG_PTR* completionKey,
+    LPOVERLAPPED* overlapped, DWORD milliseconds) {
+    STANDIN_OBJECT* completion = static_cast<STANDIN_OBJECT*>(completionPort);
+    std::unique_lock<std::mutex> guard(completion->Lock);
+    auto queued = [completion]() { return !completion->Packets.empty(); };
+
+    if (milliseconds == INFINITE) {
+        completion->Changed.wait(guard, queued);
+    }
+    else if (!completion->Changed.wait_for(guard, std::chrono::milliseconds(milliseconds), queued)) {
+        *overlapped = nullptr;
+        StandInLastError = WAIT_TIMEOUT;
+        return FALSE;
+    }
+
+    const STANDIN_PACKET packet = completion->Packets.front();
+    completion->Packets.pop_front();
+
+    *bytesTransferred = packet.BytesTransferred;
+    *completionKey = packet.CompletionKey;
+    *overlapped = packet.Overlapped;
+    StandInLastError = packet.Error;
+    return packet.Error == ERROR_SUCCESS;
+}
+
+HANDLE StandInCreateFile() {
+    STANDIN_OBJECT* object = new STANDIN_OBJECT;
+
+    object->Kind = StandInFile;
+    return object;
+}
+
+BOOL StandInCompleteIo(HANDLE file, LPOVERLAPPED overlapped, DWORD bytesTransferred, DWORD error) {
+    STANDIN_OBJECT* completion = static_cast<STANDIN_OBJECT*>(file)->Completion;
+
+    if (!completion) {
+        return FALSE;
+    }
+
+    std::lock_guard<std::mutex> guard(completion->Lock);
+    completion->Packets.push_back({ bytesTransferred, static_cast<STANDIN_OBJECT*>(file)->CompletionKey,
+        overlapped, error });
+    completion->Changed.notify_one();
+    return TRUE;
+}
@@ -0,0 +1,269 @@
+/*++
+Module Name:
+    windows.h
+
+Abstract:
+    User-mode stand-in for the Win32 headers, so that the UserLogger sources
+    can be compiled into the UserLogger tests as they are, with GCC or Clang
+    on any POSIX system. Only what those sources use is declared. The
+    routines are implemented in win32StandIn.cpp on top of the C++ standard
+    library and POSIX.
+
+Environment:
+    User mode
+--*/
+
+#ifndef __USERLOGGERTEST_WINDOWS_H__
+#define __USERLOGGERTEST_WINDOWS_H__
+
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// The MSVC headers bring these in along the way, and main.cpp relies on it.
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+
+/*************************************************************************
+    Basic types
+*************************************************************************/
+
+#define VOID                void
+#define TRUE                1
+#define FALSE               0
+#define WINAPI
+
+typedef void* PVOID, * LPVOID;
+typedef const void* LPCVOID;
+typedef unsigned char UCHAR, BYTE, * PUCHAR;
+typedef char CHAR, * PCHAR, * PSTR;
+typedef const char* PCSTR, * LPCSTR;
+typedef uint16_t USHORT, WORD;
+typedef int32_t LONG, BOOL, HRESULT;
+typedef uint32_t ULONG, DWORD, * PULONG, * LPDWORD;
+typedef long long LONG64, LONGLONG;
+typedef unsigned long long ULONG64, UINT64, ULONGLONG, DWORD64;
+typedef uintptr_t ULONG_PTR, SIZE_T;
+typedef wchar_t WCHAR, * PWSTR, * LPWSTR;
+typedef const wchar_t* PCWSTR, * LPCWSTR;
+typedef void* HANDLE;
+typedef struct _SECURITY_ATTRIBUTES* LPSECURITY_ATTRIBUTES;
+
+#define _countof(A)         (sizeof(A) / sizeof((A)[0]))
+#define FIELD_OFFSET(Type, Field)           offsetof(Type, Field)
+#define ZeroMemory(Destination, Length)     memset((Destination), 0, (Length))
+#define CONTAINING_RECORD(Address, Type, Field) \
+    ((Type*)((PCHAR)(Address) - offsetof(Type, Field)))
+
+#define INFINITE            0xFFFFFFFF
+#define INVALID_HANDLE_VALUE ((HANDLE)(intptr_t)-1)
+
+typedef struct _FILETIME {
+    DWORD dwLowDateTime;
+    DWORD dwHighDateTime;
+} FILETIME, * LPFILETIME;
+
+typedef union _ULARGE_INTEGER {
+    struct {
+        DWORD LowPart;
+        DWORD HighPart;
+    };
+    ULONGLONG QuadPart;
+} ULARGE_INTEGER;
+
+typedef struct _OVERLAPPED {
+    ULONG_PTR Internal;
+    ULONG_PTR InternalHigh;
+    union {
+        struct {
+            DWORD Offset;
+            DWORD OffsetHigh;
+        };
+        PVOID Pointer;
+    };
+    HANDLE hEvent;
+} OVERLAPPED, * LPOVERLAPPED;
+
+
+/*************************************************************************
+    Errors
+*************************************************************************/
+
+#define ERROR_SUCCESS               0
+#define ERROR_FILE_NOT_FOUND        2
+#define ERROR_ACCESS_DENIED         5
+#define ERROR_INVALID_HANDLE        6
+#define ERROR_NOT_ENOUGH_MEMORY     8
+#define ERROR_INVALID_DATA          13
+#define ERROR_INVALID_PARAMETER     87
+#define ERROR_ALREADY_EXISTS        183
+#define ERROR_IO_PENDING            997
+
+#define S_OK                        ((HRESULT)0)
+#define E_FAIL                      ((HRESULT)0x80004005)
+#define E_HANDLE                    ((HRESULT)0x80070006)
+#define E_OUTOFMEMORY               ((HRESULT)0x8007000E)
+#define E_INVALIDARG                ((HRESULT)0x80070057)
+
+#define SUCCEEDED(hr)               ((HRESULT)(hr) >= 0)
+#define FAILED(hr)                  ((HRESULT)(hr) < 0)
+#define HRESULT_FROM_WIN32(x)       ((HRESULT)(x) <= 0 ? (HRESULT)(x) : \
+                                     (HRESULT)(((x) & 0x0000FFFF) | 0x80070000))
+
+DWORD GetLastError();
+
+
+/*************************************************************************
+    Time, files and intrinsics
+*************************************************************************/
+
+#define MOVEFILE_REPLACE_EXISTING   0x00000001
+
+// 100 ns units since 1601, from the real-time clock.
+void GetSystemTimePreciseAsFileTime(LPFILETIME systemTime);
+
+BOOL MoveFileExA(LPCSTR existingFileName, LPCSTR newFileName, DWORD flags);
+
+inline UCHAR _BitScanReverse64(unsigned long* index, ULONG64 mask) {
+    if (mask == 0) {
+        return 0;
+    }
+    *index = 63 - __builtin_clzll(mask);
+    return 1;
+}
+
+inline UCHAR _BitScanForward64(unsigned long* index, ULONG64 mask) {
+    if (mask == 0) {
+        return 0;
+    }
+    *index = __builtin_ctzll(mask);
+    return 1;
+}
+
+
+/*************************************************************************
+    Threads, events and locks
+*************************************************************************/
+
+#define WAIT_OBJECT_0                   0
+#define WAIT_TIMEOUT                    258
+#define WAIT_FAILED                     0xFFFFFFFF
+
+#define THREAD_PRIORITY_NORMAL          0
+#define THREAD_PRIORITY_ABOVE_NORMAL    1
+
+typedef DWORD (WINAPI* LPTHREAD_START_ROUTINE)(LPVOID Parameter);
+
+HANDLE CreateThread(PVOID attributes, SIZE_T stackSize, LPTHREAD_START_ROUTINE start, LPVOID parameter,
+    DWORD flags, LPDWORD threadId);
+BOOL SetThreadPriority(HANDLE thread, int priority);
+
+HANDLE CreateEventW(PVOID attributes, BOOL manualReset, BOOL initialState, LPCWSTR name);
+BOOL SetEvent(HANDLE event);
+
+DWORD WaitForSingleObject(HANDLE handle, DWORD milliseconds);
+BOOL CloseHandle(HANDLE handle);
+
+void Sleep(DWORD milliseconds);
+ULONGLONG GetTickCount64();
+
+// The tests often run on fewer processors than threads, where spinning on a
+// pause instruction would hold up the thread being waited for.
+#define YieldProcessor()            sched_yield()
+
+inline LONG InterlockedExchange(volatile LONG* target, LONG value) {
+    return __atomic_exchange_n(target, value, __ATOMIC_SEQ_CST);
+}
+
+inline LONG64 InterlockedExchange64(volatile LONG64* target, LONG64 value) {
+    return __atomic_exchange_n(target, value, __ATOMIC_SEQ_CST);
+}
+
+inline LONG InterlockedCompareExchange(volatile LONG* target, LONG exchange, LONG comparand) {
+    __atomic_compare_exchange_n(target, &comparand, exchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return comparand;
+}
+
+inline LONG InterlockedIncrement(volatile LONG* target) {
+    return __atomic_add_fetch(target, 1, __ATOMIC_SEQ_CST);
+}
+
+inline LONG InterlockedDecrement(volatile LONG* target) {
+    return __atomic_sub_fetch(target, 1, __ATOMIC_SEQ_CST);
+}
+
+inline LONG ReadAcquire(const volatile LONG* source) {
+    return __atomic_load_n(source, __ATOMIC_ACQUIRE);
+}
+
+inline LONG64 ReadAcquire64(const volatile LONG64* source) {
+    return __atomic_load_n(source, __ATOMIC_ACQUIRE);
+}
+
+typedef struct _SRWLOCK {
+    pthread_rwlock_t Lock;
+} SRWLOCK, * PSRWLOCK;
+
+#define SRWLOCK_INIT                { PTHREAD_RWLOCK_INITIALIZER }
+
+inline void AcquireSRWLockExclusive(PSRWLOCK lock) { pthread_rwlock_wrlock(&lock->Lock); }
+inline void ReleaseSRWLockExclusive(PSRWLOCK lock) { pthread_rwlock_unlock(&lock->Lock); }
+inline void AcquireSRWLockShared(PSRWLOCK lock) { pthread_rwlock_rdlock(&lock->Lock); }
+inline void ReleaseSRWLockShared(PSRWLOCK lock) { pthread_rwlock_unlock(&lock->Lock); }
+
+
+
+/*************************************************************************
+    Processes and shared memory
+*************************************************************************/
+
+// Named objects live in one namespace of the test process, until the last
+// handle and view of them goes away, as in a Win32 session.
+
+#define SYNCHRONIZE                 0x00100000
+#define EVENT_MODIFY_STATE          0x0002
+
+#define PAGE_READWRITE              0x04
+#define FILE_MAP_WRITE              0x0002
+#define FILE_MAP_READ               0x0004
+
+DWORD GetCurrentProcessId();
+
+// Only the test process itself can be opened; it never exits.
+HANDLE OpenProcess(DWORD access, BOOL inheritHandle, DWORD processId);
+
+HANDLE OpenEventW(DWORD access, BOOL inheritHandle, LPCWSTR name);
+
+// Only mappings backed by the paging file, file set to INVALID_HANDLE_VALUE.
+HANDLE CreateFileMappingW(HANDLE file, PVOID attributes, DWORD protect, DWORD maximumSizeHigh,
+    DWORD maximumSizeLow, LPCWSTR name);
+HANDLE OpenFileMappingW(DWORD access, BOOL inheritHandle, LPCWSTR name);
+
+// Views at the same offset of a mapping share an address.
+LPVOID MapViewOfFile(HANDLE mapping, DWORD access, DWORD offsetHigh, DWORD offsetLow, SIZE_T bytes);
+BOOL UnmapViewOfFile(const void* baseAddress);
+
+
+/*************************************************************************
+    I/O completion ports
+*************************************************************************/
+
+// Packets are taken in the order they were queued, by whichever thread
+// waits; the number of concurrent threads is not limited.
+HANDLE CreateIoCompletionPort(HANDLE file, HANDLE existingCompletionPort, ULONG_PTR completionKey,
+    DWORD numberOfConcurrentThreads);
+BOOL GetQueuedCompletionStatus(HANDLE completionPort, LPDWORD bytesTransferred, ULONG_PTR* completionKey,
+    LPOVERLAPPED* overlapped, DWORD milliseconds);
+
+// Not Win32: the handle of a file or device that a test simulates, and the
+// completion of an I/O on it. The I/O is failed with error, unless it is
+// ERROR_SUCCESS, and queued to the completion port associated with the
+// file. Returns FALSE if there is none.
+HANDLE StandInCreateFile();
+BOOL StandInCompleteIo(HANDLE file, LPOVERLAPPED overlapped, DWORD bytesTransferred, DWORD error);
+
+#endif
@@ -17,7 +17,11 @@ Environment:
 #include <fltKernel.h>
 #include <dontuse.h>
 #include <ntstrsafe.h>
+#include "loggerMatch.h"
+#include "loggerRundown.h"
 #include "loggerFilter.h"
+#include "loggerTrace.h"
+#include "loggerProcess.h"
 
 #pragma prefast(disable:__WARNING_ENCODE_MEMBER_FUNCTION_POINTER, "Not valid for kernel mode drivers")
 
@@ -31,7 +35,26 @@ Environment:
 #pragma alloc_text(PAGE, LoggerCreatePreRoutine)
 #pragma alloc_text(PAGE, LoggerPortConnect)
 #pragma alloc_text(PAGE, LoggerPortDisconnect)
+#pragma alloc_text(PAGE, LoggerPortMessage)
 #pragma alloc_text(PAGE, SendMessageToUserMode)
+#pragma alloc_text(INIT, LoggerConnectionInitialize)
+#pragma alloc_text(PAGE, LoggerConnectionFree)
+#pragma alloc_text(PAGE, LoggerConnectionOpen)
+#pragma alloc_text(PAGE, LoggerConnectionClose)
+#pragma alloc_text(INIT, LoggerLaneInitialize)
+#pragma alloc_text(PAGE, LoggerLaneFree)
+#pragma alloc_text(PAGE, LoggerBacklogInitialize)
+#pragma alloc_text(PAGE, LoggerBacklogFree)
+#pragma alloc_text(PAGE, LoggerBacklogRecord)
+#pragma alloc_text(PAGE, LoggerBacklogShed)
+#pragma alloc_text(PAGE, LoggerBacklogAcknowledge)
+#pragma alloc_text(PAGE, LoggerBacklogQuery)
+#pragma alloc_text(PAGE, LoggerBacklogReplay)
+#pragma alloc_text(PAGE, LoggerBacklogResend)
+#pragma alloc_text(INIT, LoggerCompileTargets)
+#pragma alloc_text(PAGE, LoggerOpenParametersKey)
+#pragma alloc_text(PAGE, LoggerReadRegistryDword)
+#pragma alloc_text(PAGE, LoggerReadRegistryValue)
 #endif
 
 
@@ -48,7 +71,10 @@ LoggerCreatePreRoutine(
 /*
 Routine Description:
     This routine is called before a file is created or opened.
-    It sends a notification to a user-mode application that logs the events.
+    It records the event in the backlog of its lane and sends a notification
+    to a user-mode application that logs the events. When no application is
+    connected the event stays in the backlog until one connects and asks
+    for a replay.
 
 Arguments:
     data - Structure containing information about the ongoing operation.
@@ -65,6 +91,14 @@ Return Value:
     PFLT_FILE_NAME_INFORMATION name_info = NULL;
     PLOGGER_NOTIFICATION notification = NULL;
     PLOGGER_STREAM_HANDLE_CONTEXT context = NULL;
+    ULONG rule;
+    PLOGGER_LANE lane;
+    LARGE_INTEGER timestamp;
+
+    // Drop excluded processes before paying for the name query.
+    if (!LoggerProcessFilterAllows(PsGetCurrentProcessId())) {
+        return FLT_PREOP_SUCCESS_NO_CALLBACK;
+    }
 
     status = FltGetFileNameInformation(data,
         FLT_FILE_NAME_NORMALIZED
@@ -75,26 +109,18 @@ Return Value:
         return FLT_PREOP_SUCCESS_NO_CALLBACK;
     }
 
-    status = FltParseFileNameInformation(name_info);
-    if (!NT_SUCCESS(status)) {
+    // If no target rule matches the file, we don't need to monitor it.
+    // All rules are checked in a single pass over the name.
+    if (!LoggerMatcherMatch(&LoggerFilterData.Targets, &name_info->Name, &rule)) {
         FltReleaseFileNameInformation(name_info);
         return FLT_PREOP_SUCCESS_NO_CALLBACK;
     }
 
-    // If the file is not the target file, we don't need to monitor it.
-    if (RtlCompareUnicodeString(&name_info->Name, &TargetFilePath, TRUE) != 0) {
-        FltReleaseFileNameInformation(name_info);
-        return FLT_PREOP_SUCCESS_NO_CALLBACK;
-    }
+    LOGGER_TRACE_VERBOSE(CREATE, LoggerTraceCreateMatched,
+        PtrToUint(PsGetCurrentProcessId()), name_info->Name.Length, rule, 0);
 
-    KdPrint(("[LoggerFilter] " __FUNCTION__ " [%u] Start     to creat/open the file (%wZ)\n",
-        PtrToUint(PsGetCurrentProcessId()),
-        &name_info->FinalComponent));
+    FltReleaseFileNameInformation(name_info);
 
-    //  If no client port just ignore this write.
-    if (LoggerFilterData.ClientPort == NULL) {
-        return FLT_PREOP_SUCCESS_NO_CALLBACK;
-    }
     status = FltGetStreamHandleContext(flt_object->Instance,
         flt_object->FileObject,
         &context);
@@ -108,33 +134,69 @@ Return Value:
                 'nacS');
 
             if (notification == NULL) {
+                LOGGER_TRACE_ERROR(CREATE, LoggerTraceCreateNoMemory,
+                    PtrToUint(PsGetCurrentProcessId()), 0, 0, 0);
                 data->IoStatus.Status = STATUS_INSUFFICIENT_RESOURCES;
                 data->IoStatus.Information = 0;
                 //returnStatus = FLT_PREOP_COMPLETE;
                 leave;
             }
 
+            // High priority rules come first in the matcher; the lane
+            // decides the port, backlog and sequence space of the event.
+            if (rule < LoggerFilterData.HighPriorityRuleCount) {
+                lane = &LoggerFilterData.Lanes[LoggerPriorityHigh];
+            }
+            else {
+                lane = &LoggerFilterData.Lanes[LoggerPriorityBulk];
+                rule -= LoggerFilterData.HighPriorityRuleCount;
+            }
+
             // Get the current process ID
             notification->ProcessId = (UINT64)(ULONG_PTR)PsGetCurrentProcessId();
+            notification->Rule = rule;
+            notification->Priority = lane->Priority;
+
+            // UserLogger measures the end-to-end latency from this stamp.
+            KeQuerySystemTimePrecise(&timestamp);
+            notification->Timestamp = timestamp.QuadPart;
+
             CHAR formattedTime[20];
             GetFormattedTime(formattedTime, sizeof(formattedTime));
-            DbgPrint("Current Time: %s\n", formattedTime);
 
             // Assuming `formattedTime` is a string and `notification->Time` is a character array, use strcpy to copy the string.
             strcpy(notification->Time, formattedTime);
-            KdPrint(("Current Time: %s\n", formattedTime));
 
 
             // Populate the message data
             RtlCopyMemory(notification->MessageData, "File accessed", sizeof("File accessed"));
 
-            status = SendMessageToUserMode(notification, sizeof(LOGGER_NOTIFICATION));
+            // Record the event before looking at the client port, so an event
+            // recorded while a client connects is either sent live or replayed.
+            LoggerBacklogRecord(&lane->Backlog, notification);
+
+            LOGGER_TRACE_INFO(CREATE, LoggerTraceEventRecorded,
+                notification->Sequence, notification->ProcessId, notification->Priority, 0);
+
+            status = SendMessageToUserMode(&lane->Connection,
+                notification,
+                sizeof(LOGGER_NOTIFICATION),
+                lane->SendTimeout);
 
             if (STATUS_SUCCESS == status) {
-                DbgPrint("!!! LoggerFilter.sys --- sent message to user-mode\n");
+                LOGGER_TRACE_VERBOSE(PORT, LoggerTraceEventSent, notification->Sequence, 0, 0, 0);
+            }
+            else if (STATUS_PORT_DISCONNECTED == status) {
+                //  No client, the event waits in the backlog.
+            }
+            else if (STATUS_TIMEOUT == status) {
+                //  The client is behind; the event is shed rather than delay the
+                //  create, and resent when the client asks for it.
+                LoggerBacklogShed(&lane->Backlog, notification->Sequence);
+                LOGGER_TRACE_INFO(PORT, LoggerTraceEventShed, notification->Sequence, notification->Priority, 0, 0);
             }
             else { // Couldn't send message. This sample will let the i/o through.
-                DbgPrint("!!! LoggerFilter.sys --- couldn't send message to user-mode, status 0x%X\n", status);
+                LOGGER_TRACE_ERROR(PORT, LoggerTraceSendFailed, notification->Sequence, (ULONG)status, 0, 0);
             }
         }
     }
@@ -200,57 +262,155 @@ Arguments:
         for this driver are located in the registry.
 
 Return Value:
-    Returns STATUS_SUCCESS.
+    STATUS_SUCCESS, or the status of the first step that failed. On failure
+    nothing stays registered or allocated.
 */
 {
     OBJECT_ATTRIBUTES oa;
     UNICODE_STRING portName;
     PSECURITY_DESCRIPTOR sd;
     NTSTATUS status;
-    UNREFERENCED_PARAMETER(RegistryPath );
+    HANDLE parametersKey;
+    PKEY_VALUE_PARTIAL_INFORMATION excluded;
+    PKEY_VALUE_PARTIAL_INFORMATION included;
+    ULONG backlogEntries;
+    ULONG backlogMaxAge;
+    ULONG priority;
+
+    status = LoggerTraceInitialize();
+
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    // Compile the targets first: a lane no rule routes to needs no backlog.
+    // Then preallocate the lanes, before any event can arrive.
+    parametersKey = LoggerOpenParametersKey(RegistryPath);
+
+    status = LoggerCompileTargets(parametersKey);
+
+    KdPrint(("[LoggerFilter] " __FUNCTION__ " LoggerCompileTargets status: %x\n", status));
+
+    backlogEntries = LoggerReadRegistryDword(parametersKey, L"BacklogEntries", LOGGER_DEFAULT_BACKLOG_ENTRIES);
+    backlogMaxAge = LoggerReadRegistryDword(parametersKey, L"BacklogMaxAgeSeconds", LOGGER_DEFAULT_BACKLOG_AGE_SECONDS);
+
+    for (priority = 0; priority < LoggerPriorityCount && NT_SUCCESS(status); priority++) {
+
+        // Only bulk sends give up on a slow client; high priority events wait for it.
+        status = LoggerLaneInitialize(&LoggerFilterData.Lanes[priority],
+            (LOGGER_PRIORITY)priority,
+            (priority == LoggerPriorityHigh && LoggerFilterData.HighPriorityRuleCount == 0) ?
+                LOGGER_IDLE_BACKLOG_ENTRIES :
+                backlogEntries,
+            backlogMaxAge,
+            (priority == LoggerPriorityBulk) ?
+                LoggerReadRegistryDword(parametersKey, L"BulkSendTimeoutMs", LOGGER_DEFAULT_BULK_SEND_TIMEOUT_MS) :
+                LOGGER_NO_SEND_TIMEOUT);
+    }
+
+    if (NT_SUCCESS(status)) {
+
+        // Resolve the excluded and included image names to process IDs.
+        excluded = LoggerReadRegistryValue(parametersKey, L"ExcludedProcesses", REG_MULTI_SZ);
+        included = LoggerReadRegistryValue(parametersKey, L"IncludedProcesses", REG_MULTI_SZ);
+
+        status = LoggerProcessFilterInitialize(
+            excluded ? (PCWSTR)excluded->Data : NULL, excluded ? excluded->DataLength : 0,
+            included ? (PCWSTR)included->Data : NULL, included ? included->DataLength : 0);
+
+        KdPrint(("[LoggerFilter] " __FUNCTION__ " LoggerProcessFilterInitialize status: %x\n", status));
+
+        if (excluded != NULL) {
+            ExFreePoolWithTag(excluded, 'grgL');
+        }
+        if (included != NULL) {
+            ExFreePoolWithTag(included, 'grgL');
+        }
+    }
+
+    if (parametersKey != NULL) {
+        ZwClose(parametersKey);
+    }
+
+    if (!NT_SUCCESS(status)) {
+        LoggerProcessFilterFree();
+        LoggerMatcherFree(&LoggerFilterData.Targets);
+        for (priority = 0; priority < LoggerPriorityCount; priority++) {
+            LoggerLaneFree(&LoggerFilterData.Lanes[priority]);
+        }
+        LoggerTraceFree();
+        return status;
+    }
 
     status = FltRegisterFilter(DriverObject,
                                 &FilterRegistration,
                                 &LoggerFilterData.FilterHandle);
 	KdPrint(("[LoggerFilter] " __FUNCTION__ " FltRegisterFilter status: %x\n", status));
-    FLT_ASSERT(NT_SUCCESS(status));
 
-    RtlInitUnicodeString(&portName, LOGGERPortName);
+    if (NT_SUCCESS(status)) {
 
-    status = FltBuildDefaultSecurityDescriptor(&sd, FLT_PORT_ALL_ACCESS);
+        status = FltBuildDefaultSecurityDescriptor(&sd, FLT_PORT_ALL_ACCESS);
 
-    if (NT_SUCCESS(status)) {
+        if (NT_SUCCESS(status)) {
 
-        InitializeObjectAttributes(&oa,
-            &portName,
-            OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
-            NULL,
-            sd);
-
-        status = FltCreateCommunicationPort(LoggerFilterData.FilterHandle,
-            &LoggerFilterData.ServerPort,
-            &oa,
-            NULL,
-            LoggerPortConnect,
-            LoggerPortDisconnect,
-            NULL,
-            1);
-
-		KdPrint(("[LoggerFilter] " __FUNCTION__ " FltCreateCommunicationPort status: %x\n", status));
-        
-        // The security descriptor is not needed once the call to FltCreateCommunicationPort() is made.
-        FltFreeSecurityDescriptor(sd);
+            // One port per lane. The lane is the port cookie, so the connect,
+            // disconnect and message routines know which lane they serve.
+            for (priority = 0; priority < LoggerPriorityCount && NT_SUCCESS(status); priority++) {
+
+                RtlInitUnicodeString(&portName,
+                    (priority == LoggerPriorityHigh) ? LOGGERHighPortName : LOGGERPortName);
+
+                InitializeObjectAttributes(&oa,
+                    &portName,
+                    OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+                    NULL,
+                    sd);
+
+                status = FltCreateCommunicationPort(LoggerFilterData.FilterHandle,
+                    &LoggerFilterData.Lanes[priority].ServerPort,
+                    &oa,
+                    &LoggerFilterData.Lanes[priority],
+                    LoggerPortConnect,
+                    LoggerPortDisconnect,
+                    LoggerPortMessage,
+                    1);
+
+		        KdPrint(("[LoggerFilter] " __FUNCTION__ " FltCreateCommunicationPort %wZ status: %x\n", &portName, status));
+            }
+
+            // The security descriptor is not needed once the call to FltCreateCommunicationPort() is made.
+            FltFreeSecurityDescriptor(sd);
+        }
 
         if (NT_SUCCESS(status)) {
 
             status = FltStartFiltering(LoggerFilterData.FilterHandle); // Start filtering i/o
 		    KdPrint(("[LoggerFilter] " __FUNCTION__ " FltStartFiltering status: %x\n", status));
+        }
 
-            if (!NT_SUCCESS(status)) {
-                FltUnregisterFilter(LoggerFilterData.FilterHandle);
+        if (!NT_SUCCESS(status)) {
+            for (priority = 0; priority < LoggerPriorityCount; priority++) {
+                if (LoggerFilterData.Lanes[priority].ServerPort != NULL) {
+                    FltCloseCommunicationPort(LoggerFilterData.Lanes[priority].ServerPort);
+                    LoggerFilterData.Lanes[priority].ServerPort = NULL;
+                }
             }
         }
 	}
+
+    if (!NT_SUCCESS(status)) {
+        // A failed FltRegisterFilter leaves no handle to unregister.
+        if (LoggerFilterData.FilterHandle != NULL) {
+            FltUnregisterFilter(LoggerFilterData.FilterHandle);
+            LoggerFilterData.FilterHandle = NULL;
+        }
+        LoggerProcessFilterFree();
+        LoggerMatcherFree(&LoggerFilterData.Targets);
+        for (priority = 0; priority < LoggerPriorityCount; priority++) {
+            LoggerLaneFree(&LoggerFilterData.Lanes[priority]);
+        }
+        LoggerTraceFree();
+    }
     return status;
 }
 
@@ -319,11 +479,20 @@ Return Value:
     Returns the final status of this operation.
 */
 {
+    ULONG priority;
 
     UNREFERENCED_PARAMETER(Flags);
     PAGED_CODE();
-	FltCloseCommunicationPort(LoggerFilterData.ServerPort);
+    for (priority = 0; priority < LoggerPriorityCount; priority++) {
+        FltCloseCommunicationPort(LoggerFilterData.Lanes[priority].ServerPort);
+    }
     FltUnregisterFilter(LoggerFilterData.FilterHandle);
+    LoggerProcessFilterFree();
+    LoggerMatcherFree(&LoggerFilterData.Targets);
+    for (priority = 0; priority < LoggerPriorityCount; priority++) {
+        LoggerLaneFree(&LoggerFilterData.Lanes[priority]);
+    }
+    LoggerTraceFree();
     return STATUS_SUCCESS;
 }
 
@@ -376,30 +545,30 @@ Routine Description:
 
 Arguments:
     ClientPort - The client communication port for the user-mode application.
-    ServerPortCookie - The context associated with the server port (unused here).
+    ServerPortCookie - The lane of the server port.
     ConnectionContext - The connection context from the user-mode application (optional).
     SizeOfContext - The size of the connection context in bytes.
-    ConnectionCookie - Context passed to the disconnection routine (unused here).
+    ConnectionCookie - Receives the lane, passed to the disconnection and message routines.
 
 Return Value:
     STATUS_SUCCESS - Connection accepted.
 */
 {
+    PLOGGER_LANE lane = (PLOGGER_LANE)ServerPortCookie;
+
     PAGED_CODE();
 
-    UNREFERENCED_PARAMETER(ServerPortCookie);
     UNREFERENCED_PARAMETER(ConnectionContext);
     UNREFERENCED_PARAMETER(SizeOfContext);
-    UNREFERENCED_PARAMETER(ConnectionCookie = NULL);
 
-    FLT_ASSERT(LoggerFilterData.ClientPort == NULL);
-    FLT_ASSERT(LoggerFilterData.UserProcess == NULL);
+    FLT_ASSERT(lane != NULL);
 
-    // Set the user process and port.
-    LoggerFilterData.UserProcess = PsGetCurrentProcess();
-    LoggerFilterData.ClientPort = ClientPort;
+    // Set the user process and port, and let senders use them.
+    LoggerConnectionOpen(&lane->Connection, ClientPort);
+    *ConnectionCookie = lane;
 
-    DbgPrint("!!! LoggerFilter.sys --- connected, port=0x%p\n", ClientPort);
+    LOGGER_TRACE_INFO(PORT, LoggerTracePortConnected,
+        PtrToUint(PsGetProcessId(lane->Connection.UserProcess)), lane->Priority, 0, 0);
 
     return STATUS_SUCCESS;
 }
@@ -415,41 +584,743 @@ Routine Description
     We use it to close our handle to the connection
 
 Arguments
-    ConnectionCookie - Context from the port connect routine
+    ConnectionCookie - The lane, from the port connect routine
 
 Return value
     None
 */
 {
-    UNREFERENCED_PARAMETER(ConnectionCookie);
+    PLOGGER_LANE lane = (PLOGGER_LANE)ConnectionCookie;
 
     PAGED_CODE();
 
-    DbgPrint("!!! LoggerFilter.sys --- disconnected, port=0x%p\n", LoggerFilterData.ClientPort);
+    FLT_ASSERT(lane != NULL);
 
-    FltCloseClientPort(LoggerFilterData.FilterHandle, &LoggerFilterData.ClientPort);
+    LOGGER_TRACE_INFO(PORT, LoggerTracePortDisconnected, lane->Priority, 0, 0, 0);
 
-    LoggerFilterData.UserProcess = NULL;
+    LoggerConnectionClose(&lane->Connection);
+}
+
+NTSTATUS
+LoggerPortMessage(
+    _In_opt_ PVOID PortCookie,
+    _In_reads_bytes_opt_(InputBufferLength) PVOID InputBuffer,
+    _In_ ULONG InputBufferLength,
+    _Out_writes_bytes_to_opt_(OutputBufferLength, *ReturnOutputBufferLength) PVOID OutputBuffer,
+    _In_ ULONG OutputBufferLength,
+    _Out_ PULONG ReturnOutputBufferLength
+)
+/*
+Routine Description:
+    This routine is called when the user-mode application sends a command
+    with FilterSendMessage. It serves replay requests after a (re)connect,
+    resend requests for shed events and acknowledgements of events that
+    have been written to the log, for the lane of the port the command was
+    sent to.
+
+Arguments:
+    PortCookie - The lane, from the port connect routine.
+    InputBuffer - User buffer holding a LOGGER_COMMAND_MESSAGE.
+    InputBufferLength - Size of the input buffer in bytes.
+    OutputBuffer - User buffer receiving a LOGGER_REPLAY_REPLY for replay
+        requests, a LOGGER_RESEND_REPLY for resend requests.
+    OutputBufferLength - Size of the output buffer in bytes.
+    ReturnOutputBufferLength - Number of bytes written to the output buffer.
+
+Return Value:
+    STATUS_SUCCESS if the command was handled, an error status otherwise.
+*/
+{
+    PLOGGER_LANE lane = (PLOGGER_LANE)PortCookie;
+    LOGGER_COMMAND_MESSAGE message;
+    LOGGER_REPLAY_REPLY reply;
+    LOGGER_RESEND_REPLY resendReply;
+
+    PAGED_CODE();
+
+    *ReturnOutputBufferLength = 0;
+
+    if (lane == NULL || InputBuffer == NULL || InputBufferLength < sizeof(LOGGER_COMMAND_MESSAGE)) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    // The buffers belong to the calling process, so access them under try/except.
+    try {
+        RtlCopyMemory(&message, InputBuffer, sizeof(LOGGER_COMMAND_MESSAGE));
+    }
+    except (EXCEPTION_EXECUTE_HANDLER) {
+        return GetExceptionCode();
+    }
+
+    switch (message.Command) {
+
+    case LoggerCommandReplay:
+    case LoggerCommandQuery:
+
+        if (OutputBuffer == NULL || OutputBufferLength < sizeof(LOGGER_REPLAY_REPLY)) {
+            return STATUS_BUFFER_TOO_SMALL;
+        }
+
+        if (message.Command == LoggerCommandQuery) {
+            LoggerBacklogQuery(&lane->Backlog, &reply);
+        }
+        else {
+            LoggerBacklogReplay(&lane->Backlog,
+                &lane->Connection,
+                (message.SessionId == lane->Backlog.SessionId) ? message.Sequence : 0,
+                &reply);
+        }
+
+        try {
+            RtlCopyMemory(OutputBuffer, &reply, sizeof(LOGGER_REPLAY_REPLY));
+        }
+        except (EXCEPTION_EXECUTE_HANDLER) {
+            return GetExceptionCode();
+        }
+
+        *ReturnOutputBufferLength = sizeof(LOGGER_REPLAY_REPLY);
+        return STATUS_SUCCESS;
+
+    case LoggerCommandResend:
+
+        if (OutputBuffer == NULL || OutputBufferLength < sizeof(LOGGER_RESEND_REPLY)) {
+            return STATUS_BUFFER_TOO_SMALL;
+        }
+
+        LoggerBacklogResend(&lane->Backlog,
+            &lane->Connection,
+            (message.SessionId == lane->Backlog.SessionId) ? message.Sequence : 0,
+            message.Mask,
+            &resendReply);
+
+        try {
+            RtlCopyMemory(OutputBuffer, &resendReply, sizeof(LOGGER_RESEND_REPLY));
+        }
+        except (EXCEPTION_EXECUTE_HANDLER) {
+            return GetExceptionCode();
+        }
+
+        *ReturnOutputBufferLength = sizeof(LOGGER_RESEND_REPLY);
+        return STATUS_SUCCESS;
+
+    case LoggerCommandAck:
+
+        // A sequence of an earlier session would mark events of this one as
+        // logged, and they could then be overwritten silently.
+        if (message.SessionId == lane->Backlog.SessionId) {
+            LoggerBacklogAcknowledge(&lane->Backlog, message.Sequence);
+        }
+
+        if (OutputBuffer == NULL || OutputBufferLength < sizeof(LOGGER_REPLAY_REPLY)) {
+            return STATUS_SUCCESS;
+        }
+
+        LoggerBacklogQuery(&lane->Backlog, &reply);
+
+        try {
+            RtlCopyMemory(OutputBuffer, &reply, sizeof(LOGGER_REPLAY_REPLY));
+        }
+        except (EXCEPTION_EXECUTE_HANDLER) {
+            return GetExceptionCode();
+        }
+
+        *ReturnOutputBufferLength = sizeof(LOGGER_REPLAY_REPLY);
+        return STATUS_SUCCESS;
+
+    case LoggerCommandReadTrace:
+
+        if (OutputBuffer == NULL) {
+            return STATUS_BUFFER_TOO_SMALL;
+        }
+
+        return LoggerTraceRead(OutputBuffer, OutputBufferLength, ReturnOutputBufferLength);
+
+    default:
+        return STATUS_INVALID_PARAMETER;
+    }
 }
 
 NTSTATUS SendMessageToUserMode(
+    PLOGGER_CONNECTION Connection,
     PVOID messageBuffer,
-    ULONG messageSize
+    ULONG messageSize,
+    PLARGE_INTEGER Timeout
 )
+/*
+Routine Description:
+    Sends a message to the connected client. The client port is used under
+    run-down protection, so it cannot be closed while the message is sent.
+
+Arguments:
+    Timeout - Relative time to wait for the client to take the message,
+        NULL to wait as long as it takes.
+
+Return Value:
+    STATUS_PORT_DISCONNECTED if no client is connected, otherwise the status
+    of FltSendMessage, STATUS_TIMEOUT when the client did not take the
+    message in time.
+*/
 {
-    NTSTATUS status = FltSendMessage(
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    if (!LoggerRundownAcquire(&Connection->Rundown)) {
+        return STATUS_PORT_DISCONNECTED;
+    }
+
+    status = FltSendMessage(
         LoggerFilterData.FilterHandle,
-        &LoggerFilterData.ClientPort,
+        &Connection->ClientPort,
         messageBuffer,
         messageSize,
         NULL,
         NULL,
-        NULL
+        Timeout
     );
 
+    LoggerRundownRelease(&Connection->Rundown);
+
+    return status;
+}
+
+
+/*************************************************************************
+	Connection routines
+*************************************************************************/
+
+NTSTATUS
+LoggerConnectionInitialize(
+    _Out_ PLOGGER_CONNECTION Connection
+)
+/*
+Routine Description:
+    Allocates the run-down protection of a connection. It starts run down,
+    so senders fail until a client connects.
+
+Return Value:
+    STATUS_SUCCESS or STATUS_INSUFFICIENT_RESOURCES.
+*/
+{
+    PAGED_CODE();
+
+    RtlZeroMemory(Connection, sizeof(LOGGER_CONNECTION));
+
+    return LoggerRundownInitialize(&Connection->Rundown, 'ncgL');
+}
+
+VOID
+LoggerConnectionFree(
+    _Inout_ PLOGGER_CONNECTION Connection
+)
+{
+    PAGED_CODE();
+
+    FLT_ASSERT(Connection->ClientPort == NULL);
+
+    LoggerRundownFree(&Connection->Rundown);
+}
+
+VOID
+LoggerConnectionOpen(
+    _Inout_ PLOGGER_CONNECTION Connection,
+    _In_ PFLT_PORT ClientPort
+)
+/*
+Routine Description:
+    Stores the client port of a new connection, then lets senders acquire it.
+    Called from the port connect routine, so the calling process is the client.
+*/
+{
+    PAGED_CODE();
+
+    FLT_ASSERT(Connection->ClientPort == NULL);
+    FLT_ASSERT(Connection->UserProcess == NULL);
+
+    Connection->UserProcess = PsGetCurrentProcess();
+    Connection->ClientPort = ClientPort;
+
+    // Re-initializing is an interlocked operation, so a sender that acquires
+    // the protection sees the port stored above.
+    LoggerRundownReInitialize(&Connection->Rundown);
+}
+
+VOID
+LoggerConnectionClose(
+    _Inout_ PLOGGER_CONNECTION Connection
+)
+/*
+Routine Description:
+    Stops new senders, waits for the sends in progress and closes the client
+    port. The client has already closed its handle when this is called, so the
+    filter manager fails the sends that are waiting for it and the wait is short.
+*/
+{
+    PAGED_CODE();
+
+    LoggerRundownWait(&Connection->Rundown);
+
+    FltCloseClientPort(LoggerFilterData.FilterHandle, &Connection->ClientPort);
+
+    Connection->UserProcess = NULL;
+}
+
+
+/*************************************************************************
+	Lane routines
+*************************************************************************/
+
+NTSTATUS
+LoggerLaneInitialize(
+    _Out_ PLOGGER_LANE Lane,
+    _In_ LOGGER_PRIORITY Priority,
+    _In_ ULONG Capacity,
+    _In_ ULONG MaxAgeSeconds,
+    _In_ ULONG SendTimeoutMs
+)
+/*
+Routine Description:
+    Preallocates the backlog and the connection of a lane. Its port is
+    created once the filter is registered.
+
+Arguments:
+    Lane - The lane to initialize.
+    Priority - The priority of the events it carries.
+    Capacity, MaxAgeSeconds - The backlog limits, see LoggerBacklogInitialize.
+    SendTimeoutMs - How long a live send waits for the client, or
+        LOGGER_NO_SEND_TIMEOUT to wait as long as it takes.
+
+Return Value:
+    STATUS_SUCCESS or STATUS_INSUFFICIENT_RESOURCES. On error nothing stays allocated.
+*/
+{
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    RtlZeroMemory(Lane, sizeof(LOGGER_LANE));
+
+    Lane->Priority = Priority;
+
+    if (SendTimeoutMs != LOGGER_NO_SEND_TIMEOUT) {
+        // Negative for a relative time, in 100 ns units.
+        Lane->SendTimeoutValue.QuadPart = -(LONGLONG)SendTimeoutMs * 10000;
+        Lane->SendTimeout = &Lane->SendTimeoutValue;
+    }
+
+    status = LoggerBacklogInitialize(&Lane->Backlog, Capacity, MaxAgeSeconds);
+
+    if (NT_SUCCESS(status)) {
+        status = LoggerConnectionInitialize(&Lane->Connection);
+
+        if (!NT_SUCCESS(status)) {
+            LoggerBacklogFree(&Lane->Backlog);
+        }
+    }
+
     return status;
 }
 
+VOID
+LoggerLaneFree(
+    _Inout_ PLOGGER_LANE Lane
+)
+{
+    PAGED_CODE();
+
+    LoggerConnectionFree(&Lane->Connection);
+    LoggerBacklogFree(&Lane->Backlog);
+}
+
+
+/*************************************************************************
+	Backlog routines
+*************************************************************************/
+
+NTSTATUS
+LoggerBacklogInitialize(
+    _Out_ PLOGGER_BACKLOG Backlog,
+    _In_ ULONG Capacity,
+    _In_ ULONG MaxAgeSeconds
+)
+/*
+Routine Description:
+    Preallocates the backlog ring. The ring is never resized, so recording an
+    event only copies it into a slot.
+
+Arguments:
+    Backlog - The backlog to initialize.
+    Capacity - Number of events kept, clamped to LOGGER_MAX_BACKLOG_ENTRIES.
+        Each entry costs sizeof(LOGGER_BACKLOG_ENTRY) bytes of nonpaged pool.
+    MaxAgeSeconds - Events older than this are not replayed, 0 for no limit.
+
+Return Value:
+    STATUS_SUCCESS or STATUS_INSUFFICIENT_RESOURCES.
+*/
+{
+    LARGE_INTEGER now;
+
+    PAGED_CODE();
+
+    RtlZeroMemory(Backlog, sizeof(LOGGER_BACKLOG));
+
+    if (Capacity == 0) {
+        Capacity = LOGGER_DEFAULT_BACKLOG_ENTRIES;
+    }
+    else if (Capacity > LOGGER_MAX_BACKLOG_ENTRIES) {
+        Capacity = LOGGER_MAX_BACKLOG_ENTRIES;
+    }
+
+    Backlog->Entries = ExAllocatePoolZero(NonPagedPool,
+        (SIZE_T)Capacity * sizeof(LOGGER_BACKLOG_ENTRY),
+        'gblL');
+
+    if (Backlog->Entries == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    KeQuerySystemTime(&now);
+
+    Backlog->Capacity = Capacity;
+    Backlog->MaxAge = (LONGLONG)MaxAgeSeconds * 10000000;
+    Backlog->SessionId = (UINT64)now.QuadPart;
+
+    KdPrint(("[LoggerFilter] " __FUNCTION__ " %u entries, max age %us\n", Capacity, MaxAgeSeconds));
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+LoggerBacklogFree(
+    _Inout_ PLOGGER_BACKLOG Backlog
+)
+{
+    PAGED_CODE();
+
+    if (Backlog->Entries != NULL) {
+        ExFreePoolWithTag(Backlog->Entries, 'gblL');
+        Backlog->Entries = NULL;
+    }
+}
+
+static
+VOID
+LoggerBacklogRaise(
+    _Inout_ volatile LONG64* Value,
+    _In_ LONG64 Sequence
+)
+/*
+Routine Description:
+    Raises Value to Sequence unless it is already at or above it.
+*/
+{
+    LONG64 current = InterlockedCompareExchange64(Value, 0, 0);
+
+    while (current < Sequence) {
+
+        LONG64 previous = InterlockedCompareExchange64(Value, Sequence, current);
+
+        if (previous == current) {
+            break;
+        }
+
+        current = previous;
+    }
+}
+
+VOID
+LoggerBacklogRecord(
+    _Inout_ PLOGGER_BACKLOG Backlog,
+    _Inout_ PLOGGER_NOTIFICATION Notification
+)
+/*
+Routine Description:
+    Assigns the next sequence number to the notification and copies it into
+    the ring, overwriting the oldest entry when the ring is full. The live
+    notification also reports the highest sequence shed so far; the copy in
+    the ring does not, since a replay resends those events.
+
+    Concurrent creates each reserve their own slot, so none waits for
+    another. Until the slot's Sequence is stored the entry reads as not
+    recorded yet.
+
+Arguments:
+    Backlog - The backlog to record into.
+    Notification - The event. Its Sequence and ShedSequence are filled in on return.
+*/
+{
+    PLOGGER_BACKLOG_ENTRY entry;
+    LARGE_INTEGER now;
+    LONG64 sequence;
+    LONG64 overwritten;
+
+    PAGED_CODE();
+
+    KeQuerySystemTime(&now);
+
+    sequence = InterlockedIncrement64(&Backlog->LastSequence);
+    entry = &Backlog->Entries[(sequence - 1) % Backlog->Capacity];
+
+    // Overwriting an entry the client never acknowledged loses it.
+    overwritten = sequence - (LONG64)Backlog->Capacity;
+
+    if (overwritten > InterlockedCompareExchange64(&Backlog->AckedSequence, 0, 0)) {
+        InterlockedIncrement64(&Backlog->DroppedCount);
+        LOGGER_TRACE_INFO(BACKLOG, LoggerTraceBacklogOverwrite, overwritten, 0, 0, 0);
+    }
+
+    Notification->SessionId = Backlog->SessionId;
+    Notification->Sequence = (UINT64)sequence;
+    Notification->ShedSequence = 0;
+
+    entry->RecordedTime = now;
+    RtlCopyMemory(&entry->Notification, Notification, sizeof(LOGGER_NOTIFICATION));
+
+    InterlockedExchange64(&entry->Sequence, sequence);
+
+    Notification->ShedSequence = (UINT64)InterlockedCompareExchange64(&Backlog->ShedSequence, 0, 0);
+}
+
+VOID
+LoggerBacklogShed(
+    _Inout_ PLOGGER_BACKLOG Backlog,
+    _In_ UINT64 Sequence
+)
+/*
+Routine Description:
+    Notes that the live send of a recorded event was given up. The event
+    stays in the ring, and the next notification recorded reports it to the
+    client, which asks for it again with LoggerCommandResend.
+*/
+{
+    PAGED_CODE();
+
+    LoggerBacklogRaise(&Backlog->ShedSequence, (LONG64)Sequence);
+}
+
+VOID
+LoggerBacklogAcknowledge(
+    _Inout_ PLOGGER_BACKLOG Backlog,
+    _In_ UINT64 Sequence
+)
+/*
+Routine Description:
+    Marks every event up to and including Sequence as logged by the client.
+    Acknowledged entries stay in the ring but may be overwritten silently.
+*/
+{
+    PAGED_CODE();
+
+    if (Sequence <= (UINT64)InterlockedCompareExchange64(&Backlog->LastSequence, 0, 0)) {
+        LoggerBacklogRaise(&Backlog->AckedSequence, (LONG64)Sequence);
+    }
+}
+
+static
+NTSTATUS
+LoggerBacklogCopy(
+    _In_ PLOGGER_BACKLOG Backlog,
+    _In_ UINT64 Sequence,
+    _Out_ PLOGGER_NOTIFICATION Notification
+)
+/*
+Routine Description:
+    Copies the held event Sequence out of the ring.
+
+Return Value:
+    STATUS_SUCCESS, STATUS_RETRY if the event is still being recorded (its
+    live send is still to come), or STATUS_NOT_FOUND if it was overwritten
+    or is older than the maximum age; either way it is lost.
+*/
+{
+    PLOGGER_BACKLOG_ENTRY entry;
+    LARGE_INTEGER now;
+    LONG64 stamp;
+
+    PAGED_CODE();
+
+    entry = &Backlog->Entries[(Sequence - 1) % Backlog->Capacity];
+    stamp = InterlockedCompareExchange64(&entry->Sequence, 0, 0);
+
+    if (stamp < (LONG64)Sequence) {
+        return STATUS_RETRY;
+    }
+
+    if (stamp > (LONG64)Sequence) {
+        return STATUS_NOT_FOUND;
+    }
+
+    RtlCopyMemory(Notification, &entry->Notification, sizeof(LOGGER_NOTIFICATION));
+
+    // The copy is only whole if no later create reserved the slot meanwhile.
+    if (InterlockedCompareExchange64(&Backlog->LastSequence, 0, 0) - (LONG64)Sequence >=
+            (LONG64)Backlog->Capacity) {
+        return STATUS_NOT_FOUND;
+    }
+
+    KeQuerySystemTime(&now);
+
+    if (Backlog->MaxAge != 0 &&
+        now.QuadPart - entry->RecordedTime.QuadPart > Backlog->MaxAge) {
+        return STATUS_NOT_FOUND;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+LoggerBacklogQuery(
+    _In_ PLOGGER_BACKLOG Backlog,
+    _Out_ PLOGGER_REPLAY_REPLY Reply
+)
+/*
+Routine Description:
+    Reports the session and the range of sequences currently held, without
+    sending anything. Entries older than the maximum age are still counted.
+*/
+{
+    UINT64 next;
+
+    PAGED_CODE();
+
+    next = (UINT64)InterlockedCompareExchange64(&Backlog->LastSequence, 0, 0) + 1;
+
+    RtlZeroMemory(Reply, sizeof(LOGGER_REPLAY_REPLY));
+
+    Reply->SessionId = Backlog->SessionId;
+    Reply->NextSequence = next;
+    Reply->FirstSequence = (next > Backlog->Capacity) ? next - Backlog->Capacity : 1;
+    Reply->Capacity = Backlog->Capacity;
+    Reply->DroppedCount = (UINT64)InterlockedCompareExchange64(&Backlog->DroppedCount, 0, 0);
+}
+
+VOID
+LoggerBacklogReplay(
+    _Inout_ PLOGGER_BACKLOG Backlog,
+    _In_ PLOGGER_CONNECTION Connection,
+    _In_ UINT64 AfterSequence,
+    _Out_ PLOGGER_REPLAY_REPLY Reply
+)
+/*
+Routine Description:
+    Sends every held event newer than AfterSequence to the connected client,
+    oldest first. Recording continues while the replay waits on the client.
+
+Arguments:
+    Backlog - The backlog to replay.
+    Connection - The connection of the same lane. Replayed events are never
+        shed, since the client asked for them.
+    AfterSequence - Last sequence the client has logged, 0 for everything.
+    Reply - Receives the session and the range of sequences that were
+        available. Every sequence below Reply->FirstSequence that the client
+        has not logged is lost.
+*/
+{
+    LOGGER_NOTIFICATION notification;
+    UINT64 sequence;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    LoggerBacklogQuery(Backlog, Reply);
+
+    if (Reply->FirstSequence <= AfterSequence) {
+        Reply->FirstSequence = AfterSequence + 1;
+    }
+
+    LOGGER_TRACE_INFO(BACKLOG, LoggerTraceReplay, AfterSequence, Reply->FirstSequence, Reply->NextSequence, 0);
+
+    for (sequence = Reply->FirstSequence; sequence < Reply->NextSequence; sequence++) {
+
+        status = LoggerBacklogCopy(Backlog, sequence, &notification);
+
+        if (status == STATUS_NOT_FOUND) {
+            // Overwritten since the replay started, or too old. Either way it
+            // is a gap, and so is everything before it.
+            Reply->FirstSequence = sequence + 1;
+            continue;
+        }
+
+        if (!NT_SUCCESS(status)) {
+            continue;
+        }
+
+        if (!NT_SUCCESS(SendMessageToUserMode(Connection,
+                &notification,
+                sizeof(LOGGER_NOTIFICATION),
+                NULL))) {
+            break;
+        }
+    }
+}
+
+VOID
+LoggerBacklogResend(
+    _In_ PLOGGER_BACKLOG Backlog,
+    _In_ PLOGGER_CONNECTION Connection,
+    _In_ UINT64 Sequence,
+    _In_ UINT64 Mask,
+    _Out_ PLOGGER_RESEND_REPLY Reply
+)
+/*
+Routine Description:
+    Sends the selected events again, typically ones whose live send was
+    shed. Like a replay, the sends wait for the client however long it
+    takes, so the client must keep reading while it waits for the reply.
+
+Arguments:
+    Backlog - The backlog to resend from.
+    Connection - The connection of the same lane.
+    Sequence, Mask - Bit i of Mask selects sequence Sequence + i.
+    Reply - Receives the selected events that are no longer held. Events
+        not recorded yet are neither sent nor reported lost.
+*/
+{
+    LOGGER_NOTIFICATION notification;
+    UINT64 next;
+    ULONG bit;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    Reply->LostMask = 0;
+
+    // 0 for a request from another session, which selects nothing.
+    if (Sequence == 0) {
+        return;
+    }
+
+    next = (UINT64)InterlockedCompareExchange64(&Backlog->LastSequence, 0, 0) + 1;
+
+    LOGGER_TRACE_INFO(BACKLOG, LoggerTraceResend, Sequence, Mask, 0, 0);
+
+    for (; _BitScanForward64(&bit, Mask); Mask &= Mask - 1) {
+
+        // Not recorded yet, and neither is anything after it.
+        if (Sequence + bit >= next) {
+            break;
+        }
+
+        status = LoggerBacklogCopy(Backlog, Sequence + bit, &notification);
+
+        if (status == STATUS_NOT_FOUND) {
+            Reply->LostMask |= 1ull << bit;
+            continue;
+        }
+
+        if (!NT_SUCCESS(status)) {
+            continue;
+        }
+
+        if (!NT_SUCCESS(SendMessageToUserMode(Connection,
+                &notification,
+                sizeof(LOGGER_NOTIFICATION),
+                NULL))) {
+            break;
+        }
+    }
+}
+
 
 /*************************************************************************
 	Utility routines
@@ -492,3 +1363,225 @@ Notes:
 
     RtlStringCchCopyA(buffer, bufferSize, tempBuffer);
 }
+
+NTSTATUS
+LoggerCompileTargets(
+    _In_opt_ HANDLE Key
+)
+/*
+Routine Description:
+    Compiles the rules of HighPriorityPatterns followed by those of
+    TargetPatterns, or by TargetFilePath when TargetPatterns holds none, into
+    LoggerFilterData.Targets. The matcher reports the lowest matching rule,
+    so a high priority rule wins over any bulk rule matching the same name.
+    Rules whose DFA grew past the limits still load, split over more DFAs
+    or matched one by one, which makes every create slower; that is logged.
+
+Arguments:
+    Key - The Parameters key, or NULL.
+
+Return Value:
+    The status of LoggerMatcherCompile, or STATUS_INSUFFICIENT_RESOURCES.
+*/
+{
+    PKEY_VALUE_PARTIAL_INFORMATION high;
+    PKEY_VALUE_PARTIAL_INFORMATION bulk;
+    PUNICODE_STRING rules;
+    ULONG highCount = 0;
+    ULONG bulkCount = 0;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    high = LoggerReadRegistryValue(Key, L"HighPriorityPatterns", REG_MULTI_SZ);
+    bulk = LoggerReadRegistryValue(Key, L"TargetPatterns", REG_MULTI_SZ);
+
+    if (high != NULL) {
+        highCount = LoggerMatcherSplitMultiSz((PCWSTR)high->Data, high->DataLength, NULL, 0);
+    }
+    if (bulk != NULL) {
+        bulkCount = LoggerMatcherSplitMultiSz((PCWSTR)bulk->Data, bulk->DataLength, NULL, 0);
+    }
+
+    rules = ExAllocatePoolZero(PagedPool,
+        ((SIZE_T)highCount + (bulkCount ? bulkCount : 1)) * sizeof(UNICODE_STRING),
+        'trgL');
+
+    if (rules == NULL) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+    }
+    else {
+        if (highCount != 0) {
+            LoggerMatcherSplitMultiSz((PCWSTR)high->Data, high->DataLength, rules, highCount);
+        }
+
+        if (bulkCount != 0) {
+            LoggerMatcherSplitMultiSz((PCWSTR)bulk->Data, bulk->DataLength, &rules[highCount], bulkCount);
+        }
+        else {
+            rules[highCount] = TargetFilePath;
+            bulkCount = 1;
+        }
+
+        status = LoggerMatcherCompile(rules, highCount + bulkCount, &LoggerFilterData.Targets);
+        LoggerFilterData.HighPriorityRuleCount = highCount;
+
+        if (NT_SUCCESS(status) &&
+            (LoggerFilterData.Targets.SplitCount != 0 || LoggerFilterData.Targets.ChainCount != 0)) {
+
+            KdPrint(("[LoggerFilter] " __FUNCTION__ " rules past the DFA limits: %u DFAs after %u splits, %u rules without a DFA\n",
+                LoggerFilterData.Targets.AutomatonCount,
+                LoggerFilterData.Targets.SplitCount,
+                LoggerFilterData.Targets.ChainCount));
+
+            LOGGER_TRACE_INFO(CREATE, LoggerTraceTargetsSplit,
+                LoggerFilterData.Targets.AutomatonCount,
+                LoggerFilterData.Targets.SplitCount,
+                LoggerFilterData.Targets.ChainCount,
+                0);
+        }
+
+        ExFreePoolWithTag(rules, 'trgL');
+    }
+
+    if (high != NULL) {
+        ExFreePoolWithTag(high, 'grgL');
+    }
+    if (bulk != NULL) {
+        ExFreePoolWithTag(bulk, 'grgL');
+    }
+    return status;
+}
+
+HANDLE
+LoggerOpenParametersKey(
+    _In_ PUNICODE_STRING RegistryPath
+)
+/*
+Routine Description:
+    Opens the Parameters subkey of the driver's service key.
+
+Return Value:
+    The key handle, or NULL if the key does not exist. The caller closes it with ZwClose.
+*/
+{
+    OBJECT_ATTRIBUTES attributes;
+    UNICODE_STRING subKeyName = RTL_CONSTANT_STRING(L"Parameters");
+    HANDLE serviceKey = NULL;
+    HANDLE parametersKey = NULL;
+
+    PAGED_CODE();
+
+    InitializeObjectAttributes(&attributes,
+        RegistryPath,
+        OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+        NULL,
+        NULL);
+
+    if (!NT_SUCCESS(ZwOpenKey(&serviceKey, KEY_READ, &attributes))) {
+        return NULL;
+    }
+
+    InitializeObjectAttributes(&attributes,
+        &subKeyName,
+        OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+        serviceKey,
+        NULL);
+
+    if (!NT_SUCCESS(ZwOpenKey(&parametersKey, KEY_READ, &attributes))) {
+        parametersKey = NULL;
+    }
+
+    ZwClose(serviceKey);
+    return parametersKey;
+}
+
+ULONG
+LoggerReadRegistryDword(
+    _In_opt_ HANDLE Key,
+    _In_ PCWSTR ValueName,
+    _In_ ULONG DefaultValue
+)
+/*
+Routine Description:
+    Reads a REG_DWORD value, falling back to DefaultValue when the key or
+    the value is missing or has the wrong type.
+*/
+{
+    UNICODE_STRING name;
+    DECLSPEC_ALIGN(8) UCHAR buffer[sizeof(KEY_VALUE_PARTIAL_INFORMATION) + sizeof(ULONG)];
+    PKEY_VALUE_PARTIAL_INFORMATION info = (PKEY_VALUE_PARTIAL_INFORMATION)buffer;
+    ULONG resultLength;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    if (Key == NULL) {
+        return DefaultValue;
+    }
+
+    RtlInitUnicodeString(&name, ValueName);
+
+    status = ZwQueryValueKey(Key,
+        &name,
+        KeyValuePartialInformation,
+        info,
+        sizeof(buffer),
+        &resultLength);
+
+    if (!NT_SUCCESS(status) || info->Type != REG_DWORD || info->DataLength != sizeof(ULONG)) {
+        return DefaultValue;
+    }
+
+    return *(PULONG)info->Data;
+}
+
+PKEY_VALUE_PARTIAL_INFORMATION
+LoggerReadRegistryValue(
+    _In_opt_ HANDLE Key,
+    _In_ PCWSTR ValueName,
+    _In_ ULONG Type
+)
+/*
+Routine Description:
+    Reads a registry value of any size into paged pool.
+
+Return Value:
+    The value, or NULL if the key or the value is missing or has another
+    type. The caller frees it with ExFreePoolWithTag(..., 'grgL').
+*/
+{
+    UNICODE_STRING name;
+    PKEY_VALUE_PARTIAL_INFORMATION info = NULL;
+    ULONG length = 0;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    if (Key == NULL) {
+        return NULL;
+    }
+
+    RtlInitUnicodeString(&name, ValueName);
+
+    status = ZwQueryValueKey(Key, &name, KeyValuePartialInformation, NULL, 0, &length);
+
+    if (status != STATUS_BUFFER_TOO_SMALL && status != STATUS_BUFFER_OVERFLOW) {
+        return NULL;
+    }
+
+    info = ExAllocatePoolZero(PagedPool, length, 'grgL');
+
+    if (info == NULL) {
+        return NULL;
+    }
+
+    status = ZwQueryValueKey(Key, &name, KeyValuePartialInformation, info, length, &length);
+
+    if (!NT_SUCCESS(status) || info->Type != Type) {
+        ExFreePoolWithTag(info, 'grgL');
+        return NULL;
+    }
+
+    return info;
+}
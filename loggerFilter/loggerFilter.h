@@ -3,17 +3,223 @@
 
 
 // Path to the file that we want to monitor : C:\Temp\file.txt
+// Used as the only target rule when the TargetPatterns value is not set.
 UNICODE_STRING TargetFilePath = RTL_CONSTANT_STRING(L"\\Device\\HarddiskVolume3\\Temp\\file.txt");
-// Name of port used to communicate
+// Name of port used to communicate, for events of the bulk lane
 const PWSTR LOGGERPortName = L"\\LOGGERPort";
+// Name of the port for events of the high priority lane
+const PWSTR LOGGERHighPortName = L"\\LOGGERHighPort";
+
+// Priority lanes. Each lane has its own port, backlog and sequence numbers,
+// so events of one lane never queue behind events of the other.
+typedef enum _LOGGER_PRIORITY {
+
+    // Events of TargetPatterns. A live send gives up after a timeout; the
+    // client asks for the event again, see LoggerCommandResend.
+    LoggerPriorityBulk,
+
+    // Events of HighPriorityPatterns.
+    LoggerPriorityHigh,
+
+    LoggerPriorityCount
+
+} LOGGER_PRIORITY;
 
 typedef struct _LOGGER_NOTIFICATION {
+    // Driver load the event belongs to, see LOGGER_REPLAY_REPLY.
+    UINT64 SessionId;
+    // Monotonically increasing event number, starting at 1 for each driver load.
+    UINT64 Sequence;
     UINT64 ProcessId;
+    // System time of the create, in 100 ns units, for UserLogger's latency metrics.
+    LONG64 Timestamp;
+    // Highest sequence of this lane whose live send was given up when this
+    // event was recorded. Those events never arrive live, so the client asks
+    // for them with LoggerCommandResend instead of waiting. Always 0 in
+    // replayed events.
+    UINT64 ShedSequence;
+    // Index of the matching rule in HighPriorityPatterns for the high
+    // priority lane, in TargetPatterns for the bulk lane, 0 for TargetFilePath.
+    ULONG Rule;
+    // LOGGER_PRIORITY of the lane the event was recorded in.
+    ULONG Priority;
 	CHAR Time[20];
     CHAR MessageData[256];
 
 } LOGGER_NOTIFICATION, * PLOGGER_NOTIFICATION;
 
+// Commands sent by UserLogger through FilterSendMessage.
+typedef enum _LOGGER_COMMAND {
+
+    // Resend every backlog entry newer than Sequence. Replies with LOGGER_REPLAY_REPLY.
+    LoggerCommandReplay,
+
+    // The client has durably logged every event up to and including Sequence.
+    // Ignored when SessionId is not the lane's current session. Replies with
+    // LOGGER_REPLAY_REPLY if an output buffer is given.
+    LoggerCommandAck,
+
+    // Drain the binary trace rings. Replies with LOGGER_TRACE_READ_REPLY
+    // followed by LOGGER_TRACE_RECORDs, see loggerTrace.h.
+    LoggerCommandReadTrace,
+
+    // Report the session and held range without sending anything.
+    // Replies with LOGGER_REPLAY_REPLY.
+    LoggerCommandQuery,
+
+    // Resend the held events selected by Sequence and Mask, waiting for the
+    // client however long it takes. Replies with LOGGER_RESEND_REPLY.
+    LoggerCommandResend
+
+} LOGGER_COMMAND;
+
+typedef struct _LOGGER_COMMAND_MESSAGE {
+    LOGGER_COMMAND Command;
+    ULONG Reserved;
+    // Session the client's Sequence belongs to. A replay from another
+    // session starts from the oldest held event. Sessions and sequences
+    // belong to the lane of the port the command is sent to.
+    UINT64 SessionId;
+    UINT64 Sequence;
+    // LoggerCommandResend only: bit i selects sequence Sequence + i.
+    UINT64 Mask;
+
+} LOGGER_COMMAND_MESSAGE, * PLOGGER_COMMAND_MESSAGE;
+
+typedef struct _LOGGER_REPLAY_REPLY {
+    // Identifies this driver load; sequence numbers restart when it changes.
+    UINT64 SessionId;
+
+    // Oldest sequence still held. Anything older that the client never
+    // received was dropped or expired and is a gap in the log.
+    UINT64 FirstSequence;
+
+    // Sequence that will be assigned to the next event.
+    UINT64 NextSequence;
+
+    // Number of entries the backlog of the lane holds, which bounds how far
+    // a replay can reach back. The client sizes its reorder window from it.
+    ULONG Capacity;
+    ULONG Reserved;
+
+    // Events the backlog overwrote before the client acknowledged them,
+    // since the driver was loaded.
+    UINT64 DroppedCount;
+
+} LOGGER_REPLAY_REPLY, * PLOGGER_REPLAY_REPLY;
+
+typedef struct _LOGGER_RESEND_REPLY {
+    // Selected events the backlog no longer holds, because they were
+    // overwritten or expired: bit i stands for sequence Sequence + i. They
+    // are lost; every other selected event was sent.
+    UINT64 LostMask;
+
+} LOGGER_RESEND_REPLY, * PLOGGER_RESEND_REPLY;
+
+
+//---------------------------------------------------------------------------
+//      Backlog
+//---------------------------------------------------------------------------
+
+// Defaults used when the Parameters registry key does not override them.
+#define LOGGER_DEFAULT_BACKLOG_ENTRIES      4096
+#define LOGGER_MAX_BACKLOG_ENTRIES          65536
+#define LOGGER_DEFAULT_BACKLOG_AGE_SECONDS  300
+
+// Backlog of a lane no target rule routes to, such as the high priority lane
+// when HighPriorityPatterns is empty. It only keeps the lane's port working.
+#define LOGGER_IDLE_BACKLOG_ENTRIES         1
+
+// How long a live send of the bulk lane waits for the client before the
+// event is shed. It stays in the backlog, the next event recorded in the lane
+// reports it, and the client asks for it again with LoggerCommandResend.
+#define LOGGER_DEFAULT_BULK_SEND_TIMEOUT_MS 100
+#define LOGGER_NO_SEND_TIMEOUT              MAXULONG
+
+typedef struct _LOGGER_BACKLOG_ENTRY {
+
+    // Sequence stored in this slot, 0 if the slot was never used. Stored
+    // last, so a reader can tell a complete entry from one being written.
+    volatile LONG64 Sequence;
+
+    // System time at which the event was recorded, used for age expiry.
+    LARGE_INTEGER RecordedTime;
+
+    LOGGER_NOTIFICATION Notification;
+
+} LOGGER_BACKLOG_ENTRY, * PLOGGER_BACKLOG_ENTRY;
+
+// Fixed-size ring of the most recent events that the client has not yet
+// acknowledged. It is preallocated at load time so recording never allocates
+// and never waits for the client. When the ring is full the oldest entry is
+// overwritten and counted as dropped. Like the trace rings, it takes no lock:
+// a create reserves its sequence with InterlockedIncrement64, fills the slot
+// and publishes it by storing the slot's Sequence last.
+typedef struct _LOGGER_BACKLOG {
+
+    PLOGGER_BACKLOG_ENTRY Entries;
+    ULONG Capacity;
+
+    // Maximum age of a replayed entry in 100ns units, 0 for no limit.
+    LONGLONG MaxAge;
+
+    UINT64 SessionId;
+
+    // Last sequence assigned, 0 before the first event.
+    DECLSPEC_CACHEALIGN volatile LONG64 LastSequence;
+
+    DECLSPEC_CACHEALIGN volatile LONG64 AckedSequence;
+
+    // See LOGGER_REPLAY_REPLY.DroppedCount.
+    volatile LONG64 DroppedCount;
+
+    // Highest sequence shed so far, see LOGGER_NOTIFICATION.ShedSequence.
+    volatile LONG64 ShedSequence;
+
+} LOGGER_BACKLOG, * PLOGGER_BACKLOG;
+
+
+//---------------------------------------------------------------------------
+//      Connection
+//---------------------------------------------------------------------------
+
+// The connection to UserLogger. Senders use the client port under run-down
+// protection instead of a lock, and disconnect waits for them to drain
+// before closing it. Acquiring the protection only touches a counter of the
+// current processor, see loggerRundown.h.
+typedef struct _LOGGER_CONNECTION {
+
+    // Run down while no client is connected, so senders fail to acquire it.
+    LOGGER_RUNDOWN Rundown;
+
+    // Client port, only valid while run-down protection is held.
+    PFLT_PORT ClientPort;
+
+    // User process that connected to the port
+    PEPROCESS UserProcess;
+
+} LOGGER_CONNECTION, * PLOGGER_CONNECTION;
+
+// Everything that carries the events of one priority.
+typedef struct _LOGGER_LANE {
+
+    LOGGER_PRIORITY Priority;
+
+    // Listens for incoming connections
+    PFLT_PORT ServerPort;
+
+    // Connection to user-mode
+    LOGGER_CONNECTION Connection;
+
+    // Events kept for replay across client restarts.
+    LOGGER_BACKLOG Backlog;
+
+    // How long a live send waits for the client, NULL for as long as it takes.
+    PLARGE_INTEGER SendTimeout;
+    LARGE_INTEGER SendTimeoutValue;
+
+} LOGGER_LANE, * PLOGGER_LANE;
+
 
 //---------------------------------------------------------------------------
 //      Global variables
@@ -27,14 +233,13 @@ typedef struct _LOGGER_FILTER_DATA {
     // The object that identifies this driver.
     PDRIVER_OBJECT DriverObject;
 
-    // Listens for incoming connections
-    PFLT_PORT ServerPort;
+    // One lane per LOGGER_PRIORITY.
+    LOGGER_LANE Lanes[LoggerPriorityCount];
 
-    // User process that connected to the port
-    PEPROCESS UserProcess;
-
-    // Client port for a connection to user-mode
-    PFLT_PORT ClientPort;
+    // Target rules, compiled at load. The first HighPriorityRuleCount rules
+    // are those of HighPriorityPatterns.
+    LOGGER_MATCHER Targets;
+    ULONG HighPriorityRuleCount;
 
 } LOGGER_FILTER_DATA, * PLOGGER_FILTER_DATA;
 
@@ -121,13 +326,152 @@ LoggerPortDisconnect(
     _In_opt_ PVOID ConnectionCookie
 );
 
+NTSTATUS
+LoggerPortMessage(
+    _In_opt_ PVOID PortCookie,
+    _In_reads_bytes_opt_(InputBufferLength) PVOID InputBuffer,
+    _In_ ULONG InputBufferLength,
+    _Out_writes_bytes_to_opt_(OutputBufferLength, *ReturnOutputBufferLength) PVOID OutputBuffer,
+    _In_ ULONG OutputBufferLength,
+    _Out_ PULONG ReturnOutputBufferLength
+);
+
 NTSTATUS SendMessageToUserMode(
+    PLOGGER_CONNECTION Connection,
     PVOID messageBuffer,
-    ULONG messageSize
+    ULONG messageSize,
+    PLARGE_INTEGER Timeout
+);
+
+/*************************************************************************
+	Prototypes for the connection routines
+	Implementation in LoggerFilter.c
+*************************************************************************/
+
+NTSTATUS
+LoggerConnectionInitialize(
+    _Out_ PLOGGER_CONNECTION Connection
+);
+
+VOID
+LoggerConnectionFree(
+    _Inout_ PLOGGER_CONNECTION Connection
+);
+
+VOID
+LoggerConnectionOpen(
+    _Inout_ PLOGGER_CONNECTION Connection,
+    _In_ PFLT_PORT ClientPort
+);
+
+VOID
+LoggerConnectionClose(
+    _Inout_ PLOGGER_CONNECTION Connection
+);
+
+/*************************************************************************
+	Prototypes for the lane routines
+	Implementation in LoggerFilter.c
+*************************************************************************/
+
+NTSTATUS
+LoggerLaneInitialize(
+    _Out_ PLOGGER_LANE Lane,
+    _In_ LOGGER_PRIORITY Priority,
+    _In_ ULONG Capacity,
+    _In_ ULONG MaxAgeSeconds,
+    _In_ ULONG SendTimeoutMs
+);
+
+VOID
+LoggerLaneFree(
+    _Inout_ PLOGGER_LANE Lane
+);
+
+/*************************************************************************
+	Prototypes for the backlog routines
+	Implementation in LoggerFilter.c
+*************************************************************************/
+
+NTSTATUS
+LoggerBacklogInitialize(
+    _Out_ PLOGGER_BACKLOG Backlog,
+    _In_ ULONG Capacity,
+    _In_ ULONG MaxAgeSeconds
+);
+
+VOID
+LoggerBacklogFree(
+    _Inout_ PLOGGER_BACKLOG Backlog
+);
+
+VOID
+LoggerBacklogRecord(
+    _Inout_ PLOGGER_BACKLOG Backlog,
+    _Inout_ PLOGGER_NOTIFICATION Notification
+);
+
+VOID
+LoggerBacklogShed(
+    _Inout_ PLOGGER_BACKLOG Backlog,
+    _In_ UINT64 Sequence
+);
+
+VOID
+LoggerBacklogAcknowledge(
+    _Inout_ PLOGGER_BACKLOG Backlog,
+    _In_ UINT64 Sequence
+);
+
+VOID
+LoggerBacklogQuery(
+    _In_ PLOGGER_BACKLOG Backlog,
+    _Out_ PLOGGER_REPLAY_REPLY Reply
+);
+
+VOID
+LoggerBacklogReplay(
+    _Inout_ PLOGGER_BACKLOG Backlog,
+    _In_ PLOGGER_CONNECTION Connection,
+    _In_ UINT64 AfterSequence,
+    _Out_ PLOGGER_REPLAY_REPLY Reply
+);
+
+VOID
+LoggerBacklogResend(
+    _In_ PLOGGER_BACKLOG Backlog,
+    _In_ PLOGGER_CONNECTION Connection,
+    _In_ UINT64 Sequence,
+    _In_ UINT64 Mask,
+    _Out_ PLOGGER_RESEND_REPLY Reply
 );
 
 /*************************************************************************/
 
 void GetFormattedTime(CHAR* buffer, SIZE_T bufferSize);
 
+NTSTATUS
+LoggerCompileTargets(
+    _In_opt_ HANDLE Key
+);
+
+HANDLE
+LoggerOpenParametersKey(
+    _In_ PUNICODE_STRING RegistryPath
+);
+
+ULONG
+LoggerReadRegistryDword(
+    _In_opt_ HANDLE Key,
+    _In_ PCWSTR ValueName,
+    _In_ ULONG DefaultValue
+);
+
+PKEY_VALUE_PARTIAL_INFORMATION
+LoggerReadRegistryValue(
+    _In_opt_ HANDLE Key,
+    _In_ PCWSTR ValueName,
+    _In_ ULONG Type
+);
+
 #endif
@@ -0,0 +1,1514 @@
+/*++
+Module Name:
+    LoggerMatch.c
+
+Abstract:
+    This module compiles the target rules into case-folded DFAs and matches
+    file names against them. Each rule is turned into a chain of NFA
+    positions, and the subset construction walks the sets of positions that
+    are reachable together. Transition rows are stored as a default target
+    plus the classes that differ from it, which keeps literal-heavy rule sets
+    small. Rules are grouped by shape before the construction, and a group
+    whose DFA grows too large is split until its parts fit.
+
+Environment:
+    Kernel mode
+--*/
+
+
+#include <fltKernel.h>
+#include "loggerMatch.h"
+
+#define LOGGER_MATCH_TAG            'mmgL'
+
+#define LOGGER_MATCH_CLASS_OTHER    0
+#define LOGGER_MATCH_CLASS_SEPARATOR 1
+
+#define LOGGER_MATCH_DEAD_STATE     0
+#define LOGGER_MATCH_START_STATE    1
+
+// Kinds of NFA positions.
+#define LOGGER_MATCH_LITERAL        0
+#define LOGGER_MATCH_QUESTION       1
+#define LOGGER_MATCH_STAR           2
+#define LOGGER_MATCH_GLOBSTAR       3
+#define LOGGER_MATCH_ACCEPT         4
+
+#define LOGGER_MATCH_EMPTY_SLOT     MAXULONG
+
+static const WCHAR LoggerMatchDevicePrefix[] = L"\\DEVICE\\";
+
+// Positions of a rule matched without a DFA that fit on the stack.
+#define LOGGER_MATCH_STACK_WORDS    8
+
+typedef struct _LOGGER_MATCH_BUILDER {
+
+    PLOGGER_MATCHER Matcher;
+    ULONG AutomatonCapacity;
+    ULONG ChainCapacity;
+
+    // DFA being built, and the states it may grow to.
+    PLOGGER_MATCH_AUTOMATON Automaton;
+    ULONG StateLimit;
+    ULONG StateCapacity;
+    ULONG ExceptionCapacity;
+
+    PLOGGER_MATCH_TOKEN Tokens;
+    ULONG TokenCount;
+
+    // First position of every rule, LOGGER_MATCH_EMPTY_SLOT for empty rules.
+    PULONG RuleStart;
+
+    // Rules that are not empty, in rule order within each group: first the
+    // rules without a '**' followed by more of the pattern, then the others.
+    PULONG Order;
+    ULONG OrderCount;
+    ULONG AnchoredCount;
+
+    // Position sets of the DFA states, sorted, back to back in SetPool.
+    PULONG SetPool;
+    ULONG SetPoolUsed;
+    ULONG SetPoolSize;
+    PULONG SetOffset;
+    PULONG SetLength;
+    ULONG SetCapacity;
+
+    // Open addressing table of state indexes, keyed by position set.
+    PULONG Hash;
+    ULONG HashSize;
+
+    // Scratch, TokenCount entries each.
+    PULONG Current;
+    PULONG Target;
+    PULONG Mark;
+    ULONG Generation;
+
+    // Scratch, ClassCount entries each.
+    PULONG LiteralCount;
+    PULONG Row;
+
+} LOGGER_MATCH_BUILDER, * PLOGGER_MATCH_BUILDER;
+
+WCHAR
+LoggerMatchUpcase(
+    _In_ WCHAR Char
+);
+
+USHORT
+LoggerMatchClassify(
+    _In_ PLOGGER_MATCHER Matcher,
+    _In_ WCHAR Char
+);
+
+ULONG
+LoggerMatchRun(
+    _In_ PLOGGER_MATCHER Matcher,
+    _In_ PLOGGER_MATCH_AUTOMATON Automaton,
+    _In_ PCUNICODE_STRING Name
+);
+
+BOOLEAN
+LoggerMatchSimulate(
+    _In_ PLOGGER_MATCHER Matcher,
+    _In_reads_(Count) PLOGGER_MATCH_TOKEN Chain,
+    _In_ ULONG Count,
+    _In_ PCUNICODE_STRING Name
+);
+
+BOOLEAN
+LoggerMatchAddBit(
+    _In_ PLOGGER_MATCH_TOKEN Chain,
+    _Inout_ PULONG64 Set,
+    _In_ ULONG Position
+);
+
+BOOLEAN
+LoggerMatchIsVolumeRelative(
+    _In_ PCUNICODE_STRING Rule
+);
+
+NTSTATUS
+LoggerMatchBuildClasses(
+    _In_reads_(RuleCount) PCUNICODE_STRING Rules,
+    _In_ ULONG RuleCount,
+    _Inout_ PLOGGER_MATCHER Matcher
+);
+
+NTSTATUS
+LoggerMatchBuildTokens(
+    _In_reads_(RuleCount) PCUNICODE_STRING Rules,
+    _In_ ULONG RuleCount,
+    _Inout_ PLOGGER_MATCH_BUILDER Builder
+);
+
+ULONG
+LoggerMatchChainLength(
+    _In_ PLOGGER_MATCH_TOKEN Chain
+);
+
+NTSTATUS
+LoggerMatchBuildOrder(
+    _In_ ULONG RuleCount,
+    _Inout_ PLOGGER_MATCH_BUILDER Builder
+);
+
+NTSTATUS
+LoggerMatchBuildScratch(
+    _Inout_ PLOGGER_MATCH_BUILDER Builder
+);
+
+NTSTATUS
+LoggerMatchBuildGroup(
+    _Inout_ PLOGGER_MATCH_BUILDER Builder,
+    _In_reads_(Count) PULONG Rules,
+    _In_ ULONG Count
+);
+
+NTSTATUS
+LoggerMatchBuildAutomaton(
+    _Inout_ PLOGGER_MATCH_BUILDER Builder,
+    _In_reads_(Count) PULONG Rules,
+    _In_ ULONG Count
+);
+
+NTSTATUS
+LoggerMatchBuildStates(
+    _Inout_ PLOGGER_MATCH_BUILDER Builder,
+    _In_reads_(Count) PULONG Rules,
+    _In_ ULONG Count
+);
+
+NTSTATUS
+LoggerMatchAddChain(
+    _Inout_ PLOGGER_MATCH_BUILDER Builder,
+    _In_ ULONG Rule
+);
+
+NTSTATUS
+LoggerMatchGrow(
+    _Inout_ PVOID* Array,
+    _Inout_ PULONG Capacity,
+    _In_ ULONG ElementSize,
+    _In_ ULONG Needed
+);
+
+VOID
+LoggerMatchSort(
+    _Inout_updates_(Count) PULONG Values,
+    _In_ ULONG Count
+);
+
+ULONG
+LoggerMatchHashSet(
+    _In_reads_(Count) PULONG Set,
+    _In_ ULONG Count
+);
+
+NTSTATUS
+LoggerMatchAddState(
+    _Inout_ PLOGGER_MATCH_BUILDER Builder,
+    _In_reads_(Count) PULONG Set,
+    _In_ ULONG Count,
+    _Out_ PULONG State
+);
+
+VOID
+LoggerMatchAddPosition(
+    _Inout_ PLOGGER_MATCH_BUILDER Builder,
+    _In_ ULONG Position,
+    _Inout_ PULONG Count
+);
+
+NTSTATUS
+LoggerMatchStep(
+    _Inout_ PLOGGER_MATCH_BUILDER Builder,
+    _In_reads_(Count) PULONG Set,
+    _In_ ULONG Count,
+    _In_ ULONG Class,
+    _Out_ PULONG State
+);
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text(INIT, LoggerMatcherCompile)
+#pragma alloc_text(INIT, LoggerMatcherSplitMultiSz)
+#pragma alloc_text(INIT, LoggerMatchIsVolumeRelative)
+#pragma alloc_text(INIT, LoggerMatchBuildClasses)
+#pragma alloc_text(INIT, LoggerMatchBuildTokens)
+#pragma alloc_text(INIT, LoggerMatchChainLength)
+#pragma alloc_text(INIT, LoggerMatchBuildOrder)
+#pragma alloc_text(INIT, LoggerMatchBuildScratch)
+#pragma alloc_text(INIT, LoggerMatchBuildGroup)
+#pragma alloc_text(INIT, LoggerMatchBuildAutomaton)
+#pragma alloc_text(INIT, LoggerMatchBuildStates)
+#pragma alloc_text(INIT, LoggerMatchAddChain)
+#pragma alloc_text(INIT, LoggerMatchGrow)
+#pragma alloc_text(INIT, LoggerMatchSort)
+#pragma alloc_text(INIT, LoggerMatchHashSet)
+#pragma alloc_text(INIT, LoggerMatchAddState)
+#pragma alloc_text(INIT, LoggerMatchAddPosition)
+#pragma alloc_text(INIT, LoggerMatchStep)
+#pragma alloc_text(PAGE, LoggerMatcherFree)
+#pragma alloc_text(PAGE, LoggerMatcherMatch)
+#pragma alloc_text(PAGE, LoggerMatchRun)
+#pragma alloc_text(PAGE, LoggerMatchSimulate)
+#pragma alloc_text(PAGE, LoggerMatchAddBit)
+#pragma alloc_text(PAGE, LoggerMatchUpcase)
+#pragma alloc_text(PAGE, LoggerMatchClassify)
+#endif
+
+
+NTSTATUS
+LoggerMatcherCompile(
+    _In_reads_(RuleCount) PCUNICODE_STRING Rules,
+    _In_ ULONG RuleCount,
+    _Out_ PLOGGER_MATCHER Matcher
+)
+/*
+Routine Description:
+    Compiles the rules into DFAs, one for the rules without a '**' followed
+    by more of the pattern and one for the others. A group whose DFA grows
+    past the limits is split, see LoggerMatchBuildGroup.
+
+Arguments:
+    Rules - Patterns, in rule order. Empty patterns never match.
+    RuleCount - Number of patterns.
+    Matcher - Receives the DFAs.
+
+Return Value:
+    STATUS_SUCCESS, STATUS_IMPLEMENTATION_LIMIT when the rules have more
+    positions than LOGGER_MATCH_MAX_SET_POOL, or another error status. On
+    error nothing stays allocated.
+*/
+{
+    LOGGER_MATCH_BUILDER builder;
+    NTSTATUS status;
+
+    RtlZeroMemory(Matcher, sizeof(LOGGER_MATCHER));
+    RtlZeroMemory(&builder, sizeof(LOGGER_MATCH_BUILDER));
+
+    Matcher->RuleCount = RuleCount;
+    builder.Matcher = Matcher;
+
+    status = LoggerMatchBuildClasses(Rules, RuleCount, Matcher);
+
+    if (NT_SUCCESS(status)) {
+        status = LoggerMatchBuildTokens(Rules, RuleCount, &builder);
+    }
+
+    if (NT_SUCCESS(status)) {
+        status = LoggerMatchBuildOrder(RuleCount, &builder);
+    }
+
+    if (NT_SUCCESS(status)) {
+        status = LoggerMatchBuildScratch(&builder);
+    }
+
+    if (NT_SUCCESS(status) && builder.AnchoredCount != 0) {
+        status = LoggerMatchBuildGroup(&builder, builder.Order, builder.AnchoredCount);
+    }
+
+    if (NT_SUCCESS(status) && builder.OrderCount > builder.AnchoredCount) {
+        status = LoggerMatchBuildGroup(&builder,
+            &builder.Order[builder.AnchoredCount],
+            builder.OrderCount - builder.AnchoredCount);
+    }
+
+    if (builder.Tokens != NULL) {
+        ExFreePoolWithTag(builder.Tokens, LOGGER_MATCH_TAG);
+    }
+    if (builder.RuleStart != NULL) {
+        ExFreePoolWithTag(builder.RuleStart, LOGGER_MATCH_TAG);
+    }
+    if (builder.Order != NULL) {
+        ExFreePoolWithTag(builder.Order, LOGGER_MATCH_TAG);
+    }
+    if (builder.SetPool != NULL) {
+        ExFreePoolWithTag(builder.SetPool, LOGGER_MATCH_TAG);
+    }
+    if (builder.SetOffset != NULL) {
+        ExFreePoolWithTag(builder.SetOffset, LOGGER_MATCH_TAG);
+    }
+    if (builder.SetLength != NULL) {
+        ExFreePoolWithTag(builder.SetLength, LOGGER_MATCH_TAG);
+    }
+    if (builder.Hash != NULL) {
+        ExFreePoolWithTag(builder.Hash, LOGGER_MATCH_TAG);
+    }
+    if (builder.Current != NULL) {
+        ExFreePoolWithTag(builder.Current, LOGGER_MATCH_TAG);
+    }
+    if (builder.Target != NULL) {
+        ExFreePoolWithTag(builder.Target, LOGGER_MATCH_TAG);
+    }
+    if (builder.Mark != NULL) {
+        ExFreePoolWithTag(builder.Mark, LOGGER_MATCH_TAG);
+    }
+    if (builder.LiteralCount != NULL) {
+        ExFreePoolWithTag(builder.LiteralCount, LOGGER_MATCH_TAG);
+    }
+    if (builder.Row != NULL) {
+        ExFreePoolWithTag(builder.Row, LOGGER_MATCH_TAG);
+    }
+
+    if (!NT_SUCCESS(status)) {
+        LoggerMatcherFree(Matcher);
+        return status;
+    }
+
+    KdPrint(("[LoggerFilter] " __FUNCTION__ " %u rules, %u classes, %u DFAs, %u splits, %u rules without a DFA\n",
+        Matcher->RuleCount,
+        Matcher->ClassCount,
+        Matcher->AutomatonCount,
+        Matcher->SplitCount,
+        Matcher->ChainCount));
+
+    return STATUS_SUCCESS;
+}
+
+ULONG
+LoggerMatcherSplitMultiSz(
+    _In_reads_bytes_(Length) PCWSTR MultiSz,
+    _In_ ULONG Length,
+    _Out_writes_opt_(Capacity) PUNICODE_STRING Rules,
+    _In_ ULONG Capacity
+)
+/*
+Routine Description:
+    Splits a REG_MULTI_SZ into rules that point into it.
+
+Arguments:
+    MultiSz - The value data.
+    Length - Size of the data in bytes.
+    Rules - Receives the first Capacity strings, or NULL to only count them.
+        Rules keep their position in the list, so a rule index read from the
+        log always names the same string in the registry value. A string too
+        long for a UNICODE_STRING is stored empty and never matches. The end
+        of the data ends the last string when its terminator is missing.
+    Capacity - Number of entries in Rules.
+
+Return Value:
+    The number of strings in the value.
+*/
+{
+    ULONG chars = Length / sizeof(WCHAR);
+    ULONG index;
+    ULONG start;
+    ULONG count = 0;
+
+    for (index = 0, start = 0; index <= chars; index++) {
+        if (index < chars && MultiSz[index] != L'\0') {
+            continue;
+        }
+        if (index > start) {
+            if (Rules != NULL && count < Capacity) {
+                RtlZeroMemory(&Rules[count], sizeof(UNICODE_STRING));
+
+                if ((index - start) * sizeof(WCHAR) <= MAXUSHORT) {
+                    Rules[count].Buffer = (PWCH)&MultiSz[start];
+                    Rules[count].Length = (USHORT)((index - start) * sizeof(WCHAR));
+                    Rules[count].MaximumLength = Rules[count].Length;
+                }
+            }
+            count++;
+        }
+        start = index + 1;
+    }
+
+    return count;
+}
+
+VOID
+LoggerMatcherFree(
+    _Inout_ PLOGGER_MATCHER Matcher
+)
+{
+    ULONG index;
+
+    PAGED_CODE();
+
+    for (index = 0; index < Matcher->AutomatonCount; index++) {
+        ExFreePoolWithTag(Matcher->Automata[index].States, LOGGER_MATCH_TAG);
+        if (Matcher->Automata[index].Exceptions != NULL) {
+            ExFreePoolWithTag(Matcher->Automata[index].Exceptions, LOGGER_MATCH_TAG);
+        }
+    }
+    if (Matcher->Automata != NULL) {
+        ExFreePoolWithTag(Matcher->Automata, LOGGER_MATCH_TAG);
+    }
+    if (Matcher->Chains != NULL) {
+        ExFreePoolWithTag(Matcher->Chains, LOGGER_MATCH_TAG);
+    }
+    if (Matcher->WideChars != NULL) {
+        ExFreePoolWithTag(Matcher->WideChars, LOGGER_MATCH_TAG);
+    }
+    if (Matcher->WideClass != NULL) {
+        ExFreePoolWithTag(Matcher->WideClass, LOGGER_MATCH_TAG);
+    }
+    RtlZeroMemory(Matcher, sizeof(LOGGER_MATCHER));
+}
+
+BOOLEAN
+LoggerMatcherMatch(
+    _In_ PLOGGER_MATCHER Matcher,
+    _In_ PCUNICODE_STRING Name,
+    _Out_ PULONG Rule
+)
+/*
+Routine Description:
+    Runs the name through every DFA that holds a rule below the best match
+    so far, then through the rules matched without a DFA.
+
+Arguments:
+    Matcher - Compiled rules.
+    Name - Normalized file name.
+    Rule - Receives the lowest matching rule index, or LOGGER_MATCH_NO_RULE.
+
+Return Value:
+    TRUE if a rule matched.
+*/
+{
+    ULONG best = LOGGER_MATCH_NO_RULE;
+    ULONG rule;
+    ULONG index;
+    ULONG end;
+
+    PAGED_CODE();
+
+    for (index = 0; index < Matcher->AutomatonCount; index++) {
+        if (Matcher->Automata[index].FirstRule < best) {
+            rule = LoggerMatchRun(Matcher, &Matcher->Automata[index], Name);
+            if (rule < best) {
+                best = rule;
+            }
+        }
+    }
+
+    for (index = 0; index < Matcher->ChainTokenCount; index = end + 1) {
+        for (end = index; Matcher->Chains[end].Kind != LOGGER_MATCH_ACCEPT; end++) {
+            NOTHING;
+        }
+        if (Matcher->Chains[end].Rule < best &&
+            LoggerMatchSimulate(Matcher, &Matcher->Chains[index], end - index + 1, Name)) {
+            best = Matcher->Chains[end].Rule;
+        }
+    }
+
+    *Rule = best;
+    return best != LOGGER_MATCH_NO_RULE;
+}
+
+ULONG
+LoggerMatchRun(
+    _In_ PLOGGER_MATCHER Matcher,
+    _In_ PLOGGER_MATCH_AUTOMATON Automaton,
+    _In_ PCUNICODE_STRING Name
+)
+/*
+Routine Description:
+    Runs one DFA over the name, one transition per character, and stops as
+    soon as none of its rules can match any more.
+
+Return Value:
+    The lowest matching rule of the DFA, or LOGGER_MATCH_NO_RULE.
+*/
+{
+    ULONG chars = Name->Length / sizeof(WCHAR);
+    ULONG index;
+    ULONG state = LOGGER_MATCH_START_STATE;
+
+    PAGED_CODE();
+
+    for (index = 0; index < chars; index++) {
+        PLOGGER_MATCH_STATE current = &Automaton->States[state];
+        PLOGGER_MATCH_EXCEPTION exception = &Automaton->Exceptions[current->FirstException];
+        ULONG cls = LoggerMatchClassify(Matcher, LoggerMatchUpcase(Name->Buffer[index]));
+        ULONG low = 0;
+        ULONG high = current->ExceptionCount;
+
+        state = current->Default;
+        while (low < high) {
+            ULONG middle = (low + high) / 2;
+            if (exception[middle].Class < cls) {
+                low = middle + 1;
+            } else if (exception[middle].Class > cls) {
+                high = middle;
+            } else {
+                state = exception[middle].Target;
+                break;
+            }
+        }
+
+        if (state == LOGGER_MATCH_DEAD_STATE) {
+            return LOGGER_MATCH_NO_RULE;
+        }
+    }
+
+    return Automaton->States[state].Rule;
+}
+
+BOOLEAN
+LoggerMatchAddBit(
+    _In_ PLOGGER_MATCH_TOKEN Chain,
+    _Inout_ PULONG64 Set,
+    _In_ ULONG Position
+)
+/*
+Routine Description:
+    Adds a position and everything reachable from it without consuming a
+    character to a bit set, like LoggerMatchAddPosition.
+
+Return Value:
+    TRUE, so that callers can note that the set is not empty.
+*/
+{
+    PAGED_CODE();
+
+    for (;;) {
+        Set[Position / 64] |= 1ULL << (Position % 64);
+
+        if (Chain[Position].Kind != LOGGER_MATCH_STAR && Chain[Position].Kind != LOGGER_MATCH_GLOBSTAR) {
+            return TRUE;
+        }
+        Position++;
+    }
+}
+
+BOOLEAN
+LoggerMatchSimulate(
+    _In_ PLOGGER_MATCHER Matcher,
+    _In_reads_(Count) PLOGGER_MATCH_TOKEN Chain,
+    _In_ ULONG Count,
+    _In_ PCUNICODE_STRING Name
+)
+/*
+Routine Description:
+    Matches the name against a rule that has no DFA by stepping through
+    the set of its positions, as LoggerMatchStep does, at the cost of one
+    pass over the positions per character. Sets of rules longer than
+    LOGGER_MATCH_STACK_WORDS words are allocated for the call.
+
+Return Value:
+    TRUE if the rule matched. FALSE also when the sets could not be
+    allocated.
+*/
+{
+    ULONG64 stackSets[2 * LOGGER_MATCH_STACK_WORDS];
+    PULONG64 pooledSets = NULL;
+    PULONG64 current = stackSets;
+    PULONG64 next;
+    PULONG64 swap;
+    ULONG words = (Count + 63) / 64;
+    ULONG chars = Name->Length / sizeof(WCHAR);
+    ULONG index;
+    ULONG position;
+    BOOLEAN alive = TRUE;
+    BOOLEAN matched;
+
+    PAGED_CODE();
+
+    if (words > LOGGER_MATCH_STACK_WORDS) {
+        pooledSets = ExAllocatePoolZero(PagedPool, (SIZE_T)words * 2 * sizeof(ULONG64), LOGGER_MATCH_TAG);
+        if (pooledSets == NULL) {
+            return FALSE;
+        }
+        current = pooledSets;
+    }
+    next = current + words;
+
+    RtlZeroMemory(current, words * sizeof(ULONG64));
+    LoggerMatchAddBit(Chain, current, 0);
+
+    for (index = 0; index < chars && alive; index++) {
+        ULONG cls = LoggerMatchClassify(Matcher, LoggerMatchUpcase(Name->Buffer[index]));
+
+        RtlZeroMemory(next, words * sizeof(ULONG64));
+        alive = FALSE;
+
+        for (position = 0; position < Count; position++) {
+            if ((current[position / 64] & (1ULL << (position % 64))) == 0) {
+                continue;
+            }
+
+            switch (Chain[position].Kind) {
+            case LOGGER_MATCH_LITERAL:
+                if (Chain[position].Class == cls) {
+                    alive = LoggerMatchAddBit(Chain, next, position + 1);
+                }
+                break;
+
+            case LOGGER_MATCH_QUESTION:
+                if (cls != LOGGER_MATCH_CLASS_SEPARATOR) {
+                    alive = LoggerMatchAddBit(Chain, next, position + 1);
+                }
+                break;
+
+            case LOGGER_MATCH_STAR:
+                if (cls != LOGGER_MATCH_CLASS_SEPARATOR) {
+                    alive = LoggerMatchAddBit(Chain, next, position);
+                }
+                break;
+
+            case LOGGER_MATCH_GLOBSTAR:
+                alive = LoggerMatchAddBit(Chain, next, position);
+                break;
+
+            default:
+                break;
+            }
+        }
+
+        swap = current;
+        current = next;
+        next = swap;
+    }
+
+    matched = alive && (current[(Count - 1) / 64] & (1ULL << ((Count - 1) % 64))) != 0;
+
+    if (pooledSets != NULL) {
+        ExFreePoolWithTag(pooledSets, LOGGER_MATCH_TAG);
+    }
+    return matched;
+}
+
+WCHAR
+LoggerMatchUpcase(
+    _In_ WCHAR Char
+)
+{
+    PAGED_CODE();
+
+    if (Char < 0x80) {
+        return (Char >= L'a' && Char <= L'z') ? (WCHAR)(Char - (L'a' - L'A')) : Char;
+    }
+    return RtlUpcaseUnicodeChar(Char);
+}
+
+USHORT
+LoggerMatchClassify(
+    _In_ PLOGGER_MATCHER Matcher,
+    _In_ WCHAR Char
+)
+/*
+Routine Description:
+    Maps an upcased character to its class. Characters that no rule names
+    fall into LOGGER_MATCH_CLASS_OTHER.
+*/
+{
+    ULONG low = 0;
+    ULONG high = Matcher->WideCount;
+
+    PAGED_CODE();
+
+    if (Char < 0x80) {
+        return Matcher->AsciiClass[Char];
+    }
+
+    while (low < high) {
+        ULONG middle = (low + high) / 2;
+        if (Matcher->WideChars[middle] < Char) {
+            low = middle + 1;
+        } else if (Matcher->WideChars[middle] > Char) {
+            high = middle;
+        } else {
+            return Matcher->WideClass[middle];
+        }
+    }
+    return LOGGER_MATCH_CLASS_OTHER;
+}
+
+BOOLEAN
+LoggerMatchIsVolumeRelative(
+    _In_ PCUNICODE_STRING Rule
+)
+{
+    ULONG chars = Rule->Length / sizeof(WCHAR);
+    ULONG index;
+
+    if (chars < ARRAYSIZE(LoggerMatchDevicePrefix) - 1) {
+        return TRUE;
+    }
+
+    for (index = 0; index < ARRAYSIZE(LoggerMatchDevicePrefix) - 1; index++) {
+        if (LoggerMatchUpcase(Rule->Buffer[index]) != LoggerMatchDevicePrefix[index]) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+NTSTATUS
+LoggerMatchBuildClasses(
+    _In_reads_(RuleCount) PCUNICODE_STRING Rules,
+    _In_ ULONG RuleCount,
+    _Inout_ PLOGGER_MATCHER Matcher
+)
+/*
+Routine Description:
+    Gives every upcased literal character of the rules its own class.
+    ASCII characters are looked up in a table, the rest in a sorted array.
+*/
+{
+    ULONG rule;
+    ULONG index;
+    ULONG total = 0;
+    ULONG count = 0;
+    USHORT next = LOGGER_MATCH_CLASS_SEPARATOR + 1;
+
+    Matcher->AsciiClass[L'\\'] = LOGGER_MATCH_CLASS_SEPARATOR;
+
+    for (index = 0; index < ARRAYSIZE(LoggerMatchDevicePrefix) - 1; index++) {
+        WCHAR c = LoggerMatchDevicePrefix[index];
+        if (Matcher->AsciiClass[c] == LOGGER_MATCH_CLASS_OTHER) {
+            Matcher->AsciiClass[c] = next++;
+        }
+    }
+
+    for (rule = 0; rule < RuleCount; rule++) {
+        for (index = 0; index < Rules[rule].Length / sizeof(WCHAR); index++) {
+            WCHAR c = LoggerMatchUpcase(Rules[rule].Buffer[index]);
+            if (c >= 0x80) {
+                total++;
+            } else if (c != L'*' && c != L'?' && Matcher->AsciiClass[c] == LOGGER_MATCH_CLASS_OTHER) {
+                Matcher->AsciiClass[c] = next++;
+            }
+        }
+    }
+
+    if (total != 0) {
+        Matcher->WideChars = ExAllocatePoolZero(PagedPool, total * sizeof(WCHAR), LOGGER_MATCH_TAG);
+        Matcher->WideClass = ExAllocatePoolZero(PagedPool, total * sizeof(USHORT), LOGGER_MATCH_TAG);
+        if (Matcher->WideChars == NULL || Matcher->WideClass == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        // Insertion into the sorted array, there are rarely more than a few.
+        for (rule = 0; rule < RuleCount; rule++) {
+            for (index = 0; index < Rules[rule].Length / sizeof(WCHAR); index++) {
+                WCHAR c = LoggerMatchUpcase(Rules[rule].Buffer[index]);
+                ULONG slot;
+
+                if (c < 0x80) {
+                    continue;
+                }
+                for (slot = count; slot > 0 && Matcher->WideChars[slot - 1] > c; slot--) {
+                    NOTHING;
+                }
+                if (slot > 0 && Matcher->WideChars[slot - 1] == c) {
+                    continue;
+                }
+                RtlMoveMemory(&Matcher->WideChars[slot + 1], &Matcher->WideChars[slot], (count - slot) * sizeof(WCHAR));
+                Matcher->WideChars[slot] = c;
+                count++;
+            }
+        }
+
+        for (index = 0; index < count; index++) {
+            if (next == MAXUSHORT) {
+                return STATUS_IMPLEMENTATION_LIMIT;
+            }
+            Matcher->WideClass[index] = next++;
+        }
+        Matcher->WideCount = count;
+    }
+
+    Matcher->ClassCount = next;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+LoggerMatchBuildTokens(
+    _In_reads_(RuleCount) PCUNICODE_STRING Rules,
+    _In_ ULONG RuleCount,
+    _Inout_ PLOGGER_MATCH_BUILDER Builder
+)
+/*
+Routine Description:
+    Lays the rules out as one array of NFA positions. Each rule is a chain
+    that ends in an accept position; a '*' or '**' position loops on itself
+    and can also be skipped.
+*/
+{
+    PLOGGER_MATCHER matcher = Builder->Matcher;
+    ULONG64 total = 0;
+    ULONG rule;
+    ULONG index;
+    ULONG count = 0;
+
+    // Each rule may get the volume prefix, a '*', a separator and its accept
+    // position. ARRAYSIZE counts the prefix's terminator, hence only + 2.
+    for (rule = 0; rule < RuleCount; rule++) {
+        total += Rules[rule].Length / sizeof(WCHAR) + ARRAYSIZE(LoggerMatchDevicePrefix) + 2;
+    }
+
+    if (total == 0 || total > LOGGER_MATCH_MAX_SET_POOL) {
+        return total == 0 ? STATUS_INVALID_PARAMETER : STATUS_IMPLEMENTATION_LIMIT;
+    }
+
+    Builder->Tokens = ExAllocatePoolZero(PagedPool, (SIZE_T)total * sizeof(LOGGER_MATCH_TOKEN), LOGGER_MATCH_TAG);
+    Builder->RuleStart = ExAllocatePoolZero(PagedPool, (SIZE_T)RuleCount * sizeof(ULONG), LOGGER_MATCH_TAG);
+    if (Builder->Tokens == NULL || Builder->RuleStart == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    for (rule = 0; rule < RuleCount; rule++) {
+        PCUNICODE_STRING pattern = &Rules[rule];
+        ULONG chars = pattern->Length / sizeof(WCHAR);
+
+        if (chars == 0) {
+            Builder->RuleStart[rule] = LOGGER_MATCH_EMPTY_SLOT;
+            continue;
+        }
+        Builder->RuleStart[rule] = count;
+
+        if (LoggerMatchIsVolumeRelative(pattern)) {
+            for (index = 0; index < ARRAYSIZE(LoggerMatchDevicePrefix) - 1; index++) {
+                Builder->Tokens[count].Kind = LOGGER_MATCH_LITERAL;
+                Builder->Tokens[count].Class = matcher->AsciiClass[LoggerMatchDevicePrefix[index]];
+                count++;
+            }
+            Builder->Tokens[count++].Kind = LOGGER_MATCH_STAR;
+
+            // The volume name ends where the relative rule starts.
+            if (pattern->Buffer[0] != L'\\') {
+                Builder->Tokens[count].Kind = LOGGER_MATCH_LITERAL;
+                Builder->Tokens[count].Class = LOGGER_MATCH_CLASS_SEPARATOR;
+                count++;
+            }
+        }
+
+        for (index = 0; index < chars; index++) {
+            WCHAR c = LoggerMatchUpcase(pattern->Buffer[index]);
+
+            if (c == L'*') {
+                if (index + 1 < chars && pattern->Buffer[index + 1] == L'*') {
+                    while (index + 1 < chars && pattern->Buffer[index + 1] == L'*') {
+                        index++;
+                    }
+                    Builder->Tokens[count++].Kind = LOGGER_MATCH_GLOBSTAR;
+                } else {
+                    Builder->Tokens[count++].Kind = LOGGER_MATCH_STAR;
+                }
+            } else if (c == L'?') {
+                Builder->Tokens[count++].Kind = LOGGER_MATCH_QUESTION;
+            } else {
+                Builder->Tokens[count].Kind = LOGGER_MATCH_LITERAL;
+                Builder->Tokens[count].Class = LoggerMatchClassify(matcher, c);
+                count++;
+            }
+        }
+
+        Builder->Tokens[count].Kind = LOGGER_MATCH_ACCEPT;
+        Builder->Tokens[count].Rule = rule;
+        count++;
+    }
+
+    Builder->TokenCount = count;
+    return STATUS_SUCCESS;
+}
+
+ULONG
+LoggerMatchChainLength(
+    _In_ PLOGGER_MATCH_TOKEN Chain
+)
+/*
+Routine Description:
+    Counts the positions of a rule, its accept position included.
+*/
+{
+    ULONG length = 1;
+
+    while (Chain[length - 1].Kind != LOGGER_MATCH_ACCEPT) {
+        length++;
+    }
+    return length;
+}
+
+NTSTATUS
+LoggerMatchBuildOrder(
+    _In_ ULONG RuleCount,
+    _Inout_ PLOGGER_MATCH_BUILDER Builder
+)
+/*
+Routine Description:
+    Groups the rules by shape. A '**' followed by more of the pattern stays
+    in the position set of every state after it, next to the positions of
+    every other rule, so rules that have one are kept apart from the others.
+    A trailing '**' only makes the rule accept, and stays with the others.
+*/
+{
+    ULONG pass;
+    ULONG rule;
+
+    Builder->Order = ExAllocatePoolZero(PagedPool, (SIZE_T)RuleCount * sizeof(ULONG), LOGGER_MATCH_TAG);
+    if (Builder->Order == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    for (pass = 0; pass < 2; pass++) {
+        for (rule = 0; rule < RuleCount; rule++) {
+            PLOGGER_MATCH_TOKEN token;
+            BOOLEAN floating = FALSE;
+
+            if (Builder->RuleStart[rule] == LOGGER_MATCH_EMPTY_SLOT) {
+                continue;
+            }
+
+            for (token = &Builder->Tokens[Builder->RuleStart[rule]]; token->Kind != LOGGER_MATCH_ACCEPT; token++) {
+                if (token->Kind == LOGGER_MATCH_GLOBSTAR && token[1].Kind != LOGGER_MATCH_ACCEPT) {
+                    floating = TRUE;
+                }
+            }
+
+            if (floating == (pass != 0)) {
+                Builder->Order[Builder->OrderCount++] = rule;
+            }
+        }
+
+        if (pass == 0) {
+            Builder->AnchoredCount = Builder->OrderCount;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+LoggerMatchBuildScratch(
+    _Inout_ PLOGGER_MATCH_BUILDER Builder
+)
+/*
+Routine Description:
+    Allocates the scratch that the subset construction of every DFA reuses.
+*/
+{
+    ULONG classes = Builder->Matcher->ClassCount;
+
+    Builder->HashSize = 1024;
+    Builder->Hash = ExAllocatePoolZero(PagedPool, Builder->HashSize * sizeof(ULONG), LOGGER_MATCH_TAG);
+    Builder->Current = ExAllocatePoolZero(PagedPool, Builder->TokenCount * sizeof(ULONG), LOGGER_MATCH_TAG);
+    Builder->Target = ExAllocatePoolZero(PagedPool, Builder->TokenCount * sizeof(ULONG), LOGGER_MATCH_TAG);
+    Builder->Mark = ExAllocatePoolZero(PagedPool, Builder->TokenCount * sizeof(ULONG), LOGGER_MATCH_TAG);
+    Builder->LiteralCount = ExAllocatePoolZero(PagedPool, classes * sizeof(ULONG), LOGGER_MATCH_TAG);
+    Builder->Row = ExAllocatePoolZero(PagedPool, classes * sizeof(ULONG), LOGGER_MATCH_TAG);
+
+    if (Builder->Hash == NULL || Builder->Current == NULL || Builder->Target == NULL ||
+        Builder->Mark == NULL || Builder->LiteralCount == NULL || Builder->Row == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+LoggerMatchBuildGroup(
+    _Inout_ PLOGGER_MATCH_BUILDER Builder,
+    _In_reads_(Count) PULONG Rules,
+    _In_ ULONG Count
+)
+/*
+Routine Description:
+    Builds one DFA for the rules. When it grows past the limits, builds the
+    two halves of the rules separately instead, down to a single rule; a
+    rule that is past the limits on its own is matched without a DFA.
+    The halves keep the rule order, so each DFA holds a run of the rules.
+*/
+{
+    NTSTATUS status;
+
+    status = LoggerMatchBuildAutomaton(Builder, Rules, Count);
+    if (status != STATUS_IMPLEMENTATION_LIMIT) {
+        return status;
+    }
+
+    if (Count == 1) {
+        return LoggerMatchAddChain(Builder, Rules[0]);
+    }
+
+    Builder->Matcher->SplitCount++;
+
+    status = LoggerMatchBuildGroup(Builder, Rules, Count / 2);
+    if (NT_SUCCESS(status)) {
+        status = LoggerMatchBuildGroup(Builder, &Rules[Count / 2], Count - Count / 2);
+    }
+    return status;
+}
+
+NTSTATUS
+LoggerMatchBuildAutomaton(
+    _Inout_ PLOGGER_MATCH_BUILDER Builder,
+    _In_reads_(Count) PULONG Rules,
+    _In_ ULONG Count
+)
+/*
+Routine Description:
+    Builds the DFA of the rules and adds it to the matcher.
+
+Return Value:
+    STATUS_SUCCESS, STATUS_IMPLEMENTATION_LIMIT when the DFA grows past
+    the limits, or another error status. On error the DFA is not added.
+*/
+{
+    PLOGGER_MATCHER matcher = Builder->Matcher;
+    PLOGGER_MATCH_AUTOMATON automaton;
+    ULONG64 limit = 0;
+    ULONG index;
+    NTSTATUS status;
+
+    status = LoggerMatchGrow((PVOID*)&matcher->Automata, &Builder->AutomatonCapacity,
+        sizeof(LOGGER_MATCH_AUTOMATON), matcher->AutomatonCount + 1);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    for (index = 0; index < Count; index++) {
+        limit += LoggerMatchChainLength(&Builder->Tokens[Builder->RuleStart[Rules[index]]]);
+    }
+    limit = limit * LOGGER_MATCH_STATES_PER_POSITION + LOGGER_MATCH_BASE_STATES;
+
+    automaton = &matcher->Automata[matcher->AutomatonCount];
+    RtlZeroMemory(automaton, sizeof(LOGGER_MATCH_AUTOMATON));
+    automaton->FirstRule = Rules[0];
+
+    Builder->Automaton = automaton;
+    Builder->StateLimit = limit < LOGGER_MATCH_MAX_STATES ? (ULONG)limit : LOGGER_MATCH_MAX_STATES;
+    Builder->StateCapacity = 0;
+    Builder->ExceptionCapacity = 0;
+    Builder->SetPoolUsed = 0;
+    RtlFillMemory(Builder->Hash, Builder->HashSize * sizeof(ULONG), 0xFF);
+
+    status = LoggerMatchBuildStates(Builder, Rules, Count);
+
+    if (!NT_SUCCESS(status)) {
+        if (automaton->States != NULL) {
+            ExFreePoolWithTag(automaton->States, LOGGER_MATCH_TAG);
+        }
+        if (automaton->Exceptions != NULL) {
+            ExFreePoolWithTag(automaton->Exceptions, LOGGER_MATCH_TAG);
+        }
+        RtlZeroMemory(automaton, sizeof(LOGGER_MATCH_AUTOMATON));
+        return status;
+    }
+
+    matcher->AutomatonCount++;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+LoggerMatchAddChain(
+    _Inout_ PLOGGER_MATCH_BUILDER Builder,
+    _In_ ULONG Rule
+)
+/*
+Routine Description:
+    Copies the positions of a rule to the rules matched without a DFA.
+*/
+{
+    PLOGGER_MATCHER matcher = Builder->Matcher;
+    PLOGGER_MATCH_TOKEN chain = &Builder->Tokens[Builder->RuleStart[Rule]];
+    ULONG length = LoggerMatchChainLength(chain);
+    NTSTATUS status;
+
+    status = LoggerMatchGrow((PVOID*)&matcher->Chains, &Builder->ChainCapacity,
+        sizeof(LOGGER_MATCH_TOKEN), matcher->ChainTokenCount + length);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    RtlCopyMemory(&matcher->Chains[matcher->ChainTokenCount], chain, length * sizeof(LOGGER_MATCH_TOKEN));
+    matcher->ChainTokenCount += length;
+    matcher->ChainCount++;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+LoggerMatchGrow(
+    _Inout_ PVOID* Array,
+    _Inout_ PULONG Capacity,
+    _In_ ULONG ElementSize,
+    _In_ ULONG Needed
+)
+{
+    ULONG capacity = *Capacity;
+    PVOID array;
+
+    if (Needed <= capacity) {
+        return STATUS_SUCCESS;
+    }
+
+    capacity = capacity < 256 ? 256 : capacity;
+    while (capacity < Needed) {
+        capacity *= 2;
+    }
+
+    array = ExAllocatePoolZero(PagedPool, (SIZE_T)capacity * ElementSize, LOGGER_MATCH_TAG);
+    if (array == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    if (*Array != NULL) {
+        RtlCopyMemory(array, *Array, (SIZE_T)*Capacity * ElementSize);
+        ExFreePoolWithTag(*Array, LOGGER_MATCH_TAG);
+    }
+
+    *Array = array;
+    *Capacity = capacity;
+    return STATUS_SUCCESS;
+}
+
+VOID
+LoggerMatchSort(
+    _Inout_updates_(Count) PULONG Values,
+    _In_ ULONG Count
+)
+/*
+Routine Description:
+    Heap sort, position sets can hold one entry per rule. A step mostly
+    keeps the order of the set it starts from, so sorted input is detected
+    first.
+*/
+{
+    ULONG start = Count / 2;
+    ULONG end = Count;
+    ULONG index;
+
+    for (index = 1; index < Count && Values[index - 1] < Values[index]; index++) {
+        NOTHING;
+    }
+    if (index >= Count) {
+        return;
+    }
+
+    while (end > 1) {
+        ULONG root;
+        ULONG value;
+
+        if (start > 0) {
+            start--;
+        } else {
+            end--;
+            value = Values[end];
+            Values[end] = Values[0];
+            Values[0] = value;
+        }
+
+        root = start;
+        value = Values[root];
+        for (;;) {
+            ULONG child = root * 2 + 1;
+            if (child >= end) {
+                break;
+            }
+            if (child + 1 < end && Values[child + 1] > Values[child]) {
+                child++;
+            }
+            if (Values[child] <= value) {
+                break;
+            }
+            Values[root] = Values[child];
+            root = child;
+        }
+        Values[root] = value;
+    }
+}
+
+ULONG
+LoggerMatchHashSet(
+    _In_reads_(Count) PULONG Set,
+    _In_ ULONG Count
+)
+{
+    ULONG hash = 2166136261;
+    ULONG index;
+
+    for (index = 0; index < Count; index++) {
+        hash = (hash ^ Set[index]) * 16777619;
+    }
+    return hash;
+}
+
+NTSTATUS
+LoggerMatchAddState(
+    _Inout_ PLOGGER_MATCH_BUILDER Builder,
+    _In_reads_(Count) PULONG Set,
+    _In_ ULONG Count,
+    _Out_ PULONG State
+)
+/*
+Routine Description:
+    Returns the state of a sorted position set, adding it if it is new.
+*/
+{
+    PLOGGER_MATCH_AUTOMATON automaton = Builder->Automaton;
+    ULONG hash = LoggerMatchHashSet(Set, Count);
+    ULONG slot;
+    ULONG state;
+    NTSTATUS status;
+
+    for (slot = hash & (Builder->HashSize - 1);
+        Builder->Hash[slot] != LOGGER_MATCH_EMPTY_SLOT;
+        slot = (slot + 1) & (Builder->HashSize - 1)) {
+
+        state = Builder->Hash[slot];
+        if (Builder->SetLength[state] == Count &&
+            RtlCompareMemory(&Builder->SetPool[Builder->SetOffset[state]], Set, Count * sizeof(ULONG)) == Count * sizeof(ULONG)) {
+            *State = state;
+            return STATUS_SUCCESS;
+        }
+    }
+
+    state = automaton->StateCount;
+    if (state >= Builder->StateLimit || Builder->SetPoolUsed + Count > LOGGER_MATCH_MAX_SET_POOL) {
+        return STATUS_IMPLEMENTATION_LIMIT;
+    }
+
+    status = LoggerMatchGrow((PVOID*)&Builder->SetPool, &Builder->SetPoolSize, sizeof(ULONG), Builder->SetPoolUsed + Count);
+
+    // The set arrays are kept from one DFA to the next, the states are not.
+    if (NT_SUCCESS(status) && state + 1 > Builder->SetCapacity) {
+        ULONG capacity = Builder->SetCapacity;
+
+        status = LoggerMatchGrow((PVOID*)&Builder->SetOffset, &capacity, sizeof(ULONG), state + 1);
+        if (NT_SUCCESS(status)) {
+            capacity = Builder->SetCapacity;
+            status = LoggerMatchGrow((PVOID*)&Builder->SetLength, &capacity, sizeof(ULONG), state + 1);
+        }
+        if (NT_SUCCESS(status)) {
+            Builder->SetCapacity = capacity;
+        }
+    }
+
+    if (NT_SUCCESS(status)) {
+        status = LoggerMatchGrow((PVOID*)&automaton->States, &Builder->StateCapacity,
+            sizeof(LOGGER_MATCH_STATE), state + 1);
+    }
+
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    RtlCopyMemory(&Builder->SetPool[Builder->SetPoolUsed], Set, Count * sizeof(ULONG));
+    Builder->SetOffset[state] = Builder->SetPoolUsed;
+    Builder->SetLength[state] = Count;
+    Builder->SetPoolUsed += Count;
+    automaton->StateCount++;
+    Builder->Hash[slot] = state;
+
+    // Keep the table at most half full.
+    if (automaton->StateCount * 2 > Builder->HashSize) {
+        ULONG size = Builder->HashSize * 2;
+        PULONG table = ExAllocatePoolZero(PagedPool, (SIZE_T)size * sizeof(ULONG), LOGGER_MATCH_TAG);
+        ULONG index;
+
+        if (table == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        RtlFillMemory(table, (SIZE_T)size * sizeof(ULONG), 0xFF);
+        for (index = 0; index < automaton->StateCount; index++) {
+            slot = LoggerMatchHashSet(&Builder->SetPool[Builder->SetOffset[index]], Builder->SetLength[index]) & (size - 1);
+            while (table[slot] != LOGGER_MATCH_EMPTY_SLOT) {
+                slot = (slot + 1) & (size - 1);
+            }
+            table[slot] = index;
+        }
+
+        ExFreePoolWithTag(Builder->Hash, LOGGER_MATCH_TAG);
+        Builder->Hash = table;
+        Builder->HashSize = size;
+    }
+
+    *State = state;
+    return STATUS_SUCCESS;
+}
+
+VOID
+LoggerMatchAddPosition(
+    _Inout_ PLOGGER_MATCH_BUILDER Builder,
+    _In_ ULONG Position,
+    _Inout_ PULONG Count
+)
+/*
+Routine Description:
+    Adds a position and everything reachable from it without consuming a
+    character to Builder->Target, skipping positions already in it.
+*/
+{
+    for (;;) {
+        USHORT kind;
+
+        if (Builder->Mark[Position] == Builder->Generation) {
+            return;
+        }
+        Builder->Mark[Position] = Builder->Generation;
+        Builder->Target[(*Count)++] = Position;
+
+        kind = Builder->Tokens[Position].Kind;
+        if (kind != LOGGER_MATCH_STAR && kind != LOGGER_MATCH_GLOBSTAR) {
+            return;
+        }
+        Position++;
+    }
+}
+
+NTSTATUS
+LoggerMatchStep(
+    _Inout_ PLOGGER_MATCH_BUILDER Builder,
+    _In_reads_(Count) PULONG Set,
+    _In_ ULONG Count,
+    _In_ ULONG Class,
+    _Out_ PULONG State
+)
+/*
+Routine Description:
+    Computes the state reached from the position set on a character of the
+    given class.
+*/
+{
+    ULONG target = 0;
+    ULONG index;
+
+    Builder->Generation++;
+
+    for (index = 0; index < Count; index++) {
+        ULONG position = Set[index];
+        PLOGGER_MATCH_TOKEN token = &Builder->Tokens[position];
+
+        switch (token->Kind) {
+        case LOGGER_MATCH_LITERAL:
+            if (token->Class == Class) {
+                LoggerMatchAddPosition(Builder, position + 1, &target);
+            }
+            break;
+
+        case LOGGER_MATCH_QUESTION:
+            if (Class != LOGGER_MATCH_CLASS_SEPARATOR) {
+                LoggerMatchAddPosition(Builder, position + 1, &target);
+            }
+            break;
+
+        case LOGGER_MATCH_STAR:
+            if (Class != LOGGER_MATCH_CLASS_SEPARATOR) {
+                LoggerMatchAddPosition(Builder, position, &target);
+            }
+            break;
+
+        case LOGGER_MATCH_GLOBSTAR:
+            LoggerMatchAddPosition(Builder, position, &target);
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    if (target == 0) {
+        *State = LOGGER_MATCH_DEAD_STATE;
+        return STATUS_SUCCESS;
+    }
+
+    LoggerMatchSort(Builder->Target, target);
+    return LoggerMatchAddState(Builder, Builder->Target, target, State);
+}
+
+NTSTATUS
+LoggerMatchBuildStates(
+    _Inout_ PLOGGER_MATCH_BUILDER Builder,
+    _In_reads_(Count) PULONG Rules,
+    _In_ ULONG Count
+)
+/*
+Routine Description:
+    Subset construction of the DFA of the given rules. States are numbered
+    in the order they are found and processed in that order, so the loop
+    ends when no new state turns up. Only the classes named by a literal in
+    the current set, the separator and one representative of all other
+    classes are stepped; every other class goes where
+    LOGGER_MATCH_CLASS_OTHER goes.
+*/
+{
+    PLOGGER_MATCH_AUTOMATON automaton = Builder->Automaton;
+    ULONG classes = Builder->Matcher->ClassCount;
+    ULONG state;
+    ULONG index;
+    ULONG count;
+    NTSTATUS status;
+
+    // The dead state is the empty set.
+    status = LoggerMatchAddState(Builder, NULL, 0, &state);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    // The start state holds the first position of every rule.
+    Builder->Generation++;
+    count = 0;
+    for (index = 0; index < Count; index++) {
+        LoggerMatchAddPosition(Builder, Builder->RuleStart[Rules[index]], &count);
+    }
+    LoggerMatchSort(Builder->Target, count);
+    status = LoggerMatchAddState(Builder, Builder->Target, count, &state);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    automaton->States[LOGGER_MATCH_DEAD_STATE].Default = LOGGER_MATCH_DEAD_STATE;
+    automaton->States[LOGGER_MATCH_DEAD_STATE].Rule = LOGGER_MATCH_NO_RULE;
+
+    for (state = LOGGER_MATCH_START_STATE; state < automaton->StateCount; state++) {
+        PLOGGER_MATCH_STATE current;
+        ULONG rule = LOGGER_MATCH_NO_RULE;
+        ULONG cls;
+
+        // Adding states can move the pool, so work on a copy of the set.
+        count = Builder->SetLength[state];
+        RtlCopyMemory(Builder->Current, &Builder->SetPool[Builder->SetOffset[state]], count * sizeof(ULONG));
+
+        // Find the classes named by a literal of the set.
+        RtlZeroMemory(Builder->LiteralCount, classes * sizeof(ULONG));
+        for (index = 0; index < count; index++) {
+            PLOGGER_MATCH_TOKEN token = &Builder->Tokens[Builder->Current[index]];
+            if (token->Kind == LOGGER_MATCH_LITERAL) {
+                Builder->LiteralCount[token->Class]++;
+            } else if (token->Kind == LOGGER_MATCH_ACCEPT && token->Rule < rule) {
+                rule = token->Rule;
+            }
+        }
+
+        status = LoggerMatchStep(Builder, Builder->Current, count, LOGGER_MATCH_CLASS_OTHER, &Builder->Row[LOGGER_MATCH_CLASS_OTHER]);
+
+        for (cls = LOGGER_MATCH_CLASS_SEPARATOR; cls < classes && NT_SUCCESS(status); cls++) {
+            if (cls == LOGGER_MATCH_CLASS_SEPARATOR || Builder->LiteralCount[cls] != 0) {
+                status = LoggerMatchStep(Builder, Builder->Current, count, cls, &Builder->Row[cls]);
+            } else {
+                Builder->Row[cls] = Builder->Row[LOGGER_MATCH_CLASS_OTHER];
+            }
+        }
+
+        if (!NT_SUCCESS(status)) {
+            return status;
+        }
+
+        current = &automaton->States[state];
+        current->Default = Builder->Row[LOGGER_MATCH_CLASS_OTHER];
+        current->FirstException = automaton->ExceptionCount;
+        current->Rule = rule;
+
+        for (cls = LOGGER_MATCH_CLASS_SEPARATOR; cls < classes; cls++) {
+            if (Builder->Row[cls] == current->Default) {
+                continue;
+            }
+
+            status = LoggerMatchGrow((PVOID*)&automaton->Exceptions, &Builder->ExceptionCapacity,
+                sizeof(LOGGER_MATCH_EXCEPTION), automaton->ExceptionCount + 1);
+            if (!NT_SUCCESS(status)) {
+                return status;
+            }
+
+            automaton->Exceptions[automaton->ExceptionCount].Class = cls;
+            automaton->Exceptions[automaton->ExceptionCount].Target = Builder->Row[cls];
+            automaton->ExceptionCount++;
+            current->ExceptionCount++;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
@@ -0,0 +1,137 @@
+#ifndef __LOGGERMATCH_H__
+#define __LOGGERMATCH_H__
+
+/*************************************************************************
+    Target rules.
+
+    A rule is a path pattern, matched case-insensitively against the whole
+    normalized file name:
+        *       any run of characters other than '\'
+        **      any run of characters, including '\'
+        ?       one character other than '\'
+    Anything else matches itself. A rule that does not start with \Device\
+    is relative to the root of any volume.
+
+    Rules are compiled into DFAs, a name is run through each of them in one
+    pass, and the lowest-numbered matching rule is reported. A rule in which
+    '**' is followed by more of the pattern keeps a position open in every
+    state it reaches, which multiplies the states of the other rules, so
+    such rules get a DFA of their own. A DFA that grows past the limits
+    below is split in halves by rule, down to one rule per DFA; a rule past
+    them on its own is matched by stepping through its positions instead.
+*************************************************************************/
+
+#define LOGGER_MATCH_NO_RULE        MAXULONG
+
+// A DFA is split past these. Its states are also bounded by the positions
+// of its rules, so one that blows up is caught before it costs much time.
+// Compilation fails with STATUS_IMPLEMENTATION_LIMIT only when the rules
+// have more than LOGGER_MATCH_MAX_SET_POOL positions in all.
+#define LOGGER_MATCH_MAX_STATES     (1 << 20)
+#define LOGGER_MATCH_MAX_SET_POOL   (1 << 23)
+#define LOGGER_MATCH_BASE_STATES    4096
+#define LOGGER_MATCH_STATES_PER_POSITION 16
+
+typedef struct _LOGGER_MATCH_TOKEN {
+    USHORT Kind;
+    USHORT Class;
+
+    // Rule index, for accept positions.
+    ULONG Rule;
+
+} LOGGER_MATCH_TOKEN, * PLOGGER_MATCH_TOKEN;
+
+typedef struct _LOGGER_MATCH_STATE {
+
+    // Target for every class that has no exception.
+    ULONG Default;
+
+    // Transitions that differ from Default, sorted by class.
+    ULONG FirstException;
+    ULONG ExceptionCount;
+
+    // Lowest rule accepting in this state, or LOGGER_MATCH_NO_RULE.
+    ULONG Rule;
+
+} LOGGER_MATCH_STATE, * PLOGGER_MATCH_STATE;
+
+typedef struct _LOGGER_MATCH_EXCEPTION {
+    ULONG Class;
+    ULONG Target;
+
+} LOGGER_MATCH_EXCEPTION, * PLOGGER_MATCH_EXCEPTION;
+
+typedef struct _LOGGER_MATCH_AUTOMATON {
+
+    // State 0 rejects everything, state 1 is the start state.
+    PLOGGER_MATCH_STATE States;
+    ULONG StateCount;
+
+    PLOGGER_MATCH_EXCEPTION Exceptions;
+    ULONG ExceptionCount;
+
+    // Lowest rule compiled in. The DFA is not run once a lower rule matched.
+    ULONG FirstRule;
+
+} LOGGER_MATCH_AUTOMATON, * PLOGGER_MATCH_AUTOMATON;
+
+typedef struct _LOGGER_MATCHER {
+
+    PLOGGER_MATCH_AUTOMATON Automata;
+    ULONG AutomatonCount;
+
+    // Rules matched without a DFA, as chains of positions that each end in
+    // an accept position, back to back.
+    PLOGGER_MATCH_TOKEN Chains;
+    ULONG ChainTokenCount;
+    ULONG ChainCount;
+
+    // Number of DFAs split because they grew past the limits.
+    ULONG SplitCount;
+
+    // Character classes of upcased characters. Class 0 is every character
+    // that no rule names, class 1 is '\'.
+    USHORT AsciiClass[128];
+    PWCHAR WideChars;
+    PUSHORT WideClass;
+    ULONG WideCount;
+    ULONG ClassCount;
+
+    ULONG RuleCount;
+
+} LOGGER_MATCHER, * PLOGGER_MATCHER;
+
+
+/*************************************************************************
+    Prototypes for the matcher routines
+    Implementation in LoggerMatch.c
+*************************************************************************/
+
+NTSTATUS
+LoggerMatcherCompile(
+    _In_reads_(RuleCount) PCUNICODE_STRING Rules,
+    _In_ ULONG RuleCount,
+    _Out_ PLOGGER_MATCHER Matcher
+);
+
+ULONG
+LoggerMatcherSplitMultiSz(
+    _In_reads_bytes_(Length) PCWSTR MultiSz,
+    _In_ ULONG Length,
+    _Out_writes_opt_(Capacity) PUNICODE_STRING Rules,
+    _In_ ULONG Capacity
+);
+
+VOID
+LoggerMatcherFree(
+    _Inout_ PLOGGER_MATCHER Matcher
+);
+
+BOOLEAN
+LoggerMatcherMatch(
+    _In_ PLOGGER_MATCHER Matcher,
+    _In_ PCUNICODE_STRING Name,
+    _Out_ PULONG Rule
+);
+
+#endif
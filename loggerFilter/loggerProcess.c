@@ -0,0 +1,482 @@
+/*++
+Module Name:
+    LoggerProcess.c
+
+Abstract:
+    This module implements the process filter. Configured image names are
+    matched when a process starts and recorded in per-list PID bitmaps, so
+    the create path can drop events of excluded processes before it queries
+    the file name.
+
+Environment:
+    Kernel mode
+--*/
+
+
+#include <fltKernel.h>
+#include "loggerTrace.h"
+#include "loggerProcess.h"
+
+// Layout of the SystemProcessInformation records, as documented in winternl.h
+#define LOGGER_SYSTEM_PROCESS_INFORMATION_CLASS 5
+
+typedef struct _LOGGER_SYSTEM_PROCESS_INFORMATION {
+    ULONG NextEntryOffset;
+    ULONG NumberOfThreads;
+    UCHAR Reserved1[48];
+    UNICODE_STRING ImageName;
+    KPRIORITY BasePriority;
+    HANDLE UniqueProcessId;
+
+} LOGGER_SYSTEM_PROCESS_INFORMATION, * PLOGGER_SYSTEM_PROCESS_INFORMATION;
+
+NTSYSAPI
+NTSTATUS
+NTAPI
+ZwQuerySystemInformation(
+    _In_ ULONG SystemInformationClass,
+    _Out_writes_bytes_opt_(SystemInformationLength) PVOID SystemInformation,
+    _In_ ULONG SystemInformationLength,
+    _Out_opt_ PULONG ReturnLength
+);
+
+LOGGER_PROCESS_FILTER LoggerProcessFilter;
+
+NTSTATUS
+LoggerProcessParseNames(
+    _In_reads_bytes_opt_(Length) PCWSTR MultiSz,
+    _In_ ULONG Length,
+    _Out_ PLOGGER_PROCESS_NAMES Names
+);
+
+VOID
+LoggerProcessFreeNames(
+    _Inout_ PLOGGER_PROCESS_NAMES Names
+);
+
+ULONG
+LoggerProcessMatchLists(
+    _In_ PCUNICODE_STRING ImageName
+);
+
+VOID
+LoggerProcessUpdate(
+    _In_ HANDLE ProcessId,
+    _In_ ULONG Lists
+);
+
+VOID
+LoggerProcessNotify(
+    _Inout_ PEPROCESS Process,
+    _In_ HANDLE ProcessId,
+    _Inout_opt_ PPS_CREATE_NOTIFY_INFO CreateInfo
+);
+
+VOID
+LoggerProcessScanRunning(
+    VOID
+);
+
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text(INIT, LoggerProcessFilterInitialize)
+#pragma alloc_text(INIT, LoggerProcessParseNames)
+#pragma alloc_text(INIT, LoggerProcessScanRunning)
+#pragma alloc_text(PAGE, LoggerProcessFilterFree)
+#pragma alloc_text(PAGE, LoggerProcessFreeNames)
+#pragma alloc_text(PAGE, LoggerProcessMatchLists)
+#pragma alloc_text(PAGE, LoggerProcessNotify)
+#endif
+
+
+NTSTATUS
+LoggerProcessFilterInitialize(
+    _In_reads_bytes_opt_(ExcludedLength) PCWSTR ExcludedNames,
+    _In_ ULONG ExcludedLength,
+    _In_reads_bytes_opt_(IncludedLength) PCWSTR IncludedNames,
+    _In_ ULONG IncludedLength
+)
+/*
+Routine Description:
+    Builds the name lists and bitmaps, registers for process notifications
+    and marks the processes that are already running. Does nothing when
+    both lists are empty.
+
+Arguments:
+    ExcludedNames - REG_MULTI_SZ of image names whose events are dropped.
+    ExcludedLength - Size of ExcludedNames in bytes.
+    IncludedNames - REG_MULTI_SZ of image names; when not empty, only their
+        events are logged.
+    IncludedLength - Size of IncludedNames in bytes.
+
+Return Value:
+    STATUS_SUCCESS or an error status. On error nothing stays allocated.
+*/
+{
+    volatile LONG* notified;
+    NTSTATUS status;
+
+    RtlZeroMemory(&LoggerProcessFilter, sizeof(LOGGER_PROCESS_FILTER));
+
+    status = LoggerProcessParseNames(ExcludedNames, ExcludedLength, &LoggerProcessFilter.ExcludedNames);
+    if (NT_SUCCESS(status)) {
+        status = LoggerProcessParseNames(IncludedNames, IncludedLength, &LoggerProcessFilter.IncludedNames);
+    }
+
+    if (NT_SUCCESS(status) && LoggerProcessFilter.ExcludedNames.Count == 0 &&
+        LoggerProcessFilter.IncludedNames.Count == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    if (NT_SUCCESS(status) && LoggerProcessFilter.ExcludedNames.Count != 0) {
+        LoggerProcessFilter.Excluded = ExAllocatePoolZero(NonPagedPool, LOGGER_PROCESS_BITMAP_BITS / 8, 'fpgL');
+        if (LoggerProcessFilter.Excluded == NULL) {
+            status = STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+
+    if (NT_SUCCESS(status) && LoggerProcessFilter.IncludedNames.Count != 0) {
+        LoggerProcessFilter.Included = ExAllocatePoolZero(NonPagedPool, LOGGER_PROCESS_BITMAP_BITS / 8, 'fpgL');
+        if (LoggerProcessFilter.Included == NULL) {
+            status = STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+
+    if (NT_SUCCESS(status)) {
+        LoggerProcessFilter.Notified = ExAllocatePoolZero(PagedPool, LOGGER_PROCESS_BITMAP_BITS / 8, 'fpgL');
+        if (LoggerProcessFilter.Notified == NULL) {
+            status = STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+
+    // Register before scanning, so a process that starts during the scan is
+    // seen by one or the other. This needs the /INTEGRITYCHECK linker flag.
+    if (NT_SUCCESS(status)) {
+        FltInitializePushLock(&LoggerProcessFilter.ScanLock);
+
+        status = PsSetCreateProcessNotifyRoutineEx(LoggerProcessNotify, FALSE);
+        LoggerProcessFilter.NotifyRegistered = NT_SUCCESS(status);
+
+        if (!NT_SUCCESS(status)) {
+            FltDeletePushLock(&LoggerProcessFilter.ScanLock);
+        }
+    }
+
+    if (!NT_SUCCESS(status)) {
+        LoggerProcessFilterFree();
+        return status;
+    }
+
+    LoggerProcessScanRunning();
+
+    // From here on the notification alone keeps the bits.
+    FltAcquirePushLockExclusive(&LoggerProcessFilter.ScanLock);
+    notified = LoggerProcessFilter.Notified;
+    LoggerProcessFilter.Notified = NULL;
+    FltReleasePushLock(&LoggerProcessFilter.ScanLock);
+
+    ExFreePoolWithTag((PVOID)notified, 'fpgL');
+
+    KdPrint(("[LoggerFilter] " __FUNCTION__ " %u excluded, %u included image names\n",
+        LoggerProcessFilter.ExcludedNames.Count,
+        LoggerProcessFilter.IncludedNames.Count));
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+LoggerProcessFilterFree(
+    VOID
+)
+{
+    PAGED_CODE();
+
+    if (LoggerProcessFilter.NotifyRegistered) {
+        PsSetCreateProcessNotifyRoutineEx(LoggerProcessNotify, TRUE);
+        FltDeletePushLock(&LoggerProcessFilter.ScanLock);
+        LoggerProcessFilter.NotifyRegistered = FALSE;
+    }
+
+    if (LoggerProcessFilter.Notified != NULL) {
+        ExFreePoolWithTag((PVOID)LoggerProcessFilter.Notified, 'fpgL');
+        LoggerProcessFilter.Notified = NULL;
+    }
+
+    if (LoggerProcessFilter.Excluded != NULL) {
+        ExFreePoolWithTag((PVOID)LoggerProcessFilter.Excluded, 'fpgL');
+        LoggerProcessFilter.Excluded = NULL;
+    }
+
+    if (LoggerProcessFilter.Included != NULL) {
+        ExFreePoolWithTag((PVOID)LoggerProcessFilter.Included, 'fpgL');
+        LoggerProcessFilter.Included = NULL;
+    }
+
+    LoggerProcessFreeNames(&LoggerProcessFilter.ExcludedNames);
+    LoggerProcessFreeNames(&LoggerProcessFilter.IncludedNames);
+}
+
+NTSTATUS
+LoggerProcessParseNames(
+    _In_reads_bytes_opt_(Length) PCWSTR MultiSz,
+    _In_ ULONG Length,
+    _Out_ PLOGGER_PROCESS_NAMES Names
+)
+/*
+Routine Description:
+    Copies a REG_MULTI_SZ into a list of counted strings.
+*/
+{
+    ULONG chars = Length / sizeof(WCHAR);
+    ULONG index;
+    ULONG start;
+    ULONG count = 0;
+
+    RtlZeroMemory(Names, sizeof(LOGGER_PROCESS_NAMES));
+
+    if (MultiSz == NULL || chars == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    for (index = 0; index < chars; index++) {
+        if (MultiSz[index] == L'\0' && index > 0 && MultiSz[index - 1] != L'\0') {
+            count++;
+        }
+    }
+
+    if (count == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    Names->Buffer = ExAllocatePoolZero(PagedPool, Length, 'fpgL');
+    Names->Names = ExAllocatePoolZero(PagedPool, count * sizeof(UNICODE_STRING), 'fpgL');
+
+    if (Names->Buffer == NULL || Names->Names == NULL) {
+        LoggerProcessFreeNames(Names);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlCopyMemory(Names->Buffer, MultiSz, Length);
+
+    for (index = 0, start = 0; index < chars && Names->Count < count; index++) {
+        if (Names->Buffer[index] != L'\0') {
+            continue;
+        }
+        if (index > start && (index - start) * sizeof(WCHAR) <= MAXUSHORT) {
+            PUNICODE_STRING name = &Names->Names[Names->Count++];
+            name->Buffer = &Names->Buffer[start];
+            name->Length = (USHORT)((index - start) * sizeof(WCHAR));
+            name->MaximumLength = name->Length;
+        }
+        start = index + 1;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+LoggerProcessFreeNames(
+    _Inout_ PLOGGER_PROCESS_NAMES Names
+)
+{
+    PAGED_CODE();
+
+    if (Names->Names != NULL) {
+        ExFreePoolWithTag(Names->Names, 'fpgL');
+    }
+    if (Names->Buffer != NULL) {
+        ExFreePoolWithTag(Names->Buffer, 'fpgL');
+    }
+    RtlZeroMemory(Names, sizeof(LOGGER_PROCESS_NAMES));
+}
+
+ULONG
+LoggerProcessMatchLists(
+    _In_ PCUNICODE_STRING ImageName
+)
+/*
+Routine Description:
+    Returns the LOGGER_PROCESS_LIST_* flags of the lists holding the final
+    component of ImageName. The comparison is case-insensitive.
+*/
+{
+    UNICODE_STRING fileName;
+    USHORT index;
+    ULONG lists = 0;
+    ULONG i;
+
+    PAGED_CODE();
+
+    fileName = *ImageName;
+
+    for (index = ImageName->Length / sizeof(WCHAR); index > 0; index--) {
+        if (ImageName->Buffer[index - 1] == L'\\') {
+            fileName.Buffer = &ImageName->Buffer[index];
+            fileName.Length = ImageName->Length - index * sizeof(WCHAR);
+            fileName.MaximumLength = fileName.Length;
+            break;
+        }
+    }
+
+    for (i = 0; i < LoggerProcessFilter.ExcludedNames.Count; i++) {
+        if (RtlEqualUnicodeString(&fileName, &LoggerProcessFilter.ExcludedNames.Names[i], TRUE)) {
+            lists |= LOGGER_PROCESS_LIST_EXCLUDED;
+            break;
+        }
+    }
+
+    for (i = 0; i < LoggerProcessFilter.IncludedNames.Count; i++) {
+        if (RtlEqualUnicodeString(&fileName, &LoggerProcessFilter.IncludedNames.Names[i], TRUE)) {
+            lists |= LOGGER_PROCESS_LIST_INCLUDED;
+            break;
+        }
+    }
+
+    return lists;
+}
+
+VOID
+LoggerProcessUpdate(
+    _In_ HANDLE ProcessId,
+    _In_ ULONG Lists
+)
+/*
+Routine Description:
+    Sets the process's bit in each list of Lists and clears it in the
+    others. Each bit is changed with one interlocked operation, so readers
+    never see a torn word.
+*/
+{
+    ULONG_PTR pid = (ULONG_PTR)ProcessId;
+    ULONG_PTR index = pid / 4;
+    LONG mask = (LONG)(1UL << (index % 32));
+
+    if (pid >= LOGGER_PROCESS_MAX_PID) {
+        return;
+    }
+
+    if (LoggerProcessFilter.Excluded != NULL) {
+        if (Lists & LOGGER_PROCESS_LIST_EXCLUDED) {
+            InterlockedOr(&LoggerProcessFilter.Excluded[index / 32], mask);
+        }
+        else {
+            InterlockedAnd(&LoggerProcessFilter.Excluded[index / 32], ~mask);
+        }
+    }
+
+    if (LoggerProcessFilter.Included != NULL) {
+        if (Lists & LOGGER_PROCESS_LIST_INCLUDED) {
+            InterlockedOr(&LoggerProcessFilter.Included[index / 32], mask);
+        }
+        else {
+            InterlockedAnd(&LoggerProcessFilter.Included[index / 32], ~mask);
+        }
+    }
+}
+
+VOID
+LoggerProcessNotify(
+    _Inout_ PEPROCESS Process,
+    _In_ HANDLE ProcessId,
+    _Inout_opt_ PPS_CREATE_NOTIFY_INFO CreateInfo
+)
+/*
+Routine Description:
+    Process creation and exit callback. A new process gets its bits set from
+    its image name; an exiting process has them cleared, so a reused ID
+    never inherits the previous process's lists. While the running processes
+    are scanned, the ID is also marked as notified, so the scan does not
+    overwrite these bits with a stale snapshot entry.
+*/
+{
+    ULONG_PTR index = (ULONG_PTR)ProcessId / 4;
+    ULONG lists = 0;
+
+    UNREFERENCED_PARAMETER(Process);
+
+    PAGED_CODE();
+
+    if (CreateInfo != NULL && CreateInfo->ImageFileName != NULL) {
+        lists = LoggerProcessMatchLists(CreateInfo->ImageFileName);
+
+        if (lists != 0) {
+            LOGGER_TRACE_INFO(PROCESS, LoggerTraceProcessListed, PtrToUint(ProcessId), lists, 0, 0);
+        }
+    }
+
+    // Notified only goes from set to NULL once the notification is
+    // registered, so a NULL read here means the scan is over.
+    if (LoggerProcessFilter.Notified == NULL) {
+        LoggerProcessUpdate(ProcessId, lists);
+        return;
+    }
+
+    FltAcquirePushLockShared(&LoggerProcessFilter.ScanLock);
+
+    if (LoggerProcessFilter.Notified != NULL && (ULONG_PTR)ProcessId < LOGGER_PROCESS_MAX_PID) {
+        InterlockedOr(&LoggerProcessFilter.Notified[index / 32], (LONG)(1UL << (index % 32)));
+    }
+    LoggerProcessUpdate(ProcessId, lists);
+
+    FltReleasePushLock(&LoggerProcessFilter.ScanLock);
+}
+
+VOID
+LoggerProcessScanRunning(
+    VOID
+)
+/*
+Routine Description:
+    Marks the processes that were already running when the driver loaded.
+    The snapshot buffer is grown until the process list fits. IDs the
+    notification has seen since it was registered are skipped: their bits
+    are current, and the snapshot may be older.
+*/
+{
+    PLOGGER_SYSTEM_PROCESS_INFORMATION info;
+    ULONG_PTR index;
+    ULONG lists;
+    PVOID buffer = NULL;
+    ULONG length = 64 * 1024;
+    NTSTATUS status;
+
+    for (;;) {
+        buffer = ExAllocatePoolZero(PagedPool, length, 'fpgL');
+        if (buffer == NULL) {
+            return;
+        }
+
+        status = ZwQuerySystemInformation(LOGGER_SYSTEM_PROCESS_INFORMATION_CLASS, buffer, length, &length);
+        if (status != STATUS_INFO_LENGTH_MISMATCH) {
+            break;
+        }
+
+        ExFreePoolWithTag(buffer, 'fpgL');
+        buffer = NULL;
+        length += 16 * 1024;
+    }
+
+    if (NT_SUCCESS(status)) {
+        info = buffer;
+        for (;;) {
+            if (info->ImageName.Buffer != NULL && (ULONG_PTR)info->UniqueProcessId < LOGGER_PROCESS_MAX_PID) {
+                lists = LoggerProcessMatchLists(&info->ImageName);
+                index = (ULONG_PTR)info->UniqueProcessId / 4;
+
+                FltAcquirePushLockExclusive(&LoggerProcessFilter.ScanLock);
+
+                if ((LoggerProcessFilter.Notified[index / 32] & (1UL << (index % 32))) == 0) {
+                    LoggerProcessUpdate(info->UniqueProcessId, lists);
+                }
+
+                FltReleasePushLock(&LoggerProcessFilter.ScanLock);
+            }
+            if (info->NextEntryOffset == 0) {
+                break;
+            }
+            info = (PLOGGER_SYSTEM_PROCESS_INFORMATION)((PUCHAR)info + info->NextEntryOffset);
+        }
+    }
+
+    ExFreePoolWithTag(buffer, 'fpgL');
+}
@@ -0,0 +1,108 @@
+#ifndef __LOGGERPROCESS_H__
+#define __LOGGERPROCESS_H__
+
+/*************************************************************************
+    Process filter.
+
+    Processes are excluded or included by image name (for example
+    "MsMpEng.exe"). Names are resolved to process IDs when a process starts,
+    through a process creation notification, and for processes already
+    running when the driver loads. The create path then only tests a bit.
+*************************************************************************/
+
+// Process IDs are multiples of 4, so bit (pid / 4) represents a process.
+// IDs at or above LOGGER_PROCESS_MAX_PID are never listed.
+#define LOGGER_PROCESS_BITMAP_BITS      (1 << 20)
+#define LOGGER_PROCESS_MAX_PID          (LOGGER_PROCESS_BITMAP_BITS * 4)
+
+#define LOGGER_PROCESS_LIST_EXCLUDED    0x1
+#define LOGGER_PROCESS_LIST_INCLUDED    0x2
+
+typedef struct _LOGGER_PROCESS_NAMES {
+    PUNICODE_STRING Names;
+    ULONG Count;
+    PWCHAR Buffer;
+
+} LOGGER_PROCESS_NAMES, * PLOGGER_PROCESS_NAMES;
+
+typedef struct _LOGGER_PROCESS_FILTER {
+
+    // One bit per process ID, updated with interlocked operations and read
+    // without synchronization. NULL when the corresponding list is empty.
+    volatile LONG* Excluded;
+    volatile LONG* Included;
+
+    LOGGER_PROCESS_NAMES ExcludedNames;
+    LOGGER_PROCESS_NAMES IncludedNames;
+
+    // One bit per process ID the notification has seen, only while the
+    // processes that were running at load are scanned. The scan leaves
+    // those IDs alone: its snapshot entry may be of a process that has
+    // exited since, and the ID may already belong to a new process.
+    // ScanLock is taken shared by the notification and exclusive by the
+    // scan, so neither updates an ID between the other's check and write.
+    volatile LONG* Notified;
+    EX_PUSH_LOCK ScanLock;
+
+    BOOLEAN NotifyRegistered;
+
+} LOGGER_PROCESS_FILTER, * PLOGGER_PROCESS_FILTER;
+
+extern LOGGER_PROCESS_FILTER LoggerProcessFilter;
+
+
+/*************************************************************************
+    Prototypes for the process filter routines
+    Implementation in LoggerProcess.c
+*************************************************************************/
+
+NTSTATUS
+LoggerProcessFilterInitialize(
+    _In_reads_bytes_opt_(ExcludedLength) PCWSTR ExcludedNames,
+    _In_ ULONG ExcludedLength,
+    _In_reads_bytes_opt_(IncludedLength) PCWSTR IncludedNames,
+    _In_ ULONG IncludedLength
+);
+
+VOID
+LoggerProcessFilterFree(
+    VOID
+);
+
+FORCEINLINE
+BOOLEAN
+LoggerProcessFilterAllows(
+    _In_ HANDLE ProcessId
+)
+/*
+Routine Description:
+    Returns FALSE if events of this process must not be logged: it is
+    excluded, or an inclusion list exists and it is not on it.
+*/
+{
+    ULONG_PTR pid = (ULONG_PTR)ProcessId;
+    ULONG_PTR index = pid / 4;
+    BOOLEAN listed;
+
+    if (LoggerProcessFilter.Excluded == NULL && LoggerProcessFilter.Included == NULL) {
+        return TRUE;
+    }
+
+    if (pid >= LOGGER_PROCESS_MAX_PID) {
+        return LoggerProcessFilter.Included == NULL;
+    }
+
+    if (LoggerProcessFilter.Excluded != NULL &&
+        (LoggerProcessFilter.Excluded[index / 32] & (1UL << (index % 32))) != 0) {
+        return FALSE;
+    }
+
+    if (LoggerProcessFilter.Included == NULL) {
+        return TRUE;
+    }
+
+    listed = (LoggerProcessFilter.Included[index / 32] & (1UL << (index % 32))) != 0;
+    return listed;
+}
+
+#endif
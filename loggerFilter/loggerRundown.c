@@ -0,0 +1,185 @@
+/*++
+Module Name:
+    LoggerRundown.c
+
+Abstract:
+    This module implements the run-down protection of the connections:
+    lock-free acquisition on per-processor counters, and a wait for the
+    acquisitions in progress when the protection is run down.
+
+Environment:
+    Kernel mode
+--*/
+
+
+#include <fltKernel.h>
+#include "loggerRundown.h"
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text(INIT, LoggerRundownInitialize)
+#pragma alloc_text(PAGE, LoggerRundownFree)
+#pragma alloc_text(PAGE, LoggerRundownWait)
+#pragma alloc_text(PAGE, LoggerRundownReInitialize)
+#endif
+
+static
+PLOGGER_RUNDOWN_COUNTER
+LoggerRundownCounter(
+    _In_ PLOGGER_RUNDOWN Rundown
+)
+{
+    // Processors added after the counters were allocated share them.
+    return &Rundown->Counters[KeGetCurrentProcessorNumberEx(NULL) % Rundown->CounterCount];
+}
+
+NTSTATUS
+LoggerRundownInitialize(
+    _Out_ PLOGGER_RUNDOWN Rundown,
+    _In_ ULONG Tag
+)
+/*
+Routine Description:
+    Allocates a counter per active processor, each set to run down, so the
+    protection cannot be acquired until LoggerRundownReInitialize.
+
+Return Value:
+    STATUS_SUCCESS or STATUS_INSUFFICIENT_RESOURCES.
+*/
+{
+    ULONG count = KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    ULONG index;
+
+    PAGED_CODE();
+
+    RtlZeroMemory(Rundown, sizeof(LOGGER_RUNDOWN));
+
+    Rundown->Counters = ExAllocatePoolZero(NonPagedPool,
+        (SIZE_T)count * sizeof(LOGGER_RUNDOWN_COUNTER),
+        Tag);
+
+    if (Rundown->Counters == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    for (index = 0; index < count; index++) {
+        Rundown->Counters[index].Value = LOGGER_RUNDOWN_ACTIVE;
+    }
+
+    Rundown->CounterCount = count;
+    Rundown->Tag = Tag;
+    KeInitializeEvent(&Rundown->Drained, NotificationEvent, TRUE);
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+LoggerRundownFree(
+    _Inout_ PLOGGER_RUNDOWN Rundown
+)
+{
+    PAGED_CODE();
+
+    if (Rundown->Counters != NULL) {
+        ExFreePoolWithTag(Rundown->Counters, Rundown->Tag);
+        Rundown->Counters = NULL;
+        Rundown->CounterCount = 0;
+    }
+}
+
+BOOLEAN
+LoggerRundownAcquire(
+    _Inout_ PLOGGER_RUNDOWN Rundown
+)
+{
+    PLOGGER_RUNDOWN_COUNTER counter = LoggerRundownCounter(Rundown);
+    LONG64 value = counter->Value;
+    LONG64 seen;
+
+    // The exchange fails if the waiter has swapped in LOGGER_RUNDOWN_ACTIVE
+    // since the read, so a reference is never added behind its back.
+    while ((value & LOGGER_RUNDOWN_ACTIVE) == 0) {
+        seen = InterlockedCompareExchange64(&counter->Value, value + LOGGER_RUNDOWN_REFERENCE, value);
+        if (seen == value) {
+            return TRUE;
+        }
+        value = seen;
+    }
+    return FALSE;
+}
+
+VOID
+LoggerRundownRelease(
+    _Inout_ PLOGGER_RUNDOWN Rundown
+)
+{
+    PLOGGER_RUNDOWN_COUNTER counter = LoggerRundownCounter(Rundown);
+    LONG64 value = counter->Value;
+    LONG64 seen;
+
+    while ((value & LOGGER_RUNDOWN_ACTIVE) == 0) {
+        seen = InterlockedCompareExchange64(&counter->Value, value - LOGGER_RUNDOWN_REFERENCE, value);
+        if (seen == value) {
+            return;
+        }
+        value = seen;
+    }
+
+    // The waiter has taken this counter, and the reference with it.
+    if (InterlockedDecrement64(&Rundown->Draining) == 0) {
+        KeSetEvent(&Rundown->Drained, IO_NO_INCREMENT, FALSE);
+    }
+}
+
+VOID
+LoggerRundownWait(
+    _Inout_ PLOGGER_RUNDOWN Rundown
+)
+/*
+Routine Description:
+    Stops new acquisitions and waits until those in progress are released.
+    Returns at once if the protection is already run down.
+*/
+{
+    LONG64 held = 0;
+    LONG64 value;
+    ULONG index;
+
+    PAGED_CODE();
+
+    KeClearEvent(&Rundown->Drained);
+
+    for (index = 0; index < Rundown->CounterCount; index++) {
+        value = InterlockedExchange64(&Rundown->Counters[index].Value, LOGGER_RUNDOWN_ACTIVE);
+        if ((value & LOGGER_RUNDOWN_ACTIVE) == 0) {
+            held += value / LOGGER_RUNDOWN_REFERENCE;
+        }
+    }
+
+    // Releases since the swap have already counted Draining down, so only
+    // the one that ends at 0 after the add sets the event.
+    if (InterlockedExchangeAdd64(&Rundown->Draining, held) + held != 0) {
+        KeWaitForSingleObject(&Rundown->Drained, Executive, KernelMode, FALSE, NULL);
+    }
+}
+
+VOID
+LoggerRundownReInitialize(
+    _Inout_ PLOGGER_RUNDOWN Rundown
+)
+/*
+Routine Description:
+    Lets the protection be acquired again after LoggerRundownWait. The
+    exchanges are full barriers: a thread that acquires it sees what was
+    stored before this call, such as a new client port.
+*/
+{
+    ULONG index;
+
+    PAGED_CODE();
+
+    InterlockedExchange64(&Rundown->Draining, 0);
+
+    for (index = 0; index < Rundown->CounterCount; index++) {
+        InterlockedExchange64(&Rundown->Counters[index].Value, 0);
+    }
+}
@@ -0,0 +1,93 @@
+#ifndef __LOGGERRUNDOWN_H__
+#define __LOGGERRUNDOWN_H__
+
+/*************************************************************************
+    Run-down protection.
+
+    Guards an object that is used by many threads at once and torn down by
+    one, such as the client port of a connection. Users acquire the
+    protection without a lock, and the owner runs it down: new acquisitions
+    fail and the owner waits until every acquired one is released.
+
+    Each processor has a counter in a cache line of its own, so acquiring
+    and releasing only touch the line of the current processor. A thread may
+    release on another processor than it acquired on; the counters are only
+    meaningful summed up. Running down swaps LOGGER_RUNDOWN_ACTIVE into every
+    counter and moves what it held into Draining, which releases made from
+    then on decrement.
+
+    Only kernel routines that the user-mode stand-in of loggerFilterTest
+    provides are used, so the same code runs in the driver and in the test.
+*************************************************************************/
+
+// Set in a counter while the protection is run down. References are
+// counted in steps of 2 below it.
+#define LOGGER_RUNDOWN_ACTIVE       1
+#define LOGGER_RUNDOWN_REFERENCE    2
+
+typedef struct _LOGGER_RUNDOWN_COUNTER {
+
+    DECLSPEC_CACHEALIGN volatile LONG64 Value;
+
+} LOGGER_RUNDOWN_COUNTER, * PLOGGER_RUNDOWN_COUNTER;
+
+typedef struct _LOGGER_RUNDOWN {
+
+    // One per active processor.
+    PLOGGER_RUNDOWN_COUNTER Counters;
+    ULONG CounterCount;
+    ULONG Tag;
+
+    // References not yet released since the protection was run down. May be
+    // negative until the waiter has added up the counters.
+    DECLSPEC_CACHEALIGN volatile LONG64 Draining;
+
+    // Signaled by the release that brings Draining to 0.
+    KEVENT Drained;
+
+} LOGGER_RUNDOWN, * PLOGGER_RUNDOWN;
+
+
+/*************************************************************************
+    Prototypes for the run-down protection routines
+    Implementation in LoggerRundown.c
+*************************************************************************/
+
+// Allocates the counters. The protection starts run down.
+NTSTATUS
+LoggerRundownInitialize(
+    _Out_ PLOGGER_RUNDOWN Rundown,
+    _In_ ULONG Tag
+);
+
+VOID
+LoggerRundownFree(
+    _Inout_ PLOGGER_RUNDOWN Rundown
+);
+
+// Returns FALSE if the protection is run down. Callable at any IRQL up to
+// DISPATCH_LEVEL.
+BOOLEAN
+LoggerRundownAcquire(
+    _Inout_ PLOGGER_RUNDOWN Rundown
+);
+
+VOID
+LoggerRundownRelease(
+    _Inout_ PLOGGER_RUNDOWN Rundown
+);
+
+// Runs the protection down and waits until every acquisition is released.
+// Only one thread at a time may run it down or re-initialize it.
+VOID
+LoggerRundownWait(
+    _Inout_ PLOGGER_RUNDOWN Rundown
+);
+
+// Lets acquisitions succeed again, once run down.
+VOID
+LoggerRundownReInitialize(
+    _Inout_ PLOGGER_RUNDOWN Rundown
+);
+
+#endif
@@ -0,0 +1,252 @@
+/*++
+Module Name:
+    LoggerTrace.c
+
+Abstract:
+    This module implements the binary trace facility used on the create path.
+    Each processor owns a ring of fixed-size records. Writers claim a slot with
+    one interlocked increment and never format text or wait. The rings are
+    drained by UserLogger through the communication port.
+
+Environment:
+    Kernel mode
+--*/
+
+
+#include <fltKernel.h>
+#include "loggerTrace.h"
+
+typedef struct _LOGGER_TRACE_BUFFER {
+
+    // Number of records ever written to this ring.
+    DECLSPEC_CACHEALIGN volatile LONG64 Next;
+
+    // Number of records already handed to user-mode. Protected by ReadLock.
+    LONG64 ReadCursor;
+
+    LOGGER_TRACE_RECORD Records[LOGGER_TRACE_RECORDS_PER_CPU];
+
+} LOGGER_TRACE_BUFFER, * PLOGGER_TRACE_BUFFER;
+
+typedef struct _LOGGER_TRACE_DATA {
+
+    PLOGGER_TRACE_BUFFER Buffers;
+    ULONG BufferCount;
+
+    // Serializes readers; writers never take it.
+    EX_PUSH_LOCK ReadLock;
+
+} LOGGER_TRACE_DATA, * PLOGGER_TRACE_DATA;
+
+LOGGER_TRACE_DATA LoggerTraceData;
+
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text(INIT, LoggerTraceInitialize)
+#pragma alloc_text(PAGE, LoggerTraceFree)
+#pragma alloc_text(PAGE, LoggerTraceRead)
+#endif
+
+
+NTSTATUS
+LoggerTraceInitialize(
+    VOID
+)
+/*
+Routine Description:
+    Allocates one trace ring per active processor. When every trace level is
+    compiled out nothing is allocated.
+
+Return Value:
+    STATUS_SUCCESS or STATUS_INSUFFICIENT_RESOURCES.
+*/
+{
+#if LOGGER_TRACE_MAX_LEVEL > LOGGER_TRACE_LEVEL_NONE
+    ULONG count = KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+
+    LoggerTraceData.Buffers = ExAllocatePoolZero(NonPagedPool,
+        (SIZE_T)count * sizeof(LOGGER_TRACE_BUFFER),
+        'rtgL');
+
+    if (LoggerTraceData.Buffers == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    FltInitializePushLock(&LoggerTraceData.ReadLock);
+    LoggerTraceData.BufferCount = count;
+#endif
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+LoggerTraceFree(
+    VOID
+)
+{
+    PAGED_CODE();
+
+    if (LoggerTraceData.Buffers != NULL) {
+        FltDeletePushLock(&LoggerTraceData.ReadLock);
+        ExFreePoolWithTag(LoggerTraceData.Buffers, 'rtgL');
+        LoggerTraceData.Buffers = NULL;
+        LoggerTraceData.BufferCount = 0;
+    }
+}
+
+VOID
+LoggerTraceWrite(
+    _In_ USHORT FormatId,
+    _In_ UCHAR Level,
+    _In_ UCHAR Category,
+    _In_ UINT64 Arg0,
+    _In_ UINT64 Arg1,
+    _In_ UINT64 Arg2,
+    _In_ UINT64 Arg3
+)
+/*
+Routine Description:
+    Appends a record to the current processor's ring. Callable at any IRQL
+    up to DISPATCH_LEVEL. The thread may be rescheduled onto another
+    processor between reading the processor number and claiming the slot;
+    the interlocked claim keeps that safe, the record is merely filed under
+    the processor it started on.
+*/
+{
+    PLOGGER_TRACE_BUFFER buffer;
+    PLOGGER_TRACE_RECORD record;
+    ULONG processor;
+    LONG64 slot;
+
+    if (LoggerTraceData.Buffers == NULL) {
+        return;
+    }
+
+    processor = KeGetCurrentProcessorNumberEx(NULL);
+    if (processor >= LoggerTraceData.BufferCount) {
+        return;
+    }
+
+    buffer = &LoggerTraceData.Buffers[processor];
+    slot = InterlockedIncrement64(&buffer->Next) - 1;
+    record = &buffer->Records[slot % LOGGER_TRACE_RECORDS_PER_CPU];
+
+    record->Timestamp = KeQueryPerformanceCounter(NULL).QuadPart;
+    record->FormatId = FormatId;
+    record->Level = Level;
+    record->Category = Category;
+    record->Processor = processor;
+    record->Args[0] = Arg0;
+    record->Args[1] = Arg1;
+    record->Args[2] = Arg2;
+    record->Args[3] = Arg3;
+
+    InterlockedExchange64(&record->Stamp, slot + 1);
+}
+
+NTSTATUS
+LoggerTraceRead(
+    _Out_writes_bytes_to_(OutputBufferLength, *ReturnOutputBufferLength) PVOID OutputBuffer,
+    _In_ ULONG OutputBufferLength,
+    _Out_ PULONG ReturnOutputBufferLength
+)
+/*
+Routine Description:
+    Copies the records written since the previous read into a user buffer,
+    as a LOGGER_TRACE_READ_REPLY header followed by the records. Records
+    that were overwritten before they could be read are counted as lost.
+
+Arguments:
+    OutputBuffer - User buffer, accessed under try/except.
+    OutputBufferLength - Size of the output buffer in bytes.
+    ReturnOutputBufferLength - Number of bytes written.
+
+Return Value:
+    STATUS_SUCCESS, STATUS_BUFFER_TOO_SMALL, or the exception code if the
+    user buffer is not writable.
+*/
+{
+    LOGGER_TRACE_READ_REPLY header;
+    LOGGER_TRACE_RECORD record;
+    PLOGGER_TRACE_RECORD output;
+    ULONG capacity;
+    ULONG index;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    PAGED_CODE();
+
+    *ReturnOutputBufferLength = 0;
+
+    if (OutputBufferLength < sizeof(LOGGER_TRACE_READ_REPLY)) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    RtlZeroMemory(&header, sizeof(header));
+    KeQueryPerformanceCounter((PLARGE_INTEGER)&header.Frequency);
+
+    capacity = (OutputBufferLength - sizeof(LOGGER_TRACE_READ_REPLY)) / sizeof(LOGGER_TRACE_RECORD);
+    output = (PLOGGER_TRACE_RECORD)((PUCHAR)OutputBuffer + sizeof(LOGGER_TRACE_READ_REPLY));
+
+    if (LoggerTraceData.Buffers == NULL) {
+        capacity = 0;
+    }
+    else {
+        FltAcquirePushLockExclusive(&LoggerTraceData.ReadLock);
+    }
+
+    try {
+
+        for (index = 0; index < LoggerTraceData.BufferCount && header.RecordCount < capacity; index++) {
+
+            PLOGGER_TRACE_BUFFER buffer = &LoggerTraceData.Buffers[index];
+            LONG64 next = InterlockedCompareExchange64(&buffer->Next, 0, 0);
+            LONG64 cursor = buffer->ReadCursor;
+
+            if (next - cursor > LOGGER_TRACE_RECORDS_PER_CPU) {
+                header.LostCount += (ULONG)(next - LOGGER_TRACE_RECORDS_PER_CPU - cursor);
+                cursor = next - LOGGER_TRACE_RECORDS_PER_CPU;
+            }
+
+            while (cursor < next && header.RecordCount < capacity) {
+
+                PLOGGER_TRACE_RECORD slot = &buffer->Records[cursor % LOGGER_TRACE_RECORDS_PER_CPU];
+                LONG64 stamp = InterlockedCompareExchange64(&slot->Stamp, 0, 0);
+
+                if (stamp < cursor + 1) {
+                    // Claimed but not finished yet, pick it up on the next read.
+                    break;
+                }
+
+                RtlCopyMemory(&record, slot, sizeof(LOGGER_TRACE_RECORD));
+
+                // A writer claims a slot before filling it, so if nobody has
+                // claimed the slot's next lap the copy is not torn.
+                if (stamp == cursor + 1 &&
+                    InterlockedCompareExchange64(&buffer->Next, 0, 0) - cursor <= LOGGER_TRACE_RECORDS_PER_CPU) {
+                    RtlCopyMemory(&output[header.RecordCount++], &record, sizeof(LOGGER_TRACE_RECORD));
+                }
+                else {
+                    // Overwritten by a newer record while we were reading.
+                    header.LostCount++;
+                }
+                cursor++;
+            }
+
+            buffer->ReadCursor = cursor;
+        }
+
+        RtlCopyMemory(OutputBuffer, &header, sizeof(LOGGER_TRACE_READ_REPLY));
+
+        *ReturnOutputBufferLength = sizeof(LOGGER_TRACE_READ_REPLY) +
+            header.RecordCount * sizeof(LOGGER_TRACE_RECORD);
+    }
+    except (EXCEPTION_EXECUTE_HANDLER) {
+        status = GetExceptionCode();
+    }
+
+    if (LoggerTraceData.Buffers != NULL) {
+        FltReleasePushLock(&LoggerTraceData.ReadLock);
+    }
+
+    return status;
+}
@@ -0,0 +1,160 @@
+#ifndef __LOGGERTRACE_H__
+#define __LOGGERTRACE_H__
+
+/*************************************************************************
+    Binary trace facility.
+
+    Trace points write fixed-size records (a format ID and raw arguments)
+    into a per-processor ring instead of formatting text with DbgPrint.
+    UserLogger drains the rings with LoggerCommandReadTrace and decodes the
+    records later using the format strings in userlogger.h.
+
+    Levels and categories that are not enabled at compile time expand to
+    nothing. Override LOGGER_TRACE_MAX_LEVEL and LOGGER_TRACE_CATEGORIES in
+    the project's preprocessor definitions.
+*************************************************************************/
+
+#define LOGGER_TRACE_LEVEL_NONE         0
+#define LOGGER_TRACE_LEVEL_ERROR        1
+#define LOGGER_TRACE_LEVEL_INFO         2
+#define LOGGER_TRACE_LEVEL_VERBOSE      3
+
+#define LOGGER_TRACE_CATEGORY_CREATE    0x01
+#define LOGGER_TRACE_CATEGORY_PORT      0x02
+#define LOGGER_TRACE_CATEGORY_BACKLOG   0x04
+#define LOGGER_TRACE_CATEGORY_PROCESS   0x08
+
+#ifndef LOGGER_TRACE_MAX_LEVEL
+#if DBG
+#define LOGGER_TRACE_MAX_LEVEL          LOGGER_TRACE_LEVEL_VERBOSE
+#else
+#define LOGGER_TRACE_MAX_LEVEL          LOGGER_TRACE_LEVEL_INFO
+#endif
+#endif
+
+#ifndef LOGGER_TRACE_CATEGORIES
+#define LOGGER_TRACE_CATEGORIES         0xFF
+#endif
+
+// Records kept per processor. Older records are overwritten.
+#define LOGGER_TRACE_RECORDS_PER_CPU    1024
+#define LOGGER_TRACE_MAX_ARGS           4
+
+// Format IDs, must match the decoder table in userlogger.h
+typedef enum _LOGGER_TRACE_FORMAT {
+    LoggerTraceCreateMatched = 1,       // ProcessId, NameLength, Rule
+    LoggerTraceCreateNoMemory,          // ProcessId
+    LoggerTraceEventRecorded,           // Sequence, ProcessId, Priority
+    LoggerTraceEventSent,               // Sequence
+    LoggerTraceSendFailed,              // Sequence, Status
+    LoggerTraceBacklogOverwrite,        // Sequence
+    LoggerTraceReplay,                  // AfterSequence, FirstSequence, NextSequence
+    LoggerTracePortConnected,           // ProcessId, Priority
+    LoggerTracePortDisconnected,        // Priority
+    LoggerTraceProcessListed,           // ProcessId, LOGGER_PROCESS_LIST_* flags
+    LoggerTraceEventShed,               // Sequence, Priority
+    LoggerTraceResend,                  // Sequence, Mask
+    LoggerTraceTargetsSplit             // AutomatonCount, SplitCount, ChainCount
+
+} LOGGER_TRACE_FORMAT;
+
+typedef struct _LOGGER_TRACE_RECORD {
+
+    // Write index + 1 in the processor's ring, stored last so a reader can
+    // tell a complete record from one that is being written.
+    LONG64 Stamp;
+
+    // KeQueryPerformanceCounter ticks.
+    LONG64 Timestamp;
+
+    USHORT FormatId;
+    UCHAR Level;
+    UCHAR Category;
+    ULONG Processor;
+
+    UINT64 Args[LOGGER_TRACE_MAX_ARGS];
+
+} LOGGER_TRACE_RECORD, * PLOGGER_TRACE_RECORD;
+
+// Header of a LoggerCommandReadTrace reply, followed by RecordCount records.
+typedef struct _LOGGER_TRACE_READ_REPLY {
+    UINT64 Frequency;
+    ULONG RecordCount;
+    ULONG LostCount;
+
+} LOGGER_TRACE_READ_REPLY, * PLOGGER_TRACE_READ_REPLY;
+
+#define LOGGER_TRACE_ENABLED(Level, Category) \
+    ((Level) <= LOGGER_TRACE_MAX_LEVEL && ((Category) & LOGGER_TRACE_CATEGORIES) != 0)
+
+// Silences the constant condition warning of the macros on MSVC; other
+// compilers, such as the one building the user-mode tests, need nothing.
+#ifdef _MSC_VER
+#define LOGGER_TRACE_PRAGMA(Pragma)     __pragma(Pragma)
+#else
+#define LOGGER_TRACE_PRAGMA(Pragma)
+#endif
+
+#if LOGGER_TRACE_MAX_LEVEL > LOGGER_TRACE_LEVEL_NONE
+
+#define LOGGER_TRACE(Level, Category, FormatId, A0, A1, A2, A3)                 \
+    LOGGER_TRACE_PRAGMA(warning(push))                                          \
+    LOGGER_TRACE_PRAGMA(warning(disable: 4127))                                 \
+    do {                                                                        \
+        if (LOGGER_TRACE_ENABLED(Level, Category)) {                            \
+            LoggerTraceWrite((FormatId), (Level), (Category),                   \
+                (UINT64)(A0), (UINT64)(A1), (UINT64)(A2), (UINT64)(A3));        \
+        }                                                                       \
+    } while (0)                                                                 \
+    LOGGER_TRACE_PRAGMA(warning(pop))
+
+#else
+
+#define LOGGER_TRACE(Level, Category, FormatId, A0, A1, A2, A3) ((void)0)
+
+#endif
+
+#define LOGGER_TRACE_ERROR(Category, FormatId, A0, A1, A2, A3) \
+    LOGGER_TRACE(LOGGER_TRACE_LEVEL_ERROR, LOGGER_TRACE_CATEGORY_##Category, FormatId, A0, A1, A2, A3)
+
+#define LOGGER_TRACE_INFO(Category, FormatId, A0, A1, A2, A3) \
+    LOGGER_TRACE(LOGGER_TRACE_LEVEL_INFO, LOGGER_TRACE_CATEGORY_##Category, FormatId, A0, A1, A2, A3)
+
+#define LOGGER_TRACE_VERBOSE(Category, FormatId, A0, A1, A2, A3) \
+    LOGGER_TRACE(LOGGER_TRACE_LEVEL_VERBOSE, LOGGER_TRACE_CATEGORY_##Category, FormatId, A0, A1, A2, A3)
+
+
+/*************************************************************************
+    Prototypes for the trace routines
+    Implementation in LoggerTrace.c
+*************************************************************************/
+
+NTSTATUS
+LoggerTraceInitialize(
+    VOID
+);
+
+VOID
+LoggerTraceFree(
+    VOID
+);
+
+VOID
+LoggerTraceWrite(
+    _In_ USHORT FormatId,
+    _In_ UCHAR Level,
+    _In_ UCHAR Category,
+    _In_ UINT64 Arg0,
+    _In_ UINT64 Arg1,
+    _In_ UINT64 Arg2,
+    _In_ UINT64 Arg3
+);
+
+NTSTATUS
+LoggerTraceRead(
+    _Out_writes_bytes_to_(OutputBufferLength, *ReturnOutputBufferLength) PVOID OutputBuffer,
+    _In_ ULONG OutputBufferLength,
+    _Out_ PULONG ReturnOutputBufferLength
+);
+
+#endif
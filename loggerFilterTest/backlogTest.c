@@ -0,0 +1,661 @@
+/*++
+Module Name:
+    backlogTest.c
+
+Abstract:
+    Checks the backlog and acknowledgement protocol of LoggerFilter in user
+    mode. The driver is loaded with DriverEntry against the stand-in filter
+    manager, files are opened through its pre-create routine, and a client
+    connects, disconnects and sends commands the way UserLogger does. Also
+    checks that a failed DriverEntry leaves nothing behind and that
+    concurrent creates record every event exactly once.
+    The process exits with the number of failed checks.
+
+Environment:
+    User mode
+--*/
+
+#include <stdio.h>
+#include "loggerFilter.c"
+
+#define TEST_FILE_NAME      L"\\Device\\HarddiskVolume1\\Temp\\a.txt"
+#define TEST_SECOND         10000000LL
+
+#define CHECK(Condition)                                                        \
+    if (!(Condition)) {                                                         \
+        printf("FAIL %s: %s, line %d\n", Title, #Condition, __LINE__);          \
+        failures++;                                                             \
+    }
+
+#define SET_MULTI_SZ(Name, Value)   StandInSetRegistryMultiSz((Name), (Value), sizeof(Value))
+
+typedef struct _TEST_CLIENT {
+
+    PFLT_PORT Port;
+
+    pthread_mutex_t Lock;
+    PLOGGER_NOTIFICATION Received;
+    ULONG Count;
+    ULONG Capacity;
+
+    // Takes no live event of a send that has a timeout, like a client that
+    // has fallen behind, so those sends are shed.
+    BOOLEAN Stalled;
+
+} TEST_CLIENT, * PTEST_CLIENT;
+
+typedef struct _TEST_CASE {
+    PCSTR Title;
+    ULONG (*Run)(PCSTR Title);
+} TEST_CASE;
+
+
+/*************************************************************************
+    Driver and client helpers
+*************************************************************************/
+
+static
+VOID
+TestSetup(
+    _In_ ULONG BacklogEntries,
+    _In_ ULONG MaxAgeSeconds
+)
+{
+    StandInReset();
+    SET_MULTI_SZ(L"TargetPatterns", L"\\Temp\\**\0");
+    StandInSetRegistryDword(L"BacklogEntries", BacklogEntries);
+    StandInSetRegistryDword(L"BacklogMaxAgeSeconds", MaxAgeSeconds);
+}
+
+static
+NTSTATUS
+TestLoad(
+    VOID
+)
+{
+    DRIVER_OBJECT driver = { NULL };
+    UNICODE_STRING registryPath =
+        RTL_CONSTANT_STRING(L"\\REGISTRY\\MACHINE\\SYSTEM\\CurrentControlSet\\Services\\loggerFilter");
+
+    // A driver is loaded with its globals zeroed.
+    RtlZeroMemory(&LoggerFilterData, sizeof(LoggerFilterData));
+
+    return DriverEntry(&driver, &registryPath);
+}
+
+static
+VOID
+TestCreates(
+    _In_ ULONG Count
+)
+{
+    while (Count-- != 0) {
+        StandInCreate(TEST_FILE_NAME);
+    }
+}
+
+static
+NTSTATUS
+TestClientReceive(
+    _In_opt_ PVOID Context,
+    _In_ PVOID Buffer,
+    _In_ ULONG Length,
+    _In_opt_ PLARGE_INTEGER Timeout
+)
+{
+    PTEST_CLIENT client = Context;
+
+    if (client->Stalled && Timeout != NULL) {
+        return STATUS_TIMEOUT;
+    }
+
+    assert(Length == sizeof(LOGGER_NOTIFICATION));
+
+    pthread_mutex_lock(&client->Lock);
+
+    if (client->Count == client->Capacity) {
+        client->Capacity = client->Capacity ? client->Capacity * 2 : 64;
+        client->Received = realloc(client->Received, client->Capacity * sizeof(LOGGER_NOTIFICATION));
+        assert(client->Received != NULL);
+    }
+    memcpy(&client->Received[client->Count++], Buffer, sizeof(LOGGER_NOTIFICATION));
+
+    pthread_mutex_unlock(&client->Lock);
+    return STATUS_SUCCESS;
+}
+
+static
+BOOLEAN
+TestConnect(
+    _Out_ PTEST_CLIENT Client
+)
+{
+    memset(Client, 0, sizeof(TEST_CLIENT));
+    pthread_mutex_init(&Client->Lock, NULL);
+
+    Client->Port = StandInConnect(LOGGERPortName, TestClientReceive, Client);
+    return Client->Port != NULL;
+}
+
+static
+VOID
+TestDisconnect(
+    _Inout_ PTEST_CLIENT Client
+)
+{
+    if (Client->Port != NULL) {
+        StandInDisconnect(Client->Port);
+        Client->Port = NULL;
+    }
+    free(Client->Received);
+    pthread_mutex_destroy(&Client->Lock);
+    memset(Client, 0, sizeof(TEST_CLIENT));
+}
+
+static
+NTSTATUS
+TestCommand(
+    _In_ PTEST_CLIENT Client,
+    _In_ LOGGER_COMMAND Command,
+    _In_ UINT64 SessionId,
+    _In_ UINT64 Sequence,
+    _In_ UINT64 Mask,
+    _Out_writes_bytes_opt_(ReplyLength) PVOID Reply,
+    _In_ ULONG ReplyLength
+)
+{
+    LOGGER_COMMAND_MESSAGE message;
+    ULONG returned;
+
+    memset(&message, 0, sizeof(message));
+    message.Command = Command;
+    message.SessionId = SessionId;
+    message.Sequence = Sequence;
+    message.Mask = Mask;
+
+    return StandInSendCommand(Client->Port, &message, sizeof(message), Reply, ReplyLength, &returned);
+}
+
+static
+LOGGER_REPLAY_REPLY
+TestQuery(
+    _In_ PTEST_CLIENT Client
+)
+{
+    LOGGER_REPLAY_REPLY reply;
+
+    memset(&reply, 0, sizeof(reply));
+    TestCommand(Client, LoggerCommandQuery, 0, 0, 0, &reply, sizeof(reply));
+    return reply;
+}
+
+static
+BOOLEAN
+TestReceived(
+    _In_ PTEST_CLIENT Client,
+    _In_ UINT64 First,
+    _In_ UINT64 Last
+)
+/*
+Routine Description:
+    Returns TRUE if the client received exactly the sequences First to Last,
+    in order.
+*/
+{
+    ULONG index;
+
+    if (Client->Count != Last + 1 - First) {
+        return FALSE;
+    }
+
+    for (index = 0; index < Client->Count; index++) {
+        if (Client->Received[index].Sequence != First + index) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+
+/*************************************************************************
+    Cases
+*************************************************************************/
+
+static
+ULONG
+TestReplayAfterReconnect(
+    _In_ PCSTR Title
+)
+{
+    TEST_CLIENT client;
+    LOGGER_REPLAY_REPLY reply;
+    UINT64 session;
+    ULONG failures = 0;
+
+    TestSetup(16, 60);
+    CHECK(NT_SUCCESS(TestLoad()));
+    CHECK(TestConnect(&client));
+
+    session = TestQuery(&client).SessionId;
+
+    TestCreates(3);
+    CHECK(TestReceived(&client, 1, 3));
+    CHECK(client.Received[0].SessionId == session);
+    CHECK(NT_SUCCESS(TestCommand(&client, LoggerCommandAck, session, 3, 0, NULL, 0)));
+
+    // Recorded while no client is connected.
+    TestDisconnect(&client);
+    TestCreates(5);
+
+    CHECK(TestConnect(&client));
+    CHECK(NT_SUCCESS(TestCommand(&client, LoggerCommandReplay, session, 3, 0, &reply, sizeof(reply))));
+    CHECK(TestReceived(&client, 4, 8));
+    CHECK(reply.SessionId == session);
+    CHECK(reply.FirstSequence == 4);
+    CHECK(reply.NextSequence == 9);
+    CHECK(reply.DroppedCount == 0);
+
+    // Live events follow the replayed ones.
+    TestCreates(1);
+    CHECK(TestReceived(&client, 4, 9));
+
+    TestDisconnect(&client);
+    StandInUnload();
+    CHECK(StandInSendsOnClosedPorts() == 0);
+    CHECK(StandInOutstandingAllocations() == 0);
+    return failures;
+}
+
+static
+ULONG
+TestReplayFromAnotherSession(
+    _In_ PCSTR Title
+)
+{
+    TEST_CLIENT client;
+    LOGGER_REPLAY_REPLY reply;
+    UINT64 session;
+    ULONG failures = 0;
+
+    TestSetup(16, 60);
+    CHECK(NT_SUCCESS(TestLoad()));
+
+    TestCreates(4);
+
+    // A sequence of an earlier session says nothing about this one.
+    CHECK(TestConnect(&client));
+    session = TestQuery(&client).SessionId;
+    CHECK(NT_SUCCESS(TestCommand(&client, LoggerCommandReplay, session - 1, 3, 0, &reply, sizeof(reply))));
+    CHECK(TestReceived(&client, 1, 4));
+    CHECK(reply.FirstSequence == 1);
+
+    TestDisconnect(&client);
+    StandInUnload();
+    CHECK(StandInOutstandingAllocations() == 0);
+    return failures;
+}
+
+static
+ULONG
+TestRingOverwrite(
+    _In_ PCSTR Title
+)
+{
+    TEST_CLIENT client;
+    LOGGER_REPLAY_REPLY reply;
+    UINT64 session;
+    ULONG failures = 0;
+
+    TestSetup(16, 0);
+    CHECK(NT_SUCCESS(TestLoad()));
+
+    // Four more than the ring holds, none acknowledged.
+    TestCreates(20);
+
+    CHECK(TestConnect(&client));
+    CHECK(NT_SUCCESS(TestCommand(&client, LoggerCommandReplay, 0, 0, 0, &reply, sizeof(reply))));
+    CHECK(TestReceived(&client, 5, 20));
+    CHECK(reply.FirstSequence == 5);
+    CHECK(reply.NextSequence == 21);
+    CHECK(reply.Capacity == 16);
+    CHECK(reply.DroppedCount == 4);
+
+    // Overwriting acknowledged events loses nothing.
+    session = reply.SessionId;
+    CHECK(NT_SUCCESS(TestCommand(&client, LoggerCommandAck, session, 20, 0, NULL, 0)));
+    TestDisconnect(&client);
+    TestCreates(16);
+
+    CHECK(TestConnect(&client));
+    reply = TestQuery(&client);
+    CHECK(reply.FirstSequence == 21);
+    CHECK(reply.DroppedCount == 4);
+
+    TestDisconnect(&client);
+    StandInUnload();
+    CHECK(StandInOutstandingAllocations() == 0);
+    return failures;
+}
+
+static
+ULONG
+TestExpiryByAge(
+    _In_ PCSTR Title
+)
+{
+    TEST_CLIENT client;
+    LOGGER_REPLAY_REPLY reply;
+    ULONG failures = 0;
+
+    TestSetup(16, 60);
+    CHECK(NT_SUCCESS(TestLoad()));
+
+    TestCreates(3);
+    StandInAdvanceTime(61 * TEST_SECOND);
+    TestCreates(2);
+
+    CHECK(TestConnect(&client));
+    CHECK(NT_SUCCESS(TestCommand(&client, LoggerCommandReplay, 0, 0, 0, &reply, sizeof(reply))));
+    CHECK(TestReceived(&client, 4, 5));
+    CHECK(reply.FirstSequence == 4);
+    CHECK(reply.NextSequence == 6);
+
+    // Expired events are not overwritten, so they are not counted as dropped.
+    CHECK(reply.DroppedCount == 0);
+
+    TestDisconnect(&client);
+    StandInUnload();
+    CHECK(StandInOutstandingAllocations() == 0);
+    return failures;
+}
+
+static
+ULONG
+TestAckFromAnotherSession(
+    _In_ PCSTR Title
+)
+{
+    TEST_CLIENT client;
+    LOGGER_REPLAY_REPLY reply;
+    UINT64 session;
+    ULONG failures = 0;
+
+    TestSetup(16, 0);
+    CHECK(NT_SUCCESS(TestLoad()));
+    CHECK(TestConnect(&client));
+
+    session = TestQuery(&client).SessionId;
+
+    TestCreates(10);
+    CHECK(TestReceived(&client, 1, 10));
+
+    // The reply still reports the lane, but nothing is acknowledged.
+    memset(&reply, 0, sizeof(reply));
+    CHECK(NT_SUCCESS(TestCommand(&client, LoggerCommandAck, session - 1, 10, 0, &reply, sizeof(reply))));
+    CHECK(reply.SessionId == session);
+    CHECK(reply.NextSequence == 11);
+
+    // So overwriting the ten events counts them as dropped...
+    TestDisconnect(&client);
+    TestCreates(16);
+
+    CHECK(TestConnect(&client));
+    reply = TestQuery(&client);
+    CHECK(reply.DroppedCount == 10);
+
+    // ...unlike overwriting events acknowledged in the current session.
+    CHECK(NT_SUCCESS(TestCommand(&client, LoggerCommandAck, session, 26, 0, NULL, 0)));
+    TestDisconnect(&client);
+    TestCreates(16);
+
+    CHECK(TestConnect(&client));
+    reply = TestQuery(&client);
+    CHECK(reply.DroppedCount == 10);
+
+    TestDisconnect(&client);
+    StandInUnload();
+    CHECK(StandInOutstandingAllocations() == 0);
+    return failures;
+}
+
+static
+ULONG
+TestShedAndResend(
+    _In_ PCSTR Title
+)
+{
+    TEST_CLIENT client;
+    LOGGER_RESEND_REPLY reply;
+    UINT64 session;
+    ULONG failures = 0;
+
+    TestSetup(16, 0);
+    CHECK(NT_SUCCESS(TestLoad()));
+    CHECK(TestConnect(&client));
+
+    session = TestQuery(&client).SessionId;
+
+    client.Stalled = TRUE;
+    TestCreates(3);
+    CHECK(client.Count == 0);
+
+    // The next live event reports the shed ones.
+    client.Stalled = FALSE;
+    TestCreates(1);
+    CHECK(TestReceived(&client, 4, 4));
+    CHECK(client.Received[0].ShedSequence == 3);
+
+    CHECK(NT_SUCCESS(TestCommand(&client, LoggerCommandResend, session, 1, 0x7, &reply, sizeof(reply))));
+    CHECK(reply.LostMask == 0);
+    CHECK(client.Count == 4);
+    CHECK(client.Count == 4 && client.Received[1].Sequence == 1 && client.Received[3].Sequence == 3);
+    CHECK(client.Count == 4 && client.Received[1].ShedSequence == 0);
+
+    // Another session's request selects nothing.
+    CHECK(NT_SUCCESS(TestCommand(&client, LoggerCommandResend, session - 1, 1, 0x7, &reply, sizeof(reply))));
+    CHECK(client.Count == 4);
+
+    TestDisconnect(&client);
+    StandInUnload();
+    CHECK(StandInOutstandingAllocations() == 0);
+    return failures;
+}
+
+static
+VOID
+TestSetupUnwind(
+    VOID
+)
+{
+    TestSetup(16, 60);
+    SET_MULTI_SZ(L"HighPriorityPatterns", L"\\Secrets\\**\0");
+    SET_MULTI_SZ(L"ExcludedProcesses", L"skip.exe\0");
+    StandInProcessStart((HANDLE)(ULONG_PTR)400, L"\\Device\\HarddiskVolume1\\skip.exe");
+}
+
+static
+ULONG
+TestDriverEntryUnwind(
+    _In_ PCSTR Title
+)
+/*
+Routine Description:
+    Fails each call of a clean load in turn, and checks that whenever
+    DriverEntry fails it leaves nothing allocated or registered.
+*/
+{
+    ULONG failures = 0;
+    ULONG calls;
+    ULONG step;
+    NTSTATUS status;
+
+    TestSetupUnwind();
+    StandInFailCall(0);
+    CHECK(NT_SUCCESS(TestLoad()));
+    calls = StandInFailCall(0);
+    StandInUnload();
+
+    for (step = 1; step <= calls; step++) {
+
+        TestSetupUnwind();
+        StandInFailCall(step);
+        status = TestLoad();
+        StandInFailCall(0);
+
+        if (NT_SUCCESS(status)) {
+            // The failed call was one the driver does without.
+            StandInUnload();
+        }
+        else if (StandInFilterRegistered() || StandInOpenServerPorts() != 0) {
+            printf("FAIL %s: call %lu left the filter registered\n", Title, (unsigned long)step);
+            failures++;
+        }
+
+        if (StandInProcessNotifyRegistered()) {
+            printf("FAIL %s: call %lu left the process notification registered\n", Title, (unsigned long)step);
+            failures++;
+        }
+
+        if (StandInOutstandingAllocations() != 0) {
+            printf("FAIL %s: call %lu leaked %ld resources\n", Title, (unsigned long)step,
+                (long)StandInOutstandingAllocations());
+            failures++;
+            break;
+        }
+    }
+
+    CHECK(calls > 10);
+    return failures;
+}
+
+#define TEST_THREADS            8
+#define TEST_CREATES_PER_THREAD 2000
+
+static
+PVOID
+TestCreateThread(
+    _In_ PVOID Context
+)
+{
+    StandInSetCurrentProcess(Context);
+    TestCreates(TEST_CREATES_PER_THREAD);
+    return NULL;
+}
+
+static
+ULONG
+TestConcurrentRecord(
+    _In_ PCSTR Title
+)
+/*
+Routine Description:
+    Creates files from several threads at once, each on its own processor,
+    through a ring much smaller than the number of events. Each event must
+    be sent exactly once, with a sequence of its own, and every overwrite
+    counted as dropped.
+*/
+{
+    const ULONG total = TEST_THREADS * TEST_CREATES_PER_THREAD;
+    pthread_t threads[TEST_THREADS];
+    TEST_CLIENT client;
+    LOGGER_REPLAY_REPLY reply;
+    PUCHAR seen;
+    UINT64 session;
+    ULONG duplicates = 0;
+    ULONG foreign = 0;
+    ULONG index;
+    ULONG failures = 0;
+
+    TestSetup(64, 0);
+    CHECK(NT_SUCCESS(TestLoad()));
+    CHECK(TestConnect(&client));
+
+    session = TestQuery(&client).SessionId;
+
+    for (index = 0; index < TEST_THREADS; index++) {
+        pthread_create(&threads[index], NULL, TestCreateThread, (PVOID)(ULONG_PTR)(2000 + 4 * index));
+    }
+    for (index = 0; index < TEST_THREADS; index++) {
+        pthread_join(threads[index], NULL);
+    }
+
+    seen = calloc(total + 1, 1);
+    assert(seen != NULL);
+
+    for (index = 0; index < client.Count; index++) {
+        PLOGGER_NOTIFICATION notification = &client.Received[index];
+
+        if (notification->Sequence == 0 || notification->Sequence > total || seen[notification->Sequence]++) {
+            duplicates++;
+        }
+        if (notification->SessionId != session || notification->ProcessId < 2000 ||
+            notification->ProcessId >= 2000 + 4 * TEST_THREADS) {
+            foreign++;
+        }
+    }
+
+    CHECK(client.Count == total);
+    CHECK(duplicates == 0);
+    CHECK(foreign == 0);
+    free(seen);
+
+    reply = TestQuery(&client);
+    CHECK(reply.NextSequence == total + 1);
+    CHECK(reply.DroppedCount == total - 64);
+
+    // The ring holds the last 64 events, whole.
+    TestDisconnect(&client);
+    CHECK(TestConnect(&client));
+    CHECK(NT_SUCCESS(TestCommand(&client, LoggerCommandReplay, 0, 0, 0, &reply, sizeof(reply))));
+    CHECK(TestReceived(&client, total - 63, total));
+
+    for (index = 0, foreign = 0; index < client.Count; index++) {
+        if (client.Received[index].ProcessId < 2000 || client.Received[index].ProcessId >= 2000 + 4 * TEST_THREADS ||
+            strcmp(client.Received[index].MessageData, "File accessed") != 0) {
+            foreign++;
+        }
+    }
+    CHECK(foreign == 0);
+
+    TestDisconnect(&client);
+    StandInUnload();
+    CHECK(StandInSendsOnClosedPorts() == 0);
+    CHECK(StandInOutstandingAllocations() == 0);
+    return failures;
+}
+
+static const TEST_CASE TestCases[] = {
+    { "events recorded while disconnected are replayed after reconnect", TestReplayAfterReconnect },
+    { "a replay from another session starts from the oldest held event", TestReplayFromAnotherSession },
+    { "a full ring overwrites the oldest events and counts the unacknowledged ones", TestRingOverwrite },
+    { "events older than the maximum age are not replayed", TestExpiryByAge },
+    { "an acknowledgement from another session is ignored", TestAckFromAnotherSession },
+    { "shed bulk events are resent on request", TestShedAndResend },
+    { "a failed DriverEntry leaves nothing behind", TestDriverEntryUnwind },
+    { "concurrent creates record every event exactly once", TestConcurrentRecord },
+};
+
+int
+__cdecl
+main(
+    VOID
+)
+{
+    ULONG failures = 0;
+    ULONG caseFailures;
+    ULONG index;
+
+    for (index = 0; index < ARRAYSIZE(TestCases); index++) {
+        caseFailures = TestCases[index].Run(TestCases[index].Title);
+
+        if (caseFailures == 0) {
+            printf("ok   %s\n", TestCases[index].Title);
+        }
+        failures += caseFailures;
+    }
+
+    StandInReset();
+
+    printf("%lu failure(s)\n", (unsigned long)failures);
+    return (int)failures;
+}
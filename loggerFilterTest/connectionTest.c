@@ -0,0 +1,479 @@
+/*++
+Module Name:
+    connectionTest.c
+
+Abstract:
+    Checks the run-down protection of LoggerFilter's connections in user
+    mode: a new protection fails until re-initialized, running it down waits
+    for the last release on whatever processor it is made, and no
+    acquisition overlaps a run down while many threads acquire and release
+    on moving processors. Then storms both ports with connects and
+    disconnects while sender threads create files, and checks that no send
+    uses a closed client port and that every event is recorded once.
+    The process exits with the number of failed checks.
+
+Environment:
+    User mode
+--*/
+
+#include <stdio.h>
+#include <sched.h>
+#include <time.h>
+#include "loggerFilter.c"
+
+#define TEST_BULK_FILE_NAME     L"\\Device\\HarddiskVolume1\\Temp\\a.txt"
+#define TEST_HIGH_FILE_NAME     L"\\Device\\HarddiskVolume1\\Secrets\\key.bin"
+
+#define TEST_THREADS            8
+#define TEST_STORM_CYCLES       2000
+
+#define CHECK(Condition)                                                        \
+    if (!(Condition)) {                                                         \
+        printf("FAIL %s: %s, line %d\n", Title, #Condition, __LINE__);          \
+        failures++;                                                             \
+    }
+
+#define SET_MULTI_SZ(Name, Value)   StandInSetRegistryMultiSz((Name), (Value), sizeof(Value))
+
+typedef struct _TEST_CASE {
+    PCSTR Title;
+    ULONG (*Run)(PCSTR Title);
+} TEST_CASE;
+
+// Shared by the threads of a storm.
+typedef struct _TEST_STORM {
+
+    LOGGER_RUNDOWN Rundown;
+
+    // Cleared by the owner while the protection is run down.
+    volatile LONG Open;
+    // Threads holding the protection.
+    volatile LONG Holders;
+    // Acquisitions made while not Open, and run downs with holders left.
+    volatile LONG Violations;
+    volatile LONG64 Acquired;
+    volatile LONG Stop;
+
+    // Events received per lane, and sequences received twice.
+    volatile LONG64 Received[LoggerPriorityCount];
+    volatile LONG Duplicates;
+    PUCHAR Seen[LoggerPriorityCount];
+    ULONG SeenLength;
+
+    volatile LONG64 Creates;
+
+} TEST_STORM, * PTEST_STORM;
+
+static
+VOID
+TestSleep(
+    _In_ ULONG Milliseconds
+)
+{
+    struct timespec delay = { Milliseconds / 1000, (Milliseconds % 1000) * 1000000L };
+
+    nanosleep(&delay, NULL);
+}
+
+
+/*************************************************************************
+    Run-down protection
+*************************************************************************/
+
+static
+ULONG
+TestStartsRunDown(
+    _In_ PCSTR Title
+)
+{
+    LOGGER_RUNDOWN rundown;
+    ULONG failures = 0;
+
+    StandInReset();
+
+    CHECK(NT_SUCCESS(LoggerRundownInitialize(&rundown, 'tsgL')));
+    CHECK(rundown.CounterCount == KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS));
+    CHECK(!LoggerRundownAcquire(&rundown));
+
+    // Nothing holds it, so this returns at once.
+    LoggerRundownWait(&rundown);
+
+    LoggerRundownReInitialize(&rundown);
+    CHECK(LoggerRundownAcquire(&rundown));
+    CHECK(LoggerRundownAcquire(&rundown));
+    LoggerRundownRelease(&rundown);
+    LoggerRundownRelease(&rundown);
+
+    LoggerRundownWait(&rundown);
+    CHECK(!LoggerRundownAcquire(&rundown));
+    LoggerRundownWait(&rundown);
+
+    LoggerRundownFree(&rundown);
+    CHECK(StandInOutstandingAllocations() == 0);
+
+    // A failed allocation leaves nothing to free.
+    StandInFailCall(1);
+    CHECK(LoggerRundownInitialize(&rundown, 'tsgL') == STATUS_INSUFFICIENT_RESOURCES);
+    LoggerRundownFree(&rundown);
+    StandInFailCall(0);
+    return failures;
+}
+
+static
+PVOID
+TestWaitThread(
+    _In_ PVOID Context
+)
+{
+    PTEST_STORM storm = Context;
+
+    LoggerRundownWait(&storm->Rundown);
+    __atomic_store_n(&storm->Stop, 1, __ATOMIC_SEQ_CST);
+    return NULL;
+}
+
+static
+ULONG
+TestWaitForRelease(
+    _In_ PCSTR Title
+)
+/*
+Routine Description:
+    Holds the protection twice from processor 1 and releases from processors
+    5 and 2 while another thread runs it down.
+*/
+{
+    TEST_STORM storm;
+    pthread_t waiter;
+    ULONG failures = 0;
+
+    StandInReset();
+    memset(&storm, 0, sizeof(storm));
+
+    CHECK(NT_SUCCESS(LoggerRundownInitialize(&storm.Rundown, 'tsgL')));
+    LoggerRundownReInitialize(&storm.Rundown);
+
+    StandInSetProcessor(1);
+    CHECK(LoggerRundownAcquire(&storm.Rundown));
+    CHECK(LoggerRundownAcquire(&storm.Rundown));
+
+    pthread_create(&waiter, NULL, TestWaitThread, &storm);
+    TestSleep(50);
+    CHECK(!__atomic_load_n(&storm.Stop, __ATOMIC_SEQ_CST));
+    CHECK(!LoggerRundownAcquire(&storm.Rundown));
+
+    StandInSetProcessor(5);
+    LoggerRundownRelease(&storm.Rundown);
+    TestSleep(20);
+    CHECK(!__atomic_load_n(&storm.Stop, __ATOMIC_SEQ_CST));
+
+    StandInSetProcessor(2);
+    LoggerRundownRelease(&storm.Rundown);
+    pthread_join(waiter, NULL);
+    CHECK(__atomic_load_n(&storm.Stop, __ATOMIC_SEQ_CST));
+
+    LoggerRundownFree(&storm.Rundown);
+    CHECK(StandInOutstandingAllocations() == 0);
+    return failures;
+}
+
+static
+PVOID
+TestAcquireThread(
+    _In_ PVOID Context
+)
+{
+    PTEST_STORM storm = Context;
+    ULONG processor = (ULONG)KeGetCurrentProcessorNumberEx(NULL);
+    ULONG round;
+
+    for (round = 0; !__atomic_load_n(&storm->Stop, __ATOMIC_SEQ_CST); round++) {
+        if (!LoggerRundownAcquire(&storm->Rundown)) {
+            sched_yield();
+            continue;
+        }
+
+        InterlockedIncrement(&storm->Holders);
+        if (!__atomic_load_n(&storm->Open, __ATOMIC_SEQ_CST)) {
+            InterlockedIncrement(&storm->Violations);
+        }
+        InterlockedIncrement64(&storm->Acquired);
+        if (round % 16 == 0) {
+            sched_yield();
+        }
+        InterlockedDecrement(&storm->Holders);
+
+        // Every few rounds the release is made on another processor.
+        if (round % 3 == 0) {
+            StandInSetProcessor(processor + round);
+        }
+        LoggerRundownRelease(&storm->Rundown);
+    }
+    return NULL;
+}
+
+static
+ULONG
+TestAcquireStorm(
+    _In_ PCSTR Title
+)
+{
+    pthread_t threads[TEST_THREADS];
+    TEST_STORM storm;
+    ULONG cycle;
+    ULONG index;
+    ULONG failures = 0;
+
+    StandInReset();
+    memset(&storm, 0, sizeof(storm));
+
+    CHECK(NT_SUCCESS(LoggerRundownInitialize(&storm.Rundown, 'tsgL')));
+    storm.Open = TRUE;
+    LoggerRundownReInitialize(&storm.Rundown);
+
+    for (index = 0; index < TEST_THREADS; index++) {
+        pthread_create(&threads[index], NULL, TestAcquireThread, &storm);
+    }
+
+    // Plays disconnect and connect: tear the resource down only once every
+    // holder is gone, and bring it back before letting them in.
+    for (cycle = 0; cycle < TEST_STORM_CYCLES; cycle++) {
+        LoggerRundownWait(&storm.Rundown);
+        __atomic_store_n(&storm.Open, FALSE, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&storm.Holders, __ATOMIC_SEQ_CST) != 0) {
+            InterlockedIncrement(&storm.Violations);
+        }
+        sched_yield();
+        __atomic_store_n(&storm.Open, TRUE, __ATOMIC_SEQ_CST);
+        LoggerRundownReInitialize(&storm.Rundown);
+        sched_yield();
+    }
+
+    __atomic_store_n(&storm.Stop, 1, __ATOMIC_SEQ_CST);
+    for (index = 0; index < TEST_THREADS; index++) {
+        pthread_join(threads[index], NULL);
+    }
+
+    LoggerRundownWait(&storm.Rundown);
+    CHECK(storm.Violations == 0);
+    CHECK(storm.Holders == 0);
+    CHECK(storm.Acquired > 0);
+    CHECK(storm.Rundown.Draining == 0);
+
+    LoggerRundownFree(&storm.Rundown);
+    CHECK(StandInOutstandingAllocations() == 0);
+    return failures;
+}
+
+
+/*************************************************************************
+    Connections
+*************************************************************************/
+
+static
+NTSTATUS
+TestStormReceive(
+    _In_opt_ PVOID Context,
+    _In_ PVOID Buffer,
+    _In_ ULONG Length,
+    _In_opt_ PLARGE_INTEGER Timeout
+)
+{
+    PTEST_STORM storm = Context;
+    PLOGGER_NOTIFICATION notification = Buffer;
+
+    UNREFERENCED_PARAMETER(Timeout);
+
+    assert(Length == sizeof(LOGGER_NOTIFICATION));
+
+    if (notification->Sequence == 0 || notification->Sequence >= storm->SeenLength ||
+        __atomic_fetch_add(&storm->Seen[notification->Priority][notification->Sequence], 1, __ATOMIC_SEQ_CST) != 0) {
+        InterlockedIncrement(&storm->Duplicates);
+    }
+    InterlockedIncrement64(&storm->Received[notification->Priority]);
+    return STATUS_SUCCESS;
+}
+
+static
+PVOID
+TestSenderThread(
+    _In_ PVOID Context
+)
+{
+    PTEST_STORM storm = Context;
+    ULONG round;
+
+    StandInSetCurrentProcess((HANDLE)(ULONG_PTR)(2000 + 4 * KeGetCurrentProcessorNumberEx(NULL)));
+
+    for (round = 0; !__atomic_load_n(&storm->Stop, __ATOMIC_SEQ_CST); round++) {
+        StandInCreate(round % 2 == 0 ? TEST_BULK_FILE_NAME : TEST_HIGH_FILE_NAME);
+        InterlockedIncrement64(&storm->Creates);
+    }
+    return NULL;
+}
+
+typedef struct _TEST_CONNECTOR {
+    PTEST_STORM Storm;
+    PCWSTR PortName;
+    ULONG Connects;
+} TEST_CONNECTOR, * PTEST_CONNECTOR;
+
+static
+PVOID
+TestConnectorThread(
+    _In_ PVOID Context
+)
+{
+    PTEST_CONNECTOR connector = Context;
+    PFLT_PORT port;
+    ULONG cycle;
+
+    for (cycle = 0; cycle < TEST_STORM_CYCLES; cycle++) {
+        port = StandInConnect(connector->PortName, TestStormReceive, connector->Storm);
+        if (port == NULL) {
+            continue;
+        }
+        connector->Connects++;
+        if (cycle % 4 == 0) {
+            sched_yield();
+        }
+        StandInDisconnect(port);
+    }
+    return NULL;
+}
+
+static
+UINT64
+TestNextSequence(
+    _In_ PFLT_PORT Port
+)
+{
+    LOGGER_COMMAND_MESSAGE message;
+    LOGGER_REPLAY_REPLY reply;
+    ULONG returned;
+
+    memset(&message, 0, sizeof(message));
+    memset(&reply, 0, sizeof(reply));
+    message.Command = LoggerCommandQuery;
+
+    StandInSendCommand(Port, &message, sizeof(message), &reply, sizeof(reply), &returned);
+    return reply.NextSequence;
+}
+
+static
+ULONG
+TestConnectStorm(
+    _In_ PCSTR Title
+)
+/*
+Routine Description:
+    Connects and disconnects both lanes over and over while sender threads
+    create files of both. Each disconnect runs the lane's connection down
+    and closes the client port under the senders.
+*/
+{
+    DRIVER_OBJECT driver = { NULL };
+    UNICODE_STRING registryPath =
+        RTL_CONSTANT_STRING(L"\\REGISTRY\\MACHINE\\SYSTEM\\CurrentControlSet\\Services\\loggerFilter");
+    static TEST_STORM storm;
+    TEST_CONNECTOR connectors[LoggerPriorityCount];
+    pthread_t senders[TEST_THREADS];
+    pthread_t connectorThreads[LoggerPriorityCount];
+    PFLT_PORT port;
+    UINT64 recorded = 0;
+    ULONG priority;
+    ULONG index;
+    ULONG failures = 0;
+
+    StandInReset();
+    memset(&storm, 0, sizeof(storm));
+    SET_MULTI_SZ(L"TargetPatterns", L"\\Temp\\**\0");
+    SET_MULTI_SZ(L"HighPriorityPatterns", L"\\Secrets\\**\0");
+
+    // Sequences are numbered per driver load; far more than the storm makes.
+    storm.SeenLength = 1 << 24;
+    for (priority = 0; priority < LoggerPriorityCount; priority++) {
+        storm.Seen[priority] = calloc(storm.SeenLength, 1);
+        assert(storm.Seen[priority] != NULL);
+    }
+
+    RtlZeroMemory(&LoggerFilterData, sizeof(LoggerFilterData));
+    CHECK(NT_SUCCESS(DriverEntry(&driver, &registryPath)));
+
+    for (index = 0; index < TEST_THREADS; index++) {
+        pthread_create(&senders[index], NULL, TestSenderThread, &storm);
+    }
+    for (priority = 0; priority < LoggerPriorityCount; priority++) {
+        connectors[priority].Storm = &storm;
+        connectors[priority].PortName = priority == LoggerPriorityHigh ? LOGGERHighPortName : LOGGERPortName;
+        connectors[priority].Connects = 0;
+        pthread_create(&connectorThreads[priority], NULL, TestConnectorThread, &connectors[priority]);
+    }
+    for (priority = 0; priority < LoggerPriorityCount; priority++) {
+        pthread_join(connectorThreads[priority], NULL);
+    }
+
+    __atomic_store_n(&storm.Stop, 1, __ATOMIC_SEQ_CST);
+    for (index = 0; index < TEST_THREADS; index++) {
+        pthread_join(senders[index], NULL);
+    }
+
+    CHECK(StandInSendsOnClosedPorts() == 0);
+    CHECK(storm.Duplicates == 0);
+
+    // Every create was recorded once, in its own lane, whether it was sent
+    // live or not.
+    for (priority = 0; priority < LoggerPriorityCount; priority++) {
+        CHECK(connectors[priority].Connects == TEST_STORM_CYCLES);
+
+        port = StandInConnect(connectors[priority].PortName, TestStormReceive, &storm);
+        CHECK(port != NULL);
+        if (port != NULL) {
+            recorded += TestNextSequence(port) - 1;
+            StandInDisconnect(port);
+        }
+    }
+    CHECK(recorded == (UINT64)storm.Creates);
+    CHECK(storm.Received[LoggerPriorityBulk] + storm.Received[LoggerPriorityHigh] <= storm.Creates);
+
+    StandInUnload();
+    CHECK(StandInSendsOnClosedPorts() == 0);
+    CHECK(StandInOutstandingAllocations() == 0);
+
+    for (priority = 0; priority < LoggerPriorityCount; priority++) {
+        free(storm.Seen[priority]);
+    }
+    return failures;
+}
+
+static const TEST_CASE TestCases[] = {
+    { "a new protection is run down until re-initialized", TestStartsRunDown },
+    { "running down waits for the last release on any processor", TestWaitForRelease },
+    { "no acquisition overlaps a run down under a storm", TestAcquireStorm },
+    { "connect and disconnect storms never send on a closed port", TestConnectStorm },
+};
+
+int
+__cdecl
+main(
+    VOID
+)
+{
+    ULONG failures = 0;
+    ULONG caseFailures;
+    ULONG index;
+
+    for (index = 0; index < ARRAYSIZE(TestCases); index++) {
+        caseFailures = TestCases[index].Run(TestCases[index].Title);
+
+        if (caseFailures == 0) {
+            printf("ok   %s\n", TestCases[index].Title);
+        }
+        failures += caseFailures;
+    }
+
+    StandInReset();
+
+    printf("%lu failure(s)\n", (unsigned long)failures);
+    return (int)failures;
+}
@@ -0,0 +1,10 @@
+/*++
+Module Name:
+    dontuse.h
+
+Abstract:
+    User-mode stand-in for the WDK header of banned routines. Empty.
+
+Environment:
+    User mode
+--*/
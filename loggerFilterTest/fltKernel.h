@@ -0,0 +1,886 @@
+/*++
+Module Name:
+    fltKernel.h
+
+Abstract:
+    User-mode stand-in for the kernel and filter manager headers, so that
+    the LoggerFilter sources can be compiled into the driver tests as they
+    are, with GCC or Clang on any POSIX system. The routines the driver
+    calls are implemented in kernelStandIn.c on top of the C library and
+    POSIX threads.
+
+    The second half of this header is the test side of the stand-in: it
+    plays the filter manager (ports, creates), the process manager and the
+    registry, and injects failures into the calls that can fail.
+
+Environment:
+    User mode
+--*/
+
+#ifndef __LOGGERFILTERTEST_FLTKERNEL_H__
+#define __LOGGERFILTERTEST_FLTKERNEL_H__
+
+#include <assert.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+
+/*************************************************************************
+    Basic types
+*************************************************************************/
+
+#define VOID                void
+#define CONST               const
+#define NTAPI
+#define NTSYSAPI
+#define TRUE                1
+#define FALSE               0
+#define NOTHING
+
+typedef void* PVOID;
+typedef unsigned char UCHAR, * PUCHAR, BOOLEAN, * PBOOLEAN;
+typedef char CHAR, * PCHAR, * PSTR;
+typedef const char* PCSTR;
+typedef int16_t SHORT;
+typedef uint16_t USHORT, * PUSHORT;
+typedef int32_t LONG, * PLONG;
+typedef uint32_t ULONG, * PULONG;
+typedef long long LONGLONG, LONG64, * PLONG64;
+typedef unsigned long long ULONGLONG, ULONG64, UINT64, * PULONG64;
+typedef uintptr_t ULONG_PTR, SIZE_T, * PSIZE_T;
+typedef intptr_t LONG_PTR;
+typedef wchar_t WCHAR, * PWCHAR, * PWCH, * PWSTR;
+typedef const wchar_t* PCWSTR, * PCWCH;
+typedef LONG NTSTATUS;
+typedef LONG KPRIORITY;
+typedef void* HANDLE, ** PHANDLE;
+typedef ULONG ACCESS_MASK;
+typedef ULONG DEVICE_TYPE;
+
+typedef union _LARGE_INTEGER {
+    struct {
+        ULONG LowPart;
+        LONG HighPart;
+    };
+    LONGLONG QuadPart;
+} LARGE_INTEGER, * PLARGE_INTEGER;
+
+typedef struct _UNICODE_STRING {
+    USHORT Length;
+    USHORT MaximumLength;
+    PWCH Buffer;
+} UNICODE_STRING, * PUNICODE_STRING;
+typedef const UNICODE_STRING* PCUNICODE_STRING;
+
+#define MAXUSHORT           0xffff
+#define MAXULONG            0xffffffff
+#define ARRAYSIZE(A)        (sizeof(A) / sizeof((A)[0]))
+#define FIELD_OFFSET(T, F)  offsetof(T, F)
+#define CONTAINING_RECORD(Address, Type, Field) \
+    ((Type*)((PUCHAR)(Address) - offsetof(Type, Field)))
+
+#define PtrToUint(P)        ((unsigned int)(ULONG_PTR)(P))
+#define PtrToUlong(P)       ((ULONG)(ULONG_PTR)(P))
+
+#define UNREFERENCED_PARAMETER(P)   ((void)(P))
+#define PAGED_CODE()
+#define FLT_ASSERT(E)               assert(E)
+#define KdPrint(_x_)
+
+#define DECLSPEC_ALIGN(N)           __attribute__((aligned(N)))
+#define DECLSPEC_CACHEALIGN         DECLSPEC_ALIGN(64)
+#define FORCEINLINE                 static inline __attribute__((always_inline))
+#define __cdecl
+
+
+/*************************************************************************
+    Annotations
+*************************************************************************/
+
+#define _In_
+#define _In_opt_
+#define _In_reads_(Count)
+#define _In_reads_bytes_(Size)
+#define _In_reads_bytes_opt_(Size)
+#define _Inout_
+#define _Inout_opt_
+#define _Inout_updates_(Count)
+#define _Out_
+#define _Out_opt_
+#define _Out_writes_(Count)
+#define _Out_writes_opt_(Count)
+#define _Out_writes_bytes_opt_(Size)
+#define _Out_writes_bytes_to_(Size, Count)
+#define _Out_writes_bytes_to_opt_(Size, Count)
+#define _Outptr_result_maybenull_
+
+
+/*************************************************************************
+    Structured exception handling
+
+    User buffers cannot fault here, so a guarded block runs as a plain
+    block: a handler never runs and leave jumps to the termination handler.
+*************************************************************************/
+
+#define try                         do
+#define leave                       break
+#define finally                     while (0);
+#define except(Filter)              while (0); if (0)
+#define GetExceptionCode()          STATUS_ACCESS_VIOLATION
+#define EXCEPTION_EXECUTE_HANDLER   1
+
+
+/*************************************************************************
+    Status codes
+*************************************************************************/
+
+#define NT_SUCCESS(Status)                  (((NTSTATUS)(Status)) >= 0)
+
+#define STATUS_SUCCESS                      ((NTSTATUS)0x00000000L)
+#define STATUS_TIMEOUT                      ((NTSTATUS)0x00000102L)
+#define STATUS_BUFFER_OVERFLOW              ((NTSTATUS)0x80000005L)
+#define STATUS_UNSUCCESSFUL                 ((NTSTATUS)0xC0000001L)
+#define STATUS_INFO_LENGTH_MISMATCH         ((NTSTATUS)0xC0000004L)
+#define STATUS_ACCESS_VIOLATION             ((NTSTATUS)0xC0000005L)
+#define STATUS_INVALID_PARAMETER            ((NTSTATUS)0xC000000DL)
+#define STATUS_OBJECT_NAME_NOT_FOUND        ((NTSTATUS)0xC0000034L)
+#define STATUS_INSUFFICIENT_RESOURCES       ((NTSTATUS)0xC000009AL)
+#define STATUS_BUFFER_TOO_SMALL             ((NTSTATUS)0xC0000023L)
+#define STATUS_PORT_DISCONNECTED            ((NTSTATUS)0xC0000037L)
+#define STATUS_NOT_FOUND                    ((NTSTATUS)0xC0000225L)
+#define STATUS_RETRY                        ((NTSTATUS)0xC000022DL)
+#define STATUS_IMPLEMENTATION_LIMIT         ((NTSTATUS)0xC000042BL)
+#define STATUS_FLT_DO_NOT_ATTACH            ((NTSTATUS)0xC01C000FL)
+
+
+/*************************************************************************
+    Memory, strings and time
+*************************************************************************/
+
+typedef enum _POOL_TYPE {
+    NonPagedPool,
+    PagedPool
+
+} POOL_TYPE;
+
+PVOID
+ExAllocatePoolZero(
+    _In_ POOL_TYPE PoolType,
+    _In_ SIZE_T NumberOfBytes,
+    _In_ ULONG Tag
+);
+
+VOID
+ExFreePoolWithTag(
+    _In_ PVOID P,
+    _In_ ULONG Tag
+);
+
+#define RtlZeroMemory(Destination, Length)          memset((Destination), 0, (Length))
+#define RtlFillMemory(Destination, Length, Fill)    memset((Destination), (Fill), (Length))
+#define RtlCopyMemory(Destination, Source, Length)  memcpy((Destination), (Source), (Length))
+#define RtlMoveMemory(Destination, Source, Length)  memmove((Destination), (Source), (Length))
+
+SIZE_T
+RtlCompareMemory(
+    _In_ const VOID* Source1,
+    _In_ const VOID* Source2,
+    _In_ SIZE_T Length
+);
+
+#define RTL_CONSTANT_STRING(s) \
+    { sizeof(s) - sizeof((s)[0]), sizeof(s), (PWCH)(s) }
+
+VOID
+RtlInitUnicodeString(
+    _Out_ PUNICODE_STRING DestinationString,
+    _In_opt_ PCWSTR SourceString
+);
+
+// Upcases Latin-1; other characters are returned as they are.
+WCHAR
+RtlUpcaseUnicodeChar(
+    _In_ WCHAR SourceCharacter
+);
+
+BOOLEAN
+RtlEqualUnicodeString(
+    _In_ PCUNICODE_STRING String1,
+    _In_ PCUNICODE_STRING String2,
+    _In_ BOOLEAN CaseInSensitive
+);
+
+typedef struct _TIME_FIELDS {
+    SHORT Year;
+    SHORT Month;
+    SHORT Day;
+    SHORT Hour;
+    SHORT Minute;
+    SHORT Second;
+    SHORT Milliseconds;
+    SHORT Weekday;
+} TIME_FIELDS, * PTIME_FIELDS;
+
+VOID
+KeQuerySystemTime(
+    _Out_ PLARGE_INTEGER CurrentTime
+);
+
+#define KeQuerySystemTimePrecise KeQuerySystemTime
+
+// Ticks of 100 ns.
+LARGE_INTEGER
+KeQueryPerformanceCounter(
+    _Out_opt_ PLARGE_INTEGER PerformanceFrequency
+);
+
+VOID
+ExSystemTimeToLocalTime(
+    _In_ PLARGE_INTEGER SystemTime,
+    _Out_ PLARGE_INTEGER LocalTime
+);
+
+VOID
+RtlTimeToTimeFields(
+    _In_ PLARGE_INTEGER Time,
+    _Out_ PTIME_FIELDS TimeFields
+);
+
+
+/*************************************************************************
+    Interlocked operations and processors
+*************************************************************************/
+
+#define InterlockedIncrement(Target)        __atomic_add_fetch((Target), 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement(Target)        __atomic_sub_fetch((Target), 1, __ATOMIC_SEQ_CST)
+#define InterlockedIncrement64(Target)      __atomic_add_fetch((Target), 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement64(Target)      __atomic_sub_fetch((Target), 1, __ATOMIC_SEQ_CST)
+#define InterlockedExchange64(Target, Value) \
+    __atomic_exchange_n((Target), (Value), __ATOMIC_SEQ_CST)
+#define InterlockedExchangeAdd64(Target, Value) \
+    __atomic_fetch_add((Target), (Value), __ATOMIC_SEQ_CST)
+#define InterlockedOr(Target, Value)        __atomic_fetch_or((Target), (Value), __ATOMIC_SEQ_CST)
+#define InterlockedAnd(Target, Value)       __atomic_fetch_and((Target), (Value), __ATOMIC_SEQ_CST)
+
+static inline
+LONG
+InterlockedCompareExchange(
+    _Inout_ volatile LONG* Destination,
+    _In_ LONG Exchange,
+    _In_ LONG Comparand
+)
+{
+    __atomic_compare_exchange_n(Destination, &Comparand, Exchange, FALSE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return Comparand;
+}
+
+static inline
+LONG64
+InterlockedCompareExchange64(
+    _Inout_ volatile LONG64* Destination,
+    _In_ LONG64 Exchange,
+    _In_ LONG64 Comparand
+)
+{
+    __atomic_compare_exchange_n(Destination, &Comparand, Exchange, FALSE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return Comparand;
+}
+
+static inline
+BOOLEAN
+_BitScanForward64(
+    _Out_ ULONG* Index,
+    _In_ UINT64 Mask
+)
+{
+    if (Mask == 0) {
+        return FALSE;
+    }
+    *Index = (ULONG)__builtin_ctzll(Mask);
+    return TRUE;
+}
+
+#define ALL_PROCESSOR_GROUPS    0xffff
+
+typedef struct _PROCESSOR_NUMBER* PPROCESSOR_NUMBER;
+
+// Each thread is given a processor of its own, in turn, unless the test
+// sets one with StandInSetProcessor.
+ULONG
+KeGetCurrentProcessorNumberEx(
+    _Out_opt_ PPROCESSOR_NUMBER ProcNumber
+);
+
+ULONG
+KeQueryActiveProcessorCountEx(
+    _In_ USHORT GroupNumber
+);
+
+
+/*************************************************************************
+    Push locks and events
+*************************************************************************/
+
+typedef struct _EX_PUSH_LOCK {
+    pthread_rwlock_t Lock;
+} EX_PUSH_LOCK, * PEX_PUSH_LOCK;
+
+#define FltInitializePushLock(PushLock)         pthread_rwlock_init(&(PushLock)->Lock, NULL)
+#define FltDeletePushLock(PushLock)             pthread_rwlock_destroy(&(PushLock)->Lock)
+#define FltAcquirePushLockExclusive(PushLock)   pthread_rwlock_wrlock(&(PushLock)->Lock)
+#define FltAcquirePushLockShared(PushLock)      pthread_rwlock_rdlock(&(PushLock)->Lock)
+#define FltReleasePushLock(PushLock)            pthread_rwlock_unlock(&(PushLock)->Lock)
+
+typedef enum _EVENT_TYPE {
+    NotificationEvent,
+    SynchronizationEvent
+} EVENT_TYPE;
+
+typedef enum _KWAIT_REASON {
+    Executive
+} KWAIT_REASON;
+
+typedef enum _MODE {
+    KernelMode,
+    UserMode
+} KPROCESSOR_MODE;
+
+#define IO_NO_INCREMENT     0
+
+typedef struct _KEVENT {
+    pthread_mutex_t Lock;
+    pthread_cond_t Changed;
+    EVENT_TYPE Type;
+    volatile LONG Signaled;
+} KEVENT, * PKEVENT, * PRKEVENT;
+
+VOID
+KeInitializeEvent(
+    _Out_ PRKEVENT Event,
+    _In_ EVENT_TYPE Type,
+    _In_ BOOLEAN State
+);
+
+LONG
+KeSetEvent(
+    _Inout_ PRKEVENT Event,
+    _In_ KPRIORITY Increment,
+    _In_ BOOLEAN Wait
+);
+
+VOID
+KeClearEvent(
+    _Inout_ PRKEVENT Event
+);
+
+// Only waits on a KEVENT, without a timeout.
+NTSTATUS
+KeWaitForSingleObject(
+    _In_ PVOID Object,
+    _In_ KWAIT_REASON WaitReason,
+    _In_ KPROCESSOR_MODE WaitMode,
+    _In_ BOOLEAN Alertable,
+    _In_opt_ PLARGE_INTEGER Timeout
+);
+
+
+/*************************************************************************
+    Processes
+*************************************************************************/
+
+typedef struct _EPROCESS {
+    HANDLE UniqueProcessId;
+} EPROCESS, * PEPROCESS;
+
+typedef struct _PS_CREATE_NOTIFY_INFO {
+    SIZE_T Size;
+    ULONG Flags;
+    HANDLE ParentProcessId;
+    PCUNICODE_STRING ImageFileName;
+    PCUNICODE_STRING CommandLine;
+    NTSTATUS CreationStatus;
+} PS_CREATE_NOTIFY_INFO, * PPS_CREATE_NOTIFY_INFO;
+
+typedef VOID (*PCREATE_PROCESS_NOTIFY_ROUTINE_EX)(
+    _Inout_ PEPROCESS Process,
+    _In_ HANDLE ProcessId,
+    _Inout_opt_ PPS_CREATE_NOTIFY_INFO CreateInfo);
+
+// The process of the calling thread, see StandInSetCurrentProcess.
+PEPROCESS
+PsGetCurrentProcess(
+    VOID
+);
+
+HANDLE
+PsGetCurrentProcessId(
+    VOID
+);
+
+#define PsGetProcessId(Process)     ((Process)->UniqueProcessId)
+
+NTSTATUS
+PsSetCreateProcessNotifyRoutineEx(
+    _In_ PCREATE_PROCESS_NOTIFY_ROUTINE_EX NotifyRoutine,
+    _In_ BOOLEAN Remove
+);
+
+
+/*************************************************************************
+    Registry and objects
+*************************************************************************/
+
+#define OBJ_CASE_INSENSITIVE    0x00000040L
+#define OBJ_KERNEL_HANDLE       0x00000200L
+#define KEY_READ                0x00020019L
+#define REG_DWORD               4
+#define REG_MULTI_SZ            7
+
+typedef struct _OBJECT_ATTRIBUTES {
+    ULONG Length;
+    HANDLE RootDirectory;
+    PUNICODE_STRING ObjectName;
+    ULONG Attributes;
+    PVOID SecurityDescriptor;
+    PVOID SecurityQualityOfService;
+} OBJECT_ATTRIBUTES, * POBJECT_ATTRIBUTES;
+
+#define InitializeObjectAttributes(p, n, a, r, s) {     \
+    (p)->Length = sizeof(OBJECT_ATTRIBUTES);            \
+    (p)->RootDirectory = (r);                           \
+    (p)->Attributes = (a);                              \
+    (p)->ObjectName = (n);                              \
+    (p)->SecurityDescriptor = (s);                      \
+    (p)->SecurityQualityOfService = NULL;               \
+}
+
+typedef enum _KEY_VALUE_INFORMATION_CLASS {
+    KeyValuePartialInformation = 2
+
+} KEY_VALUE_INFORMATION_CLASS;
+
+typedef struct _KEY_VALUE_PARTIAL_INFORMATION {
+    ULONG TitleIndex;
+    ULONG Type;
+    ULONG DataLength;
+    UCHAR Data[1];
+} KEY_VALUE_PARTIAL_INFORMATION, * PKEY_VALUE_PARTIAL_INFORMATION;
+
+NTSTATUS
+ZwOpenKey(
+    _Out_ PHANDLE KeyHandle,
+    _In_ ACCESS_MASK DesiredAccess,
+    _In_ POBJECT_ATTRIBUTES ObjectAttributes
+);
+
+NTSTATUS
+ZwQueryValueKey(
+    _In_ HANDLE KeyHandle,
+    _In_ PUNICODE_STRING ValueName,
+    _In_ KEY_VALUE_INFORMATION_CLASS KeyValueInformationClass,
+    _Out_writes_bytes_to_opt_(Length, *ResultLength) PVOID KeyValueInformation,
+    _In_ ULONG Length,
+    _Out_ PULONG ResultLength
+);
+
+NTSTATUS
+ZwClose(
+    _In_ HANDLE Handle
+);
+
+
+/*************************************************************************
+    Filter manager
+*************************************************************************/
+
+typedef struct _DRIVER_OBJECT {
+    PVOID DriverExtension;
+} DRIVER_OBJECT, * PDRIVER_OBJECT;
+
+typedef NTSTATUS DRIVER_INITIALIZE(
+    _In_ PDRIVER_OBJECT DriverObject,
+    _In_ PUNICODE_STRING RegistryPath);
+
+typedef struct _STANDIN_FILTER* PFLT_FILTER;
+typedef struct _STANDIN_PORT* PFLT_PORT;
+typedef struct _STANDIN_INSTANCE* PFLT_INSTANCE;
+typedef struct _STANDIN_VOLUME* PFLT_VOLUME;
+typedef struct _STANDIN_FILE_OBJECT* PFILE_OBJECT;
+typedef PVOID PFLT_CONTEXT;
+typedef PVOID PSECURITY_DESCRIPTOR;
+
+typedef ULONG FLT_FILTER_UNLOAD_FLAGS;
+typedef ULONG FLT_INSTANCE_SETUP_FLAGS;
+typedef ULONG FLT_INSTANCE_QUERY_TEARDOWN_FLAGS;
+typedef ULONG FLT_FILESYSTEM_TYPE;
+typedef ULONG FLT_FILE_NAME_OPTIONS;
+
+#define FILE_DEVICE_NETWORK_FILE_SYSTEM     0x00000014
+#define FLT_PORT_ALL_ACCESS                 0x001F0001
+#define FLT_REGISTRATION_VERSION            0x0203
+#define FLT_FILE_NAME_NORMALIZED            0x01
+#define FLT_FILE_NAME_QUERY_DEFAULT         0x0100
+#define FLT_STREAMHANDLE_CONTEXT            0x0010
+#define FLT_CONTEXT_END                     0xffff
+#define IRP_MJ_CREATE                       0x00
+#define IRP_MJ_OPERATION_END                ((UCHAR)0x80)
+
+typedef enum _FLT_PREOP_CALLBACK_STATUS {
+    FLT_PREOP_SUCCESS_WITH_CALLBACK,
+    FLT_PREOP_SUCCESS_NO_CALLBACK,
+    FLT_PREOP_PENDING,
+    FLT_PREOP_DISALLOW_FASTIO,
+    FLT_PREOP_COMPLETE,
+    FLT_PREOP_SYNCHRONIZE
+
+} FLT_PREOP_CALLBACK_STATUS;
+
+typedef struct _IO_STATUS_BLOCK {
+    NTSTATUS Status;
+    ULONG_PTR Information;
+} IO_STATUS_BLOCK;
+
+typedef struct _FLT_CALLBACK_DATA {
+    IO_STATUS_BLOCK IoStatus;
+
+    // Normalized name of the file being opened, returned by
+    // FltGetFileNameInformation.
+    PCWSTR StandInFileName;
+} FLT_CALLBACK_DATA, * PFLT_CALLBACK_DATA;
+
+typedef struct _FLT_RELATED_OBJECTS {
+    USHORT Size;
+    USHORT TransactionContext;
+    PFLT_FILTER Filter;
+    PFLT_VOLUME Volume;
+    PFLT_INSTANCE Instance;
+    PFILE_OBJECT FileObject;
+} FLT_RELATED_OBJECTS, * PFLT_RELATED_OBJECTS;
+typedef const FLT_RELATED_OBJECTS* PCFLT_RELATED_OBJECTS;
+
+typedef struct _FLT_FILE_NAME_INFORMATION {
+    USHORT Size;
+    USHORT NamesParsed;
+    FLT_FILE_NAME_OPTIONS Format;
+    UNICODE_STRING Name;
+} FLT_FILE_NAME_INFORMATION, * PFLT_FILE_NAME_INFORMATION;
+
+typedef FLT_PREOP_CALLBACK_STATUS (*PFLT_PRE_OPERATION_CALLBACK)(
+    _Inout_ PFLT_CALLBACK_DATA Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _Out_ PVOID* CompletionContext);
+
+typedef NTSTATUS (*PFLT_FILTER_UNLOAD_CALLBACK)(
+    _In_ FLT_FILTER_UNLOAD_FLAGS Flags);
+
+typedef NTSTATUS (*PFLT_INSTANCE_SETUP_CALLBACK)(
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ FLT_INSTANCE_SETUP_FLAGS Flags,
+    _In_ DEVICE_TYPE VolumeDeviceType,
+    _In_ FLT_FILESYSTEM_TYPE VolumeFilesystemType);
+
+typedef NTSTATUS (*PFLT_INSTANCE_QUERY_TEARDOWN_CALLBACK)(
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ FLT_INSTANCE_QUERY_TEARDOWN_FLAGS Flags);
+
+typedef NTSTATUS (*PFLT_CONNECT_NOTIFY)(
+    _In_ PFLT_PORT ClientPort,
+    _In_opt_ PVOID ServerPortCookie,
+    _In_reads_bytes_opt_(SizeOfContext) PVOID ConnectionContext,
+    _In_ ULONG SizeOfContext,
+    _Outptr_result_maybenull_ PVOID* ConnectionPortCookie);
+
+typedef VOID (*PFLT_DISCONNECT_NOTIFY)(
+    _In_opt_ PVOID ConnectionCookie);
+
+typedef NTSTATUS (*PFLT_MESSAGE_NOTIFY)(
+    _In_opt_ PVOID PortCookie,
+    _In_reads_bytes_opt_(InputBufferLength) PVOID InputBuffer,
+    _In_ ULONG InputBufferLength,
+    _Out_writes_bytes_to_opt_(OutputBufferLength, *ReturnOutputBufferLength) PVOID OutputBuffer,
+    _In_ ULONG OutputBufferLength,
+    _Out_ PULONG ReturnOutputBufferLength);
+
+typedef struct _FLT_OPERATION_REGISTRATION {
+    UCHAR MajorFunction;
+    ULONG Flags;
+    PFLT_PRE_OPERATION_CALLBACK PreOperation;
+    PVOID PostOperation;
+    PVOID Reserved1;
+} FLT_OPERATION_REGISTRATION, * PFLT_OPERATION_REGISTRATION;
+
+typedef struct _FLT_CONTEXT_REGISTRATION {
+    USHORT ContextType;
+    USHORT Flags;
+    PVOID ContextCleanupCallback;
+    SIZE_T Size;
+    ULONG PoolTag;
+    PVOID ContextAllocateCallback;
+    PVOID ContextFreeCallback;
+    PVOID Reserved1;
+} FLT_CONTEXT_REGISTRATION, * PFLT_CONTEXT_REGISTRATION;
+
+typedef struct _FLT_REGISTRATION {
+    USHORT Size;
+    USHORT Version;
+    ULONG Flags;
+    const FLT_CONTEXT_REGISTRATION* ContextRegistration;
+    const FLT_OPERATION_REGISTRATION* OperationRegistration;
+    PFLT_FILTER_UNLOAD_CALLBACK FilterUnloadCallback;
+    PFLT_INSTANCE_SETUP_CALLBACK InstanceSetupCallback;
+    PFLT_INSTANCE_QUERY_TEARDOWN_CALLBACK InstanceQueryTeardownCallback;
+    PVOID InstanceTeardownStartCallback;
+    PVOID InstanceTeardownCompleteCallback;
+    PVOID GenerateFileNameCallback;
+    PVOID NormalizeNameComponentCallback;
+    PVOID NormalizeContextCleanupCallback;
+} FLT_REGISTRATION, * PFLT_REGISTRATION;
+
+NTSTATUS
+FltRegisterFilter(
+    _In_ PDRIVER_OBJECT Driver,
+    _In_ const FLT_REGISTRATION* Registration,
+    _Out_ PFLT_FILTER* RetFilter
+);
+
+VOID
+FltUnregisterFilter(
+    _In_ PFLT_FILTER Filter
+);
+
+NTSTATUS
+FltStartFiltering(
+    _In_ PFLT_FILTER Filter
+);
+
+NTSTATUS
+FltBuildDefaultSecurityDescriptor(
+    _Out_ PSECURITY_DESCRIPTOR* SecurityDescriptor,
+    _In_ ACCESS_MASK DesiredAccess
+);
+
+VOID
+FltFreeSecurityDescriptor(
+    _In_ PSECURITY_DESCRIPTOR SecurityDescriptor
+);
+
+NTSTATUS
+FltCreateCommunicationPort(
+    _In_ PFLT_FILTER Filter,
+    _Out_ PFLT_PORT* ServerPort,
+    _In_ POBJECT_ATTRIBUTES ObjectAttributes,
+    _In_opt_ PVOID ServerPortCookie,
+    _In_ PFLT_CONNECT_NOTIFY ConnectNotifyCallback,
+    _In_ PFLT_DISCONNECT_NOTIFY DisconnectNotifyCallback,
+    _In_opt_ PFLT_MESSAGE_NOTIFY MessageNotifyCallback,
+    _In_ LONG MaxConnections
+);
+
+VOID
+FltCloseCommunicationPort(
+    _In_ PFLT_PORT ServerPort
+);
+
+VOID
+FltCloseClientPort(
+    _In_ PFLT_FILTER Filter,
+    _Inout_ PFLT_PORT* ClientPort
+);
+
+NTSTATUS
+FltSendMessage(
+    _In_ PFLT_FILTER Filter,
+    _In_ PFLT_PORT* ClientPort,
+    _In_reads_bytes_(SenderBufferLength) PVOID SenderBuffer,
+    _In_ ULONG SenderBufferLength,
+    _Out_writes_bytes_opt_(*ReplyLength) PVOID ReplyBuffer,
+    _Inout_opt_ PULONG ReplyLength,
+    _In_opt_ PLARGE_INTEGER Timeout
+);
+
+NTSTATUS
+FltGetFileNameInformation(
+    _In_ PFLT_CALLBACK_DATA CallbackData,
+    _In_ FLT_FILE_NAME_OPTIONS NameOptions,
+    _Out_ PFLT_FILE_NAME_INFORMATION* FileNameInformation
+);
+
+VOID
+FltReleaseFileNameInformation(
+    _In_ PFLT_FILE_NAME_INFORMATION FileNameInformation
+);
+
+NTSTATUS
+FltGetStreamHandleContext(
+    _In_ PFLT_INSTANCE Instance,
+    _In_ PFILE_OBJECT FileObject,
+    _Out_ PFLT_CONTEXT* Context
+);
+
+VOID
+FltReleaseContext(
+    _In_ PFLT_CONTEXT Context
+);
+
+
+/*************************************************************************
+    Test side of the stand-in
+*************************************************************************/
+
+// Restores the initial state: no filter, ports, processes or registry
+// values, and no pending fault. Pool allocations are not freed.
+VOID
+StandInReset(
+    VOID
+);
+
+// Makes the Nth call from now of a routine that can fail (pool allocations,
+// FltRegisterFilter, FltBuildDefaultSecurityDescriptor,
+// FltCreateCommunicationPort, FltStartFiltering and registering the process
+// notification) fail, 0 for none. Returns the number of such calls made
+// since the previous StandInFailCall.
+ULONG
+StandInFailCall(
+    _In_ ULONG Countdown
+);
+
+// Pool allocations, security descriptors, server ports, file name
+// information and registry keys not released yet.
+LONG
+StandInOutstandingAllocations(
+    VOID
+);
+
+// Moves the system time forward, in 100 ns units.
+VOID
+StandInAdvanceTime(
+    _In_ LONGLONG Delta
+);
+
+VOID
+StandInSetProcessor(
+    _In_ ULONG Processor
+);
+
+VOID
+StandInSetCurrentProcess(
+    _In_ HANDLE ProcessId
+);
+
+// Sets a value of the driver's Parameters key.
+VOID
+StandInSetRegistryDword(
+    _In_ PCWSTR ValueName,
+    _In_ ULONG Value
+);
+
+// MultiSz holds Length bytes, including the terminating empty string.
+VOID
+StandInSetRegistryMultiSz(
+    _In_ PCWSTR ValueName,
+    _In_ PCWSTR MultiSz,
+    _In_ ULONG Length
+);
+
+BOOLEAN
+StandInFilterRegistered(
+    VOID
+);
+
+BOOLEAN
+StandInFilterStarted(
+    VOID
+);
+
+ULONG
+StandInOpenServerPorts(
+    VOID
+);
+
+// Calls the unload routine of the registered filter.
+NTSTATUS
+StandInUnload(
+    VOID
+);
+
+// Opens a file from the current thread and process: calls the registered
+// pre-create routine with FileName as the normalized name.
+FLT_PREOP_CALLBACK_STATUS
+StandInCreate(
+    _In_ PCWSTR FileName
+);
+
+// The client end of a connection. Messages the driver sends are passed to
+// Receive on the sending thread, which returns the status FltSendMessage
+// returns: STATUS_SUCCESS once taken, STATUS_TIMEOUT if Timeout is not NULL
+// and the client would have made the sender wait longer.
+typedef NTSTATUS (*PSTANDIN_RECEIVE)(
+    _In_opt_ PVOID Context,
+    _In_ PVOID Buffer,
+    _In_ ULONG Length,
+    _In_opt_ PLARGE_INTEGER Timeout);
+
+// Connects to a server port from the current thread, like
+// FilterConnectCommunicationPort. Returns NULL if the port does not exist
+// or refuses the connection. The client port stays allocated until
+// StandInReset, so a late send through it is detected.
+PFLT_PORT
+StandInConnect(
+    _In_ PCWSTR PortName,
+    _In_ PSTANDIN_RECEIVE Receive,
+    _In_opt_ PVOID Context
+);
+
+// Sends a command to the driver, like FilterSendMessage.
+NTSTATUS
+StandInSendCommand(
+    _In_ PFLT_PORT ClientPort,
+    _In_reads_bytes_(InputBufferLength) PVOID InputBuffer,
+    _In_ ULONG InputBufferLength,
+    _Out_writes_bytes_to_opt_(OutputBufferLength, *ReturnOutputBufferLength) PVOID OutputBuffer,
+    _In_ ULONG OutputBufferLength,
+    _Out_ PULONG ReturnOutputBufferLength
+);
+
+// Closes the client end, like closing the handle in user mode.
+VOID
+StandInDisconnect(
+    _In_ PFLT_PORT ClientPort
+);
+
+// Sends through a client port that was closed, or through no port at all.
+// A driver that uses its client port correctly never makes any.
+LONG
+StandInSendsOnClosedPorts(
+    VOID
+);
+
+// Starts or ends a process, calling the registered process notification.
+VOID
+StandInProcessStart(
+    _In_ HANDLE ProcessId,
+    _In_ PCWSTR ImageName
+);
+
+VOID
+StandInProcessExit(
+    _In_ HANDLE ProcessId
+);
+
+BOOLEAN
+StandInProcessNotifyRegistered(
+    VOID
+);
+
+// Called by ZwQuerySystemInformation once the snapshot is taken, before it
+// returns, so that a test can start and end processes in between.
+VOID
+StandInSetSnapshotHook(
+    _In_opt_ VOID (*Hook)(VOID)
+);
+
+#endif
@@ -0,0 +1,1297 @@
+/*++
+Module Name:
+    kernelStandIn.c
+
+Abstract:
+    Implements the kernel and filter manager routines declared by the
+    stand-in fltKernel.h, and the test side that plays the filter manager,
+    the process manager and the registry for the driver tests.
+
+Environment:
+    User mode
+--*/
+
+#include <sched.h>
+#include <stdio.h>
+#include <time.h>
+#include "fltKernel.h"
+
+#define STANDIN_PROCESSOR_COUNT     8
+#define STANDIN_MAX_SERVER_PORTS    8
+#define STANDIN_MAX_PROCESSES       1024
+#define STANDIN_MAX_VALUES          32
+#define STANDIN_MAX_NAME            64
+
+// 100 ns intervals between 1601-01-01 and 1970-01-01.
+#define STANDIN_EPOCH_DELTA         116444736000000000LL
+
+#define STANDIN_SERVICE_KEY         ((HANDLE)(ULONG_PTR)0x10)
+#define STANDIN_PARAMETERS_KEY      ((HANDLE)(ULONG_PTR)0x20)
+
+struct _STANDIN_FILTER {
+    const FLT_REGISTRATION* Registration;
+    BOOLEAN Started;
+};
+
+struct _STANDIN_PORT {
+
+    BOOLEAN Server;
+
+    // Server ports.
+    WCHAR Name[STANDIN_MAX_NAME];
+    PVOID Cookie;
+    PFLT_CONNECT_NOTIFY Connect;
+    PFLT_DISCONNECT_NOTIFY Disconnect;
+    PFLT_MESSAGE_NOTIFY Message;
+    LONG MaxConnections;
+    LONG Connections;
+
+    // Client ports.
+    struct _STANDIN_PORT* ServerPort;
+    PVOID ConnectionCookie;
+    PSTANDIN_RECEIVE Receive;
+    PVOID Context;
+    volatile LONG Disconnected;
+    volatile LONG Closed;
+    volatile LONG SendsInProgress;
+    struct _STANDIN_PORT* NextClient;
+};
+
+typedef struct _STANDIN_PROCESS {
+    HANDLE ProcessId;
+    WCHAR ImageName[STANDIN_MAX_NAME];
+} STANDIN_PROCESS, * PSTANDIN_PROCESS;
+
+typedef struct _STANDIN_VALUE {
+    WCHAR Name[STANDIN_MAX_NAME];
+    ULONG Type;
+    ULONG Length;
+    PUCHAR Data;
+} STANDIN_VALUE, * PSTANDIN_VALUE;
+
+// Layout of the SystemProcessInformation records, as documented in winternl.h
+typedef struct _STANDIN_SYSTEM_PROCESS_INFORMATION {
+    ULONG NextEntryOffset;
+    ULONG NumberOfThreads;
+    UCHAR Reserved1[48];
+    UNICODE_STRING ImageName;
+    KPRIORITY BasePriority;
+    HANDLE UniqueProcessId;
+} STANDIN_SYSTEM_PROCESS_INFORMATION, * PSTANDIN_SYSTEM_PROCESS_INFORMATION;
+
+static struct {
+
+    pthread_mutex_t Lock;
+
+    volatile LONG Outstanding;
+    volatile LONG FallibleCalls;
+    volatile LONG FailAt;
+    volatile LONGLONG TimeOffset;
+    volatile LONG NextProcessor;
+    volatile LONG SendsOnClosedPorts;
+
+    struct _STANDIN_FILTER Filter;
+    BOOLEAN FilterRegistered;
+
+    struct _STANDIN_PORT* ServerPorts[STANDIN_MAX_SERVER_PORTS];
+    struct _STANDIN_PORT* Clients;
+
+    PCREATE_PROCESS_NOTIFY_ROUTINE_EX NotifyRoutine;
+    STANDIN_PROCESS Processes[STANDIN_MAX_PROCESSES];
+    ULONG ProcessCount;
+    VOID (*SnapshotHook)(VOID);
+
+    STANDIN_VALUE Values[STANDIN_MAX_VALUES];
+    ULONG ValueCount;
+
+} StandIn = { .Lock = PTHREAD_MUTEX_INITIALIZER };
+
+static __thread ULONG CurrentProcessor = MAXULONG;
+static __thread EPROCESS CurrentProcess = { (HANDLE)(ULONG_PTR)1000 };
+
+NTSTATUS
+ZwQuerySystemInformation(
+    _In_ ULONG SystemInformationClass,
+    _Out_writes_bytes_opt_(SystemInformationLength) PVOID SystemInformation,
+    _In_ ULONG SystemInformationLength,
+    _Out_opt_ PULONG ReturnLength
+);
+
+
+/*************************************************************************
+    Helpers
+*************************************************************************/
+
+static
+BOOLEAN
+StandInFault(
+    VOID
+)
+{
+    LONG call = InterlockedIncrement(&StandIn.FallibleCalls);
+
+    return call == StandIn.FailAt;
+}
+
+static
+PVOID
+StandInAllocate(
+    _In_ SIZE_T Size
+)
+{
+    PVOID p = calloc(1, Size != 0 ? Size : 1);
+
+    if (p == NULL) {
+        fprintf(stderr, "out of memory\n");
+        abort();
+    }
+    InterlockedIncrement(&StandIn.Outstanding);
+    return p;
+}
+
+static
+VOID
+StandInRelease(
+    _In_ PVOID P
+)
+{
+    assert(P != NULL);
+    InterlockedDecrement(&StandIn.Outstanding);
+    free(P);
+}
+
+static
+VOID
+StandInCopyName(
+    _Out_writes_(STANDIN_MAX_NAME) PWCHAR Destination,
+    _In_ PCWCH Source,
+    _In_ SIZE_T Chars
+)
+{
+    if (Chars >= STANDIN_MAX_NAME) {
+        Chars = STANDIN_MAX_NAME - 1;
+    }
+    memcpy(Destination, Source, Chars * sizeof(WCHAR));
+    Destination[Chars] = L'\0';
+}
+
+
+/*************************************************************************
+    Memory, strings and time
+*************************************************************************/
+
+PVOID
+ExAllocatePoolZero(
+    _In_ POOL_TYPE PoolType,
+    _In_ SIZE_T NumberOfBytes,
+    _In_ ULONG Tag
+)
+{
+    UNREFERENCED_PARAMETER(PoolType);
+    UNREFERENCED_PARAMETER(Tag);
+
+    if (StandInFault()) {
+        return NULL;
+    }
+    return StandInAllocate(NumberOfBytes);
+}
+
+VOID
+ExFreePoolWithTag(
+    _In_ PVOID P,
+    _In_ ULONG Tag
+)
+{
+    UNREFERENCED_PARAMETER(Tag);
+
+    StandInRelease(P);
+}
+
+SIZE_T
+RtlCompareMemory(
+    _In_ const VOID* Source1,
+    _In_ const VOID* Source2,
+    _In_ SIZE_T Length
+)
+{
+    const UCHAR* a = Source1;
+    const UCHAR* b = Source2;
+    SIZE_T same = 0;
+
+    while (same < Length && a[same] == b[same]) {
+        same++;
+    }
+    return same;
+}
+
+VOID
+RtlInitUnicodeString(
+    _Out_ PUNICODE_STRING DestinationString,
+    _In_opt_ PCWSTR SourceString
+)
+{
+    SIZE_T length = SourceString != NULL ? wcslen(SourceString) * sizeof(WCHAR) : 0;
+
+    DestinationString->Buffer = (PWCH)SourceString;
+    DestinationString->Length = (USHORT)length;
+    DestinationString->MaximumLength = SourceString != NULL ? (USHORT)(length + sizeof(WCHAR)) : 0;
+}
+
+WCHAR
+RtlUpcaseUnicodeChar(
+    _In_ WCHAR SourceCharacter
+)
+{
+    if (SourceCharacter >= L'a' && SourceCharacter <= L'z') {
+        return SourceCharacter - (L'a' - L'A');
+    }
+    if (SourceCharacter >= 0xE0 && SourceCharacter <= 0xFE && SourceCharacter != 0xF7) {
+        return SourceCharacter - 0x20;
+    }
+    if (SourceCharacter == 0xFF) {
+        return 0x178;
+    }
+    if (SourceCharacter == 0xB5) {
+        return 0x39C;
+    }
+    return SourceCharacter;
+}
+
+BOOLEAN
+RtlEqualUnicodeString(
+    _In_ PCUNICODE_STRING String1,
+    _In_ PCUNICODE_STRING String2,
+    _In_ BOOLEAN CaseInSensitive
+)
+{
+    USHORT index;
+
+    if (String1->Length != String2->Length) {
+        return FALSE;
+    }
+
+    for (index = 0; index < String1->Length / sizeof(WCHAR); index++) {
+        WCHAR a = String1->Buffer[index];
+        WCHAR b = String2->Buffer[index];
+
+        if (CaseInSensitive) {
+            a = RtlUpcaseUnicodeChar(a);
+            b = RtlUpcaseUnicodeChar(b);
+        }
+        if (a != b) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+VOID
+KeQuerySystemTime(
+    _Out_ PLARGE_INTEGER CurrentTime
+)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    CurrentTime->QuadPart = (LONGLONG)now.tv_sec * 10000000 + now.tv_nsec / 100 +
+        STANDIN_EPOCH_DELTA + __atomic_load_n(&StandIn.TimeOffset, __ATOMIC_SEQ_CST);
+}
+
+LARGE_INTEGER
+KeQueryPerformanceCounter(
+    _Out_opt_ PLARGE_INTEGER PerformanceFrequency
+)
+{
+    struct timespec now;
+    LARGE_INTEGER counter;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if (PerformanceFrequency != NULL) {
+        PerformanceFrequency->QuadPart = 10000000;
+    }
+
+    counter.QuadPart = (LONGLONG)now.tv_sec * 10000000 + now.tv_nsec / 100;
+    return counter;
+}
+
+VOID
+ExSystemTimeToLocalTime(
+    _In_ PLARGE_INTEGER SystemTime,
+    _Out_ PLARGE_INTEGER LocalTime
+)
+{
+    *LocalTime = *SystemTime;
+}
+
+VOID
+RtlTimeToTimeFields(
+    _In_ PLARGE_INTEGER Time,
+    _Out_ PTIME_FIELDS TimeFields
+)
+{
+    time_t seconds = (time_t)((Time->QuadPart - STANDIN_EPOCH_DELTA) / 10000000);
+    struct tm fields;
+
+    gmtime_r(&seconds, &fields);
+
+    TimeFields->Year = (SHORT)(fields.tm_year + 1900);
+    TimeFields->Month = (SHORT)(fields.tm_mon + 1);
+    TimeFields->Day = (SHORT)fields.tm_mday;
+    TimeFields->Hour = (SHORT)fields.tm_hour;
+    TimeFields->Minute = (SHORT)fields.tm_min;
+    TimeFields->Second = (SHORT)fields.tm_sec;
+    TimeFields->Milliseconds = (SHORT)((Time->QuadPart / 10000) % 1000);
+    TimeFields->Weekday = (SHORT)fields.tm_wday;
+}
+
+
+/*************************************************************************
+    Processors and events
+*************************************************************************/
+
+ULONG
+KeGetCurrentProcessorNumberEx(
+    _Out_opt_ PPROCESSOR_NUMBER ProcNumber
+)
+{
+    UNREFERENCED_PARAMETER(ProcNumber);
+
+    if (CurrentProcessor == MAXULONG) {
+        CurrentProcessor = (ULONG)(InterlockedIncrement(&StandIn.NextProcessor) - 1) % STANDIN_PROCESSOR_COUNT;
+    }
+    return CurrentProcessor;
+}
+
+ULONG
+KeQueryActiveProcessorCountEx(
+    _In_ USHORT GroupNumber
+)
+{
+    UNREFERENCED_PARAMETER(GroupNumber);
+
+    return STANDIN_PROCESSOR_COUNT;
+}
+
+VOID
+KeInitializeEvent(
+    _Out_ PRKEVENT Event,
+    _In_ EVENT_TYPE Type,
+    _In_ BOOLEAN State
+)
+{
+    pthread_mutex_init(&Event->Lock, NULL);
+    pthread_cond_init(&Event->Changed, NULL);
+    Event->Type = Type;
+    Event->Signaled = State;
+}
+
+LONG
+KeSetEvent(
+    _Inout_ PRKEVENT Event,
+    _In_ KPRIORITY Increment,
+    _In_ BOOLEAN Wait
+)
+{
+    LONG previous;
+
+    UNREFERENCED_PARAMETER(Increment);
+    UNREFERENCED_PARAMETER(Wait);
+
+    pthread_mutex_lock(&Event->Lock);
+    previous = Event->Signaled;
+    Event->Signaled = TRUE;
+    if (Event->Type == NotificationEvent) {
+        pthread_cond_broadcast(&Event->Changed);
+    }
+    else {
+        pthread_cond_signal(&Event->Changed);
+    }
+    pthread_mutex_unlock(&Event->Lock);
+    return previous;
+}
+
+VOID
+KeClearEvent(
+    _Inout_ PRKEVENT Event
+)
+{
+    pthread_mutex_lock(&Event->Lock);
+    Event->Signaled = FALSE;
+    pthread_mutex_unlock(&Event->Lock);
+}
+
+NTSTATUS
+KeWaitForSingleObject(
+    _In_ PVOID Object,
+    _In_ KWAIT_REASON WaitReason,
+    _In_ KPROCESSOR_MODE WaitMode,
+    _In_ BOOLEAN Alertable,
+    _In_opt_ PLARGE_INTEGER Timeout
+)
+{
+    PRKEVENT event = Object;
+
+    UNREFERENCED_PARAMETER(WaitReason);
+    UNREFERENCED_PARAMETER(WaitMode);
+    UNREFERENCED_PARAMETER(Alertable);
+
+    assert(Timeout == NULL);
+
+    pthread_mutex_lock(&event->Lock);
+    while (!event->Signaled) {
+        pthread_cond_wait(&event->Changed, &event->Lock);
+    }
+    if (event->Type == SynchronizationEvent) {
+        event->Signaled = FALSE;
+    }
+    pthread_mutex_unlock(&event->Lock);
+    return STATUS_SUCCESS;
+}
+
+
+/*************************************************************************
+    Processes
+*************************************************************************/
+
+PEPROCESS
+PsGetCurrentProcess(
+    VOID
+)
+{
+    return &CurrentProcess;
+}
+
+HANDLE
+PsGetCurrentProcessId(
+    VOID
+)
+{
+    return CurrentProcess.UniqueProcessId;
+}
+
+NTSTATUS
+PsSetCreateProcessNotifyRoutineEx(
+    _In_ PCREATE_PROCESS_NOTIFY_ROUTINE_EX NotifyRoutine,
+    _In_ BOOLEAN Remove
+)
+{
+    NTSTATUS status = STATUS_SUCCESS;
+
+    pthread_mutex_lock(&StandIn.Lock);
+
+    if (Remove) {
+        if (StandIn.NotifyRoutine == NotifyRoutine) {
+            StandIn.NotifyRoutine = NULL;
+        }
+        else {
+            status = STATUS_INVALID_PARAMETER;
+        }
+    }
+    else if (StandIn.NotifyRoutine != NULL) {
+        status = STATUS_INVALID_PARAMETER;
+    }
+    else if (StandInFault()) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+    }
+    else {
+        StandIn.NotifyRoutine = NotifyRoutine;
+    }
+
+    pthread_mutex_unlock(&StandIn.Lock);
+    return status;
+}
+
+NTSTATUS
+ZwQuerySystemInformation(
+    _In_ ULONG SystemInformationClass,
+    _Out_writes_bytes_opt_(SystemInformationLength) PVOID SystemInformation,
+    _In_ ULONG SystemInformationLength,
+    _Out_opt_ PULONG ReturnLength
+)
+/*
+Routine Description:
+    Returns a snapshot of the running processes for class 5, led by the
+    idle process, which has no image name.
+*/
+{
+    const ULONG entrySize = (ULONG)((sizeof(STANDIN_SYSTEM_PROCESS_INFORMATION) + STANDIN_MAX_NAME * sizeof(WCHAR) + 7) & ~7);
+    PSTANDIN_SYSTEM_PROCESS_INFORMATION info;
+    ULONG needed;
+    ULONG index;
+
+    if (SystemInformationClass != 5) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    pthread_mutex_lock(&StandIn.Lock);
+
+    needed = (StandIn.ProcessCount + 1) * entrySize;
+
+    if (ReturnLength != NULL) {
+        *ReturnLength = needed;
+    }
+
+    if (SystemInformationLength < needed) {
+        pthread_mutex_unlock(&StandIn.Lock);
+        return STATUS_INFO_LENGTH_MISMATCH;
+    }
+
+    memset(SystemInformation, 0, needed);
+
+    for (index = 0; index <= StandIn.ProcessCount; index++) {
+        info = (PSTANDIN_SYSTEM_PROCESS_INFORMATION)((PUCHAR)SystemInformation + index * entrySize);
+        info->NextEntryOffset = index < StandIn.ProcessCount ? entrySize : 0;
+
+        if (index != 0) {
+            PSTANDIN_PROCESS process = &StandIn.Processes[index - 1];
+            PWCHAR name = (PWCHAR)(info + 1);
+
+            wcscpy(name, process->ImageName);
+            RtlInitUnicodeString(&info->ImageName, name);
+            info->UniqueProcessId = process->ProcessId;
+        }
+    }
+
+    pthread_mutex_unlock(&StandIn.Lock);
+
+    if (StandIn.SnapshotHook != NULL) {
+        StandIn.SnapshotHook();
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+/*************************************************************************
+    Registry
+*************************************************************************/
+
+static
+PSTANDIN_VALUE
+StandInFindValue(
+    _In_ PCWCH Name,
+    _In_ SIZE_T Chars
+)
+{
+    ULONG index;
+
+    for (index = 0; index < StandIn.ValueCount; index++) {
+        if (wcslen(StandIn.Values[index].Name) == Chars &&
+            wmemcmp(StandIn.Values[index].Name, Name, Chars) == 0) {
+            return &StandIn.Values[index];
+        }
+    }
+    return NULL;
+}
+
+NTSTATUS
+ZwOpenKey(
+    _Out_ PHANDLE KeyHandle,
+    _In_ ACCESS_MASK DesiredAccess,
+    _In_ POBJECT_ATTRIBUTES ObjectAttributes
+)
+/*
+Routine Description:
+    Opens the service key, given the registry path, and its Parameters
+    subkey, which exists once a value has been set in it.
+*/
+{
+    UNREFERENCED_PARAMETER(DesiredAccess);
+
+    if (ObjectAttributes->RootDirectory == NULL) {
+        *KeyHandle = STANDIN_SERVICE_KEY;
+    }
+    else if (ObjectAttributes->RootDirectory == STANDIN_SERVICE_KEY && StandIn.ValueCount != 0) {
+        *KeyHandle = STANDIN_PARAMETERS_KEY;
+    }
+    else {
+        return STATUS_OBJECT_NAME_NOT_FOUND;
+    }
+
+    InterlockedIncrement(&StandIn.Outstanding);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+ZwQueryValueKey(
+    _In_ HANDLE KeyHandle,
+    _In_ PUNICODE_STRING ValueName,
+    _In_ KEY_VALUE_INFORMATION_CLASS KeyValueInformationClass,
+    _Out_writes_bytes_to_opt_(Length, *ResultLength) PVOID KeyValueInformation,
+    _In_ ULONG Length,
+    _Out_ PULONG ResultLength
+)
+{
+    PKEY_VALUE_PARTIAL_INFORMATION info = KeyValueInformation;
+    PSTANDIN_VALUE value;
+
+    assert(KeyValueInformationClass == KeyValuePartialInformation);
+
+    value = KeyHandle == STANDIN_PARAMETERS_KEY ?
+        StandInFindValue(ValueName->Buffer, ValueName->Length / sizeof(WCHAR)) :
+        NULL;
+
+    if (value == NULL) {
+        return STATUS_OBJECT_NAME_NOT_FOUND;
+    }
+
+    *ResultLength = FIELD_OFFSET(KEY_VALUE_PARTIAL_INFORMATION, Data) + value->Length;
+
+    if (Length < FIELD_OFFSET(KEY_VALUE_PARTIAL_INFORMATION, Data)) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    info->TitleIndex = 0;
+    info->Type = value->Type;
+    info->DataLength = value->Length;
+
+    if (Length < *ResultLength) {
+        return STATUS_BUFFER_OVERFLOW;
+    }
+
+    memcpy(info->Data, value->Data, value->Length);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+ZwClose(
+    _In_ HANDLE Handle
+)
+{
+    assert(Handle == STANDIN_SERVICE_KEY || Handle == STANDIN_PARAMETERS_KEY);
+
+    InterlockedDecrement(&StandIn.Outstanding);
+    return STATUS_SUCCESS;
+}
+
+
+/*************************************************************************
+    Filter manager
+*************************************************************************/
+
+NTSTATUS
+FltRegisterFilter(
+    _In_ PDRIVER_OBJECT Driver,
+    _In_ const FLT_REGISTRATION* Registration,
+    _Out_ PFLT_FILTER* RetFilter
+)
+{
+    UNREFERENCED_PARAMETER(Driver);
+
+    assert(!StandIn.FilterRegistered);
+
+    if (StandInFault()) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    StandIn.Filter.Registration = Registration;
+    StandIn.Filter.Started = FALSE;
+    StandIn.FilterRegistered = TRUE;
+    *RetFilter = &StandIn.Filter;
+    return STATUS_SUCCESS;
+}
+
+VOID
+FltUnregisterFilter(
+    _In_ PFLT_FILTER Filter
+)
+{
+    assert(Filter == &StandIn.Filter && StandIn.FilterRegistered);
+    assert(StandInOpenServerPorts() == 0);
+
+    StandIn.FilterRegistered = FALSE;
+    StandIn.Filter.Started = FALSE;
+}
+
+NTSTATUS
+FltStartFiltering(
+    _In_ PFLT_FILTER Filter
+)
+{
+    assert(Filter == &StandIn.Filter && StandIn.FilterRegistered);
+
+    if (StandInFault()) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    Filter->Started = TRUE;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+FltBuildDefaultSecurityDescriptor(
+    _Out_ PSECURITY_DESCRIPTOR* SecurityDescriptor,
+    _In_ ACCESS_MASK DesiredAccess
+)
+{
+    UNREFERENCED_PARAMETER(DesiredAccess);
+
+    if (StandInFault()) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    *SecurityDescriptor = StandInAllocate(64);
+    return STATUS_SUCCESS;
+}
+
+VOID
+FltFreeSecurityDescriptor(
+    _In_ PSECURITY_DESCRIPTOR SecurityDescriptor
+)
+{
+    StandInRelease(SecurityDescriptor);
+}
+
+NTSTATUS
+FltCreateCommunicationPort(
+    _In_ PFLT_FILTER Filter,
+    _Out_ PFLT_PORT* ServerPort,
+    _In_ POBJECT_ATTRIBUTES ObjectAttributes,
+    _In_opt_ PVOID ServerPortCookie,
+    _In_ PFLT_CONNECT_NOTIFY ConnectNotifyCallback,
+    _In_ PFLT_DISCONNECT_NOTIFY DisconnectNotifyCallback,
+    _In_opt_ PFLT_MESSAGE_NOTIFY MessageNotifyCallback,
+    _In_ LONG MaxConnections
+)
+{
+    PFLT_PORT port;
+    ULONG index;
+
+    assert(Filter == &StandIn.Filter && StandIn.FilterRegistered);
+    assert(ObjectAttributes->SecurityDescriptor != NULL);
+
+    if (StandInFault()) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    port = StandInAllocate(sizeof(struct _STANDIN_PORT));
+    port->Server = TRUE;
+    StandInCopyName(port->Name, ObjectAttributes->ObjectName->Buffer,
+        ObjectAttributes->ObjectName->Length / sizeof(WCHAR));
+    port->Cookie = ServerPortCookie;
+    port->Connect = ConnectNotifyCallback;
+    port->Disconnect = DisconnectNotifyCallback;
+    port->Message = MessageNotifyCallback;
+    port->MaxConnections = MaxConnections;
+
+    pthread_mutex_lock(&StandIn.Lock);
+
+    for (index = 0; index < STANDIN_MAX_SERVER_PORTS; index++) {
+        if (StandIn.ServerPorts[index] != NULL) {
+            assert(wcscmp(StandIn.ServerPorts[index]->Name, port->Name) != 0);
+        }
+    }
+    for (index = 0; StandIn.ServerPorts[index] != NULL; index++) {
+        assert(index + 1 < STANDIN_MAX_SERVER_PORTS);
+    }
+    StandIn.ServerPorts[index] = port;
+
+    pthread_mutex_unlock(&StandIn.Lock);
+
+    *ServerPort = port;
+    return STATUS_SUCCESS;
+}
+
+VOID
+FltCloseCommunicationPort(
+    _In_ PFLT_PORT ServerPort
+)
+{
+    ULONG index;
+
+    assert(ServerPort != NULL && ServerPort->Server);
+
+    pthread_mutex_lock(&StandIn.Lock);
+
+    for (index = 0; index < STANDIN_MAX_SERVER_PORTS; index++) {
+        if (StandIn.ServerPorts[index] == ServerPort) {
+            StandIn.ServerPorts[index] = NULL;
+        }
+    }
+
+    pthread_mutex_unlock(&StandIn.Lock);
+
+    StandInRelease(ServerPort);
+}
+
+VOID
+FltCloseClientPort(
+    _In_ PFLT_FILTER Filter,
+    _Inout_ PFLT_PORT* ClientPort
+)
+{
+    PFLT_PORT port = *ClientPort;
+
+    assert(Filter == &StandIn.Filter);
+
+    *ClientPort = NULL;
+
+    if (port != NULL) {
+        // Closing under a send in progress is the race run-down protection prevents.
+        if (__atomic_load_n(&port->SendsInProgress, __ATOMIC_SEQ_CST) != 0) {
+            InterlockedIncrement(&StandIn.SendsOnClosedPorts);
+        }
+        __atomic_store_n(&port->Closed, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+NTSTATUS
+FltSendMessage(
+    _In_ PFLT_FILTER Filter,
+    _In_ PFLT_PORT* ClientPort,
+    _In_reads_bytes_(SenderBufferLength) PVOID SenderBuffer,
+    _In_ ULONG SenderBufferLength,
+    _Out_writes_bytes_opt_(*ReplyLength) PVOID ReplyBuffer,
+    _Inout_opt_ PULONG ReplyLength,
+    _In_opt_ PLARGE_INTEGER Timeout
+)
+{
+    PFLT_PORT port = *ClientPort;
+    NTSTATUS status;
+
+    UNREFERENCED_PARAMETER(ReplyBuffer);
+    UNREFERENCED_PARAMETER(ReplyLength);
+
+    assert(Filter == &StandIn.Filter);
+
+    if (port == NULL || __atomic_load_n(&port->Closed, __ATOMIC_SEQ_CST)) {
+        InterlockedIncrement(&StandIn.SendsOnClosedPorts);
+        return STATUS_PORT_DISCONNECTED;
+    }
+
+    InterlockedIncrement(&port->SendsInProgress);
+
+    if (__atomic_load_n(&port->Disconnected, __ATOMIC_SEQ_CST)) {
+        status = STATUS_PORT_DISCONNECTED;
+    }
+    else {
+        status = port->Receive(port->Context, SenderBuffer, SenderBufferLength, Timeout);
+    }
+
+    InterlockedDecrement(&port->SendsInProgress);
+    return status;
+}
+
+NTSTATUS
+FltGetFileNameInformation(
+    _In_ PFLT_CALLBACK_DATA CallbackData,
+    _In_ FLT_FILE_NAME_OPTIONS NameOptions,
+    _Out_ PFLT_FILE_NAME_INFORMATION* FileNameInformation
+)
+{
+    PFLT_FILE_NAME_INFORMATION info;
+
+    UNREFERENCED_PARAMETER(NameOptions);
+
+    info = StandInAllocate(sizeof(FLT_FILE_NAME_INFORMATION));
+    info->Size = sizeof(FLT_FILE_NAME_INFORMATION);
+    info->Format = FLT_FILE_NAME_NORMALIZED;
+    RtlInitUnicodeString(&info->Name, CallbackData->StandInFileName);
+
+    *FileNameInformation = info;
+    return STATUS_SUCCESS;
+}
+
+VOID
+FltReleaseFileNameInformation(
+    _In_ PFLT_FILE_NAME_INFORMATION FileNameInformation
+)
+{
+    StandInRelease(FileNameInformation);
+}
+
+NTSTATUS
+FltGetStreamHandleContext(
+    _In_ PFLT_INSTANCE Instance,
+    _In_ PFILE_OBJECT FileObject,
+    _Out_ PFLT_CONTEXT* Context
+)
+{
+    UNREFERENCED_PARAMETER(Instance);
+    UNREFERENCED_PARAMETER(FileObject);
+
+    *Context = NULL;
+    return STATUS_NOT_FOUND;
+}
+
+VOID
+FltReleaseContext(
+    _In_ PFLT_CONTEXT Context
+)
+{
+    UNREFERENCED_PARAMETER(Context);
+}
+
+
+/*************************************************************************
+    Test side
+*************************************************************************/
+
+VOID
+StandInReset(
+    VOID
+)
+{
+    ULONG index;
+
+    pthread_mutex_lock(&StandIn.Lock);
+
+    while (StandIn.Clients != NULL) {
+        struct _STANDIN_PORT* client = StandIn.Clients;
+        StandIn.Clients = client->NextClient;
+        free(client);
+    }
+
+    for (index = 0; index < StandIn.ValueCount; index++) {
+        free(StandIn.Values[index].Data);
+    }
+
+    StandIn.ValueCount = 0;
+    StandIn.ProcessCount = 0;
+    StandIn.NotifyRoutine = NULL;
+    StandIn.SnapshotHook = NULL;
+    StandIn.FilterRegistered = FALSE;
+    StandIn.Filter.Started = FALSE;
+    memset(StandIn.ServerPorts, 0, sizeof(StandIn.ServerPorts));
+    StandIn.FailAt = 0;
+    StandIn.FallibleCalls = 0;
+    StandIn.TimeOffset = 0;
+    StandIn.SendsOnClosedPorts = 0;
+
+    pthread_mutex_unlock(&StandIn.Lock);
+}
+
+ULONG
+StandInFailCall(
+    _In_ ULONG Countdown
+)
+{
+    ULONG calls = (ULONG)__atomic_exchange_n(&StandIn.FallibleCalls, 0, __ATOMIC_SEQ_CST);
+
+    __atomic_store_n(&StandIn.FailAt, (LONG)Countdown, __ATOMIC_SEQ_CST);
+    return calls;
+}
+
+LONG
+StandInOutstandingAllocations(
+    VOID
+)
+{
+    return __atomic_load_n(&StandIn.Outstanding, __ATOMIC_SEQ_CST);
+}
+
+VOID
+StandInAdvanceTime(
+    _In_ LONGLONG Delta
+)
+{
+    __atomic_fetch_add(&StandIn.TimeOffset, Delta, __ATOMIC_SEQ_CST);
+}
+
+VOID
+StandInSetProcessor(
+    _In_ ULONG Processor
+)
+{
+    CurrentProcessor = Processor % STANDIN_PROCESSOR_COUNT;
+}
+
+VOID
+StandInSetCurrentProcess(
+    _In_ HANDLE ProcessId
+)
+{
+    CurrentProcess.UniqueProcessId = ProcessId;
+}
+
+static
+VOID
+StandInSetRegistryValue(
+    _In_ PCWSTR ValueName,
+    _In_ ULONG Type,
+    _In_ const VOID* Data,
+    _In_ ULONG Length
+)
+{
+    PSTANDIN_VALUE value;
+
+    pthread_mutex_lock(&StandIn.Lock);
+
+    value = StandInFindValue(ValueName, wcslen(ValueName));
+
+    if (value == NULL) {
+        assert(StandIn.ValueCount < STANDIN_MAX_VALUES);
+        value = &StandIn.Values[StandIn.ValueCount++];
+        StandInCopyName(value->Name, ValueName, wcslen(ValueName));
+    }
+    else {
+        free(value->Data);
+    }
+
+    value->Type = Type;
+    value->Length = Length;
+    value->Data = malloc(Length != 0 ? Length : 1);
+    assert(value->Data != NULL);
+    memcpy(value->Data, Data, Length);
+
+    pthread_mutex_unlock(&StandIn.Lock);
+}
+
+VOID
+StandInSetRegistryDword(
+    _In_ PCWSTR ValueName,
+    _In_ ULONG Value
+)
+{
+    StandInSetRegistryValue(ValueName, REG_DWORD, &Value, sizeof(Value));
+}
+
+VOID
+StandInSetRegistryMultiSz(
+    _In_ PCWSTR ValueName,
+    _In_ PCWSTR MultiSz,
+    _In_ ULONG Length
+)
+{
+    StandInSetRegistryValue(ValueName, REG_MULTI_SZ, MultiSz, Length);
+}
+
+BOOLEAN
+StandInFilterRegistered(
+    VOID
+)
+{
+    return StandIn.FilterRegistered;
+}
+
+BOOLEAN
+StandInFilterStarted(
+    VOID
+)
+{
+    return StandIn.FilterRegistered && StandIn.Filter.Started;
+}
+
+ULONG
+StandInOpenServerPorts(
+    VOID
+)
+{
+    ULONG count = 0;
+    ULONG index;
+
+    for (index = 0; index < STANDIN_MAX_SERVER_PORTS; index++) {
+        if (StandIn.ServerPorts[index] != NULL) {
+            count++;
+        }
+    }
+    return count;
+}
+
+NTSTATUS
+StandInUnload(
+    VOID
+)
+{
+    assert(StandIn.FilterRegistered);
+
+    return StandIn.Filter.Registration->FilterUnloadCallback(0);
+}
+
+FLT_PREOP_CALLBACK_STATUS
+StandInCreate(
+    _In_ PCWSTR FileName
+)
+{
+    const FLT_OPERATION_REGISTRATION* operation;
+    FLT_CALLBACK_DATA data;
+    FLT_RELATED_OBJECTS objects;
+    PVOID completionContext = NULL;
+
+    assert(StandInFilterStarted());
+
+    memset(&data, 0, sizeof(data));
+    data.StandInFileName = FileName;
+
+    memset(&objects, 0, sizeof(objects));
+    objects.Size = sizeof(objects);
+    objects.Filter = &StandIn.Filter;
+
+    for (operation = StandIn.Filter.Registration->OperationRegistration;
+         operation->MajorFunction != IRP_MJ_OPERATION_END;
+         operation++) {
+
+        if (operation->MajorFunction == IRP_MJ_CREATE && operation->PreOperation != NULL) {
+            return operation->PreOperation(&data, &objects, &completionContext);
+        }
+    }
+    return FLT_PREOP_SUCCESS_NO_CALLBACK;
+}
+
+PFLT_PORT
+StandInConnect(
+    _In_ PCWSTR PortName,
+    _In_ PSTANDIN_RECEIVE Receive,
+    _In_opt_ PVOID Context
+)
+{
+    PFLT_PORT server = NULL;
+    PFLT_PORT client;
+    ULONG index;
+    NTSTATUS status;
+
+    pthread_mutex_lock(&StandIn.Lock);
+
+    for (index = 0; index < STANDIN_MAX_SERVER_PORTS; index++) {
+        if (StandIn.ServerPorts[index] != NULL && wcscmp(StandIn.ServerPorts[index]->Name, PortName) == 0) {
+            server = StandIn.ServerPorts[index];
+        }
+    }
+
+    if (server == NULL || server->Connections >= server->MaxConnections) {
+        pthread_mutex_unlock(&StandIn.Lock);
+        return NULL;
+    }
+
+    server->Connections++;
+
+    client = calloc(1, sizeof(struct _STANDIN_PORT));
+    assert(client != NULL);
+    client->ServerPort = server;
+    client->Receive = Receive;
+    client->Context = Context;
+    client->NextClient = StandIn.Clients;
+    StandIn.Clients = client;
+
+    pthread_mutex_unlock(&StandIn.Lock);
+
+    status = server->Connect(client, server->Cookie, NULL, 0, &client->ConnectionCookie);
+
+    if (!NT_SUCCESS(status)) {
+        pthread_mutex_lock(&StandIn.Lock);
+        server->Connections--;
+        pthread_mutex_unlock(&StandIn.Lock);
+        client->Disconnected = TRUE;
+        return NULL;
+    }
+
+    return client;
+}
+
+NTSTATUS
+StandInSendCommand(
+    _In_ PFLT_PORT ClientPort,
+    _In_reads_bytes_(InputBufferLength) PVOID InputBuffer,
+    _In_ ULONG InputBufferLength,
+    _Out_writes_bytes_to_opt_(OutputBufferLength, *ReturnOutputBufferLength) PVOID OutputBuffer,
+    _In_ ULONG OutputBufferLength,
+    _Out_ PULONG ReturnOutputBufferLength
+)
+{
+    assert(!ClientPort->Server && !ClientPort->Disconnected);
+
+    return ClientPort->ServerPort->Message(ClientPort->ConnectionCookie,
+        InputBuffer,
+        InputBufferLength,
+        OutputBuffer,
+        OutputBufferLength,
+        ReturnOutputBufferLength);
+}
+
+VOID
+StandInDisconnect(
+    _In_ PFLT_PORT ClientPort
+)
+{
+    assert(!ClientPort->Server && !ClientPort->Disconnected);
+
+    __atomic_store_n(&ClientPort->Disconnected, 1, __ATOMIC_SEQ_CST);
+
+    ClientPort->ServerPort->Disconnect(ClientPort->ConnectionCookie);
+
+    pthread_mutex_lock(&StandIn.Lock);
+    ClientPort->ServerPort->Connections--;
+    pthread_mutex_unlock(&StandIn.Lock);
+}
+
+LONG
+StandInSendsOnClosedPorts(
+    VOID
+)
+{
+    return __atomic_load_n(&StandIn.SendsOnClosedPorts, __ATOMIC_SEQ_CST);
+}
+
+VOID
+StandInProcessStart(
+    _In_ HANDLE ProcessId,
+    _In_ PCWSTR ImageName
+)
+{
+    PCREATE_PROCESS_NOTIFY_ROUTINE_EX notify;
+    PS_CREATE_NOTIFY_INFO info;
+    UNICODE_STRING imageName;
+    EPROCESS process = { ProcessId };
+
+    pthread_mutex_lock(&StandIn.Lock);
+
+    assert(StandIn.ProcessCount < STANDIN_MAX_PROCESSES);
+    StandIn.Processes[StandIn.ProcessCount].ProcessId = ProcessId;
+    StandInCopyName(StandIn.Processes[StandIn.ProcessCount].ImageName, ImageName, wcslen(ImageName));
+    StandIn.ProcessCount++;
+    notify = StandIn.NotifyRoutine;
+
+    pthread_mutex_unlock(&StandIn.Lock);
+
+    if (notify != NULL) {
+        RtlInitUnicodeString(&imageName, ImageName);
+        memset(&info, 0, sizeof(info));
+        info.Size = sizeof(info);
+        info.ImageFileName = &imageName;
+        notify(&process, ProcessId, &info);
+    }
+}
+
+VOID
+StandInProcessExit(
+    _In_ HANDLE ProcessId
+)
+{
+    PCREATE_PROCESS_NOTIFY_ROUTINE_EX notify;
+    EPROCESS process = { ProcessId };
+    ULONG index;
+
+    pthread_mutex_lock(&StandIn.Lock);
+
+    for (index = 0; index < StandIn.ProcessCount; index++) {
+        if (StandIn.Processes[index].ProcessId == ProcessId) {
+            StandIn.Processes[index] = StandIn.Processes[--StandIn.ProcessCount];
+            break;
+        }
+    }
+    notify = StandIn.NotifyRoutine;
+
+    pthread_mutex_unlock(&StandIn.Lock);
+
+    if (notify != NULL) {
+        notify(&process, ProcessId, NULL);
+    }
+}
+
+BOOLEAN
+StandInProcessNotifyRegistered(
+    VOID
+)
+{
+    return StandIn.NotifyRoutine != NULL;
+}
+
+VOID
+StandInSetSnapshotHook(
+    _In_opt_ VOID (*Hook)(VOID)
+)
+{
+    StandIn.SnapshotHook = Hook;
+}
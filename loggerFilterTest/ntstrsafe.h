@@ -0,0 +1,48 @@
+/*++
+Module Name:
+    ntstrsafe.h
+
+Abstract:
+    User-mode stand-in for the safe string routines the driver uses.
+
+Environment:
+    User mode
+--*/
+
+#ifndef __LOGGERFILTERTEST_NTSTRSAFE_H__
+#define __LOGGERFILTERTEST_NTSTRSAFE_H__
+
+#include <stdarg.h>
+#include <stdio.h>
+
+static inline
+NTSTATUS
+RtlStringCchPrintfA(
+    _Out_writes_(cchDest) PSTR pszDest,
+    _In_ SIZE_T cchDest,
+    _In_ PCSTR pszFormat,
+    ...
+)
+{
+    va_list arguments;
+    int length;
+
+    va_start(arguments, pszFormat);
+    length = vsnprintf(pszDest, cchDest, pszFormat, arguments);
+    va_end(arguments);
+
+    return (length < 0 || (SIZE_T)length >= cchDest) ? STATUS_BUFFER_OVERFLOW : STATUS_SUCCESS;
+}
+
+static inline
+NTSTATUS
+RtlStringCchCopyA(
+    _Out_writes_(cchDest) PSTR pszDest,
+    _In_ SIZE_T cchDest,
+    _In_ PCSTR pszSrc
+)
+{
+    return RtlStringCchPrintfA(pszDest, cchDest, "%s", pszSrc);
+}
+
+#endif
@@ -0,0 +1,251 @@
+/*++
+Module Name:
+    processTest.c
+
+Abstract:
+    Checks the process filter of LoggerFilter in user mode: processes that
+    run when the filter loads and processes that start later are listed by
+    image name, an exiting process loses its bits, and the scan of running
+    processes does not overwrite the bits of a process ID that exited and
+    was reused after the snapshot was taken.
+    The process exits with the number of failed checks.
+
+Environment:
+    User mode
+--*/
+
+#include <stdio.h>
+#include "fltKernel.h"
+#include "loggerTrace.h"
+#include "loggerProcess.h"
+
+#define CHECK(Condition)                                                        \
+    if (!(Condition)) {                                                         \
+        printf("FAIL %s: %s, line %d\n", Title, #Condition, __LINE__);          \
+        failures++;                                                             \
+    }
+
+#define TEST_PID(Value)         ((HANDLE)(ULONG_PTR)(Value))
+
+#define TEST_EXCLUDED_IMAGE     L"\\Device\\HarddiskVolume1\\Tools\\MsMpEng.exe"
+#define TEST_INCLUDED_IMAGE     L"\\Device\\HarddiskVolume1\\Apps\\App.exe"
+#define TEST_OTHER_IMAGE        L"\\Device\\HarddiskVolume1\\Apps\\Other.exe"
+
+typedef struct _TEST_CASE {
+    PCSTR Title;
+    ULONG (*Run)(PCSTR Title);
+} TEST_CASE;
+
+static const WCHAR TestExcludedNames[] = L"msmpeng.exe\0\0";
+static const WCHAR TestIncludedNames[] = L"app.exe\0\0";
+
+static
+NTSTATUS
+TestInitialize(
+    _In_ BOOLEAN Included
+)
+{
+    return LoggerProcessFilterInitialize(
+        TestExcludedNames, sizeof(TestExcludedNames),
+        Included ? TestIncludedNames : NULL, Included ? sizeof(TestIncludedNames) : 0);
+}
+
+
+/*************************************************************************
+    Cases
+*************************************************************************/
+
+static
+ULONG
+TestRunningAndStarted(
+    _In_ PCSTR Title
+)
+{
+    ULONG failures = 0;
+
+    StandInReset();
+    StandInProcessStart(TEST_PID(100), TEST_EXCLUDED_IMAGE);
+    StandInProcessStart(TEST_PID(104), TEST_INCLUDED_IMAGE);
+    StandInProcessStart(TEST_PID(108), TEST_OTHER_IMAGE);
+
+    CHECK(NT_SUCCESS(TestInitialize(TRUE)));
+    CHECK(StandInProcessNotifyRegistered());
+
+    // Listed by the scan.
+    CHECK(!LoggerProcessFilterAllows(TEST_PID(100)));
+    CHECK(LoggerProcessFilterAllows(TEST_PID(104)));
+    CHECK(!LoggerProcessFilterAllows(TEST_PID(108)));
+
+    // Listed by the notification.
+    StandInProcessStart(TEST_PID(200), TEST_INCLUDED_IMAGE);
+    StandInProcessStart(TEST_PID(204), TEST_EXCLUDED_IMAGE);
+    CHECK(LoggerProcessFilterAllows(TEST_PID(200)));
+    CHECK(!LoggerProcessFilterAllows(TEST_PID(204)));
+
+    // IDs beyond the bitmaps are only allowed without an inclusion list.
+    CHECK(!LoggerProcessFilterAllows(TEST_PID(LOGGER_PROCESS_MAX_PID)));
+
+    LoggerProcessFilterFree();
+    CHECK(!StandInProcessNotifyRegistered());
+    CHECK(StandInOutstandingAllocations() == 0);
+    return failures;
+}
+
+static
+ULONG
+TestExit(
+    _In_ PCSTR Title
+)
+{
+    ULONG failures = 0;
+
+    StandInReset();
+    StandInProcessStart(TEST_PID(100), TEST_EXCLUDED_IMAGE);
+
+    CHECK(NT_SUCCESS(TestInitialize(FALSE)));
+    CHECK(!LoggerProcessFilterAllows(TEST_PID(100)));
+
+    StandInProcessExit(TEST_PID(100));
+    CHECK(LoggerProcessFilterAllows(TEST_PID(100)));
+
+    StandInProcessStart(TEST_PID(100), TEST_OTHER_IMAGE);
+    CHECK(LoggerProcessFilterAllows(TEST_PID(100)));
+
+    LoggerProcessFilterFree();
+    CHECK(StandInOutstandingAllocations() == 0);
+    return failures;
+}
+
+static
+VOID
+TestReuseAfterSnapshot(
+    VOID
+)
+{
+    // The excluded process exits and a process on the inclusion list gets
+    // its ID; the included process exits and its ID stays free.
+    StandInProcessExit(TEST_PID(300));
+    StandInProcessStart(TEST_PID(300), TEST_INCLUDED_IMAGE);
+    StandInProcessExit(TEST_PID(304));
+}
+
+static
+ULONG
+TestStaleSnapshot(
+    _In_ PCSTR Title
+)
+{
+    ULONG failures = 0;
+
+    StandInReset();
+    StandInProcessStart(TEST_PID(300), TEST_EXCLUDED_IMAGE);
+    StandInProcessStart(TEST_PID(304), TEST_INCLUDED_IMAGE);
+    StandInProcessStart(TEST_PID(308), TEST_INCLUDED_IMAGE);
+    StandInSetSnapshotHook(TestReuseAfterSnapshot);
+
+    CHECK(NT_SUCCESS(TestInitialize(TRUE)));
+
+    // The snapshot still lists 300 as excluded and 304 as included.
+    CHECK(LoggerProcessFilterAllows(TEST_PID(300)));
+    CHECK(!LoggerProcessFilterAllows(TEST_PID(304)));
+    CHECK(LoggerProcessFilterAllows(TEST_PID(308)));
+
+    // The notification keeps the bits after the scan.
+    StandInProcessExit(TEST_PID(300));
+    CHECK(!LoggerProcessFilterAllows(TEST_PID(300)));
+
+    LoggerProcessFilterFree();
+    CHECK(StandInOutstandingAllocations() == 0);
+    return failures;
+}
+
+static
+ULONG
+TestNoLists(
+    _In_ PCSTR Title
+)
+{
+    static const WCHAR empty[] = L"\0\0";
+    ULONG failures = 0;
+
+    StandInReset();
+    StandInProcessStart(TEST_PID(100), TEST_EXCLUDED_IMAGE);
+
+    CHECK(NT_SUCCESS(LoggerProcessFilterInitialize(empty, sizeof(empty), NULL, 0)));
+    CHECK(!StandInProcessNotifyRegistered());
+    CHECK(LoggerProcessFilterAllows(TEST_PID(100)));
+
+    LoggerProcessFilterFree();
+    CHECK(StandInOutstandingAllocations() == 0);
+    return failures;
+}
+
+static
+ULONG
+TestFailures(
+    _In_ PCSTR Title
+)
+{
+    ULONG failures = 0;
+    ULONG calls;
+    ULONG failAt;
+
+    StandInReset();
+    StandInProcessStart(TEST_PID(100), TEST_EXCLUDED_IMAGE);
+
+    StandInFailCall(0);
+    CHECK(NT_SUCCESS(TestInitialize(TRUE)));
+    LoggerProcessFilterFree();
+    calls = StandInFailCall(0);
+    CHECK(calls != 0);
+
+    for (failAt = 1; failAt <= calls; failAt++) {
+        StandInFailCall(failAt);
+
+        // The snapshot buffer is the last allocation; without it the scan
+        // lists nothing, but the filter loads.
+        if (NT_SUCCESS(TestInitialize(TRUE))) {
+            CHECK(failAt == calls);
+            CHECK(StandInProcessNotifyRegistered());
+            LoggerProcessFilterFree();
+        }
+        else {
+            CHECK(!StandInProcessNotifyRegistered());
+        }
+        CHECK(StandInOutstandingAllocations() == 0);
+    }
+
+    StandInFailCall(0);
+    return failures;
+}
+
+static const TEST_CASE TestCases[] = {
+    { "running and started processes are listed by image name", TestRunningAndStarted },
+    { "an exited process loses its bits", TestExit },
+    { "the scan does not overwrite an ID reused after the snapshot", TestStaleSnapshot },
+    { "nothing is registered without names", TestNoLists },
+    { "a failed initialization leaves nothing behind", TestFailures },
+};
+
+int
+__cdecl
+main(
+    VOID
+)
+{
+    ULONG failures = 0;
+    ULONG caseFailures;
+    ULONG index;
+
+    for (index = 0; index < ARRAYSIZE(TestCases); index++) {
+        caseFailures = TestCases[index].Run(TestCases[index].Title);
+
+        if (caseFailures == 0) {
+            printf("ok   %s\n", TestCases[index].Title);
+        }
+        failures += caseFailures;
+    }
+
+    printf("%lu failure(s)\n", (unsigned long)failures);
+    return (int)failures;
+}
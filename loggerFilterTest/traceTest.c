@@ -0,0 +1,317 @@
+/*++
+Module Name:
+    traceTest.c
+
+Abstract:
+    Checks the binary trace rings of LoggerFilter in user mode: records
+    written through the LOGGER_TRACE macros are read back whole and in
+    order, overwritten records are counted as lost, and a reader running
+    alongside concurrent writers on the same processor never returns a
+    torn record.
+    The process exits with the number of failed checks.
+
+Environment:
+    User mode
+--*/
+
+#include <stdio.h>
+#include "fltKernel.h"
+#include "loggerTrace.h"
+
+#define CHECK(Condition)                                                        \
+    if (!(Condition)) {                                                         \
+        printf("FAIL %s: %s, line %d\n", Title, #Condition, __LINE__);          \
+        failures++;                                                             \
+    }
+
+#define TEST_BUFFER_RECORDS     (2 * LOGGER_TRACE_RECORDS_PER_CPU)
+
+typedef struct _TEST_TRACE_BUFFER {
+    LOGGER_TRACE_READ_REPLY Header;
+    LOGGER_TRACE_RECORD Records[TEST_BUFFER_RECORDS];
+} TEST_TRACE_BUFFER, * PTEST_TRACE_BUFFER;
+
+typedef struct _TEST_CASE {
+    PCSTR Title;
+    ULONG (*Run)(PCSTR Title);
+} TEST_CASE;
+
+static TEST_TRACE_BUFFER TestBuffer;
+
+static
+NTSTATUS
+TestRead(
+    _In_ ULONG Records
+)
+{
+    ULONG returned;
+    NTSTATUS status;
+
+    memset(&TestBuffer, 0xCC, sizeof(TestBuffer));
+
+    status = LoggerTraceRead(&TestBuffer,
+        sizeof(LOGGER_TRACE_READ_REPLY) + Records * sizeof(LOGGER_TRACE_RECORD),
+        &returned);
+
+    if (NT_SUCCESS(status) &&
+        returned != sizeof(LOGGER_TRACE_READ_REPLY) + TestBuffer.Header.RecordCount * sizeof(LOGGER_TRACE_RECORD)) {
+        return STATUS_UNSUCCESSFUL;
+    }
+    return status;
+}
+
+
+/*************************************************************************
+    Cases
+*************************************************************************/
+
+static
+ULONG
+TestWriteRead(
+    _In_ PCSTR Title
+)
+{
+    ULONG failures = 0;
+    ULONG index;
+
+    CHECK(NT_SUCCESS(LoggerTraceInitialize()));
+    StandInSetProcessor(2);
+
+    for (index = 0; index < 10; index++) {
+        LOGGER_TRACE_INFO(BACKLOG, LoggerTraceReplay, index, index * 2, ~(UINT64)index, 7);
+    }
+    LOGGER_TRACE_ERROR(PORT, LoggerTraceSendFailed, 11, STATUS_PORT_DISCONNECTED, 0, 0);
+
+    CHECK(NT_SUCCESS(TestRead(TEST_BUFFER_RECORDS)));
+    CHECK(TestBuffer.Header.RecordCount == 11);
+    CHECK(TestBuffer.Header.LostCount == 0);
+    CHECK(TestBuffer.Header.Frequency == 10000000);
+
+    for (index = 0; index < 10 && index < TestBuffer.Header.RecordCount; index++) {
+        PLOGGER_TRACE_RECORD record = &TestBuffer.Records[index];
+
+        CHECK(record->Stamp == index + 1);
+        CHECK(record->FormatId == LoggerTraceReplay);
+        CHECK(record->Level == LOGGER_TRACE_LEVEL_INFO);
+        CHECK(record->Category == LOGGER_TRACE_CATEGORY_BACKLOG);
+        CHECK(record->Processor == 2);
+        CHECK(record->Args[0] == index && record->Args[1] == index * 2);
+        CHECK(record->Args[2] == ~(UINT64)index && record->Args[3] == 7);
+        CHECK(index == 0 || record->Timestamp >= record[-1].Timestamp);
+    }
+
+    CHECK(TestBuffer.Records[10].FormatId == LoggerTraceSendFailed);
+    CHECK(TestBuffer.Records[10].Level == LOGGER_TRACE_LEVEL_ERROR);
+    CHECK(TestBuffer.Records[10].Args[1] == (UINT64)STATUS_PORT_DISCONNECTED);
+
+    // Records are handed out once.
+    CHECK(NT_SUCCESS(TestRead(TEST_BUFFER_RECORDS)));
+    CHECK(TestBuffer.Header.RecordCount == 0);
+
+    LoggerTraceFree();
+    CHECK(StandInOutstandingAllocations() == 0);
+    return failures;
+}
+
+static
+ULONG
+TestLevelsCompiledOut(
+    _In_ PCSTR Title
+)
+{
+    ULONG failures = 0;
+
+    CHECK(NT_SUCCESS(LoggerTraceInitialize()));
+
+    // Built without DBG, so the maximum level is INFO.
+    LOGGER_TRACE_VERBOSE(CREATE, LoggerTraceCreateMatched, 1, 2, 3, 4);
+    LOGGER_TRACE_INFO(CREATE, LoggerTraceEventRecorded, 1, 2, 3, 4);
+
+    CHECK(NT_SUCCESS(TestRead(TEST_BUFFER_RECORDS)));
+    CHECK(TestBuffer.Header.RecordCount == 1);
+    CHECK(TestBuffer.Records[0].FormatId == LoggerTraceEventRecorded);
+
+    LoggerTraceFree();
+    return failures;
+}
+
+static
+ULONG
+TestOverwrite(
+    _In_ PCSTR Title
+)
+{
+    ULONG failures = 0;
+    ULONG index;
+
+    CHECK(NT_SUCCESS(LoggerTraceInitialize()));
+    StandInSetProcessor(5);
+
+    for (index = 0; index < LOGGER_TRACE_RECORDS_PER_CPU + 100; index++) {
+        LOGGER_TRACE_INFO(PORT, LoggerTraceEventSent, index, 0, 0, 0);
+    }
+
+    // Only the last lap of the ring is left.
+    CHECK(NT_SUCCESS(TestRead(TEST_BUFFER_RECORDS)));
+    CHECK(TestBuffer.Header.RecordCount == LOGGER_TRACE_RECORDS_PER_CPU);
+    CHECK(TestBuffer.Header.LostCount == 100);
+    CHECK(TestBuffer.Records[0].Args[0] == 100);
+    CHECK(TestBuffer.Records[LOGGER_TRACE_RECORDS_PER_CPU - 1].Args[0] == LOGGER_TRACE_RECORDS_PER_CPU + 99);
+
+    LoggerTraceFree();
+    return failures;
+}
+
+static
+ULONG
+TestShortBuffer(
+    _In_ PCSTR Title
+)
+{
+    ULONG returned;
+    ULONG failures = 0;
+    ULONG index;
+
+    CHECK(NT_SUCCESS(LoggerTraceInitialize()));
+    StandInSetProcessor(1);
+
+    for (index = 0; index < 50; index++) {
+        LOGGER_TRACE_INFO(PORT, LoggerTraceEventSent, index, 0, 0, 0);
+    }
+
+    CHECK(NT_SUCCESS(TestRead(20)));
+    CHECK(TestBuffer.Header.RecordCount == 20 && TestBuffer.Records[0].Args[0] == 0);
+    CHECK(NT_SUCCESS(TestRead(20)));
+    CHECK(TestBuffer.Header.RecordCount == 20 && TestBuffer.Records[0].Args[0] == 20);
+    CHECK(NT_SUCCESS(TestRead(20)));
+    CHECK(TestBuffer.Header.RecordCount == 10 && TestBuffer.Records[0].Args[0] == 40);
+    CHECK(TestBuffer.Header.LostCount == 0);
+
+    CHECK(LoggerTraceRead(&TestBuffer, sizeof(LOGGER_TRACE_READ_REPLY) - 1, &returned) == STATUS_BUFFER_TOO_SMALL);
+    CHECK(returned == 0);
+
+    LoggerTraceFree();
+    return failures;
+}
+
+#define TEST_WRITERS            4
+#define TEST_WRITES_PER_WRITER  200000
+
+static volatile LONG TestWritersDone;
+
+static
+PVOID
+TestWriterThread(
+    _In_ PVOID Context
+)
+{
+    UINT64 writer = (UINT64)(ULONG_PTR)Context;
+    UINT64 index;
+
+    // Every writer shares one ring, like threads rescheduled onto one processor.
+    StandInSetProcessor(0);
+
+    for (index = 0; index < TEST_WRITES_PER_WRITER; index++) {
+        LOGGER_TRACE_INFO(CREATE, LoggerTraceEventRecorded, writer, index, ~index, writer ^ index);
+    }
+
+    InterlockedIncrement(&TestWritersDone);
+    return NULL;
+}
+
+static
+ULONG
+TestConcurrentWriters(
+    _In_ PCSTR Title
+)
+{
+    pthread_t threads[TEST_WRITERS];
+    UINT64 next[TEST_WRITERS] = { 0 };
+    UINT64 read = 0;
+    UINT64 lost = 0;
+    ULONG torn = 0;
+    ULONG disordered = 0;
+    ULONG failures = 0;
+    ULONG index;
+    BOOLEAN done;
+
+    CHECK(NT_SUCCESS(LoggerTraceInitialize()));
+    TestWritersDone = 0;
+
+    for (index = 0; index < TEST_WRITERS; index++) {
+        pthread_create(&threads[index], NULL, TestWriterThread, (PVOID)(ULONG_PTR)index);
+    }
+
+    do {
+        done = (__atomic_load_n(&TestWritersDone, __ATOMIC_SEQ_CST) == TEST_WRITERS);
+
+        if (!NT_SUCCESS(TestRead(TEST_BUFFER_RECORDS))) {
+            failures++;
+            break;
+        }
+
+        read += TestBuffer.Header.RecordCount;
+        lost += TestBuffer.Header.LostCount;
+
+        for (index = 0; index < TestBuffer.Header.RecordCount; index++) {
+            PLOGGER_TRACE_RECORD record = &TestBuffer.Records[index];
+            UINT64 writer = record->Args[0];
+
+            if (writer >= TEST_WRITERS || record->Args[2] != ~record->Args[1] ||
+                record->Args[3] != (writer ^ record->Args[1]) || record->FormatId != LoggerTraceEventRecorded) {
+                torn++;
+                continue;
+            }
+
+            // Each writer's records come out in the order it wrote them.
+            if (record->Args[1] < next[writer]) {
+                disordered++;
+            }
+            next[writer] = record->Args[1] + 1;
+        }
+    } while (!done);
+
+    for (index = 0; index < TEST_WRITERS; index++) {
+        pthread_join(threads[index], NULL);
+    }
+
+    CHECK(torn == 0);
+    CHECK(disordered == 0);
+    CHECK(read + lost == (UINT64)TEST_WRITERS * TEST_WRITES_PER_WRITER);
+    CHECK(read != 0);
+
+    LoggerTraceFree();
+    CHECK(StandInOutstandingAllocations() == 0);
+    return failures;
+}
+
+static const TEST_CASE TestCases[] = {
+    { "records are read back whole and in order", TestWriteRead },
+    { "levels above the maximum are compiled out", TestLevelsCompiledOut },
+    { "overwritten records are counted as lost", TestOverwrite },
+    { "a short buffer is drained over several reads", TestShortBuffer },
+    { "a reader never sees a torn record of concurrent writers", TestConcurrentWriters },
+};
+
+int
+__cdecl
+main(
+    VOID
+)
+{
+    ULONG failures = 0;
+    ULONG caseFailures;
+    ULONG index;
+
+    for (index = 0; index < ARRAYSIZE(TestCases); index++) {
+        caseFailures = TestCases[index].Run(TestCases[index].Title);
+
+        if (caseFailures == 0) {
+            printf("ok   %s\n", TestCases[index].Title);
+        }
+        failures += caseFailures;
+    }
+
+    printf("%lu failure(s)\n", (unsigned long)failures);
+    return (int)failures;
+}
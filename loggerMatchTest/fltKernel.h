@@ -0,0 +1,143 @@
+/*++
+Module Name:
+    fltKernel.h
+
+Abstract:
+    User-mode stand-in for the kernel header, so that loggerMatch.c can be
+    compiled into the matcher test and benchmark as it is, with MSVC or
+    with GCC or Clang on any POSIX system. It maps the few kernel routines
+    the matcher uses onto the C library.
+
+Environment:
+    User mode
+--*/
+
+#ifndef __LOGGERMATCHTEST_FLTKERNEL_H__
+#define __LOGGERMATCHTEST_FLTKERNEL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#ifdef _MSC_VER
+#include <sal.h>
+#else
+#define __cdecl
+#define _In_
+#define _In_reads_(Count)
+#define _In_reads_bytes_(Size)
+#define _Inout_
+#define _Inout_updates_(Count)
+#define _Out_
+#define _Out_writes_opt_(Count)
+#endif
+
+#define VOID                void
+#define TRUE                1
+#define FALSE               0
+#define NOTHING
+
+typedef void* PVOID;
+typedef unsigned char UCHAR, BOOLEAN;
+typedef const char* PCSTR;
+typedef uint16_t USHORT, * PUSHORT;
+typedef int32_t LONG;
+typedef uint32_t ULONG, * PULONG;
+typedef unsigned long long ULONG64, * PULONG64;
+typedef size_t SIZE_T;
+typedef wchar_t WCHAR, * PWCHAR, * PWCH;
+typedef const wchar_t* PCWSTR;
+typedef LONG NTSTATUS;
+
+typedef struct _UNICODE_STRING {
+    USHORT Length;
+    USHORT MaximumLength;
+    PWCH Buffer;
+} UNICODE_STRING, * PUNICODE_STRING;
+typedef const UNICODE_STRING* PCUNICODE_STRING;
+
+#define MAXUSHORT           0xffff
+#define MAXULONG            0xffffffff
+#define ARRAYSIZE(A)        (sizeof(A) / sizeof((A)[0]))
+
+#define NT_SUCCESS(Status)                  (((NTSTATUS)(Status)) >= 0)
+#define STATUS_SUCCESS                      ((NTSTATUS)0x00000000L)
+#define STATUS_INVALID_PARAMETER            ((NTSTATUS)0xC000000DL)
+#define STATUS_INSUFFICIENT_RESOURCES       ((NTSTATUS)0xC000009AL)
+#define STATUS_IMPLEMENTATION_LIMIT         ((NTSTATUS)0xC000042BL)
+
+#define PagedPool       1
+#define NonPagedPool    0
+
+#define PAGED_CODE()
+#define KdPrint(_x_)
+
+#define ExAllocatePoolZero(PoolType, NumberOfBytes, Tag)    calloc(1, (NumberOfBytes))
+#define ExFreePoolWithTag(P, Tag)                           free(P)
+
+#define RtlCopyMemory(Destination, Source, Length)          memcpy((Destination), (Source), (Length))
+#define RtlMoveMemory(Destination, Source, Length)          memmove((Destination), (Source), (Length))
+#define RtlZeroMemory(Destination, Length)                  memset((Destination), 0, (Length))
+#define RtlFillMemory(Destination, Length, Fill)            memset((Destination), (Fill), (Length))
+
+static __inline
+SIZE_T
+RtlCompareMemory(
+    _In_ const VOID* Source1,
+    _In_ const VOID* Source2,
+    _In_ SIZE_T Length
+)
+{
+    const UCHAR* first = (const UCHAR*)Source1;
+    const UCHAR* second = (const UCHAR*)Source2;
+    SIZE_T index = 0;
+
+    while (index < Length && first[index] == second[index]) {
+        index++;
+    }
+    return index;
+}
+
+static __inline
+VOID
+RtlInitUnicodeString(
+    _Out_ PUNICODE_STRING DestinationString,
+    _In_ PCWSTR SourceString
+)
+{
+    SIZE_T length = SourceString != NULL ? wcslen(SourceString) * sizeof(WCHAR) : 0;
+
+    DestinationString->Buffer = (PWCH)SourceString;
+    DestinationString->Length = (USHORT)length;
+    DestinationString->MaximumLength = (USHORT)(SourceString != NULL ? length + sizeof(WCHAR) : 0);
+}
+
+//
+// Latin-1 is enough for the names the tests use; the kernel folds the
+// whole Unicode range.
+//
+
+static __inline
+WCHAR
+RtlUpcaseUnicodeChar(
+    _In_ WCHAR SourceCharacter
+)
+{
+    if (SourceCharacter >= L'a' && SourceCharacter <= L'z') {
+        return (WCHAR)(SourceCharacter - (L'a' - L'A'));
+    }
+    if (SourceCharacter >= 0xE0 && SourceCharacter <= 0xFE && SourceCharacter != 0xF7) {
+        return (WCHAR)(SourceCharacter - 0x20);
+    }
+    if (SourceCharacter == 0xFF) {
+        return 0x178;
+    }
+    if (SourceCharacter == 0xB5) {
+        return 0x39C;
+    }
+    return SourceCharacter;
+}
+
+#endif
@@ -0,0 +1,178 @@
+/*++
+Module Name:
+    loggerMatchBench.c
+
+Abstract:
+    Measures the target rule matcher of LoggerFilter with 1,000 to 10,000
+    rules, split evenly between three shapes: a file type under a project
+    of any user, everything under an application's data and a file name
+    extension on any path. Reports the compile time, the DFAs and states
+    the rules compile into, and the time to match names that hit each
+    shape and a name that hits none.
+
+Environment:
+    User mode
+--*/
+
+#include <stdio.h>
+#include <time.h>
+#include "fltKernel.h"
+#include "loggerMatch.h"
+
+#define BENCH_MATCHES       200000
+#define BENCH_RUNS          5
+#define BENCH_RULE_CHARS    64
+
+static const ULONG BenchRuleCounts[] = { 1000, 2000, 5000, 10000 };
+
+static const PCWSTR BenchNames[] = {
+    L"\\Device\\HarddiskVolume3\\Users\\bob\\Documents\\proj17\\report.docx",
+    L"\\Device\\HarddiskVolume3\\ProgramData\\App17\\cache\\index.bin",
+    L"\\Device\\HarddiskVolume3\\Windows\\Temp\\a\\b\\file.e17",
+    L"\\Device\\HarddiskVolume3\\Windows\\System32\\drivers\\etc\\hosts",
+};
+
+static const PCSTR BenchNameTitles[] = { "docx", "app", "ext", "none" };
+
+static volatile ULONG BenchSink;
+
+static
+double
+BenchNow(
+    VOID
+)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+//
+// Best of BENCH_RUNS, in nanoseconds per match.
+//
+
+static
+double
+BenchMatch(
+    _In_ PLOGGER_MATCHER Matcher,
+    _In_ PCWSTR Name
+)
+{
+    UNICODE_STRING name;
+    double best = 0;
+    double start;
+    ULONG matched;
+    ULONG rule;
+    ULONG run;
+    ULONG index;
+
+    RtlInitUnicodeString(&name, Name);
+
+    for (run = 0; run < BENCH_RUNS; run++) {
+        matched = 0;
+        start = BenchNow();
+
+        for (index = 0; index < BENCH_MATCHES; index++) {
+            matched += LoggerMatcherMatch(Matcher, &name, &rule);
+        }
+
+        start = (BenchNow() - start) / BENCH_MATCHES;
+        BenchSink = matched;
+        if (run == 0 || start < best) {
+            best = start;
+        }
+    }
+    return best;
+}
+
+static
+VOID
+BenchRules(
+    _In_ ULONG RuleCount
+)
+{
+    PWCHAR patterns = calloc((size_t)RuleCount * BENCH_RULE_CHARS, sizeof(WCHAR));
+    PUNICODE_STRING rules = calloc(RuleCount, sizeof(UNICODE_STRING));
+    LOGGER_MATCHER matcher;
+    ULONG states = 0;
+    ULONG rule;
+    ULONG index;
+    double start;
+    NTSTATUS status;
+
+    if (patterns == NULL || rules == NULL) {
+        printf("%6lu no memory\n", (unsigned long)RuleCount);
+        free(patterns);
+        free(rules);
+        return;
+    }
+
+    for (rule = 0; rule < RuleCount; rule++) {
+        PWCHAR pattern = &patterns[(size_t)rule * BENCH_RULE_CHARS];
+
+        switch (rule % 3) {
+        case 0:
+            swprintf(pattern, BENCH_RULE_CHARS, L"\\Users\\*\\Documents\\proj%lu\\*.docx", (unsigned long)(rule / 3));
+            break;
+        case 1:
+            swprintf(pattern, BENCH_RULE_CHARS, L"\\ProgramData\\App%lu\\**", (unsigned long)(rule / 3));
+            break;
+        default:
+            swprintf(pattern, BENCH_RULE_CHARS, L"\\**.e%lu", (unsigned long)(rule / 3));
+            break;
+        }
+        RtlInitUnicodeString(&rules[rule], pattern);
+    }
+
+    start = BenchNow();
+    status = LoggerMatcherCompile(rules, RuleCount, &matcher);
+    start = (BenchNow() - start) / 1e6;
+
+    if (!NT_SUCCESS(status)) {
+        printf("%6lu compile failed, status 0x%08lX\n", (unsigned long)RuleCount, (unsigned long)status);
+    }
+    else {
+        for (index = 0; index < matcher.AutomatonCount; index++) {
+            states += matcher.Automata[index].StateCount;
+        }
+
+        printf("%6lu %10.1f %5lu %6lu %6lu %8lu", (unsigned long)RuleCount, start,
+            (unsigned long)matcher.AutomatonCount, (unsigned long)matcher.SplitCount,
+            (unsigned long)matcher.ChainCount, (unsigned long)states);
+
+        for (index = 0; index < ARRAYSIZE(BenchNames); index++) {
+            printf(" %8.1f", BenchMatch(&matcher, BenchNames[index]));
+        }
+        printf("\n");
+
+        LoggerMatcherFree(&matcher);
+    }
+
+    free(patterns);
+    free(rules);
+}
+
+int
+__cdecl
+main(
+    VOID
+)
+{
+    ULONG index;
+
+    printf("%6s %10s %5s %6s %6s %8s", "rules", "compile", "DFAs", "splits", "chains", "states");
+    for (index = 0; index < ARRAYSIZE(BenchNameTitles); index++) {
+        printf(" %8s", BenchNameTitles[index]);
+    }
+    printf("\n%6s %10s %5s %6s %6s %8s", "", "ms", "", "", "", "");
+    for (index = 0; index < ARRAYSIZE(BenchNameTitles); index++) {
+        printf(" %8s", "ns");
+    }
+    printf("\n");
+
+    for (index = 0; index < ARRAYSIZE(BenchRuleCounts); index++) {
+        BenchRules(BenchRuleCounts[index]);
+    }
+    return 0;
+}
@@ -0,0 +1,399 @@
+/*++
+Module Name:
+    loggerMatchTest.c
+
+Abstract:
+    Checks the target rule matcher of LoggerFilter in user mode. Each case
+    compiles a set of rules with LoggerMatcherCompile and matches names
+    against it, expecting either no match or the index of a given rule.
+    Further cases compile rule sets whose DFA grows past the limits, and
+    split REG_MULTI_SZ values into rules.
+    The process exits with the number of failed checks.
+
+Environment:
+    User mode
+--*/
+
+#include <stdio.h>
+#include "fltKernel.h"
+#include "loggerMatch.h"
+
+#define NO_MATCH    LOGGER_MATCH_NO_RULE
+
+#define CHECK(Condition)                                                        \
+    if (!(Condition)) {                                                         \
+        printf("FAIL %s: %s, line %d\n", Title, #Condition, __LINE__);          \
+        failures++;                                                             \
+    }
+
+// Long enough for the sets of a rule matched without a DFA to be allocated.
+#define LONG_RULE_WILDCARDS     600
+
+typedef struct _MATCH_CHECK {
+    PCWSTR Name;
+    ULONG Rule;
+} MATCH_CHECK, * PMATCH_CHECK;
+
+typedef struct _MATCH_CASE {
+    PCSTR Title;
+    PCWSTR Rules[8];
+    MATCH_CHECK Checks[16];
+} MATCH_CASE, * PMATCH_CASE;
+
+typedef struct _TEST_CASE {
+    PCSTR Title;
+    ULONG (*Run)(PCSTR Title);
+} TEST_CASE;
+
+static const MATCH_CASE MatchCases[] = {
+
+    { "literal rule on a given volume",
+      { L"\\Device\\HarddiskVolume3\\Temp\\file.txt" },
+      { { L"\\Device\\HarddiskVolume3\\Temp\\file.txt", 0 },
+        { L"\\Device\\HarddiskVolume2\\Temp\\file.txt", NO_MATCH },
+        { L"\\Device\\HarddiskVolume3\\Temp\\file.txt2", NO_MATCH },
+        { L"\\Device\\HarddiskVolume3\\Temp\\file.tx", NO_MATCH },
+        { L"", NO_MATCH } } },
+
+    { "case is folded on both sides",
+      { L"\\Device\\HarddiskVolume3\\Temp\\File.TXT", L"\\\x00C9t\x00E9\\*" },
+      { { L"\\DEVICE\\HARDDISKVOLUME3\\TEMP\\FILE.TXT", 0 },
+        { L"\\device\\harddiskvolume3\\temp\\file.txt", 0 },
+        { L"\\Device\\HarddiskVolume1\\\x00E9T\x00C9\\a", 1 },
+        { L"\\Device\\HarddiskVolume1\\ete\\a", NO_MATCH } } },
+
+    { "'*' stays within one component",
+      { L"\\Users\\*\\Documents\\*.docx" },
+      { { L"\\Device\\HarddiskVolume3\\Users\\bob\\Documents\\a.docx", 0 },
+        { L"\\Device\\HarddiskVolume3\\Users\\bob\\Documents\\.docx", 0 },
+        { L"\\Device\\HarddiskVolume3\\Users\\\\Documents\\a.docx", 0 },
+        { L"\\Device\\HarddiskVolume3\\Users\\bob\\x\\Documents\\a.docx", NO_MATCH },
+        { L"\\Device\\HarddiskVolume3\\Users\\bob\\Documents\\sub\\a.docx", NO_MATCH },
+        { L"\\Device\\HarddiskVolume3\\Users\\bob\\Documents\\a.docx.bak", NO_MATCH } } },
+
+    { "'**' crosses components",
+      { L"\\ProgramData\\Secrets\\**", L"\\**.tmp" },
+      { { L"\\Device\\HarddiskVolume1\\ProgramData\\Secrets\\k", 0 },
+        { L"\\Device\\HarddiskVolume1\\ProgramData\\Secrets\\k\\j\\i", 0 },
+        { L"\\Device\\HarddiskVolume1\\ProgramData\\Secrets\\", 0 },
+        { L"\\Device\\HarddiskVolume1\\ProgramData\\Secrets", NO_MATCH },
+        { L"\\Device\\HarddiskVolume1\\a.tmp", 1 },
+        { L"\\Device\\HarddiskVolume1\\a\\b\\c.tmp", 1 },
+        { L"\\Device\\HarddiskVolume1\\a\\b\\c.tmp\\d", NO_MATCH } } },
+
+    { "'?' is one character other than a separator",
+      { L"\\a?c\\x" },
+      { { L"\\Device\\HarddiskVolume1\\abc\\x", 0 },
+        { L"\\Device\\HarddiskVolume1\\a.c\\x", 0 },
+        { L"\\Device\\HarddiskVolume1\\a\\c\\x", NO_MATCH },
+        { L"\\Device\\HarddiskVolume1\\ac\\x", NO_MATCH },
+        { L"\\Device\\HarddiskVolume1\\abbc\\x", NO_MATCH } } },
+
+    { "rules without \\Device\\ apply to every volume",
+      { L"\\Temp\\file.txt" },
+      { { L"\\Device\\HarddiskVolume1\\Temp\\file.txt", 0 },
+        { L"\\Device\\HarddiskVolume12\\Temp\\file.txt", 0 },
+        { L"\\Device\\Mup\\Temp\\file.txt", 0 },
+        { L"\\Device\\HarddiskVolume1\\Other\\Temp\\file.txt", NO_MATCH },
+        { L"\\Temp\\file.txt", NO_MATCH },
+        { L"\\Device\\Temp\\file.txt", NO_MATCH } } },
+
+    { "rules without a leading separator start at the volume root",
+      { L"*.ini", L"Temp\\file.txt" },
+      { { L"\\Device\\HarddiskVolume2\\boot.ini", 0 },
+        { L"\\Device\\HarddiskVolume2\\w\\boot.ini", NO_MATCH },
+        { L"\\Device\\HarddiskVolume2\\Temp\\file.txt", 1 },
+        { L"\\Device\\HarddiskVolume2Temp\\file.txt", NO_MATCH } } },
+
+    { "the first matching rule wins",
+      { L"\\Temp\\**", L"\\Temp\\*.txt", L"\\Device\\HarddiskVolume3\\Temp\\file.txt", L"\\**" },
+      { { L"\\Device\\HarddiskVolume3\\Temp\\file.txt", 0 },
+        { L"\\Device\\HarddiskVolume3\\Other\\file.txt", 3 } } },
+
+    { "later rules still match what earlier ones reject",
+      { L"\\Device\\HarddiskVolume3\\Temp\\file.txt", L"\\Temp\\*.txt", L"\\**" },
+      { { L"\\Device\\HarddiskVolume3\\Temp\\file.txt", 0 },
+        { L"\\Device\\HarddiskVolume1\\Temp\\file.txt", 1 },
+        { L"\\Device\\HarddiskVolume1\\Temp\\file.log", 2 } } },
+};
+
+static
+ULONG
+RunCase(
+    _In_ const MATCH_CASE* Case
+)
+{
+    UNICODE_STRING rules[ARRAYSIZE(Case->Rules)];
+    LOGGER_MATCHER matcher;
+    ULONG ruleCount = 0;
+    ULONG failures = 0;
+    ULONG check;
+    NTSTATUS status;
+
+    while (ruleCount < ARRAYSIZE(Case->Rules) && Case->Rules[ruleCount] != NULL) {
+        RtlInitUnicodeString(&rules[ruleCount], Case->Rules[ruleCount]);
+        ruleCount++;
+    }
+
+    status = LoggerMatcherCompile(rules, ruleCount, &matcher);
+
+    if (!NT_SUCCESS(status)) {
+        printf("FAIL %s: compile status 0x%08lX\n", Case->Title, (unsigned long)status);
+        return 1;
+    }
+
+    for (check = 0; check < ARRAYSIZE(Case->Checks) && Case->Checks[check].Name != NULL; check++) {
+        const MATCH_CHECK* expected = &Case->Checks[check];
+        UNICODE_STRING name;
+        ULONG rule;
+        BOOLEAN matched;
+
+        RtlInitUnicodeString(&name, expected->Name);
+        matched = LoggerMatcherMatch(&matcher, &name, &rule);
+
+        if (!matched) {
+            rule = NO_MATCH;
+        }
+
+        if (rule != expected->Rule) {
+            printf("FAIL %s: %ls matched rule %ld, expected %ld\n", Case->Title, expected->Name,
+                rule == NO_MATCH ? -1L : (long)rule, expected->Rule == NO_MATCH ? -1L : (long)expected->Rule);
+            failures++;
+        }
+    }
+
+    LoggerMatcherFree(&matcher);
+
+    if (failures == 0) {
+        printf("ok   %s\n", Case->Title);
+    }
+    return failures;
+}
+
+static
+ULONG
+MatchName(
+    _In_ PLOGGER_MATCHER Matcher,
+    _In_ PCWSTR Name
+)
+{
+    UNICODE_STRING name;
+    ULONG rule;
+
+    RtlInitUnicodeString(&name, Name);
+    if (!LoggerMatcherMatch(Matcher, &name, &rule)) {
+        return NO_MATCH;
+    }
+    return rule;
+}
+
+//
+// Fills Buffer with Prefix followed by Count copies of Fill.
+//
+
+static
+PCWSTR
+RepeatName(
+    _Out_ PWCHAR Buffer,
+    _In_ PCWSTR Prefix,
+    _In_ WCHAR Fill,
+    _In_ ULONG Count
+)
+{
+    size_t length = wcslen(Prefix);
+    ULONG index;
+
+    wcscpy(Buffer, Prefix);
+    for (index = 0; index < Count; index++) {
+        Buffer[length + index] = Fill;
+    }
+    Buffer[length + Count] = L'\0';
+    return Buffer;
+}
+
+
+/*************************************************************************
+    DFA limits
+*************************************************************************/
+
+static
+ULONG
+TestSplit(
+    _In_ PCSTR Title
+)
+{
+    static const PCWSTR patterns[] = {
+        L"\\**A????????", L"\\**B????????", L"\\Temp\\*.txt", L"\\**",
+    };
+    UNICODE_STRING rules[ARRAYSIZE(patterns)];
+    LOGGER_MATCHER matcher;
+    ULONG failures = 0;
+    ULONG index;
+
+    for (index = 0; index < ARRAYSIZE(patterns); index++) {
+        RtlInitUnicodeString(&rules[index], patterns[index]);
+    }
+
+    // Together the first two rules track which of the last nine characters
+    // are an A or a B, past the states their positions allow.
+    CHECK(NT_SUCCESS(LoggerMatcherCompile(rules, ARRAYSIZE(rules), &matcher)));
+    CHECK(matcher.SplitCount == 1);
+    CHECK(matcher.AutomatonCount == 3);
+    CHECK(matcher.ChainCount == 0);
+
+    // Every DFA is run, the lowest rule still wins.
+    CHECK(MatchName(&matcher, L"\\Device\\HarddiskVolume1\\x\\Aabcdefgh") == 0);
+    CHECK(MatchName(&matcher, L"\\Device\\HarddiskVolume1\\ABBBBBBBBB") == 1);
+    CHECK(MatchName(&matcher, L"\\Device\\HarddiskVolume1\\AAAAAAAAA") == 0);
+    CHECK(MatchName(&matcher, L"\\Device\\HarddiskVolume1\\Temp\\a.txt") == 2);
+    CHECK(MatchName(&matcher, L"\\Device\\HarddiskVolume1\\Aabcdefg") == 3);
+    CHECK(MatchName(&matcher, L"\\Device\\HarddiskVolume1") == NO_MATCH);
+
+    LoggerMatcherFree(&matcher);
+    return failures;
+}
+
+static
+ULONG
+TestWithoutDfa(
+    _In_ PCSTR Title
+)
+{
+    static WCHAR longRule[LONG_RULE_WILDCARDS + 8];
+    static WCHAR name[LONG_RULE_WILDCARDS + 64];
+    UNICODE_STRING rules[3];
+    LOGGER_MATCHER matcher;
+    ULONG failures = 0;
+
+    RtlInitUnicodeString(&rules[0], L"\\Temp\\*.txt");
+    RtlInitUnicodeString(&rules[1], L"\\**A????????????????");
+    RtlInitUnicodeString(&rules[2], RepeatName(longRule, L"\\**Z", L'?', LONG_RULE_WILDCARDS));
+
+    // The last two are past the limits on their own: a DFA has to tell
+    // apart every arrangement of A's among the last 17 characters.
+    CHECK(NT_SUCCESS(LoggerMatcherCompile(rules, ARRAYSIZE(rules), &matcher)));
+    CHECK(matcher.ChainCount == 2);
+    CHECK(matcher.AutomatonCount == 1);
+
+    CHECK(MatchName(&matcher, L"\\Device\\HarddiskVolume1\\Temp\\a.txt") == 0);
+    CHECK(MatchName(&matcher, L"\\Device\\HarddiskVolume1\\x\\yA0123456789abcdef") == 1);
+    CHECK(MatchName(&matcher, L"\\Device\\HarddiskVolume1\\x\\ya0123456789ABCDEF") == 1);
+    CHECK(MatchName(&matcher, L"\\Device\\HarddiskVolume1\\x\\yA0123456789abcde") == NO_MATCH);
+    CHECK(MatchName(&matcher, L"\\Device\\HarddiskVolume1\\x\\yA01234567\\9abcdef") == NO_MATCH);
+    CHECK(MatchName(&matcher, L"\\Temp\\yA0123456789abcdef") == NO_MATCH);
+
+    CHECK(MatchName(&matcher, RepeatName(name, L"\\Device\\HarddiskVolume1\\z", L'z', LONG_RULE_WILDCARDS)) == 2);
+    CHECK(MatchName(&matcher, RepeatName(name, L"\\Device\\HarddiskVolume1\\z", L'z', LONG_RULE_WILDCARDS - 1)) == NO_MATCH);
+
+    LoggerMatcherFree(&matcher);
+    return failures;
+}
+
+
+/*************************************************************************
+    REG_MULTI_SZ values
+*************************************************************************/
+
+static
+ULONG
+TestSplitMultiSz(
+    _In_ PCSTR Title
+)
+{
+    static const WCHAR value[] = L"\\Temp\\**\0*.ini\0\0";
+    static const WCHAR gaps[] = L"\0a\0\0b\0\0";
+    static const WCHAR unterminated[] = { L'a', L'\0', L'b', L'c' };
+    UNICODE_STRING rules[4];
+    ULONG failures = 0;
+
+    CHECK(LoggerMatcherSplitMultiSz(value, sizeof(value), NULL, 0) == 2);
+    CHECK(LoggerMatcherSplitMultiSz(value, sizeof(value), rules, ARRAYSIZE(rules)) == 2);
+    CHECK(rules[0].Buffer == &value[0] && rules[0].Length == 8 * sizeof(WCHAR));
+    CHECK(rules[1].Buffer == &value[9] && rules[1].Length == 5 * sizeof(WCHAR));
+
+    // Empty strings are not rules.
+    CHECK(LoggerMatcherSplitMultiSz(gaps, sizeof(gaps), rules, ARRAYSIZE(rules)) == 2);
+    CHECK(rules[0].Buffer == &gaps[1] && rules[1].Buffer == &gaps[4]);
+
+    // The end of the data ends the last string, a trailing odd byte is not one.
+    CHECK(LoggerMatcherSplitMultiSz(unterminated, sizeof(unterminated), rules, ARRAYSIZE(rules)) == 2);
+    CHECK(rules[1].Buffer == &unterminated[2] && rules[1].Length == 2 * sizeof(WCHAR));
+    CHECK(LoggerMatcherSplitMultiSz(unterminated, sizeof(unterminated) - 1, rules, ARRAYSIZE(rules)) == 2);
+    CHECK(rules[1].Length == 1 * sizeof(WCHAR));
+
+    CHECK(LoggerMatcherSplitMultiSz(value, 0, rules, ARRAYSIZE(rules)) == 0);
+
+    // Every string is counted, only Capacity are stored.
+    rules[1].Length = 0xAAAA;
+    CHECK(LoggerMatcherSplitMultiSz(value, sizeof(value), rules, 1) == 2);
+    CHECK(rules[1].Length == 0xAAAA);
+
+    return failures;
+}
+
+static
+ULONG
+TestSplitLongString(
+    _In_ PCSTR Title
+)
+{
+    ULONG chars = MAXUSHORT / sizeof(WCHAR) + 2;
+    PWCHAR value = calloc(chars + 16, sizeof(WCHAR));
+    UNICODE_STRING rules[3];
+    LOGGER_MATCHER matcher;
+    ULONG failures = 0;
+
+    if (value == NULL) {
+        printf("FAIL %s: no memory\n", Title);
+        return 1;
+    }
+
+    // A string too long for a UNICODE_STRING keeps its index but is empty.
+    wcscpy(value, L"*.a");
+    RepeatName(&value[4], L"\\", L'x', chars - 1);
+    wcscpy(&value[4 + chars + 1], L"*.b");
+
+    CHECK(LoggerMatcherSplitMultiSz(value, (chars + 9) * sizeof(WCHAR), rules, ARRAYSIZE(rules)) == 3);
+    CHECK(rules[1].Length == 0 && rules[1].Buffer == NULL);
+    CHECK(rules[2].Length == 3 * sizeof(WCHAR));
+
+    CHECK(NT_SUCCESS(LoggerMatcherCompile(rules, ARRAYSIZE(rules), &matcher)));
+    CHECK(MatchName(&matcher, L"\\Device\\HarddiskVolume1\\x.b") == 2);
+    LoggerMatcherFree(&matcher);
+
+    free(value);
+    return failures;
+}
+
+static const TEST_CASE TestCases[] = {
+    { "a rule set past the DFA limits is split", TestSplit },
+    { "a rule past the DFA limits on its own is matched without one", TestWithoutDfa },
+    { "REG_MULTI_SZ values are split into rules", TestSplitMultiSz },
+    { "a string too long for a rule keeps its index", TestSplitLongString },
+};
+
+int
+__cdecl
+main(
+    VOID
+)
+{
+    ULONG failures = 0;
+    ULONG index;
+
+    for (index = 0; index < ARRAYSIZE(MatchCases); index++) {
+        failures += RunCase(&MatchCases[index]);
+    }
+
+    for (index = 0; index < ARRAYSIZE(TestCases); index++) {
+        ULONG caseFailures = TestCases[index].Run(TestCases[index].Title);
+
+        if (caseFailures == 0) {
+            printf("ok   %s\n", TestCases[index].Title);
+        }
+        failures += caseFailures;
+    }
+
+    printf("%lu failure(s)\n", (unsigned long)failures);
+    return (int)failures;
+}